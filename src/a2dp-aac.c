@@ -29,15 +29,68 @@
 #include <glib.h>
 
 #include "a2dp.h"
+#include "ba-device.h"
 #include "bluealsa-config.h"
+#include "codec-dl.h"
+#include "io-pipeline.h"
 #include "io.h"
 #include "rtp.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/trace.h"
+
+#if ENABLE_CODEC_DLOPEN
+
+CODEC_DL_SYMBOL_DECLARE(aacDecoder_Close)
+CODEC_DL_SYMBOL_DECLARE(aacDecoder_DecodeFrame)
+CODEC_DL_SYMBOL_DECLARE(aacDecoder_Fill)
+CODEC_DL_SYMBOL_DECLARE(aacDecoder_GetStreamInfo)
+CODEC_DL_SYMBOL_DECLARE(aacDecoder_Open)
+CODEC_DL_SYMBOL_DECLARE(aacDecoder_SetParam)
+CODEC_DL_SYMBOL_DECLARE(aacEncClose)
+CODEC_DL_SYMBOL_DECLARE(aacEncEncode)
+CODEC_DL_SYMBOL_DECLARE(aacEncInfo)
+CODEC_DL_SYMBOL_DECLARE(aacEncOpen)
+CODEC_DL_SYMBOL_DECLARE(aacEncoder_SetParam)
+static const char * const fdk_aac_dl_names[] = {
+	"libfdk-aac.so.2",
+	"libfdk-aac.so.1",
+	"libfdk-aac.so",
+	NULL,
+};
+static const struct codec_dl_symbol fdk_aac_dl_symbols[] = {
+	CODEC_DL_SYMBOL(aacDecoder_Close),
+	CODEC_DL_SYMBOL(aacDecoder_DecodeFrame),
+	CODEC_DL_SYMBOL(aacDecoder_Fill),
+	CODEC_DL_SYMBOL(aacDecoder_GetStreamInfo),
+	CODEC_DL_SYMBOL(aacDecoder_Open),
+	CODEC_DL_SYMBOL(aacDecoder_SetParam),
+	CODEC_DL_SYMBOL(aacEncClose),
+	CODEC_DL_SYMBOL(aacEncEncode),
+	CODEC_DL_SYMBOL(aacEncInfo),
+	CODEC_DL_SYMBOL(aacEncOpen),
+	CODEC_DL_SYMBOL(aacEncoder_SetParam),
+	{ 0 },
+};
+static struct codec_dl fdk_aac_dl = CODEC_DL_INIT(fdk_aac_dl_names, fdk_aac_dl_symbols);
+# define aacDecoder_Close codec_dl_aacDecoder_Close
+# define aacDecoder_DecodeFrame codec_dl_aacDecoder_DecodeFrame
+# define aacDecoder_Fill codec_dl_aacDecoder_Fill
+# define aacDecoder_GetStreamInfo codec_dl_aacDecoder_GetStreamInfo
+# define aacDecoder_Open codec_dl_aacDecoder_Open
+# define aacDecoder_SetParam codec_dl_aacDecoder_SetParam
+# define aacEncClose codec_dl_aacEncClose
+# define aacEncEncode codec_dl_aacEncEncode
+# define aacEncInfo codec_dl_aacEncInfo
+# define aacEncOpen codec_dl_aacEncOpen
+# define aacEncoder_SetParam codec_dl_aacEncoder_SetParam
+
+#endif
 
 static const struct a2dp_channel_mode a2dp_aac_channels[] = {
 	{ A2DP_CHM_MONO, 1, AAC_CHANNELS_1 },
@@ -131,8 +184,25 @@ struct a2dp_codec a2dp_aac_source = {
 	.enabled = true,
 };
 
+/**
+ * Make sure that the FDK-AAC library is available. */
+static int a2dp_aac_load(void) {
+#if ENABLE_CODEC_DLOPEN
+	return codec_dl_load(&fdk_aac_dl);
+#else
+	return 0;
+#endif
+}
+
 void a2dp_aac_init(void) {
 
+	if ((a2dp_aac_source.enabled || a2dp_aac_sink.enabled) &&
+			a2dp_aac_load() == -1) {
+		warn("Couldn't load FDK-AAC library, disabling AAC codec: %s", strerror(errno));
+		a2dp_aac_source.enabled = false;
+		a2dp_aac_sink.enabled = false;
+	}
+
 	if (config.a2dp.force_mono)
 		a2dp_aac_source.capabilities.aac.channels = AAC_CHANNELS_1;
 	if (config.a2dp.force_44100)
@@ -173,16 +243,26 @@ static unsigned int a2dp_aac_get_fdk_vbr_mode(
 	return 5;
 }
 
-static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
+/**
+ * Configuration key for the AAC encoder instance cache. */
+struct a2dp_aac_enc_key {
+	a2dp_aac_t configuration;
+	unsigned int channels;
+	unsigned int samplerate;
+	unsigned int latm_version;
+	bool afterburner;
+	bool true_bps;
+};
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+static void a2dp_aac_enc_free(HANDLE_AACENCODER handle) {
+	aacEncClose(&handle);
+}
 
-	struct ba_transport *t = th->t;
-	struct io_poll io = { .timeout = -1 };
+/**
+ * Open and configure AAC encoder for the given transport. */
+static HANDLE_AACENCODER a2dp_aac_enc_open(const struct ba_transport *t) {
 
 	HANDLE_AACENCODER handle;
-	AACENC_InfoStruct aacinf;
 	AACENC_ERROR err;
 
 	const a2dp_aac_t *configuration = &t->a2dp.configuration.aac;
@@ -193,11 +273,9 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 	/* create AAC encoder without the Meta Data module */
 	if ((err = aacEncOpen(&handle, 0x07, channels)) != AACENC_OK) {
 		error("Couldn't open AAC encoder: %s", aacenc_strerror(err));
-		goto fail_open;
+		return NULL;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(aacEncClose), &handle);
-
 	unsigned int aot = AOT_NONE;
 	unsigned int channelmode = channels == 1 ? MODE_1 : MODE_2;
 
@@ -221,63 +299,130 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 
 	if ((err = aacEncoder_SetParam(handle, AACENC_AOT, aot)) != AACENC_OK) {
 		error("Couldn't set audio object type: %s", aacenc_strerror(err));
-		goto fail_init;
+		goto fail;
 	}
 	if ((err = aacEncoder_SetParam(handle, AACENC_BITRATE, bitrate)) != AACENC_OK) {
 		error("Couldn't set bitrate: %s", aacenc_strerror(err));
-		goto fail_init;
+		goto fail;
 	}
 #if AACENCODER_LIB_VERSION >= 0x03041600 /* 3.4.22 */
 	if (!config.aac_true_bps) {
 		if ((err = aacEncoder_SetParam(handle, AACENC_PEAK_BITRATE, bitrate)) != AACENC_OK) {
 			error("Couldn't set peak bitrate: %s", aacenc_strerror(err));
-			goto fail_init;
+			goto fail;
 		}
 	}
 #endif
 	if ((err = aacEncoder_SetParam(handle, AACENC_SAMPLERATE, samplerate)) != AACENC_OK) {
 		error("Couldn't set sampling rate: %s", aacenc_strerror(err));
-		goto fail_init;
+		goto fail;
 	}
 	if ((err = aacEncoder_SetParam(handle, AACENC_CHANNELMODE, channelmode)) != AACENC_OK) {
 		error("Couldn't set channel mode: %s", aacenc_strerror(err));
-		goto fail_init;
+		goto fail;
 	}
 	if (configuration->vbr) {
 		const unsigned int mode = a2dp_aac_get_fdk_vbr_mode(channelmode, bitrate);
 		if ((err = aacEncoder_SetParam(handle, AACENC_BITRATEMODE, mode)) != AACENC_OK) {
 			error("Couldn't set VBR bitrate mode %u: %s", mode, aacenc_strerror(err));
-			goto fail_init;
+			goto fail;
 		}
 	}
 	if ((err = aacEncoder_SetParam(handle, AACENC_AFTERBURNER, config.aac_afterburner)) != AACENC_OK) {
 		error("Couldn't enable afterburner: %s", aacenc_strerror(err));
-		goto fail_init;
+		goto fail;
 	}
 	if ((err = aacEncoder_SetParam(handle, AACENC_TRANSMUX, TT_MP4_LATM_MCP1)) != AACENC_OK) {
 		error("Couldn't enable LATM transport type: %s", aacenc_strerror(err));
-		goto fail_init;
+		goto fail;
 	}
 	if ((err = aacEncoder_SetParam(handle, AACENC_HEADER_PERIOD, 1)) != AACENC_OK) {
 		error("Couldn't set LATM header period: %s", aacenc_strerror(err));
-		goto fail_init;
+		goto fail;
 	}
 #if AACENCODER_LIB_VERSION >= 0x03041600 /* 3.4.22 */
 	if ((err = aacEncoder_SetParam(handle, AACENC_AUDIOMUXVER, config.aac_latm_version)) != AACENC_OK) {
 		error("Couldn't set LATM version: %s", aacenc_strerror(err));
-		goto fail_init;
+		goto fail;
 	}
 #endif
 
 	if ((err = aacEncEncode(handle, NULL, NULL, NULL, NULL)) != AACENC_OK) {
 		error("Couldn't initialize AAC encoder: %s", aacenc_strerror(err));
-		goto fail_init;
+		goto fail;
+	}
+
+	return handle;
+
+fail:
+	aacEncClose(&handle);
+	return NULL;
+}
+
+/**
+ * Reset the state of the reused AAC encoder.
+ *
+ * The encoder taken from the device codec cache keeps the MDCT overlap, the
+ * TNS/LTP history and the bit reservoir of the previous stream. Resetting
+ * these states (and dropping buffered PCM) does not reallocate the encoder. */
+static int a2dp_aac_enc_reset(HANDLE_AACENCODER handle) {
+
+	AACENC_ERROR err;
+
+	if ((err = aacEncoder_SetParam(handle, AACENC_CONTROL_STATE,
+					AACENC_INIT_STATES | AACENC_RESET_INBUFFER)) != AACENC_OK ||
+			(err = aacEncEncode(handle, NULL, NULL, NULL, NULL)) != AACENC_OK) {
+		error("Couldn't reset AAC encoder: %s", aacenc_strerror(err));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	struct io_poll io = { .timeout = -1 };
+
+	HANDLE_AACENCODER handle;
+	AACENC_InfoStruct aacinf;
+	AACENC_ERROR err;
+
+	const unsigned int channels = t->a2dp.pcm.channels;
+	const unsigned int samplerate = t->a2dp.pcm.sampling;
+
+	struct a2dp_aac_enc_key key;
+	memset(&key, 0, sizeof(key));
+	key.configuration = t->a2dp.configuration.aac;
+	key.channels = channels;
+	key.samplerate = samplerate;
+	key.latm_version = config.aac_latm_version;
+	key.afterburner = config.aac_afterburner;
+	key.true_bps = config.aac_true_bps;
+
+	struct ba_device_codec codec = { .free = PTHREAD_CLEANUP(a2dp_aac_enc_free) };
+	ba_device_codec_acquire(t->d, &codec, &key, sizeof(key));
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_device_codec_release), &codec);
+
+	if ((handle = codec.handle) != NULL) {
+		if (a2dp_aac_enc_reset(handle) == -1)
+			goto fail_init;
 	}
+	else if ((codec.handle = handle = a2dp_aac_enc_open(t)) == NULL)
+		goto fail_init;
+
+	ba_transport_set_a2dp_bitrate(t, AAC_GET_BITRATE(key.configuration));
+
 	if ((err = aacEncInfo(handle, &aacinf)) != AACENC_OK) {
 		error("Couldn't get encoder info: %s", aacenc_strerror(err));
 		goto fail_init;
 	}
 
+	codec.reusable = true;
+
 	ffb_t bt = { 0 };
 	ffb_t pcm = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
@@ -291,6 +436,13 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 		goto fail_ffb;
 	}
 
+	struct io_pipeline pipe = { .th = th };
+	pthread_cleanup_push(PTHREAD_CLEANUP(io_pipeline_free), &pipe);
+
+	if (config.a2dp.pipeline &&
+			io_pipeline_start(&pipe, ffb_blen_in(&bt)) == -1)
+		warn("Couldn't start encoding pipeline: %s", strerror(errno));
+
 	rtp_header_t *rtp_header;
 	/* initialize RTP header and get anchor for payload */
 	uint8_t *rtp_payload = rtp_a2dp_init(bt.data, &rtp_header, NULL, 0);
@@ -329,8 +481,11 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
 						pcm.tail, ffb_len_in(&pcm))) <= 0) {
-			if (samples == -1)
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("PCM poll and read error: %s", strerror(errno));
+			}
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
@@ -338,8 +493,12 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 		ffb_seek(&pcm, samples);
 		while ((in_args.numInSamples = ffb_len_out(&pcm)) > 0) {
 
+			trace(encode_start, th->t, in_args.numInSamples / channels);
+			thread_stats_codec_begin(&th->stats);
 			if ((err = aacEncEncode(handle, &in_buf, &out_buf, &in_args, &out_args)) != AACENC_OK)
 				error("AAC encoding error: %s", aacenc_strerror(err));
+			thread_stats_codec_end(&th->stats);
+			trace(encode_end, th->t, out_args.numInSamples / channels, out_args.numOutBytes);
 
 			if (out_args.numOutBytes > 0) {
 
@@ -361,8 +520,8 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 					ffb_seek(&bt, RTP_HEADER_LEN + chunk_len);
 
 					ssize_t len = ffb_blen_out(&bt);
-					if ((len = io_bt_write(th, bt.data, len)) <= 0) {
-						if (len == -1)
+					if ((len = io_pipeline_write(&pipe, &io, bt.data, len)) <= 0) {
+						if (len == -1 && errno != ECANCELED)
 							error("BT write error: %s", strerror(errno));
 						goto fail;
 					}
@@ -384,12 +543,12 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 
 			unsigned int pcm_frames = out_args.numInSamples / channels;
 			/* keep data transfer at a constant bit rate */
-			asrsync_sync(&io.asrs, pcm_frames);
+			io_pipeline_sync(&pipe, &io, pcm_frames);
 			/* move forward RTP timestamp clock */
 			rtp_state_update(&rtp, pcm_frames);
 
 			/* update busy delay (encoding overhead) */
-			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+			t->a2dp.pcm.delay = io_pipeline_get_delay_usec(&pipe, &io) / 100;
 
 			/* If the input buffer was not consumed, we have to append new data to
 			 * the existing one. Since we do not use ring buffer, we will simply
@@ -404,12 +563,12 @@ fail:
 	debug_transport_thread_loop(th, "EXIT");
 	ba_transport_thread_set_state_stopping(th);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_pop(1);
 fail_ffb:
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 fail_init:
 	pthread_cleanup_pop(1);
-fail_open:
 	pthread_cleanup_pop(1);
 	return NULL;
 }
@@ -476,7 +635,7 @@ static void *a2dp_aac_dec_thread(struct ba_transport_thread *th) {
 
 		ssize_t len = ffb_blen_in(&bt);
 		if ((len = io_poll_and_read_bt(&io, th, bt.data, len)) <= 0) {
-			if (len == -1)
+			if (len == -1 && errno != ECANCELED)
 				error("BT poll and read error: %s", strerror(errno));
 			goto fail;
 		}
@@ -528,9 +687,15 @@ static void *a2dp_aac_dec_thread(struct ba_transport_thread *th) {
 		unsigned int valid = ffb_len_out(&latm);
 		CStreamInfo *aacinf;
 
-		if ((err = aacDecoder_Fill(handle, (uint8_t **)&latm.data, &data_len, &valid)) != AAC_DEC_OK)
-			error("AAC buffer fill error: %s", aacdec_strerror(err));
-		else if ((err = aacDecoder_DecodeFrame(handle, pcm.tail, ffb_blen_in(&pcm), 0)) != AAC_DEC_OK)
+		AAC_DECODER_ERROR err_fill;
+		thread_stats_codec_begin(&th->stats);
+		if ((err_fill = aacDecoder_Fill(handle, (uint8_t **)&latm.data, &data_len, &valid)) == AAC_DEC_OK)
+			err = aacDecoder_DecodeFrame(handle, pcm.tail, ffb_blen_in(&pcm), 0);
+		thread_stats_codec_end(&th->stats);
+
+		if (err_fill != AAC_DEC_OK)
+			error("AAC buffer fill error: %s", aacdec_strerror(err_fill));
+		else if (err != AAC_DEC_OK)
 			error("AAC decode frame error: %s", aacdec_strerror(err));
 		else if ((aacinf = aacDecoder_GetStreamInfo(handle)) == NULL)
 			error("Couldn't get AAC stream info");
@@ -541,8 +706,11 @@ static void *a2dp_aac_dec_thread(struct ba_transport_thread *th) {
 
 			const size_t samples = (size_t)aacinf->frameSize * channels;
 			io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
-			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
+			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("FIFO write error: %s", strerror(errno));
+			}
 
 			/* update local state with decoded PCM frames */
 			rtp_state_update(&rtp, aacinf->frameSize);
@@ -571,6 +739,9 @@ fail_open:
 
 int a2dp_aac_transport_start(struct ba_transport *t) {
 
+	if (a2dp_aac_load() == -1)
+		return -1;
+
 	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
 		return ba_transport_thread_create(&t->thread_enc, a2dp_aac_enc_thread, "ba-a2dp-aac", true);
 
@@ -27,12 +27,14 @@
 #include "codec-aptx.h"
 #include "io.h"
 #include "rtp.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/trace.h"
 
 static const struct a2dp_channel_mode a2dp_aptx_hd_channels[] = {
 	{ A2DP_CHM_STEREO, 2, APTX_CHANNEL_MODE_STEREO },
@@ -136,6 +138,9 @@ static void *a2dp_aptx_hd_enc_thread(struct ba_transport_thread *th) {
 		goto fail_ffb;
 	}
 
+	/* apt-X HD compresses 24-bit samples with the fixed 4:1 ratio */
+	ba_transport_set_a2dp_bitrate(t, samplerate * channels * 24 / 4);
+
 	rtp_header_t *rtp_header;
 	/* initialize RTP header and get anchor for payload */
 	uint8_t *rtp_payload = rtp_a2dp_init(bt.data, &rtp_header, NULL, 0);
@@ -150,8 +155,11 @@ static void *a2dp_aptx_hd_enc_thread(struct ba_transport_thread *th) {
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
 						pcm.tail, ffb_len_in(&pcm))) <= 0) {
-			if (samples == -1)
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("PCM poll and read error: %s", strerror(errno));
+			}
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
@@ -171,6 +179,9 @@ static void *a2dp_aptx_hd_enc_thread(struct ba_transport_thread *th) {
 			size_t output_len = ffb_len_in(&bt);
 			size_t pcm_samples = 0;
 
+			trace(encode_start, th->t, input_samples / channels);
+			thread_stats_codec_begin(&th->stats);
+
 			/* Generate as many apt-X frames as possible to fill the output buffer
 			 * without overflowing it. The size of the output buffer is based on
 			 * the socket MTU, so such a transfer should be most efficient. */
@@ -192,11 +203,14 @@ static void *a2dp_aptx_hd_enc_thread(struct ba_transport_thread *th) {
 
 			}
 
+			thread_stats_codec_end(&th->stats);
+			trace(encode_end, th->t, pcm_samples / channels, ffb_blen_out(&bt));
+
 			rtp_state_new_frame(&rtp, rtp_header);
 
 			ssize_t len = ffb_blen_out(&bt);
 			if ((len = io_bt_write(th, bt.data, len)) <= 0) {
-				if (len == -1)
+				if (len == -1 && errno != ECANCELED)
 					error("BT write error: %s", strerror(errno));
 				goto fail;
 			}
@@ -209,6 +223,7 @@ static void *a2dp_aptx_hd_enc_thread(struct ba_transport_thread *th) {
 
 			/* update busy delay (encoding overhead) */
 			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+			thread_stats_busy(&th->stats, asrsync_get_busy_usec(&io.asrs));
 
 			/* reinitialize output buffer */
 			ffb_rewind(&bt);
@@ -277,7 +292,7 @@ static void *a2dp_aptx_hd_dec_thread(struct ba_transport_thread *th) {
 
 		ssize_t len = ffb_blen_in(&bt);
 		if ((len = io_poll_and_read_bt(&io, th, bt.data, len)) <= 0) {
-			if (len == -1)
+			if (len == -1 && errno != ECANCELED)
 				error("BT poll and read error: %s", strerror(errno));
 			goto fail;
 		}
@@ -303,7 +318,11 @@ static void *a2dp_aptx_hd_dec_thread(struct ba_transport_thread *th) {
 			size_t decoded = ffb_len_in(&pcm);
 			ssize_t len;
 
-			if ((len = aptxhddec_decode(handle, rtp_payload, rtp_payload_len, pcm.tail, &decoded)) <= 0) {
+			thread_stats_codec_begin(&th->stats);
+			len = aptxhddec_decode(handle, rtp_payload, rtp_payload_len, pcm.tail, &decoded);
+			thread_stats_codec_end(&th->stats);
+
+			if (len <= 0) {
 				error("Apt-X decoding error: %s", strerror(errno));
 				continue;
 			}
@@ -316,8 +335,11 @@ static void *a2dp_aptx_hd_dec_thread(struct ba_transport_thread *th) {
 
 		const size_t samples = ffb_len_out(&pcm);
 		io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
-		if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
+		if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1) {
+			if (errno == ECANCELED)
+				goto fail;
 			error("FIFO write error: %s", strerror(errno));
+		}
 
 		/* update local state with decoded PCM frames */
 		rtp_state_update(&rtp, samples / channels);
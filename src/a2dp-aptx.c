@@ -25,12 +25,14 @@
 #include "a2dp.h"
 #include "codec-aptx.h"
 #include "io.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/trace.h"
 
 static const struct a2dp_channel_mode a2dp_aptx_channels[] = {
 	{ A2DP_CHM_STEREO, 2, APTX_CHANNEL_MODE_STEREO },
@@ -133,14 +135,20 @@ static void *a2dp_aptx_enc_thread(struct ba_transport_thread *th) {
 		goto fail_ffb;
 	}
 
+	/* apt-X compresses 16-bit samples with the fixed 4:1 ratio */
+	ba_transport_set_a2dp_bitrate(t, t->a2dp.pcm.sampling * channels * 16 / 4);
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
 						pcm.tail, ffb_len_in(&pcm))) <= 0) {
-			if (samples == -1)
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("PCM poll and read error: %s", strerror(errno));
+			}
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
@@ -157,6 +165,9 @@ static void *a2dp_aptx_enc_thread(struct ba_transport_thread *th) {
 			size_t output_len = ffb_len_in(&bt);
 			size_t pcm_samples = 0;
 
+			trace(encode_start, th->t, input_samples / channels);
+			thread_stats_codec_begin(&th->stats);
+
 			/* Generate as many apt-X frames as possible to fill the output buffer
 			 * without overflowing it. The size of the output buffer is based on
 			 * the socket MTU, so such a transfer should be most efficient. */
@@ -178,9 +189,12 @@ static void *a2dp_aptx_enc_thread(struct ba_transport_thread *th) {
 
 			}
 
+			thread_stats_codec_end(&th->stats);
+			trace(encode_end, th->t, pcm_samples / channels, ffb_blen_out(&bt));
+
 			ssize_t len = ffb_blen_out(&bt);
 			if ((len = io_bt_write(th, bt.data, len)) <= 0) {
-				if (len == -1)
+				if (len == -1 && errno != ECANCELED)
 					error("BT write error: %s", strerror(errno));
 				goto fail;
 			}
@@ -190,6 +204,7 @@ static void *a2dp_aptx_enc_thread(struct ba_transport_thread *th) {
 
 			/* update busy delay (encoding overhead) */
 			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+			thread_stats_busy(&th->stats, asrsync_get_busy_usec(&io.asrs));
 
 			/* reinitialize output buffer */
 			ffb_rewind(&bt);
@@ -251,7 +266,7 @@ static void *a2dp_aptx_dec_thread(struct ba_transport_thread *th) {
 
 		ssize_t len = ffb_blen_in(&bt);
 		if ((len = io_poll_and_read_bt(&io, th, bt.data, len)) <= 0) {
-			if (len == -1)
+			if (len == -1 && errno != ECANCELED)
 				error("BT poll and read error: %s", strerror(errno));
 			goto fail;
 		}
@@ -268,7 +283,11 @@ static void *a2dp_aptx_dec_thread(struct ba_transport_thread *th) {
 			size_t decoded = ffb_len_in(&pcm);
 			ssize_t len;
 
-			if ((len = aptxdec_decode(handle, input, input_len, pcm.tail, &decoded)) <= 0) {
+			thread_stats_codec_begin(&th->stats);
+			len = aptxdec_decode(handle, input, input_len, pcm.tail, &decoded);
+			thread_stats_codec_end(&th->stats);
+
+			if (len <= 0) {
 				error("Apt-X decoding error: %s", strerror(errno));
 				continue;
 			}
@@ -281,8 +300,11 @@ static void *a2dp_aptx_dec_thread(struct ba_transport_thread *th) {
 
 		const size_t samples = ffb_len_out(&pcm);
 		io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
-		if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
+		if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1) {
+			if (errno == ECANCELED)
+				goto fail;
 			error("FIFO write error: %s", strerror(errno));
+		}
 
 	}
 
@@ -27,12 +27,14 @@
 #include "a2dp.h"
 #include "codec-sbc.h"
 #include "io.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/trace.h"
 
 static const struct a2dp_sampling_freq a2dp_faststream_samplings_music[] = {
 	{ 44100, FASTSTREAM_SAMPLING_FREQ_MUSIC_44100 },
@@ -142,14 +144,20 @@ static void *a2dp_faststream_enc_thread(struct ba_transport_thread *th) {
 		goto fail_ffb;
 	}
 
+	ba_transport_set_a2dp_bitrate(t, 8ULL * sbc_frame_len *
+			1000000 / sbc_get_frame_duration(&sbc));
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 
 		ssize_t samples = ffb_len_in(&pcm);
 		if ((samples = io_poll_and_read_pcm(&io, t_a2dp_pcm, pcm.tail, samples)) <= 0) {
-			if (samples == -1)
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("PCM poll and read error: %s", strerror(errno));
+			}
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
@@ -163,6 +171,8 @@ static void *a2dp_faststream_enc_thread(struct ba_transport_thread *th) {
 		size_t pcm_frames = 0;
 		size_t sbc_frames = 0;
 
+		trace(encode_start, th->t, input_len / channels);
+		thread_stats_codec_begin(&th->stats);
 		while (input_len >= sbc_frame_samples &&
 				output_len >= sbc_frame_len &&
 				sbc_frames < 3) {
@@ -186,11 +196,14 @@ static void *a2dp_faststream_enc_thread(struct ba_transport_thread *th) {
 
 		}
 
+		thread_stats_codec_end(&th->stats);
+		trace(encode_end, th->t, pcm_frames, ffb_blen_out(&bt));
+
 		if (sbc_frames > 0) {
 
 			ssize_t len = ffb_blen_out(&bt);
 			if ((len = io_bt_write(th, bt.data, len)) <= 0) {
-				if (len == -1)
+				if (len == -1 && errno != ECANCELED)
 					error("BT write error: %s", strerror(errno));
 				goto fail;
 			}
@@ -203,6 +216,7 @@ static void *a2dp_faststream_enc_thread(struct ba_transport_thread *th) {
 
 			/* update busy delay (encoding overhead) */
 			t_a2dp_pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100;
+			thread_stats_busy(&th->stats, asrsync_get_busy_usec(&io.asrs));
 
 			/* If the input buffer was not consumed (due to codesize limit), we
 			 * have to append new data to the existing one. Since we do not use
@@ -266,7 +280,7 @@ static void *a2dp_faststream_dec_thread(struct ba_transport_thread *th) {
 
 		ssize_t len = ffb_blen_in(&bt);
 		if ((len = io_poll_and_read_bt(&io, th, bt.tail, len)) <= 0) {
-			if (len == -1)
+			if (len == -1 && errno != ECANCELED)
 				error("BT poll and read error: %s", strerror(errno));
 			goto fail;
 		}
@@ -283,8 +297,12 @@ static void *a2dp_faststream_dec_thread(struct ba_transport_thread *th) {
 			ssize_t len;
 			size_t decoded;
 
-			if ((len = sbc_decode(&sbc, input, input_len,
-							pcm.data, ffb_blen_in(&pcm), &decoded)) < 0) {
+			thread_stats_codec_begin(&th->stats);
+			len = sbc_decode(&sbc, input, input_len,
+					pcm.data, ffb_blen_in(&pcm), &decoded);
+			thread_stats_codec_end(&th->stats);
+
+			if (len < 0) {
 				error("FastStream SBC decoding error: %s", sbc_strerror(len));
 				break;
 			}
@@ -294,8 +312,11 @@ static void *a2dp_faststream_dec_thread(struct ba_transport_thread *th) {
 
 			const size_t samples = decoded / sizeof(int16_t);
 			io_pcm_scale(t_a2dp_pcm, pcm.data, samples);
-			if (io_pcm_write(t_a2dp_pcm, pcm.data, samples) == -1)
+			if (io_pcm_write(t_a2dp_pcm, pcm.data, samples) == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("FIFO write error: %s", strerror(errno));
+			}
 
 		}
 
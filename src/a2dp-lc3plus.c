@@ -28,15 +28,19 @@
 #include "a2dp.h"
 #include "audio.h"
 #include "bluealsa-config.h"
+#include "codec-lc3plus.h"
 #include "codec-sbc.h"
 #include "io.h"
 #include "rtp.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/trace.h"
+
 
 static const struct a2dp_channel_mode a2dp_lc3plus_channels[] = {
 	{ A2DP_CHM_MONO, 1, LC3PLUS_CHANNELS_1 },
@@ -95,6 +99,14 @@ struct a2dp_codec a2dp_lc3plus_source = {
 };
 
 void a2dp_lc3plus_init(void) {
+
+	if ((a2dp_lc3plus_source.enabled || a2dp_lc3plus_sink.enabled) &&
+			codec_lc3plus_load() == -1) {
+		warn("Couldn't load LC3plus library, disabling LC3plus codec: %s", strerror(errno));
+		a2dp_lc3plus_source.enabled = false;
+		a2dp_lc3plus_sink.enabled = false;
+	}
+
 }
 
 void a2dp_lc3plus_transport_init(struct ba_transport *t) {
@@ -212,6 +224,8 @@ static void *a2dp_lc3plus_enc_thread(struct ba_transport_thread *th) {
 		goto fail_setup;
 	}
 
+	ba_transport_set_a2dp_bitrate(t, config.lc3plus_bitrate);
+
 	ffb_t bt = { 0 };
 	ffb_t pcm = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
@@ -262,8 +276,11 @@ static void *a2dp_lc3plus_enc_thread(struct ba_transport_thread *th) {
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
 						pcm.tail, ffb_len_in(&pcm))) <= 0) {
-			if (samples == -1)
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("PCM poll and read error: %s", strerror(errno));
+			}
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
@@ -280,6 +297,9 @@ static void *a2dp_lc3plus_enc_thread(struct ba_transport_thread *th) {
 		size_t pcm_frames = 0;
 		size_t lc3plus_frames = 0;
 
+		trace(encode_start, th->t, input_samples / channels);
+		thread_stats_codec_begin(&th->stats);
+
 		/* pack as many LC3plus frames as possible */
 		while (input_samples >= lc3plus_frame_samples &&
 				output_len >= lc3plus_frame_len &&
@@ -305,6 +325,9 @@ static void *a2dp_lc3plus_enc_thread(struct ba_transport_thread *th) {
 
 		}
 
+		thread_stats_codec_end(&th->stats);
+		trace(encode_end, th->t, pcm_frames, ffb_blen_out(&bt));
+
 		if (lc3plus_frames > 0) {
 
 			size_t payload_len_max = t->mtu_write - rtp_headers_len;
@@ -333,7 +356,7 @@ static void *a2dp_lc3plus_enc_thread(struct ba_transport_thread *th) {
 
 				ssize_t len = ffb_blen_out(&bt);
 				if ((len = io_bt_write(th, bt.data, len)) <= 0) {
-					if (len == -1)
+					if (len == -1 && errno != ECANCELED)
 						error("BT write error: %s", strerror(errno));
 					goto fail;
 				}
@@ -362,6 +385,7 @@ static void *a2dp_lc3plus_enc_thread(struct ba_transport_thread *th) {
 
 			/* update busy delay (encoding overhead) */
 			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+			thread_stats_busy(&th->stats, asrsync_get_busy_usec(&io.asrs));
 
 			/* If the input buffer was not consumed (due to codesize limit), we
 			 * have to append new data to the existing one. Since we do not use
@@ -464,7 +488,7 @@ static void *a2dp_lc3plus_dec_thread(struct ba_transport_thread *th) {
 
 		ssize_t len = ffb_blen_in(&bt);
 		if ((len = io_poll_and_read_bt(&io, th, bt.data, len)) <= 0) {
-			if (len == -1)
+			if (len == -1 && errno != ECANCELED)
 				error("BT poll and read error: %s", strerror(errno));
 			goto fail;
 		}
@@ -503,15 +527,20 @@ static void *a2dp_lc3plus_dec_thread(struct ba_transport_thread *th) {
 		while (missing_pcm_frames > 0) {
 
 			int32_t *out_buffers[2] = { pcm_ch1, pcm_ch2 };
+			thread_stats_codec_begin(&th->stats);
 			lc3plus_dec24(handle, bt_payload.data, 0, out_buffers, 1);
+			thread_stats_codec_end(&th->stats);
 			audio_interleave_s24_4le(pcm_ch1, pcm_ch2, lc3plus_ch_samples, channels, pcm.data);
 
 			warn("Missing LC3plus data, loss concealment applied");
 
 			const size_t samples = lc3plus_frame_samples;
 			io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
-			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
+			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("FIFO write error: %s", strerror(errno));
+			}
 
 			missing_pcm_frames -= lc3plus_ch_samples;
 
@@ -558,7 +587,9 @@ static void *a2dp_lc3plus_dec_thread(struct ba_transport_thread *th) {
 		while (lc3plus_frames--) {
 
 			int32_t *out_buffers[2] = { pcm_ch1, pcm_ch2 };
+			thread_stats_codec_begin(&th->stats);
 			err = lc3plus_dec24(handle, lc3plus_payload, lc3plus_frame_len, out_buffers, 0);
+			thread_stats_codec_end(&th->stats);
 			audio_interleave_s24_4le(pcm_ch1, pcm_ch2, lc3plus_ch_samples, channels, pcm.data);
 
 			if (err == LC3PLUS_DECODE_ERROR)
@@ -572,8 +603,11 @@ static void *a2dp_lc3plus_dec_thread(struct ba_transport_thread *th) {
 
 			const size_t samples = lc3plus_frame_samples;
 			io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
-			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
+			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("FIFO write error: %s", strerror(errno));
+			}
 
 			/* update local state with decoded PCM frames */
 			rtp_state_update(&rtp, lc3plus_ch_samples);
@@ -604,6 +638,9 @@ fail_init:
 
 int a2dp_lc3plus_transport_start(struct ba_transport *t) {
 
+	if (codec_lc3plus_load() == -1)
+		return -1;
+
 	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
 		return ba_transport_thread_create(&t->thread_enc, a2dp_lc3plus_enc_thread, "ba-a2dp-lc3p", true);
 
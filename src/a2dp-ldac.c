@@ -30,14 +30,93 @@
 
 #include "a2dp.h"
 #include "bluealsa-config.h"
+#include "codec-dl.h"
+#include "io-pipeline.h"
 #include "io.h"
 #include "rtp.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/trace.h"
+
+#if ENABLE_CODEC_DLOPEN
+
+CODEC_DL_SYMBOL_DECLARE(ldacBT_encode)
+CODEC_DL_SYMBOL_DECLARE(ldacBT_free_handle)
+CODEC_DL_SYMBOL_DECLARE(ldacBT_get_eqmid)
+CODEC_DL_SYMBOL_DECLARE(ldacBT_get_error_code)
+CODEC_DL_SYMBOL_DECLARE(ldacBT_get_handle)
+CODEC_DL_SYMBOL_DECLARE(ldacBT_init_handle_encode)
+static const char * const ldac_enc_dl_names[] = {
+	"libldacBT_enc.so.2",
+	"libldacBT_enc.so",
+	NULL,
+};
+static const struct codec_dl_symbol ldac_enc_dl_symbols[] = {
+	CODEC_DL_SYMBOL(ldacBT_encode),
+	CODEC_DL_SYMBOL(ldacBT_free_handle),
+	CODEC_DL_SYMBOL(ldacBT_get_eqmid),
+	CODEC_DL_SYMBOL(ldacBT_get_error_code),
+	CODEC_DL_SYMBOL(ldacBT_get_handle),
+	CODEC_DL_SYMBOL(ldacBT_init_handle_encode),
+	{ 0 },
+};
+static struct codec_dl ldac_enc_dl = CODEC_DL_INIT(ldac_enc_dl_names, ldac_enc_dl_symbols);
+# define ldacBT_encode codec_dl_ldacBT_encode
+# define ldacBT_free_handle codec_dl_ldacBT_free_handle
+# define ldacBT_get_eqmid codec_dl_ldacBT_get_eqmid
+# define ldacBT_get_error_code codec_dl_ldacBT_get_error_code
+# define ldacBT_get_handle codec_dl_ldacBT_get_handle
+# define ldacBT_init_handle_encode codec_dl_ldacBT_init_handle_encode
+
+CODEC_DL_SYMBOL_DECLARE(ldac_ABR_Init)
+CODEC_DL_SYMBOL_DECLARE(ldac_ABR_Proc)
+CODEC_DL_SYMBOL_DECLARE(ldac_ABR_free_handle)
+CODEC_DL_SYMBOL_DECLARE(ldac_ABR_get_handle)
+CODEC_DL_SYMBOL_DECLARE(ldac_ABR_set_thresholds)
+static const char * const ldac_abr_dl_names[] = {
+	"libldacBT_abr.so.2",
+	"libldacBT_abr.so",
+	NULL,
+};
+static const struct codec_dl_symbol ldac_abr_dl_symbols[] = {
+	CODEC_DL_SYMBOL(ldac_ABR_Init),
+	CODEC_DL_SYMBOL(ldac_ABR_Proc),
+	CODEC_DL_SYMBOL(ldac_ABR_free_handle),
+	CODEC_DL_SYMBOL(ldac_ABR_get_handle),
+	CODEC_DL_SYMBOL(ldac_ABR_set_thresholds),
+	{ 0 },
+};
+static struct codec_dl ldac_abr_dl = CODEC_DL_INIT(ldac_abr_dl_names, ldac_abr_dl_symbols);
+# define ldac_ABR_Init codec_dl_ldac_ABR_Init
+# define ldac_ABR_Proc codec_dl_ldac_ABR_Proc
+# define ldac_ABR_free_handle codec_dl_ldac_ABR_free_handle
+# define ldac_ABR_get_handle codec_dl_ldac_ABR_get_handle
+# define ldac_ABR_set_thresholds codec_dl_ldac_ABR_set_thresholds
+
+# if HAVE_LDAC_DECODE
+CODEC_DL_SYMBOL_DECLARE(ldacBT_decode)
+CODEC_DL_SYMBOL_DECLARE(ldacBT_init_handle_decode)
+static const char * const ldac_dec_dl_names[] = {
+	"libldacBT_dec.so.2",
+	"libldacBT_dec.so",
+	NULL,
+};
+static const struct codec_dl_symbol ldac_dec_dl_symbols[] = {
+	CODEC_DL_SYMBOL(ldacBT_decode),
+	CODEC_DL_SYMBOL(ldacBT_init_handle_decode),
+	{ 0 },
+};
+static struct codec_dl ldac_dec_dl = CODEC_DL_INIT(ldac_dec_dl_names, ldac_dec_dl_symbols);
+# define ldacBT_decode codec_dl_ldacBT_decode
+# define ldacBT_init_handle_decode codec_dl_ldacBT_init_handle_decode
+# endif
+
+#endif
 
 static const struct a2dp_channel_mode a2dp_ldac_channels[] = {
 	{ A2DP_CHM_MONO, 1, LDAC_CHANNEL_MODE_MONO },
@@ -100,7 +179,40 @@ struct a2dp_codec a2dp_ldac_source = {
 	.samplings_size[0] = ARRAYSIZE(a2dp_ldac_samplings),
 };
 
+/**
+ * Make sure that LDAC libraries are available.
+ *
+ * @param decoder If true, load the decoder library as well. */
+static int a2dp_ldac_load(bool decoder) {
+#if ENABLE_CODEC_DLOPEN
+	if (codec_dl_load(&ldac_enc_dl) == -1)
+		return -1;
+	if (!decoder)
+		return codec_dl_load(&ldac_abr_dl);
+# if HAVE_LDAC_DECODE
+	return codec_dl_load(&ldac_dec_dl);
+# endif
+#endif
+	(void)decoder;
+	return 0;
+}
+
 void a2dp_ldac_init(void) {
+
+	if (a2dp_ldac_source.enabled &&
+			a2dp_ldac_load(false) == -1) {
+		warn("Couldn't load LDAC encoder library, disabling LDAC source: %s", strerror(errno));
+		a2dp_ldac_source.enabled = false;
+	}
+
+#if HAVE_LDAC_DECODE
+	if (a2dp_ldac_sink.enabled &&
+			a2dp_ldac_load(true) == -1) {
+		warn("Couldn't load LDAC decoder library, disabling LDAC sink: %s", strerror(errno));
+		a2dp_ldac_sink.enabled = false;
+	}
+#endif
+
 }
 
 void a2dp_ldac_transport_init(struct ba_transport *t) {
@@ -118,6 +230,31 @@ void a2dp_ldac_transport_init(struct ba_transport *t) {
 
 }
 
+/**
+ * Get nominal bitrate of the LDAC stream.
+ *
+ * @param samplerate Sampling frequency of the stream.
+ * @param eqmid LDAC encoder quality mode.
+ * @return The bitrate in bits per second. If the quality mode is invalid
+ *   (e.g. ldacBT_get_eqmid() error), this function returns 0. */
+unsigned int a2dp_ldac_get_bitrate(unsigned int samplerate, int eqmid) {
+
+	/* nominal bitrates (in kbps) for the HQ, SQ and MQ quality modes,
+	 * respectively for the 48 kHz and the 44.1 kHz sampling families */
+	static const unsigned int bitrates[][3] = {
+		{ 990, 660, 330 },
+		{ 909, 606, 303 },
+	};
+
+	if (eqmid < LDACBT_EQMID_HQ)
+		return 0;
+
+	/* ABR might select quality modes below MQ, which are not exposed
+	 * by the LDAC API, so we will report the MQ bitrate for them */
+	eqmid = MIN(eqmid, LDACBT_EQMID_MQ);
+	return 1000 * bitrates[samplerate % 48000 != 0][eqmid - LDACBT_EQMID_HQ];
+}
+
 static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
@@ -154,6 +291,8 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 		goto fail_init;
 	}
 
+	ba_transport_set_a2dp_bitrate(t, a2dp_ldac_get_bitrate(samplerate, config.ldac_eqmid));
+
 	if (ldac_ABR_Init(handle_abr, 1000 * ldac_pcm_samples / channels / samplerate) == -1) {
 		error("Couldn't initialize LDAC ABR");
 		goto fail_init;
@@ -174,6 +313,13 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 		goto fail_ffb;
 	}
 
+	struct io_pipeline pipe = { .th = th };
+	pthread_cleanup_push(PTHREAD_CLEANUP(io_pipeline_free), &pipe);
+
+	if (config.a2dp.pipeline &&
+			io_pipeline_start(&pipe, ffb_blen_in(&bt)) == -1)
+		warn("Couldn't start encoding pipeline: %s", strerror(errno));
+
 	rtp_header_t *rtp_header;
 	rtp_media_header_t *rtp_media_header;
 	/* initialize RTP headers and get anchor for payload */
@@ -190,8 +336,11 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
 						pcm.tail, ffb_len_in(&pcm))) <= 0) {
-			if (samples == -1)
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("PCM poll and read error: %s", strerror(errno));
+			}
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
@@ -212,7 +361,12 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 			int encoded;
 			int frames;
 
-			if (ldacBT_encode(handle, input, &used, bt.tail, &encoded, &frames) != 0) {
+			trace(encode_start, th->t, input_len / channels);
+			thread_stats_codec_begin(&th->stats);
+			const int ret = ldacBT_encode(handle, input, &used, bt.tail, &encoded, &frames);
+			thread_stats_codec_end(&th->stats);
+
+			if (ret != 0) {
 				error("LDAC encoding error: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
 				break;
 			}
@@ -220,6 +374,7 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 			rtp_media_header->frame_count = frames;
 
 			size_t pcm_samples = used / sample_size;
+			trace(encode_end, th->t, pcm_samples / channels, encoded);
 			input += pcm_samples;
 			input_len -= pcm_samples;
 			ffb_seek(&bt, encoded);
@@ -233,12 +388,14 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 				int queued_bytes = 0;
 				if (ioctl(t->bt_fd, TIOCOUTQ, &queued_bytes) != -1)
 					queued_bytes = abs(t->a2dp.bt_fd_coutq_init - queued_bytes);
+				/* account for packets waiting in the encoding pipeline */
+				queued_bytes += io_pipeline_get_queued_bytes(&pipe);
 
 				errno = 0;
 
 				ssize_t len = ffb_blen_out(&bt);
-				if ((len = io_bt_write(th, bt.data, len)) <= 0) {
-					if (len == -1)
+				if ((len = io_pipeline_write(&pipe, &io, bt.data, len)) <= 0) {
+					if (len == -1 && errno != ECANCELED)
 						error("BT write error: %s", strerror(errno));
 					goto fail;
 				}
@@ -249,19 +406,23 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 					 * arbitrary big value. */
 					queued_bytes = 1024 * 16;
 
-				if (config.ldac_abr)
+				if (config.ldac_abr) {
 					ldac_ABR_Proc(handle, handle_abr, queued_bytes / t->mtu_write, 1);
+					/* ABR might have changed the encoder quality mode */
+					ba_transport_set_a2dp_bitrate(t,
+							a2dp_ldac_get_bitrate(samplerate, ldacBT_get_eqmid(handle)));
+				}
 
 			}
 
 			unsigned int pcm_frames = pcm_samples / channels;
 			/* keep data transfer at a constant bit rate */
-			asrsync_sync(&io.asrs, pcm_frames);
+			io_pipeline_sync(&pipe, &io, pcm_frames);
 			/* move forward RTP timestamp clock */
 			rtp_state_update(&rtp, pcm_frames);
 
 			/* update busy delay (encoding overhead) */
-			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+			t->a2dp.pcm.delay = io_pipeline_get_delay_usec(&pipe, &io) / 100;
 
 		}
 
@@ -277,6 +438,7 @@ fail:
 	debug_transport_thread_loop(th, "EXIT");
 	ba_transport_thread_set_state_stopping(th);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_pop(1);
 fail_ffb:
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
@@ -336,7 +498,7 @@ static void *a2dp_ldac_dec_thread(struct ba_transport_thread *th) {
 
 		ssize_t len = ffb_blen_in(&bt);
 		if ((len = io_poll_and_read_bt(&io, th, bt.data, len)) <= 0) {
-			if (len == -1)
+			if (len == -1 && errno != ECANCELED)
 				error("BT poll and read error: %s", strerror(errno));
 			goto fail;
 		}
@@ -363,8 +525,12 @@ static void *a2dp_ldac_dec_thread(struct ba_transport_thread *th) {
 			int used;
 			int decoded;
 
-			if (ldacBT_decode(handle, (void *)rtp_payload, pcm.data,
-						LDACBT_SMPL_FMT_S32, rtp_payload_len, &used, &decoded) != 0) {
+			thread_stats_codec_begin(&th->stats);
+			const int ret = ldacBT_decode(handle, (void *)rtp_payload, pcm.data,
+					LDACBT_SMPL_FMT_S32, rtp_payload_len, &used, &decoded);
+			thread_stats_codec_end(&th->stats);
+
+			if (ret != 0) {
 				error("LDAC decoding error: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
 				break;
 			}
@@ -374,8 +540,11 @@ static void *a2dp_ldac_dec_thread(struct ba_transport_thread *th) {
 
 			const size_t samples = decoded / sample_size;
 			io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
-			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
+			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("FIFO write error: %s", strerror(errno));
+			}
 
 			/* update local state with decoded PCM frames */
 			rtp_state_update(&rtp, samples / channels);
@@ -401,6 +570,10 @@ fail_open:
 
 int a2dp_ldac_transport_start(struct ba_transport *t) {
 
+	const bool decoder = t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK;
+	if (a2dp_ldac_load(decoder) == -1)
+		return -1;
+
 	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
 		return ba_transport_thread_create(&t->thread_enc, a2dp_ldac_enc_thread, "ba-a2dp-ldac", true);
 
@@ -26,4 +26,6 @@ void a2dp_ldac_init(void);
 void a2dp_ldac_transport_init(struct ba_transport *t);
 int a2dp_ldac_transport_start(struct ba_transport *t);
 
+unsigned int a2dp_ldac_get_bitrate(unsigned int samplerate, int eqmid);
+
 #endif
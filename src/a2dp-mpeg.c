@@ -33,14 +33,141 @@
 #include "a2dp.h"
 #include "ba-transport.h"
 #include "bluealsa-config.h"
+#include "codec-dl.h"
 #include "io.h"
 #include "rtp.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/trace.h"
+
+#if ENABLE_CODEC_DLOPEN
+
+# if ENABLE_MP3LAME
+#  if !ENABLE_MPG123
+CODEC_DL_SYMBOL_DECLARE(hip_decode)
+CODEC_DL_SYMBOL_DECLARE(hip_decode_exit)
+CODEC_DL_SYMBOL_DECLARE(hip_decode_init)
+#  endif
+CODEC_DL_SYMBOL_DECLARE(lame_close)
+CODEC_DL_SYMBOL_DECLARE(lame_encode_buffer)
+CODEC_DL_SYMBOL_DECLARE(lame_encode_buffer_interleaved)
+CODEC_DL_SYMBOL_DECLARE(lame_get_framesize)
+CODEC_DL_SYMBOL_DECLARE(lame_init)
+CODEC_DL_SYMBOL_DECLARE(lame_init_params)
+CODEC_DL_SYMBOL_DECLARE(lame_set_VBR)
+CODEC_DL_SYMBOL_DECLARE(lame_set_VBR_q)
+CODEC_DL_SYMBOL_DECLARE(lame_set_bWriteVbrTag)
+CODEC_DL_SYMBOL_DECLARE(lame_set_brate)
+CODEC_DL_SYMBOL_DECLARE(lame_set_error_protection)
+CODEC_DL_SYMBOL_DECLARE(lame_set_free_format)
+CODEC_DL_SYMBOL_DECLARE(lame_set_in_samplerate)
+CODEC_DL_SYMBOL_DECLARE(lame_set_mode)
+CODEC_DL_SYMBOL_DECLARE(lame_set_num_channels)
+CODEC_DL_SYMBOL_DECLARE(lame_set_quality)
+static const char * const mp3lame_dl_names[] = {
+	"libmp3lame.so.0",
+	"libmp3lame.so",
+	NULL,
+};
+static const struct codec_dl_symbol mp3lame_dl_symbols[] = {
+#  if !ENABLE_MPG123
+	CODEC_DL_SYMBOL(hip_decode),
+	CODEC_DL_SYMBOL(hip_decode_exit),
+	CODEC_DL_SYMBOL(hip_decode_init),
+#  endif
+	CODEC_DL_SYMBOL(lame_close),
+	CODEC_DL_SYMBOL(lame_encode_buffer),
+	CODEC_DL_SYMBOL(lame_encode_buffer_interleaved),
+	CODEC_DL_SYMBOL(lame_get_framesize),
+	CODEC_DL_SYMBOL(lame_init),
+	CODEC_DL_SYMBOL(lame_init_params),
+	CODEC_DL_SYMBOL(lame_set_VBR),
+	CODEC_DL_SYMBOL(lame_set_VBR_q),
+	CODEC_DL_SYMBOL(lame_set_bWriteVbrTag),
+	CODEC_DL_SYMBOL(lame_set_brate),
+	CODEC_DL_SYMBOL(lame_set_error_protection),
+	CODEC_DL_SYMBOL(lame_set_free_format),
+	CODEC_DL_SYMBOL(lame_set_in_samplerate),
+	CODEC_DL_SYMBOL(lame_set_mode),
+	CODEC_DL_SYMBOL(lame_set_num_channels),
+	CODEC_DL_SYMBOL(lame_set_quality),
+	{ 0 },
+};
+static struct codec_dl mp3lame_dl = CODEC_DL_INIT(mp3lame_dl_names, mp3lame_dl_symbols);
+#  if !ENABLE_MPG123
+#  define hip_decode codec_dl_hip_decode
+#  define hip_decode_exit codec_dl_hip_decode_exit
+#  define hip_decode_init codec_dl_hip_decode_init
+#  endif
+# define lame_close codec_dl_lame_close
+# define lame_encode_buffer codec_dl_lame_encode_buffer
+# define lame_encode_buffer_interleaved codec_dl_lame_encode_buffer_interleaved
+# define lame_get_framesize codec_dl_lame_get_framesize
+# define lame_init codec_dl_lame_init
+# define lame_init_params codec_dl_lame_init_params
+# define lame_set_VBR codec_dl_lame_set_VBR
+# define lame_set_VBR_q codec_dl_lame_set_VBR_q
+# define lame_set_bWriteVbrTag codec_dl_lame_set_bWriteVbrTag
+# define lame_set_brate codec_dl_lame_set_brate
+# define lame_set_error_protection codec_dl_lame_set_error_protection
+# define lame_set_free_format codec_dl_lame_set_free_format
+# define lame_set_in_samplerate codec_dl_lame_set_in_samplerate
+# define lame_set_mode codec_dl_lame_set_mode
+# define lame_set_num_channels codec_dl_lame_set_num_channels
+# define lame_set_quality codec_dl_lame_set_quality
+# endif
+
+# if ENABLE_MPG123
+CODEC_DL_SYMBOL_DECLARE(mpg123_decode)
+CODEC_DL_SYMBOL_DECLARE(mpg123_delete)
+CODEC_DL_SYMBOL_DECLARE(mpg123_format)
+CODEC_DL_SYMBOL_DECLARE(mpg123_format_none)
+CODEC_DL_SYMBOL_DECLARE(mpg123_getformat)
+CODEC_DL_SYMBOL_DECLARE(mpg123_init)
+CODEC_DL_SYMBOL_DECLARE(mpg123_new)
+CODEC_DL_SYMBOL_DECLARE(mpg123_open_feed)
+CODEC_DL_SYMBOL_DECLARE(mpg123_param)
+CODEC_DL_SYMBOL_DECLARE(mpg123_plain_strerror)
+CODEC_DL_SYMBOL_DECLARE(mpg123_strerror)
+static const char * const mpg123_dl_names[] = {
+	"libmpg123.so.0",
+	"libmpg123.so",
+	NULL,
+};
+static const struct codec_dl_symbol mpg123_dl_symbols[] = {
+	CODEC_DL_SYMBOL(mpg123_decode),
+	CODEC_DL_SYMBOL(mpg123_delete),
+	CODEC_DL_SYMBOL(mpg123_format),
+	CODEC_DL_SYMBOL(mpg123_format_none),
+	CODEC_DL_SYMBOL(mpg123_getformat),
+	CODEC_DL_SYMBOL(mpg123_init),
+	CODEC_DL_SYMBOL(mpg123_new),
+	CODEC_DL_SYMBOL(mpg123_open_feed),
+	CODEC_DL_SYMBOL(mpg123_param),
+	CODEC_DL_SYMBOL(mpg123_plain_strerror),
+	CODEC_DL_SYMBOL(mpg123_strerror),
+	{ 0 },
+};
+static struct codec_dl mpg123_dl = CODEC_DL_INIT(mpg123_dl_names, mpg123_dl_symbols);
+# define mpg123_decode codec_dl_mpg123_decode
+# define mpg123_delete codec_dl_mpg123_delete
+# define mpg123_format codec_dl_mpg123_format
+# define mpg123_format_none codec_dl_mpg123_format_none
+# define mpg123_getformat codec_dl_mpg123_getformat
+# define mpg123_init codec_dl_mpg123_init
+# define mpg123_new codec_dl_mpg123_new
+# define mpg123_open_feed codec_dl_mpg123_open_feed
+# define mpg123_param codec_dl_mpg123_param
+# define mpg123_plain_strerror codec_dl_mpg123_plain_strerror
+# define mpg123_strerror codec_dl_mpg123_strerror
+# endif
+
+#endif
 
 static const struct a2dp_channel_mode a2dp_mpeg_channels[] = {
 	{ A2DP_CHM_MONO, 1, MPEG_CHANNEL_MODE_MONO },
@@ -167,8 +294,38 @@ struct a2dp_codec a2dp_mpeg_source = {
 	.enabled = false,
 };
 
+/**
+ * Make sure that the MPEG library is available.
+ *
+ * @param decoder If true, load the decoder library. */
+static int a2dp_mpeg_load(bool decoder) {
+#if ENABLE_CODEC_DLOPEN
+# if ENABLE_MPG123
+	if (decoder)
+		return codec_dl_load(&mpg123_dl);
+# endif
+# if ENABLE_MP3LAME
+	return codec_dl_load(&mp3lame_dl);
+# endif
+#endif
+	(void)decoder;
+	return 0;
+}
+
 void a2dp_mpeg_init(void) {
 
+	if (a2dp_mpeg_source.enabled &&
+			a2dp_mpeg_load(false) == -1) {
+		warn("Couldn't load LAME library, disabling MPEG source: %s", strerror(errno));
+		a2dp_mpeg_source.enabled = false;
+	}
+
+	if (a2dp_mpeg_sink.enabled &&
+			a2dp_mpeg_load(true) == -1) {
+		warn("Couldn't load MPEG decoder library, disabling MPEG sink: %s", strerror(errno));
+		a2dp_mpeg_sink.enabled = false;
+	}
+
 	if (config.a2dp.force_mono)
 		a2dp_mpeg_source.capabilities.mpeg.channel_mode = MPEG_CHANNEL_MODE_MONO;
 	if (config.a2dp.force_44100)
@@ -261,6 +418,7 @@ static void *a2dp_mp3_enc_thread(struct ba_transport_thread *th) {
 			error("LAME: Couldn't set CBR bitrate: %d", bitrate);
 			goto fail_setup;
 		}
+		ba_transport_set_a2dp_bitrate(t, bitrate * 1000);
 		if (mpeg_bitrate & MPEG_BIT_RATE_FREE &&
 				lame_set_free_format(handle, 1) != 0) {
 			error("LAME: Couldn't enable free format");
@@ -310,8 +468,11 @@ static void *a2dp_mp3_enc_thread(struct ba_transport_thread *th) {
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
 						pcm.tail, ffb_len_in(&pcm))) <= 0) {
-			if (samples == -1)
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("PCM poll and read error: %s", strerror(errno));
+			}
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
@@ -325,13 +486,20 @@ static void *a2dp_mp3_enc_thread(struct ba_transport_thread *th) {
 		size_t pcm_frames = samples / channels;
 		ssize_t len;
 
-		if ((len = channels == 1 ?
-					lame_encode_buffer(handle, pcm.data, NULL, pcm_frames, bt.tail, ffb_len_in(&bt)) :
-					lame_encode_buffer_interleaved(handle, pcm.data, pcm_frames, bt.tail, ffb_len_in(&bt))) < 0) {
+		trace(encode_start, th->t, pcm_frames);
+		thread_stats_codec_begin(&th->stats);
+		len = channels == 1 ?
+			lame_encode_buffer(handle, pcm.data, NULL, pcm_frames, bt.tail, ffb_len_in(&bt)) :
+			lame_encode_buffer_interleaved(handle, pcm.data, pcm_frames, bt.tail, ffb_len_in(&bt));
+		thread_stats_codec_end(&th->stats);
+
+		if (len < 0) {
 			error("LAME encoding error: %s", lame_encode_strerror(len));
 			continue;
 		}
 
+		trace(encode_end, th->t, pcm_frames, len);
+
 		if (len > 0) {
 
 			size_t payload_len_max = t->mtu_write - RTP_HEADER_LEN - sizeof(*rtp_mpeg_audio_header);
@@ -351,7 +519,7 @@ static void *a2dp_mp3_enc_thread(struct ba_transport_thread *th) {
 
 				ssize_t len = ffb_blen_out(&bt);
 				if ((len = io_bt_write(th, bt.data, len)) <= 0) {
-					if (len == -1)
+					if (len == -1 && errno != ECANCELED)
 						error("BT write error: %s", strerror(errno));
 					goto fail;
 				}
@@ -378,6 +546,7 @@ static void *a2dp_mp3_enc_thread(struct ba_transport_thread *th) {
 
 		/* update busy delay (encoding overhead) */
 		t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+		thread_stats_busy(&th->stats, asrsync_get_busy_usec(&io.asrs));
 
 		/* If the input buffer was not consumed (due to frame alignment), we
 		 * have to append new data to the existing one. Since we do not use
@@ -487,7 +656,7 @@ static void *a2dp_mpeg_dec_thread(struct ba_transport_thread *th) {
 
 		ssize_t len = ffb_blen_in(&bt);
 		if ((len = io_poll_and_read_bt(&io, th, bt.data, len)) <= 0) {
-			if (len == -1)
+			if (len == -1 && errno != ECANCELED)
 				error("BT poll and read error: %s", strerror(errno));
 			goto fail;
 		}
@@ -515,8 +684,12 @@ static void *a2dp_mpeg_dec_thread(struct ba_transport_thread *th) {
 		int encoding;
 
 decode:
-		switch (mpg123_decode(handle, rtp_mpeg, rtp_mpeg_len,
-					(uint8_t *)pcm.data, ffb_blen_in(&pcm), (size_t *)&len)) {
+		thread_stats_codec_begin(&th->stats);
+		const int ret = mpg123_decode(handle, rtp_mpeg, rtp_mpeg_len,
+				(uint8_t *)pcm.data, ffb_blen_in(&pcm), (size_t *)&len);
+		thread_stats_codec_end(&th->stats);
+
+		switch (ret) {
 		case MPG123_DONE:
 		case MPG123_NEED_MORE:
 		case MPG123_OK:
@@ -532,8 +705,11 @@ decode:
 
 		const size_t samples = len / sizeof(int16_t);
 		io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
-		if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
+		if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1) {
+			if (errno == ECANCELED)
+				goto fail;
 			error("FIFO write error: %s", strerror(errno));
+		}
 
 		/* update local state with decoded PCM frames */
 		rtp_state_update(&rtp, samples / channels);
@@ -549,15 +725,22 @@ decode:
 		int16_t pcm_r[MPEG_PCM_DECODE_SAMPLES];
 		ssize_t samples;
 
-		if ((samples = hip_decode(handle, rtp_mpeg, rtp_mpeg_len, pcm_l, pcm_r)) < 0) {
+		thread_stats_codec_begin(&th->stats);
+		samples = hip_decode(handle, rtp_mpeg, rtp_mpeg_len, pcm_l, pcm_r);
+		thread_stats_codec_end(&th->stats);
+
+		if (samples < 0) {
 			error("LAME decoding error: %zd", samples);
 			continue;
 		}
 
 		if (channels == 1) {
 			io_pcm_scale(&t->a2dp.pcm, pcm_l, samples);
-			if (io_pcm_write(&t->a2dp.pcm, pcm_l, samples) == -1)
+			if (io_pcm_write(&t->a2dp.pcm, pcm_l, samples) == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("FIFO write error: %s", strerror(errno));
+			}
 		}
 		else {
 
@@ -568,8 +751,11 @@ decode:
 			}
 
 			io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
-			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
+			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("FIFO write error: %s", strerror(errno));
+			}
 
 		}
 
@@ -599,6 +785,10 @@ fail_init:
 
 int a2dp_mpeg_transport_start(struct ba_transport *t) {
 
+	const bool decoder = t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK;
+	if (a2dp_mpeg_load(decoder) == -1)
+		return -1;
+
 	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE) {
 #if ENABLE_MP3LAME
 		if (t->a2dp.configuration.mpeg.layer == MPEG_LAYER_MP3)
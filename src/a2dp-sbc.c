@@ -13,6 +13,7 @@
 #include <endian.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -24,16 +25,21 @@
 #include <sbc/sbc.h>
 
 #include "a2dp.h"
+#include "ba-adapter.h"
+#include "ba-device.h"
 #include "bluealsa-config.h"
 #include "codec-sbc.h"
+#include "io-pipeline.h"
 #include "io.h"
 #include "rtp.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/trace.h"
 
 static const struct a2dp_channel_mode a2dp_sbc_channels[] = {
 	{ A2DP_CHM_MONO, 1, SBC_CHANNEL_MODE_MONO },
@@ -171,8 +177,10 @@ static void *a2dp_sbc_enc_thread(struct ba_transport_thread *th) {
 
 	ffb_t bt = { 0 };
 	ffb_t pcm = { 0 };
+	ffb_t silence = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &silence);
 	pthread_cleanup_push(PTHREAD_CLEANUP(sbc_finish), &sbc);
 
 	const a2dp_sbc_t *configuration = &t->a2dp.configuration.sbc;
@@ -182,6 +190,15 @@ static void *a2dp_sbc_enc_thread(struct ba_transport_thread *th) {
 
 	/* initialize SBC encoder bit-pool */
 	sbc.bitpool = sbc_a2dp_get_bitpool(configuration, config.sbc_quality);
+	/* The bit-pool selected according to the quality setting is the upper
+	 * limit. It might be lowered if the adapter bandwidth budget is exceeded
+	 * or the link degrades, in which case the SBC frame length computed below
+	 * is still valid as the upper bound of the encoded frame length. */
+	const uint8_t bitpool_max = sbc.bitpool;
+	const unsigned int bitrate_max = 8ULL * sbc_get_frame_length(&sbc) *
+		1000000 / sbc_get_frame_duration(&sbc);
+	unsigned int bw_generation = ba_adapter_bw_get_generation(t->d->a) - 1;
+	unsigned int link_generation = ba_device_link_get_generation(t->d);
 
 #if DEBUG
 	sbc_print_internals(&sbc);
@@ -203,12 +220,27 @@ static void *a2dp_sbc_enc_thread(struct ba_transport_thread *th) {
 		warn("Writing MTU too small for one single SBC frame: %zu < %zu",
 				t->mtu_write, RTP_HEADER_LEN + sizeof(rtp_media_header_t) + sbc_frame_len);
 
+	/* The number of SBC frames in the pre-encoded silence packet shall match
+	 * the number of frames in a regular packet, so the sink will receive
+	 * packets of the same duration during PCM underrun. */
+	const size_t silence_sbc_frames = MIN(MAX(mtu_write_payload_len / sbc_frame_len, 1),
+			(1 << 4) - 1);
+	const size_t silence_pcm_frames = silence_sbc_frames * sbc_frame_samples / channels;
+
 	if (ffb_init_int16_t(&pcm, ffb_pcm_len) == -1 ||
-			ffb_init_uint8_t(&bt, t->mtu_write) == -1) {
+			ffb_init_uint8_t(&bt, t->mtu_write) == -1 ||
+			ffb_init_uint8_t(&silence, rtp_headers_len + silence_sbc_frames * sbc_frame_len) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
 	}
 
+	struct io_pipeline pipe = { .th = th };
+	pthread_cleanup_push(PTHREAD_CLEANUP(io_pipeline_free), &pipe);
+
+	if (config.a2dp.pipeline &&
+			io_pipeline_start(&pipe, ffb_blen_in(&bt)) == -1)
+		warn("Couldn't start encoding pipeline: %s", strerror(errno));
+
 	rtp_header_t *rtp_header;
 	rtp_media_header_t *rtp_media_header;
 
@@ -220,14 +252,65 @@ static void *a2dp_sbc_enc_thread(struct ba_transport_thread *th) {
 	/* RTP clock frequency equal to audio samplerate */
 	rtp_state_init(&rtp, samplerate, samplerate);
 
+	rtp_header_t *silence_rtp_header;
+	rtp_media_header_t *silence_rtp_media_header;
+
+	/* Generate RTP packet with digital silence, which will be used to keep
+	 * the BT link clocked when the PCM client does not provide data on time.
+	 * Otherwise, the sink might drain its buffer and increase the latency
+	 * on every PCM underrun. */
+	uint8_t *silence_payload = rtp_a2dp_init(silence.data, &silence_rtp_header,
+			(void **)&silence_rtp_media_header, sizeof(*silence_rtp_media_header));
+	silence_rtp_media_header->frame_count = silence_sbc_frames;
+
+	ssize_t silence_len;
+	if ((silence_len = sbc_encode_silence(&sbc, silence_sbc_frames,
+					silence_payload, ffb_blen_in(&silence) - rtp_headers_len)) < 0)
+		warn("Couldn't encode SBC silence: %s", sbc_strerror(silence_len));
+	else {
+		silence_len += rtp_headers_len;
+		io.underrun.timeout = MAX(1, silence_pcm_frames * 1000 / samplerate);
+	}
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
+		const unsigned int bw_gen = ba_adapter_bw_get_generation(t->d->a);
+		const unsigned int link_gen = ba_device_link_get_generation(t->d);
+		if (bw_gen != bw_generation || link_gen != link_generation) {
+			/* adjust bit-pool to the current bandwidth budget and link state */
+			bw_generation = bw_gen;
+			link_generation = link_gen;
+			unsigned int budget = ba_adapter_bw_get_a2dp_budget(t->d->a);
+			budget = ba_device_link_scale_bitrate(t->d, budget != 0 ? budget : bitrate_max);
+			sbc.bitpool = sbc_get_bitpool_for_bitrate(&sbc,
+					configuration->min_bitpool, bitpool_max, budget);
+			ba_transport_set_a2dp_bitrate(t, 8ULL * sbc_get_frame_length(&sbc) *
+					1000000 / sbc_get_frame_duration(&sbc));
+			debug("SBC bit-pool adjusted: %u (budget: %u bps)", sbc.bitpool, budget);
+		}
+
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
 						pcm.tail, ffb_len_in(&pcm))) <= 0) {
-			if (samples == -1)
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto fail;
+				if (errno == ETIME) {
+					/* send pre-encoded silence instead of stalling the BT link */
+					rtp_state_new_frame(&rtp, silence_rtp_header);
+					ssize_t len;
+					if ((len = io_pipeline_write(&pipe, &io, silence.data, silence_len)) <= 0) {
+						if (len == -1 && errno != ECANCELED)
+							error("BT write error: %s", strerror(errno));
+						goto fail;
+					}
+					io_pipeline_sync(&pipe, &io, silence_pcm_frames);
+					rtp_state_update(&rtp, silence_pcm_frames);
+					continue;
+				}
 				error("PCM poll and read error: %s", strerror(errno));
+			}
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
@@ -244,6 +327,9 @@ static void *a2dp_sbc_enc_thread(struct ba_transport_thread *th) {
 		size_t pcm_frames = 0;
 		size_t sbc_frames = 0;
 
+		trace(encode_start, th->t, input_samples / channels);
+		thread_stats_codec_begin(&th->stats);
+
 		/* Generate as many SBC frames as possible, but less than a 4-bit media
 		 * header frame counter can contain. The size of the output buffer is
 		 * based on the socket MTU, so such transfer should be most efficient. */
@@ -271,25 +357,28 @@ static void *a2dp_sbc_enc_thread(struct ba_transport_thread *th) {
 
 		}
 
+		thread_stats_codec_end(&th->stats);
+		trace(encode_end, th->t, pcm_frames, ffb_blen_out(&bt));
+
 		if (sbc_frames > 0) {
 
 			rtp_state_new_frame(&rtp, rtp_header);
 			rtp_media_header->frame_count = sbc_frames;
 
 			ssize_t len = ffb_blen_out(&bt);
-			if ((len = io_bt_write(th, bt.data, len)) <= 0) {
-				if (len == -1)
+			if ((len = io_pipeline_write(&pipe, &io, bt.data, len)) <= 0) {
+				if (len == -1 && errno != ECANCELED)
 					error("BT write error: %s", strerror(errno));
 				goto fail;
 			}
 
 			/* keep data transfer at a constant bit rate */
-			asrsync_sync(&io.asrs, pcm_frames);
+			io_pipeline_sync(&pipe, &io, pcm_frames);
 			/* move forward RTP timestamp clock */
 			rtp_state_update(&rtp, pcm_frames);
 
 			/* update busy delay (encoding overhead) */
-			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+			t->a2dp.pcm.delay = io_pipeline_get_delay_usec(&pipe, &io) / 100;
 
 			/* If the input buffer was not consumed (due to codesize limit), we
 			 * have to append new data to the existing one. Since we do not use
@@ -305,10 +394,12 @@ fail:
 	debug_transport_thread_loop(th, "EXIT");
 	ba_transport_thread_set_state_stopping(th);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_pop(1);
 fail_ffb:
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 fail_init:
 	pthread_cleanup_pop(1);
 	return NULL;
@@ -359,7 +450,7 @@ static void *a2dp_sbc_dec_thread(struct ba_transport_thread *th) {
 
 		ssize_t len = ffb_blen_in(&bt);
 		if ((len = io_poll_and_read_bt(&io, th, bt.data, len)) <= 0) {
-			if (len == -1)
+			if (len == -1 && errno != ECANCELED)
 				error("BT poll and read error: %s", strerror(errno));
 			goto fail;
 		}
@@ -387,8 +478,12 @@ static void *a2dp_sbc_dec_thread(struct ba_transport_thread *th) {
 			ssize_t len;
 			size_t decoded;
 
-			if ((len = sbc_decode(&sbc, rtp_payload, rtp_payload_len,
-							pcm.data, ffb_blen_in(&pcm), &decoded)) < 0) {
+			thread_stats_codec_begin(&th->stats);
+			len = sbc_decode(&sbc, rtp_payload, rtp_payload_len,
+					pcm.data, ffb_blen_in(&pcm), &decoded);
+			thread_stats_codec_end(&th->stats);
+
+			if (len < 0) {
 				error("SBC decoding error: %s", sbc_strerror(len));
 				break;
 			}
@@ -405,8 +500,11 @@ static void *a2dp_sbc_dec_thread(struct ba_transport_thread *th) {
 
 			const size_t samples = decoded / sizeof(int16_t);
 			io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
-			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
+			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1) {
+				if (errno == ECANCELED)
+					goto fail;
 				error("FIFO write error: %s", strerror(errno));
+			}
 
 			/* update local state with decoded PCM frames */
 			rtp_state_update(&rtp, samples / channels);
@@ -183,3 +183,40 @@ void audio_silence_s32_4le(int32_t *buffer, size_t frames,
 		g_assert_not_reached();
 	}
 }
+
+/**
+ * Check whether PCM buffer contains digital silence.
+ *
+ * The buffer is scanned in blocks of machine words, which allows compilers
+ * to vectorize the inner loop, and the scan stops at the first non-silent
+ * block. Only the exact zero is considered to be a silence, so this check
+ * does not depend on the PCM format.
+ *
+ * @param buffer Buffer with PCM samples.
+ * @param size The size of the buffer in bytes.
+ * @return This function returns true if all bytes in the buffer are zero. */
+bool audio_is_silence(const void *buffer, size_t size) {
+
+	const uint8_t *data = buffer;
+	const size_t block = 32 * sizeof(uint64_t);
+
+	for (; size >= block; size -= block) {
+		/* Load words with memcpy(), so the buffer does not have to be aligned
+		 * and the strict aliasing rule is not violated. Compilers translate
+		 * such fixed-size copies into plain (unaligned) loads. */
+		uint64_t words[32];
+		memcpy(words, data, sizeof(words));
+		uint64_t acc = 0;
+		for (size_t i = 0; i < ARRAYSIZE(words); i++)
+			acc |= words[i];
+		if (acc != 0)
+			return false;
+		data += block;
+	}
+
+	while (size-- > 0)
+		if (*data++ != 0)
+			return false;
+
+	return true;
+}
@@ -47,4 +47,6 @@ void audio_silence_s32_4le(int32_t *buffer, size_t frames,
 		unsigned int channels, bool ch1, bool ch2);
 #define audio_silence_s24_4le audio_silence_s32_4le
 
+bool audio_is_silence(const void *buffer, size_t size);
+
 #endif
@@ -11,6 +11,8 @@
 #include "ba-adapter.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,11 +20,13 @@
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
+#include <glib.h>
 
 #include "ba-device.h"
 #include "bluealsa-config.h"
 #include "hci.h"
 #include "hfp.h"
+#include "link-monitor.h"
 #include "utils.h"
 #include "shared/log.h"
 
@@ -52,7 +56,6 @@ struct ba_adapter *ba_adapter_new(int dev_id) {
 	if (hci_get_version(dev_id, &a->chip) == -1)
 		warn("Couldn't get HCI version: %s", strerror(errno));
 
-	a->sco_dispatcher = config.main_thread;
 	a->ref_count = 1;
 
 	sprintf(a->ba_dbus_path, "/org/bluealsa/%s", a->hci.name);
@@ -63,6 +66,8 @@ struct ba_adapter *ba_adapter_new(int dev_id) {
 	pthread_mutex_init(&a->devices_mutex, NULL);
 	a->devices = g_hash_table_new_full(g_bdaddr_hash, g_bdaddr_equal, NULL, NULL);
 
+	pthread_mutex_init(&a->bw.mutex, NULL);
+
 	pthread_mutex_lock(&config.adapters_mutex);
 	config.adapters[a->hci.dev_id] = a;
 	pthread_mutex_unlock(&config.adapters_mutex);
@@ -127,10 +132,57 @@ void ba_adapter_destroy(struct ba_adapter *a) {
 	ba_adapter_unref(a);
 }
 
+struct ba_adapter_source_remove_data {
+	unsigned int tag;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool done;
+};
+
+static gboolean ba_adapter_source_remove_dispatch(void *userdata) {
+	struct ba_adapter_source_remove_data *data = userdata;
+	g_source_remove(data->tag);
+	pthread_mutex_lock(&data->mutex);
+	data->done = true;
+	pthread_cond_signal(&data->cond);
+	pthread_mutex_unlock(&data->mutex);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Remove main loop source and wait for its callback completion.
+ *
+ * The g_source_remove() function called from a thread other than the main
+ * thread does not wait for the source callback which might be running at
+ * the same time. Hence, the removal is dispatched to the main loop. */
+static void ba_adapter_source_remove(unsigned int tag) {
+
+	if (g_main_context_is_owner(NULL)) {
+		g_source_remove(tag);
+		return;
+	}
+
+	struct ba_adapter_source_remove_data data = {
+		.tag = tag,
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+
+	g_main_context_invoke(NULL, ba_adapter_source_remove_dispatch, &data);
+
+	pthread_mutex_lock(&data.mutex);
+	while (!data.done)
+		pthread_cond_wait(&data.cond, &data.mutex);
+	pthread_mutex_unlock(&data.mutex);
+
+	pthread_mutex_destroy(&data.mutex);
+	pthread_cond_destroy(&data.cond);
+
+}
+
 void ba_adapter_unref(struct ba_adapter *a) {
 
 	int ref_count;
-	int err;
 
 	pthread_mutex_lock(&config.adapters_mutex);
 	if ((ref_count = --a->ref_count) == 0)
@@ -144,19 +196,82 @@ void ba_adapter_unref(struct ba_adapter *a) {
 	debug("Freeing adapter: %s", a->hci.name);
 	g_assert_cmpint(ref_count, ==, 0);
 
-	/* make sure that the SCO dispatcher is terminated before free() */
-	if (!pthread_equal(a->sco_dispatcher, config.main_thread)) {
-		if ((err = pthread_cancel(a->sco_dispatcher)) != 0)
-			warn("Couldn't cancel SCO dispatcher thread: %s", strerror(err));
-		if ((err = pthread_join(a->sco_dispatcher, NULL)) != 0)
-			warn("Couldn't join SCO dispatcher thread: %s", strerror(err));
-	}
+	/* make sure that the SCO dispatcher is removed before free() */
+	if (a->sco_dispatcher != 0)
+		ba_adapter_source_remove(a->sco_dispatcher);
+	/* the same applies to the link monitor */
+	link_monitor_free(a->link_monitor);
 
 	g_hash_table_unref(a->devices);
 	pthread_mutex_destroy(&a->devices_mutex);
+	pthread_mutex_destroy(&a->bw.mutex);
 	free(a);
 }
 
+static unsigned int *ba_adapter_bw_get_link_counter(struct ba_adapter *a,
+		enum ba_adapter_bw_link link) {
+	switch (link) {
+	case BA_ADAPTER_BW_LINK_A2DP:
+		return &a->bw.a2dp_streams;
+	case BA_ADAPTER_BW_LINK_SCO:
+		return &a->bw.sco_links;
+	}
+	g_assert_not_reached();
+	return NULL;
+}
+
+/**
+ * Register active link in the adapter bandwidth scheduler. */
+void ba_adapter_bw_link_add(struct ba_adapter *a, enum ba_adapter_bw_link link) {
+	pthread_mutex_lock(&a->bw.mutex);
+	(*ba_adapter_bw_get_link_counter(a, link))++;
+	atomic_fetch_add_explicit(&a->bw.generation, 1, memory_order_relaxed);
+	debug("Adapter bandwidth links [%s]: A2DP: %u SCO: %u", a->hci.name,
+			a->bw.a2dp_streams, a->bw.sco_links);
+	pthread_mutex_unlock(&a->bw.mutex);
+}
+
+/**
+ * Unregister link from the adapter bandwidth scheduler. */
+void ba_adapter_bw_link_remove(struct ba_adapter *a, enum ba_adapter_bw_link link) {
+	pthread_mutex_lock(&a->bw.mutex);
+	unsigned int *counter = ba_adapter_bw_get_link_counter(a, link);
+	if (*counter > 0)
+		(*counter)--;
+	atomic_fetch_add_explicit(&a->bw.generation, 1, memory_order_relaxed);
+	debug("Adapter bandwidth links [%s]: A2DP: %u SCO: %u", a->hci.name,
+			a->bw.a2dp_streams, a->bw.sco_links);
+	pthread_mutex_unlock(&a->bw.mutex);
+}
+
+/**
+ * Get the bitrate budget of a single outgoing A2DP stream.
+ *
+ * The adapter bandwidth available for A2DP streams (configured with the
+ * --a2dp-bandwidth option) is reduced by the share reserved by every active
+ * SCO link, and the rest is divided equally between active A2DP streams.
+ *
+ * @return The budget in bits per second or 0 if the bandwidth is not
+ *   limited. */
+unsigned int ba_adapter_bw_get_a2dp_budget(struct ba_adapter *a) {
+
+	if (config.a2dp.bandwidth == 0)
+		return 0;
+
+	pthread_mutex_lock(&a->bw.mutex);
+	const unsigned int streams = a->bw.a2dp_streams;
+	const unsigned int sco_links = a->bw.sco_links;
+	pthread_mutex_unlock(&a->bw.mutex);
+
+	unsigned int share = 100;
+	if (sco_links * BA_ADAPTER_BW_SCO_SHARE < 100 - BA_ADAPTER_BW_A2DP_MIN_SHARE)
+		share -= sco_links * BA_ADAPTER_BW_SCO_SHARE;
+	else
+		share = BA_ADAPTER_BW_A2DP_MIN_SHARE;
+
+	return 1000ULL * config.a2dp.bandwidth * share / 100 / (streams > 0 ? streams : 1);
+}
+
 int ba_adapter_get_hfp_features_hf(struct ba_adapter *a) {
 	int features = config.hfp.features_rfcomm_hf;
 	if (BA_TEST_ESCO_SUPPORT(a)) {
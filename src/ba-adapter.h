@@ -16,6 +16,7 @@
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include <glib.h>
 
@@ -23,6 +24,26 @@
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
 
+/**
+ * Share of the adapter bandwidth in percent reserved by a single SCO link.
+ *
+ * The eSCO link reserves two slots (one for each direction) every 7.5 ms
+ * and the retransmission window of the same size, which is a third of the
+ * air time. */
+#define BA_ADAPTER_BW_SCO_SHARE 33
+
+/**
+ * Minimal share of the adapter bandwidth in percent left for the
+ * A2DP streams regardless of the number of active SCO links. */
+#define BA_ADAPTER_BW_A2DP_MIN_SHARE 10
+
+/**
+ * Type of the Bluetooth link scheduled by the adapter. */
+enum ba_adapter_bw_link {
+	BA_ADAPTER_BW_LINK_A2DP,
+	BA_ADAPTER_BW_LINK_SCO,
+};
+
 /* Data associated with BT adapter. */
 struct ba_adapter {
 
@@ -30,8 +51,21 @@ struct ba_adapter {
 	struct hci_dev_info hci;
 	struct hci_version chip;
 
-	/* incoming SCO links dispatcher */
-	pthread_t sco_dispatcher;
+	/* main loop source ID of the incoming SCO links dispatcher */
+	unsigned int sco_dispatcher;
+	/* ACL link monitor */
+	struct link_monitor *link_monitor;
+
+	/* Bluetooth bandwidth scheduler */
+	struct {
+		pthread_mutex_t mutex;
+		/* number of active outgoing A2DP streams */
+		unsigned int a2dp_streams;
+		/* number of active SCO links */
+		unsigned int sco_links;
+		/* incremented on every allocation change */
+		atomic_uint generation;
+	} bw;
 
 	/* data for D-Bus management */
 	char ba_dbus_path[32];
@@ -57,6 +91,18 @@ void ba_adapter_unref(struct ba_adapter *a);
 #define BA_TEST_ESCO_SUPPORT(a) \
 	((a)->hci.features[2] & LMP_TRSP_SCO && (a)->hci.features[3] & LMP_ESCO)
 
+void ba_adapter_bw_link_add(struct ba_adapter *a, enum ba_adapter_bw_link link);
+void ba_adapter_bw_link_remove(struct ba_adapter *a, enum ba_adapter_bw_link link);
+unsigned int ba_adapter_bw_get_a2dp_budget(struct ba_adapter *a);
+
+/**
+ * Get the generation of the bandwidth allocation.
+ *
+ * The value changes every time the allocation is updated, so the encoder
+ * can check it cheaply, and query for a new budget only when needed. */
+#define ba_adapter_bw_get_generation(a) \
+	atomic_load_explicit(&(a)->bw.generation, memory_order_relaxed)
+
 int ba_adapter_get_hfp_features_hf(struct ba_adapter *a);
 int ba_adapter_get_hfp_features_ag(struct ba_adapter *a);
 
@@ -20,6 +20,21 @@
 #include "storage.h"
 #include "shared/log.h"
 
+/**
+ * The maximal number of cached codec instances per device. */
+#define BA_DEVICE_CODEC_CACHE_SIZE 4
+
+struct ba_device_codec_cache_entry {
+	void *handle;
+	void (*free)(void *handle);
+};
+
+static void ba_device_codec_cache_entry_free(
+		struct ba_device_codec_cache_entry *entry) {
+	entry->free(entry->handle);
+	free(entry);
+}
+
 struct ba_device *ba_device_new(
 		struct ba_adapter *adapter,
 		const bdaddr_t *addr) {
@@ -43,9 +58,15 @@ struct ba_device *ba_device_new(
 	d->battery.charge = -1;
 	d->battery.health = -1;
 
+	d->link.bitrate_scale = 100;
+
 	pthread_mutex_init(&d->transports_mutex, NULL);
 	d->transports = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, NULL);
 
+	pthread_mutex_init(&d->codec_cache_mutex, NULL);
+	d->codec_cache = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+			(GDestroyNotify)g_bytes_unref, (GDestroyNotify)ba_device_codec_cache_entry_free);
+
 	pthread_mutex_lock(&adapter->devices_mutex);
 	g_hash_table_insert(adapter->devices, &d->addr, d);
 	pthread_mutex_unlock(&adapter->devices_mutex);
@@ -142,7 +163,12 @@ void ba_device_unref(struct ba_device *d) {
 	debug("Freeing device: %s", batostr_(&d->addr));
 	g_assert_cmpint(ref_count, ==, 0);
 
+	debug("Codec cache stats: hits: %u, misses: %u",
+			d->codec_cache_stats.hits, d->codec_cache_stats.misses);
+
 	ba_adapter_unref(a);
+	g_hash_table_unref(d->codec_cache);
+	pthread_mutex_destroy(&d->codec_cache_mutex);
 	g_hash_table_unref(d->transports);
 	pthread_mutex_destroy(&d->transports_mutex);
 	g_free(d->bluez_dbus_path);
@@ -150,3 +176,185 @@ void ba_device_unref(struct ba_device *d) {
 	g_free(d->ba_dbus_path);
 	free(d);
 }
+
+/**
+ * Update the ACL link state of the device.
+ *
+ * The encoder bitrate scale is lowered by a quarter every time the link is
+ * reported as degraded - there were failed contacts since the last update,
+ * the link quality is low or the RSSI is below the golden receive power
+ * range - and it is restored gradually when the link is healthy.
+ *
+ * @param d The BT device.
+ * @param info The link info read from the HCI.
+ * @return This function returns true if the link info has changed. */
+bool ba_device_link_update(
+		struct ba_device *d,
+		const struct hci_link_info *info) {
+
+	const bool degraded = info->failed_contacts > 0 ||
+		info->quality < BA_DEVICE_LINK_QUALITY_LOW ||
+		info->rssi < BA_DEVICE_LINK_RSSI_LOW;
+
+	unsigned int scale = atomic_load_explicit(&d->link.bitrate_scale, memory_order_relaxed);
+	unsigned int new_scale = degraded ? scale * 3 / 4 : scale + 10;
+	new_scale = MIN(MAX(new_scale, BA_DEVICE_LINK_BITRATE_SCALE_MIN), 100);
+
+	if (new_scale != scale) {
+		debug("Link bitrate scale [%s]: %u%%", batostr_(&d->addr), new_scale);
+		atomic_store_explicit(&d->link.bitrate_scale, new_scale, memory_order_relaxed);
+		atomic_fetch_add_explicit(&d->link.generation, 1, memory_order_relaxed);
+	}
+
+	bool changed = false;
+	if (atomic_exchange(&d->link.rssi, info->rssi) != info->rssi)
+		changed = true;
+	if (atomic_exchange(&d->link.quality, info->quality) != info->quality)
+		changed = true;
+	if (atomic_exchange(&d->link.failed_contacts, info->failed_contacts) != info->failed_contacts)
+		changed = true;
+	if (!atomic_exchange(&d->link.valid, true))
+		changed = true;
+
+	return changed;
+}
+
+/**
+ * Reset the ACL link state of the device, e.g. after disconnection. */
+void ba_device_link_reset(
+		struct ba_device *d) {
+	atomic_store_explicit(&d->link.valid, false, memory_order_relaxed);
+	if (atomic_exchange(&d->link.bitrate_scale, 100) != 100)
+		atomic_fetch_add_explicit(&d->link.generation, 1, memory_order_relaxed);
+}
+
+/**
+ * Scale the encoder bitrate according to the ACL link state.
+ *
+ * @param d The BT device.
+ * @param bitrate The bitrate which would be used on a healthy link.
+ * @return The bitrate which should be used on the current link. */
+unsigned int ba_device_link_scale_bitrate(
+		struct ba_device *d,
+		unsigned int bitrate) {
+	const unsigned int scale = atomic_load_explicit(&d->link.bitrate_scale, memory_order_relaxed);
+	return (unsigned long long)bitrate * scale / 100;
+}
+
+/**
+ * Acquire codec instance from the device codec cache.
+ *
+ * If there is no cached instance for the given key, the handle field of
+ * the codec structure will be set to NULL. In such case the caller shall
+ * initialize a new codec instance and store it in the handle field. The
+ * key shall be a fully initialized (including padding) structure which
+ * describes all parameters affecting codec initialization. The key memory
+ * shall be valid until the codec is released.
+ *
+ * @param d The device structure.
+ * @param codec Address of the codec structure. The free field shall be set
+ *   by the caller prior to calling this function.
+ * @param key Codec configuration key.
+ * @param key_size Size of the key. */
+void ba_device_codec_acquire(
+		struct ba_device *d,
+		struct ba_device_codec *codec,
+		const void *key,
+		size_t key_size) {
+
+	codec->d = d;
+	codec->key = key;
+	codec->key_size = key_size;
+	codec->handle = NULL;
+	codec->reusable = false;
+
+	GBytes *bytes = g_bytes_new_static(key, key_size);
+	struct ba_device_codec_cache_entry *entry = NULL;
+	GBytes *cached_key = NULL;
+
+	pthread_mutex_lock(&d->codec_cache_mutex);
+
+	if (g_hash_table_lookup_extended(d->codec_cache, bytes,
+				(gpointer)&cached_key, (gpointer)&entry)) {
+		/* take the instance out of the cache without freeing it */
+		g_hash_table_steal(d->codec_cache, bytes);
+		codec->handle = entry->handle;
+		d->codec_cache_stats.hits++;
+	}
+	else
+		d->codec_cache_stats.misses++;
+
+	debug("Codec cache %s: %s [hits: %u, misses: %u]",
+			codec->handle != NULL ? "hit" : "miss", batostr_(&d->addr),
+			d->codec_cache_stats.hits, d->codec_cache_stats.misses);
+
+	pthread_mutex_unlock(&d->codec_cache_mutex);
+
+	if (entry != NULL) {
+		g_bytes_unref(cached_key);
+		free(entry);
+	}
+
+	g_bytes_unref(bytes);
+
+}
+
+/**
+ * Release codec instance.
+ *
+ * If the codec instance was marked as reusable, it will be returned to the
+ * device codec cache, otherwise it will be freed. This function can be used
+ * as a pthread cleanup handler. */
+void ba_device_codec_release(
+		struct ba_device_codec *codec) {
+
+	if (codec->handle == NULL)
+		return;
+
+	struct ba_device_codec_cache_entry *entry = NULL;
+	struct ba_device *d = codec->d;
+
+	if (!codec->reusable ||
+			(entry = malloc(sizeof(*entry))) == NULL) {
+		codec->free(codec->handle);
+		codec->handle = NULL;
+		return;
+	}
+
+	entry->handle = codec->handle;
+	entry->free = codec->free;
+	codec->handle = NULL;
+
+	pthread_mutex_lock(&d->codec_cache_mutex);
+
+	/* Make room for the new entry. Since the number of cached instances is
+	 * very small, we will simply drop an arbitrary one. */
+	if (g_hash_table_size(d->codec_cache) >= BA_DEVICE_CODEC_CACHE_SIZE) {
+		GHashTableIter iter;
+		g_hash_table_iter_init(&iter, d->codec_cache);
+		if (g_hash_table_iter_next(&iter, NULL, NULL))
+			g_hash_table_iter_remove(&iter);
+	}
+
+	g_hash_table_replace(d->codec_cache,
+			g_bytes_new(codec->key, codec->key_size), entry);
+
+	pthread_mutex_unlock(&d->codec_cache_mutex);
+
+}
+
+/**
+ * Get the number of codec cache hits and misses.
+ *
+ * @param d Pointer to the device structure.
+ * @param hits Address where the number of cache hits will be stored.
+ * @param misses Address where the number of cache misses will be stored. */
+void ba_device_codec_cache_get_stats(
+		struct ba_device *d,
+		unsigned int *hits,
+		unsigned int *misses) {
+	pthread_mutex_lock(&d->codec_cache_mutex);
+	*hits = d->codec_cache_stats.hits;
+	*misses = d->codec_cache_stats.misses;
+	pthread_mutex_unlock(&d->codec_cache_mutex);
+}
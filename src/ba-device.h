@@ -17,12 +17,29 @@
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <bluetooth/bluetooth.h>
 #include <glib.h>
 
 #include "ba-adapter.h"
+#include "hci.h"
+
+/**
+ * Link quality below which the ACL link is considered degraded. */
+#define BA_DEVICE_LINK_QUALITY_LOW 192
+
+/**
+ * RSSI in dB below the golden receive power range, at which the ACL link
+ * is considered degraded. */
+#define BA_DEVICE_LINK_RSSI_LOW -10
+
+/**
+ * The lowest encoder bitrate scale in percent applied on degraded link. */
+#define BA_DEVICE_LINK_BITRATE_SCALE_MIN 40
 
 struct ba_device {
 
@@ -61,6 +78,20 @@ struct ba_device {
 
 	} xapl;
 
+	/* ACL link state reported by the HCI link monitor */
+	struct {
+		atomic_bool valid;
+		atomic_int rssi;
+		atomic_uint quality;
+		atomic_uint failed_contacts;
+		/* Encoder bitrate scale in percent. It is lowered as soon as the
+		 * link degrades and it is restored gradually when the link is
+		 * healthy again. */
+		atomic_uint bitrate_scale;
+		/* incremented on every bitrate scale change */
+		atomic_uint generation;
+	} link;
+
 	/* read-only list of available SEPs */
 	const GArray *seps;
 
@@ -68,6 +99,14 @@ struct ba_device {
 	pthread_mutex_t transports_mutex;
 	GHashTable *transports;
 
+	/* cache of initialized codec instances */
+	pthread_mutex_t codec_cache_mutex;
+	GHashTable *codec_cache;
+	struct {
+		unsigned int hits;
+		unsigned int misses;
+	} codec_cache_stats;
+
 	/* memory self-management */
 	int ref_count;
 
@@ -86,4 +125,46 @@ struct ba_device *ba_device_ref(
 void ba_device_destroy(struct ba_device *d);
 void ba_device_unref(struct ba_device *d);
 
+bool ba_device_link_update(
+		struct ba_device *d,
+		const struct hci_link_info *info);
+void ba_device_link_reset(
+		struct ba_device *d);
+unsigned int ba_device_link_scale_bitrate(
+		struct ba_device *d,
+		unsigned int bitrate);
+
+/**
+ * Get the generation of the link bitrate scale. */
+#define ba_device_link_get_generation(d) \
+	atomic_load_explicit(&(d)->link.generation, memory_order_relaxed)
+
+/**
+ * Codec instance borrowed from the device codec cache. */
+struct ba_device_codec {
+	struct ba_device *d;
+	/* codec configuration used as a cache key */
+	const void *key;
+	size_t key_size;
+	/* initialized codec instance or NULL */
+	void *handle;
+	/* function used to free the codec instance */
+	void (*free)(void *handle);
+	/* instance can be returned to the cache */
+	bool reusable;
+};
+
+void ba_device_codec_acquire(
+		struct ba_device *d,
+		struct ba_device_codec *codec,
+		const void *key,
+		size_t key_size);
+void ba_device_codec_release(
+		struct ba_device_codec *codec);
+
+void ba_device_codec_cache_get_stats(
+		struct ba_device *d,
+		unsigned int *hits,
+		unsigned int *misses);
+
 #endif
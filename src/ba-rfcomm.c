@@ -28,6 +28,7 @@
 #include "bluealsa-config.h"
 #include "bluealsa-dbus.h"
 #include "bluez.h"
+#include "thread-policy.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/log.h"
@@ -544,6 +545,11 @@ static int rfcomm_handler_bac_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 		case HFP_CODEC_MSBC:
 				r->codecs.msbc = true;
 			break;
+#endif
+#if ENABLE_LC3_SWB
+		case HFP_CODEC_LC3_SWB:
+				r->codecs.lc3_swb = true;
+			break;
 #endif
 		}
 	} while ((tmp = strchr(tmp, ',')) != NULL);
@@ -1015,6 +1021,8 @@ static void rfcomm_thread_cleanup(struct ba_rfcomm *r) {
 
 static void *rfcomm_thread(struct ba_rfcomm *r) {
 
+	thread_policy_apply(THREAD_CLASS_RFCOMM);
+
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 	pthread_cleanup_push(PTHREAD_CLEANUP(rfcomm_thread_cleanup), r);
 
@@ -1085,6 +1093,10 @@ static void *rfcomm_thread(struct ba_rfcomm *r) {
 #if ENABLE_MSBC
 						if (config.hfp.codecs.msbc && BA_TEST_ESCO_SUPPORT(t_sco->d->a))
 							ptr += sprintf(ptr, "%s%u", ptr != tmp ? "," : "", HFP_CODEC_MSBC);
+#endif
+#if ENABLE_LC3_SWB
+						if (config.hfp.codecs.lc3_swb && BA_TEST_ESCO_SUPPORT(t_sco->d->a))
+							ptr += sprintf(ptr, "%s%u", ptr != tmp ? "," : "", HFP_CODEC_LC3_SWB);
 #endif
 						/* advertise which HFP codecs we are supporting */
 						if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_SET, "+BAC", tmp) == -1)
@@ -1217,6 +1229,9 @@ static void *rfcomm_thread(struct ba_rfcomm *r) {
 					uint16_t codec_id;
 					bool is_supported;
 				} codecs[] = {
+#if ENABLE_LC3_SWB
+					{ HFP_CODEC_LC3_SWB, config.hfp.codecs.lc3_swb && r->codecs.lc3_swb },
+#endif
 					{ HFP_CODEC_MSBC, config.hfp.codecs.msbc && r->codecs.msbc },
 					{ HFP_CODEC_CVSD, config.hfp.codecs.cvsd && r->codecs.cvsd },
 				};
@@ -1279,6 +1294,13 @@ process:
 						rfcomm_set_hfp_codec(r, HFP_CODEC_MSBC) == -1)
 					goto ioerror;
 				break;
+#endif
+#if ENABLE_LC3_SWB
+			case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_LC3_SWB:
+				if (config.hfp.codecs.lc3_swb &&
+						rfcomm_set_hfp_codec(r, HFP_CODEC_LC3_SWB) == -1)
+					goto ioerror;
+				break;
 #endif
 			case BA_RFCOMM_SIGNAL_UPDATE_BATTERY:
 				if (rfcomm_notify_battery_level_change(r) == -1)
@@ -35,6 +35,7 @@ enum ba_rfcomm_signal {
 	BA_RFCOMM_SIGNAL_PING,
 	BA_RFCOMM_SIGNAL_HFP_SET_CODEC_CVSD,
 	BA_RFCOMM_SIGNAL_HFP_SET_CODEC_MSBC,
+	BA_RFCOMM_SIGNAL_HFP_SET_CODEC_LC3_SWB,
 	BA_RFCOMM_SIGNAL_UPDATE_BATTERY,
 	BA_RFCOMM_SIGNAL_UPDATE_VOLUME,
 };
@@ -83,6 +84,9 @@ struct ba_rfcomm {
 		bool cvsd;
 #if ENABLE_MSBC
 		bool msbc;
+#endif
+#if ENABLE_LC3_SWB
+		bool lc3_swb;
 #endif
 	} codecs;
 
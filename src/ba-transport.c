@@ -11,13 +11,16 @@
 #include "ba-transport.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <math.h>
 #include <poll.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
@@ -49,11 +52,30 @@
 #include "hfp.h"
 #include "sco.h"
 #include "storage.h"
+#include "thread-policy.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/trace.h"
+
+/**
+ * Time given to the transport thread for cooperative termination.
+ *
+ * Transport IO threads check the stop request whenever they poll for data,
+ * so under normal circumstances they terminate within one frame period. If
+ * the thread does not exit in time, it is canceled asynchronously. */
+#define BA_TRANSPORT_THREAD_STOP_TIMEOUT_MS 200
+
+/**
+ * Maximal time of the PCM drain.
+ *
+ * If the BT socket output queue is not flushed within this time (e.g. the
+ * remote device stopped receiving data), the drain is treated as completed,
+ * so the client will not wait forever. */
+#define BA_TRANSPORT_PCM_DRAIN_TIMEOUT_MS 2000
 
 static const char *transport_get_dbus_path_type(
 		struct ba_transport_type type) {
@@ -94,8 +116,6 @@ static int transport_pcm_init(
 	ba_transport_pcm_volume_set(&pcm->volume[1], NULL, NULL, NULL);
 
 	pthread_mutex_init(&pcm->mutex, NULL);
-	pthread_mutex_init(&pcm->synced_mtx, NULL);
-	pthread_cond_init(&pcm->synced, NULL);
 
 	pcm->ba_dbus_path = g_strdup_printf("%s/%s/%s",
 			t->d->ba_dbus_path, transport_get_dbus_path_type(t->type),
@@ -112,8 +132,6 @@ static void transport_pcm_free(
 	pthread_mutex_unlock(&pcm->mutex);
 
 	pthread_mutex_destroy(&pcm->mutex);
-	pthread_mutex_destroy(&pcm->synced_mtx);
-	pthread_cond_destroy(&pcm->synced);
 
 	if (pcm->ba_dbus_path != NULL)
 		g_free(pcm->ba_dbus_path);
@@ -162,13 +180,19 @@ static int transport_thread_init(
 	th->bt_fd = -1;
 	th->pipe[0] = -1;
 	th->pipe[1] = -1;
+	th->stop_fd = -1;
+	th->worker.running = false;
+	th->worker.routine = NULL;
 
 	pthread_mutex_init(&th->mutex, NULL);
 	pthread_mutex_init(&th->state_mtx, NULL);
 	pthread_cond_init(&th->changed, NULL);
+	pthread_cond_init(&th->worker.changed, NULL);
 
 	if (pipe(th->pipe) == -1)
 		return -1;
+	if ((th->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		return -1;
 
 	return 0;
 }
@@ -180,11 +204,20 @@ static int transport_thread_init(
  * synchronous cancellation (cancel + join). */
 static void transport_thread_cancel_prepare(struct ba_transport_thread *th) {
 	ba_transport_thread_set_state_stopping(th);
+	/* Request cooperative termination. The IO thread will exit as soon as
+	 * it reaches the next poll, which is much cheaper than the cancellation
+	 * via the asynchronous signal delivery. */
+	if (th->stop_fd != -1)
+		eventfd_write(th->stop_fd, 1);
 }
 
 /**
  * Synchronous transport thread cancellation.
  *
+ * This function waits for the thread to terminate after the stop request
+ * sent by the transport_thread_cancel_prepare(). If the thread does not
+ * terminate within BA_TRANSPORT_THREAD_STOP_TIMEOUT_MS, it is canceled.
+ *
  * Please be aware that when using this function caller shall not hold
  * any mutex which might be used in the IO thread. Mutex locking is not
  * a cancellation point, so the IO thread might get stuck - it will not
@@ -198,10 +231,36 @@ static void transport_thread_cancel(struct ba_transport_thread *th) {
 	if (pthread_equal(id, config.main_thread))
 		goto skip;
 
-	int err;
-	if ((err = pthread_cancel(id)) != 0 && err != ESRCH)
-		warn("Couldn't cancel transport thread: %s", strerror(err));
-	if ((err = pthread_join(id, NULL)) != 0)
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += BA_TRANSPORT_THREAD_STOP_TIMEOUT_MS * 1000000L;
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+
+	int err = 0;
+	/* Give the thread a chance to terminate cooperatively. If the stop
+	 * request was not sent, or the thread is stuck outside of the poll,
+	 * fall back to the pthread cancellation. */
+	if (th->worker.running && pthread_equal(id, th->worker.id)) {
+		/* The parked worker does not terminate - it only returns from the
+		 * IO routine and resets the thread ID by itself. */
+		while (!pthread_equal(th->id, config.main_thread) && err != ETIMEDOUT)
+			err = pthread_cond_timedwait(&th->worker.changed, &th->mutex, &ts);
+		if (pthread_equal(th->id, config.main_thread))
+			goto skip;
+		th->worker.running = false;
+		err = ETIMEDOUT;
+	}
+	else
+		err = pthread_timedjoin_np(id, NULL, &ts);
+
+	if (err == ETIMEDOUT) {
+		debug("Transport thread did not stop in time: Canceling");
+		if ((err = pthread_cancel(id)) != 0 && err != ESRCH)
+			warn("Couldn't cancel transport thread: %s", strerror(err));
+		err = pthread_join(id, NULL);
+	}
+	if (err != 0)
 		warn("Couldn't join transport thread: %s", strerror(err));
 
 	/* Indicate that the thread has been successfully terminated. Also,
@@ -223,6 +282,133 @@ static void transport_thread_cancel_wait(struct ba_transport_thread *th) {
 	pthread_mutex_unlock(&th->mutex);
 }
 
+/**
+ * Get the scheduling class of the transport thread. */
+static enum thread_class transport_thread_class(const struct ba_transport_thread *th) {
+	return th == &th->t->thread_enc ? THREAD_CLASS_ENCODER : THREAD_CLASS_DECODER;
+}
+
+/**
+ * Transport thread entry point.
+ *
+ * It applies the scheduling policy of the thread class before running
+ * the IO routine assigned by the ba_transport_thread_create() function. */
+static void *transport_thread_run(struct ba_transport_thread *th) {
+	thread_policy_apply(transport_thread_class(th));
+	thread_stats_start(&th->stats);
+	void *ret = th->routine(th);
+	thread_stats_update_cpu(&th->stats);
+	return ret;
+}
+
+/**
+ * Persistent transport thread worker.
+ *
+ * The worker waits (parked) for the IO routine assigned by the function
+ * ba_transport_thread_create() and runs it. When the routine returns, the
+ * worker parks again, so the same system thread can be reused for the next
+ * stream - also with a different codec. */
+static void *transport_thread_worker(struct ba_transport_thread *th) {
+
+	thread_policy_apply(transport_thread_class(th));
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_mutex_lock(&th->mutex);
+
+	for (;;) {
+
+		while (th->worker.routine == NULL && !th->worker.terminate)
+			pthread_cond_wait(&th->worker.changed, &th->mutex);
+		if (th->worker.terminate)
+			break;
+
+		void *(*routine)(struct ba_transport_thread *) = th->worker.routine;
+		pthread_mutex_unlock(&th->mutex);
+
+		thread_stats_start(&th->stats);
+		routine(th);
+		thread_stats_update_cpu(&th->stats);
+
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_mutex_lock(&th->mutex);
+
+		/* Indicate that the IO routine has finished. From now on, this
+		 * worker is parked until new routine is assigned. */
+		th->worker.routine = NULL;
+		th->id = config.main_thread;
+		pthread_cond_broadcast(&th->worker.changed);
+		pthread_cond_broadcast(&th->changed);
+
+	}
+
+	pthread_mutex_unlock(&th->mutex);
+	return NULL;
+}
+
+/**
+ * Run IO routine on the persistent worker thread.
+ *
+ * If the worker is not running, it is created. Otherwise, the parked worker
+ * is woken up. Upon success, the thread ID is set to the worker ID. */
+static int transport_thread_worker_run(
+		struct ba_transport_thread *th,
+		void *(*routine)(struct ba_transport_thread *),
+		const char *name) {
+
+	int ret = 0;
+
+	pthread_mutex_lock(&th->mutex);
+
+	if (!th->worker.running) {
+		th->worker.terminate = false;
+		if ((ret = pthread_create(&th->worker.id, NULL,
+						PTHREAD_ROUTINE(transport_thread_worker), th)) != 0)
+			goto final;
+		th->worker.running = true;
+	}
+	else
+		debug("Reusing parked IO thread: %s", name);
+
+	/* Set the thread name before the routine is started, so
+	 * the routine can use it (e.g. in debug messages). */
+	pthread_setname_np(th->worker.id, name);
+
+	th->id = th->worker.id;
+	th->worker.routine = routine;
+	pthread_cond_broadcast(&th->worker.changed);
+
+final:
+	pthread_mutex_unlock(&th->mutex);
+	return ret;
+}
+
+/**
+ * Terminate parked transport thread worker.
+ *
+ * This function shall be called after the IO routine has been stopped. */
+static void transport_thread_worker_terminate(
+		struct ba_transport_thread *th) {
+
+	pthread_mutex_lock(&th->mutex);
+
+	if (!th->worker.running) {
+		pthread_mutex_unlock(&th->mutex);
+		return;
+	}
+
+	pthread_t id = th->worker.id;
+	th->worker.running = false;
+	th->worker.terminate = true;
+	pthread_cond_broadcast(&th->worker.changed);
+
+	pthread_mutex_unlock(&th->mutex);
+
+	int err;
+	if ((err = pthread_join(id, NULL)) != 0)
+		warn("Couldn't join IO thread worker: %s", strerror(err));
+
+}
+
 /**
  * Release transport thread resources. */
 static void transport_thread_free(
@@ -233,9 +419,31 @@ static void transport_thread_free(
 		close(th->pipe[0]);
 	if (th->pipe[1] != -1)
 		close(th->pipe[1]);
+	if (th->stop_fd != -1)
+		close(th->stop_fd);
 	pthread_mutex_destroy(&th->mutex);
 	pthread_mutex_destroy(&th->state_mtx);
 	pthread_cond_destroy(&th->changed);
+	pthread_cond_destroy(&th->worker.changed);
+}
+
+/**
+ * Update the adapter bandwidth scheduler with the transport link state. */
+static void transport_bw_link_update(struct ba_transport *t, bool active) {
+
+	enum ba_adapter_bw_link link;
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+		link = BA_ADAPTER_BW_LINK_A2DP;
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO)
+		link = BA_ADAPTER_BW_LINK_SCO;
+	else
+		return;
+
+	if (active)
+		ba_adapter_bw_link_add(t->d->a, link);
+	else
+		ba_adapter_bw_link_remove(t->d->a, link);
+
 }
 
 int ba_transport_thread_set_state(
@@ -256,6 +464,13 @@ int ba_transport_thread_set_state(
 			goto skip;
 	}
 
+	/* The link is considered active by the adapter bandwidth
+	 * scheduler as long as the master IO thread is running. */
+	const bool running = state == BA_TRANSPORT_THREAD_STATE_RUNNING;
+	if (th->master && running != (th->state == BA_TRANSPORT_THREAD_STATE_RUNNING))
+		transport_bw_link_update(th->t, running);
+
+	trace(thread_state, th, th->state, state);
 	th->state = state;
 	pthread_cond_signal(&th->changed);
 
@@ -409,6 +624,37 @@ final:
 
 }
 
+/**
+ * Hand over incoming SCO link to the transport and start IO threads.
+ *
+ * This function is called by the thread manager, because stopping IO
+ * threads and taking the BT lock might block for a considerable amount
+ * of time. */
+static void transport_sco_link_start(struct ba_transport *t) {
+
+	const struct ba_adapter *a = t->d->a;
+	int fd;
+
+	if ((fd = atomic_exchange(&t->sco.link_fd, -1)) == -1)
+		return;
+
+	debug("Starting SCO link: %s: %d", batostr_(&t->d->addr), fd);
+
+	transport_threads_cancel(t);
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+
+	t->bt_fd = fd;
+	t->mtu_read = t->mtu_write = hci_sco_get_mtu(fd, a->hci.type);
+	if (hci_sco_enable_pkt_status(fd) == -1)
+		debug("Couldn't enable SCO packet status: %s", strerror(errno));
+
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	ba_transport_start(t);
+
+}
+
 /**
  * Transport thread manager.
  *
@@ -416,6 +662,7 @@ final:
 static void *transport_thread_manager(struct ba_transport *t) {
 
 	pthread_setname_np(pthread_self(), "ba-th-manager");
+	thread_policy_apply(THREAD_CLASS_MANAGER);
 
 	struct pollfd fds[] = {
 		{ t->thread_manager_pipe[0], POLLIN, 0 }};
@@ -448,6 +695,10 @@ static void *transport_thread_manager(struct ba_transport *t) {
 				debug("PCM clients check keep-alive: %d ms", config.keep_alive_time);
 				timeout = config.keep_alive_time;
 				break;
+			case BA_TRANSPORT_THREAD_MANAGER_SCO_LINK_START:
+				transport_sco_link_start(t);
+				timeout = -1;
+				break;
 			}
 
 		}
@@ -496,6 +747,7 @@ static struct ba_transport *transport_new(
 	pthread_cond_init(&t->stopped, NULL);
 
 	t->bt_fd = -1;
+	t->bt_sndbuf_latency = -1;
 
 	t->thread_manager_thread_id = config.main_thread;
 	t->thread_manager_pipe[0] = -1;
@@ -533,6 +785,64 @@ fail:
 	return NULL;
 }
 
+/**
+ * Get nominal bitrate of the BT socket stream in bits per second. */
+static unsigned int transport_get_bt_bitrate(const struct ba_transport *t) {
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
+		return atomic_load_explicit(&t->a2dp.bitrate, memory_order_relaxed);
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO)
+		/* CVSD is transmitted as 16-bit PCM at 8 kHz, while mSBC and LC3-SWB
+		 * use 60 bytes eSCO packets every 7.5 ms. */
+		return t->type.codec == HFP_CODEC_CVSD ? 128000 : 64000;
+	return 0;
+}
+
+/**
+ * Set BT socket output buffer size.
+ *
+ * The buffer size is derived from the latency target and the nominal bitrate
+ * of the stream. If the latency target is not set, A2DP socket buffer is set
+ * to the tripled write MTU, and SCO socket buffer is left intact.
+ *
+ * Note:
+ * This function shall be called with the bt_fd_mtx mutex locked. */
+static void transport_bt_sndbuf_apply(struct ba_transport *t) {
+
+	const unsigned int latency = ba_transport_get_bt_sndbuf_latency(t);
+	const unsigned int bitrate = transport_get_bt_bitrate(t);
+	const bool is_a2dp = t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP;
+	int size;
+
+	if (t->bt_fd == -1)
+		return;
+
+	if (latency != 0 && bitrate != 0)
+		size = MAX(1ULL * bitrate * latency / 8000, t->mtu_write);
+	else if (is_a2dp)
+		/* Minimize audio delay and increase responsiveness (seeking, stopping)
+		 * by decreasing the BT socket output buffer. We will use a tripled write
+		 * MTU value, in order to prevent tearing due to temporal heavy load. */
+		size = t->mtu_write * 3;
+	else
+		return;
+
+	if (setsockopt(t->bt_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == -1)
+		warn("Couldn't set socket output buffer size: %s", strerror(errno));
+
+	if (is_a2dp) {
+		/* The ioctl(TIOCOUTQ) on the empty BT socket reports the size of
+		 * the output buffer. However, the queue might not be empty when the
+		 * buffer is resized during streaming, so get the size directly. */
+		socklen_t len = sizeof(t->a2dp.bt_fd_coutq_init);
+		if (getsockopt(t->bt_fd, SOL_SOCKET, SO_SNDBUF, &t->a2dp.bt_fd_coutq_init, &len) == -1)
+			warn("Couldn't get socket output buffer size: %s", strerror(errno));
+	}
+
+	debug("BT socket output buffer: %d: %d bytes (latency: %u ms, bitrate: %u)",
+			t->bt_fd, size, latency, bitrate);
+
+}
+
 static int transport_acquire_bt_a2dp(struct ba_transport *t) {
 
 	GDBusMessage *msg, *rep;
@@ -564,15 +874,10 @@ static int transport_acquire_bt_a2dp(struct ba_transport *t) {
 	fd = g_unix_fd_list_get(fd_list, 0, &err);
 	t->bt_fd = fd;
 
-	/* Minimize audio delay and increase responsiveness (seeking, stopping) by
-	 * decreasing the BT socket output buffer. We will use a tripled write MTU
-	 * value, in order to prevent tearing due to temporal heavy load. */
-	size_t size = t->mtu_write * 3;
-	if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == -1)
-		warn("Couldn't set socket output buffer size: %s", strerror(errno));
-
-	if (ioctl(fd, TIOCOUTQ, &t->a2dp.bt_fd_coutq_init) == -1)
-		warn("Couldn't get socket queued bytes: %s", strerror(errno));
+	/* The nominal bitrate will be set by the encoder, so at this point
+	 * the output buffer is sized with the fallback value. */
+	atomic_store_explicit(&t->a2dp.bitrate, 0, memory_order_relaxed);
+	transport_bt_sndbuf_apply(t);
 
 	debug("New A2DP transport: %d", fd);
 	debug("A2DP socket MTU: %d: R:%u W:%u", fd, mtu_read, mtu_write);
@@ -728,6 +1033,9 @@ static int transport_acquire_bt_sco(struct ba_transport *t) {
 	t->mtu_read = t->mtu_write = hci_sco_get_mtu(fd, d->a->hci.type);
 	t->bt_fd = fd;
 
+	if (hci_sco_enable_pkt_status(fd) == -1)
+		debug("Couldn't enable SCO packet status: %s", strerror(errno));
+
 	return fd;
 
 fail:
@@ -777,8 +1085,16 @@ struct ba_transport *ba_transport_new_sco(
 	type.codec = HFP_CODEC_CVSD;
 #endif
 
+#if ENABLE_MSBC
+	if (sco_aec_init(&t->sco.aec, &t->sco.clock, config.hfp.aec) == -1)
+		goto fail;
+#endif
+
+	t->sco.link_fd = -1;
 	t->type.profile = type.profile;
 
+	sco_clock_init(&t->sco.clock);
+
 	transport_pcm_init(&t->sco.spk_pcm, &t->thread_enc, BA_TRANSPORT_PCM_MODE_SINK);
 	t->sco.spk_pcm.max_bt_volume = 15;
 
@@ -854,6 +1170,8 @@ void ba_transport_destroy(struct ba_transport *t) {
 
 	/* stop transport IO threads */
 	ba_transport_stop(t);
+	transport_thread_worker_terminate(&t->thread_enc);
+	transport_thread_worker_terminate(&t->thread_dec);
 
 	ba_transport_pcms_lock(t);
 
@@ -915,6 +1233,10 @@ void ba_transport_unref(struct ba_transport *t) {
 			ba_rfcomm_destroy(t->sco.rfcomm);
 		transport_pcm_free(&t->sco.spk_pcm);
 		transport_pcm_free(&t->sco.mic_pcm);
+		sco_clock_free(&t->sco.clock);
+#if ENABLE_MSBC
+		sco_aec_free(&t->sco.aec);
+#endif
 	}
 
 	if (!pthread_equal(t->thread_manager_thread_id, config.main_thread)) {
@@ -922,6 +1244,11 @@ void ba_transport_unref(struct ba_transport *t) {
 		pthread_join(t->thread_manager_thread_id, NULL);
 	}
 
+	/* close SCO link which was not taken by the thread manager */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
+			t->sco.link_fd != -1)
+		close(t->sco.link_fd);
+
 	transport_thread_free(&t->thread_enc);
 	transport_thread_free(&t->thread_dec);
 
@@ -1044,6 +1371,11 @@ int ba_transport_select_codec_sco(
 		case HFP_CODEC_MSBC:
 			rfcomm_signal = BA_RFCOMM_SIGNAL_HFP_SET_CODEC_MSBC;
 			break;
+#if ENABLE_LC3_SWB
+		case HFP_CODEC_LC3_SWB:
+			rfcomm_signal = BA_RFCOMM_SIGNAL_HFP_SET_CODEC_LC3_SWB;
+			break;
+#endif
 		default:
 			g_assert_not_reached();
 		}
@@ -1159,6 +1491,12 @@ static void ba_transport_set_codec_sco(struct ba_transport *t) {
 		t->sco.spk_pcm.sampling = 16000;
 		t->sco.mic_pcm.sampling = 16000;
 		break;
+#endif
+#if ENABLE_LC3_SWB
+	case HFP_CODEC_LC3_SWB:
+		t->sco.spk_pcm.sampling = 32000;
+		t->sco.mic_pcm.sampling = 32000;
+		break;
 #endif
 	default:
 		debug("Unsupported SCO codec: %#x", codec_id);
@@ -1202,6 +1540,12 @@ int ba_transport_start(struct ba_transport *t) {
 
 	debug("Starting transport: %s", ba_transport_type_to_string(t->type));
 
+	if (ba_transport_get_bt_sndbuf_latency(t) != 0) {
+		pthread_mutex_lock(&t->bt_fd_mtx);
+		transport_bt_sndbuf_apply(t);
+		pthread_mutex_unlock(&t->bt_fd_mtx);
+	}
+
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
 		switch (t->type.codec) {
 		case A2DP_CODEC_SBC:
@@ -1269,6 +1613,24 @@ int ba_transport_stop_if_no_clients(struct ba_transport *t) {
 	return 0;
 }
 
+/**
+ * Hand over connected SCO link to the transport.
+ *
+ * The transport IO threads are restarted by the thread manager, so this
+ * function does not block and it is safe to call it from the main loop.
+ * The ownership of the SCO link file descriptor is transferred to the
+ * transport, regardless of the returned value. */
+int ba_transport_sco_link_start(struct ba_transport *t, int fd) {
+
+	/* In case when the previous link has not been taken by the thread
+	 * manager yet, replace it with the new one, which supersedes it. */
+	int fd_prev;
+	if ((fd_prev = atomic_exchange(&t->sco.link_fd, fd)) != -1)
+		close(fd_prev);
+
+	return transport_thread_manager_send_command(t, BA_TRANSPORT_THREAD_MANAGER_SCO_LINK_START);
+}
+
 int ba_transport_acquire(struct ba_transport *t) {
 
 	int fd = -1;
@@ -1291,6 +1653,8 @@ int ba_transport_acquire(struct ba_transport *t) {
 	fd = t->acquire(t);
 
 final:
+	if (fd != -1)
+		gettimestamp(&t->acquire_ts);
 	pthread_mutex_unlock(&t->bt_fd_mtx);
 
 	/* For SCO profiles we can start transport IO threads right away. There
@@ -1324,6 +1688,7 @@ final:
 int ba_transport_set_a2dp_state(
 		struct ba_transport *t,
 		enum bluez_a2dp_transport_state state) {
+	trace(a2dp_state, t, t->a2dp.state, state);
 	switch (t->a2dp.state = state) {
 	case BLUEZ_A2DP_TRANSPORT_STATE_PENDING:
 		/* When transport is marked as pending, try to acquire transport, but only
@@ -1340,6 +1705,88 @@ int ba_transport_set_a2dp_state(
 	}
 }
 
+/**
+ * Get BT socket output buffer latency target.
+ *
+ * @param t Transport structure.
+ * @return The latency target in milliseconds. Zero means that the default
+ *   buffer size is used. */
+unsigned int ba_transport_get_bt_sndbuf_latency(const struct ba_transport *t) {
+
+	const int latency = atomic_load_explicit(&t->bt_sndbuf_latency, memory_order_relaxed);
+	if (latency >= 0)
+		return latency;
+
+	const bool sco = t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO;
+	if (!sco && !(t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP))
+		return 0;
+
+	unsigned int value = 0;
+	for (size_t i = 0; i < config.sndbuf_latency_len; i++) {
+		const struct ba_config_sndbuf_latency *entry = &config.sndbuf_latency[i];
+		if (entry->sco != sco)
+			continue;
+		if (entry->codec_id == t->type.codec)
+			return entry->latency;
+		if (entry->codec_id == 0xFFFF)
+			value = entry->latency;
+	}
+
+	return value;
+}
+
+/**
+ * Set BT socket output buffer latency target.
+ *
+ * The new target overrides the value configured for the transport profile
+ * and codec, and it is applied immediately if the transport is acquired. */
+void ba_transport_set_bt_sndbuf_latency(
+		struct ba_transport *t,
+		unsigned int latency) {
+	atomic_store_explicit(&t->bt_sndbuf_latency, MIN(latency, INT_MAX), memory_order_relaxed);
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	transport_bt_sndbuf_apply(t);
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+}
+
+/**
+ * Get BT socket output buffer size.
+ *
+ * @return On success this function returns the size of the output buffer
+ *   reported by the kernel. If the transport is not acquired, -1 is returned
+ *   and errno is set to ENOTCONN. */
+int ba_transport_get_bt_sndbuf_size(struct ba_transport *t) {
+
+	socklen_t len = sizeof(int);
+	int size = -1;
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	if (t->bt_fd == -1)
+		errno = ENOTCONN;
+	else if (getsockopt(t->bt_fd, SOL_SOCKET, SO_SNDBUF, &size, &len) == -1)
+		size = -1;
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	return size;
+}
+
+/**
+ * Set nominal bitrate of the A2DP encoded stream.
+ *
+ * This function shall be called by the A2DP encoder whenever the bitrate
+ * changes, so the BT socket output buffer can be resized accordingly. */
+void ba_transport_set_a2dp_bitrate(
+		struct ba_transport *t,
+		unsigned int bitrate) {
+	if (atomic_exchange_explicit(&t->a2dp.bitrate, bitrate, memory_order_relaxed) == bitrate)
+		return;
+	if (ba_transport_get_bt_sndbuf_latency(t) == 0)
+		return;
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	transport_bt_sndbuf_apply(t);
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+}
+
 bool ba_transport_pcm_is_active(struct ba_transport_pcm *pcm) {
 	return pcm->fd != -1 && pcm->active;
 }
@@ -1439,30 +1886,102 @@ int ba_transport_pcm_resume(struct ba_transport_pcm *pcm) {
 	return 0;
 }
 
+/**
+ * Start asynchronous PCM drain.
+ *
+ * This function does not block. The progress of the drain shall be checked
+ * with the ba_transport_pcm_drain_check() function.
+ *
+ * @return On success this function returns 0. Otherwise -1 is returned and
+ *   errno is set to indicate the error. */
 int ba_transport_pcm_drain(struct ba_transport_pcm *pcm) {
 
 	if (pthread_equal(pcm->th->id, config.main_thread))
 		return errno = ESRCH, -1;
 
-	pthread_mutex_lock(&pcm->synced_mtx);
+	atomic_store(&pcm->drain.synced, false);
+	gettimestamp(&pcm->drain.ts_start);
+	pcm->drain.ts_flushed = (struct timespec){ 0 };
+
+	if (ba_transport_thread_signal_send(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC) == -1)
+		return -1;
+
+	debug("PCM drain started: %d", pcm->fd);
+	return 0;
+}
+
+/**
+ * Check the progress of the asynchronous PCM drain.
+ *
+ * The drain is completed when the IO thread has consumed all data from the
+ * PCM FIFO, the encoder pipeline queue and the BT socket output queue are
+ * empty and the audio buffered by
+ * the remote device (estimated with the delay reported by the sink) has
+ * been played out.
+ *
+ * @return This function returns 1 when the drain is completed, 0 when it
+ *   is still in progress. */
+int ba_transport_pcm_drain_check(struct ba_transport_pcm *pcm) {
+
+	struct ba_transport *t = pcm->t;
+	struct timespec ts;
+	unsigned int usec;
+
+	gettimestamp(&ts);
+	timespecsub(&ts, &pcm->drain.ts_start, &ts);
+	if (ts.tv_sec * 1000 + ts.tv_nsec / 1000000 >= BA_TRANSPORT_PCM_DRAIN_TIMEOUT_MS) {
+		warn("PCM drain timeout: %d", pcm->fd);
+		return 1;
+	}
+
+	/* If the IO thread has been terminated, there
+	 * is no way to play out remaining samples. */
+	if (pthread_equal(pcm->th->id, config.main_thread))
+		goto final;
+
+	if (!atomic_load(&pcm->drain.synced))
+		return 0;
+
+	/* encoded data might still wait for the sender thread */
+	if (atomic_load(&pcm->th->pipeline_queued) > 0)
+		return 0;
+
+	if (pcm->drain.ts_flushed.tv_sec == 0 &&
+			pcm->drain.ts_flushed.tv_nsec == 0) {
+
+		if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
+
+			int queued = 0;
+
+			pthread_mutex_lock(&t->bt_fd_mtx);
+			if (t->bt_fd != -1 &&
+					ioctl(t->bt_fd, TIOCOUTQ, &queued) != -1)
+				queued = abs(t->a2dp.bt_fd_coutq_init - queued);
+			pthread_mutex_unlock(&t->bt_fd_mtx);
 
-	ba_transport_thread_signal_send(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC);
-	pthread_cond_wait(&pcm->synced, &pcm->synced_mtx);
+			if (queued > 0)
+				return 0;
 
-	pthread_mutex_unlock(&pcm->synced_mtx);
+		}
+
+		gettimestamp(&pcm->drain.ts_flushed);
+
+	}
 
-	/* TODO: Asynchronous transport release.
-	 *
-	 * Unfortunately, BlueZ does not provide API for internal buffer drain.
-	 * Also, there is no specification for Bluetooth playback drain. In order
-	 * to make sure, that all samples are played out, we have to wait some
-	 * arbitrary time before releasing transport. In order to make it right,
-	 * there is a requirement for an asynchronous release mechanism, which
-	 * is not implemented - it requires a little bit of refactoring. */
-	usleep(200000);
+	/* Wait for the remote device to play out buffered audio. For
+	 * A2DP we will use the delay reported by the sink device. */
+	usec = 0;
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
+		usec = t->a2dp.delay * 100;
+
+	gettimestamp(&ts);
+	timespecsub(&ts, &pcm->drain.ts_flushed, &ts);
+	if ((unsigned int)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000) < usec)
+		return 0;
 
+final:
 	debug("PCM drained: %d", pcm->fd);
-	return 0;
+	return 1;
 }
 
 int ba_transport_pcm_drop(struct ba_transport_pcm *pcm) {
@@ -1510,8 +2029,32 @@ int ba_transport_thread_create(
 
 	ba_transport_ref(t);
 
+	/* discard any stale stop request */
+	eventfd_t value;
+	eventfd_read(th->stop_fd, &value);
+
+	/* Pass the transport acquisition time-stamp to the master thread,
+	 * so it will be able to measure the delay of the first BT packet. */
+	th->acquire_ts = (struct timespec){ 0 };
+	if (master) {
+		pthread_mutex_lock(&t->bt_fd_mtx);
+		th->acquire_ts = t->acquire_ts;
+		t->acquire_ts = (struct timespec){ 0 };
+		pthread_mutex_unlock(&t->bt_fd_mtx);
+	}
+
 	ba_transport_thread_set_state_starting(th);
-	if ((ret = pthread_create(&th->id, NULL, PTHREAD_ROUTINE(routine), th)) != 0) {
+
+	if (config.io_thread_park)
+		ret = transport_thread_worker_run(th, routine, name);
+	else {
+		th->routine = routine;
+		if ((ret = pthread_create(&th->id, NULL,
+						PTHREAD_ROUTINE(transport_thread_run), th)) == 0)
+			pthread_setname_np(th->id, name);
+	}
+
+	if (ret != 0) {
 		error("Couldn't create transport thread: %s", strerror(ret));
 		ba_transport_thread_set_state(th, BA_TRANSPORT_THREAD_STATE_NONE, true);
 		th->id = config.main_thread;
@@ -1519,7 +2062,6 @@ int ba_transport_thread_create(
 		return -1;
 	}
 
-	pthread_setname_np(th->id, name);
 	debug("Created new IO thread [%s]: %s",
 			name, ba_transport_type_to_string(t->type));
 
@@ -17,14 +17,21 @@
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "a2dp.h"
 #include "ba-device.h"
 #include "ba-rfcomm.h"
 #include "bluez.h"
+#if ENABLE_MSBC
+# include "sco-aec.h"
+#endif
+#include "sco-clock.h"
+#include "thread-stats.h"
 #include "shared/a2dp-codecs.h"
 
 #define BA_TRANSPORT_PROFILE_NONE        (0)
@@ -130,13 +137,31 @@ struct ba_transport_pcm {
 		double scale;
 	} volume[2];
 
-	/* data synchronization */
-	pthread_mutex_t synced_mtx;
-	pthread_cond_t synced;
+	/* asynchronous PCM drain */
+	struct {
+		/* number of drain requests waiting for the drain completion
+		 * and the ID of the main loop source which checks the drain
+		 * progress; both accessed by the main thread only */
+		unsigned int requests;
+		unsigned int source;
+		/* set by the IO thread when the PCM FIFO is empty */
+		atomic_bool synced;
+		/* time-stamp of the drain request */
+		struct timespec ts_start;
+		/* time-stamp of the BT socket output queue flush */
+		struct timespec ts_flushed;
+	} drain;
+
+	/* total time in microseconds during which the encoding
+	 * was suspended due to the digital silence */
+	atomic_ullong silence_usec;
 
 	/* exported PCM D-Bus API */
 	char *ba_dbus_path;
 	bool ba_dbus_exported;
+	/* properties pending for the coalesced
+	 * D-Bus PropertiesChanged signal */
+	atomic_uint ba_dbus_update_mask;
 
 };
 
@@ -182,8 +207,36 @@ struct ba_transport_thread {
 	bool master;
 	/* clone of BT socket */
 	int bt_fd;
+	/* HCI status of the last packet read from the SCO socket */
+	uint8_t bt_pkt_status;
 	/* notification PIPE */
 	int pipe[2];
+	/* cooperative stop request */
+	int stop_fd;
+
+	/* IO routine of the non-parked thread */
+	void *(*routine)(struct ba_transport_thread *);
+
+	/* persistent worker which runs IO routines */
+	struct {
+		pthread_t id;
+		bool running;
+		bool terminate;
+		/* routine assigned to the worker */
+		void *(*routine)(struct ba_transport_thread *);
+		/* routine assigned/finished notification */
+		pthread_cond_t changed;
+	} worker;
+
+	/* time-stamp of the transport acquisition; used for
+	 * measuring the delay of the first BT packet */
+	struct timespec acquire_ts;
+
+	/* CPU usage and timing statistics */
+	struct thread_stats stats;
+
+	/* number of entries waiting in the encoder pipeline queue */
+	atomic_uint pipeline_queued;
 
 	/* state/id changed notification */
 	pthread_cond_t changed;
@@ -218,6 +271,7 @@ enum ba_transport_thread_manager_command {
 	BA_TRANSPORT_THREAD_MANAGER_TERMINATE = 0,
 	BA_TRANSPORT_THREAD_MANAGER_CANCEL_THREADS,
 	BA_TRANSPORT_THREAD_MANAGER_CANCEL_IF_NO_CLIENTS,
+	BA_TRANSPORT_THREAD_MANAGER_SCO_LINK_START,
 };
 
 struct ba_transport {
@@ -245,11 +299,17 @@ struct ba_transport {
 	 * side of the transport. The role of this socket depends on the transport
 	 * type - it can be either A2DP or SCO link. */
 	int bt_fd;
+	/* time-stamp of the last acquisition */
+	struct timespec acquire_ts;
 
 	/* max transfer unit values for bt_fd */
 	size_t mtu_read;
 	size_t mtu_write;
 
+	/* BT socket output buffer latency target in milliseconds, which
+	 * overrides the configured value; -1 if not overridden */
+	atomic_int bt_sndbuf_latency;
+
 	/* threads for audio processing */
 	struct ba_transport_thread thread_enc;
 	struct ba_transport_thread thread_dec;
@@ -293,6 +353,10 @@ struct ba_transport {
 			 * subsequent ioctl() calls. */
 			int bt_fd_coutq_init;
 
+			/* Nominal bitrate of the encoded stream in bits per second. It is
+			 * set by the encoder with ba_transport_set_a2dp_bitrate(). */
+			atomic_uint bitrate;
+
 		} a2dp;
 
 		struct {
@@ -309,6 +373,17 @@ struct ba_transport {
 			/* time-stamp when the SCO link has been closed */
 			struct timespec closed_at;
 
+			/* incoming SCO link waiting for the thread manager */
+			atomic_int link_fd;
+
+			/* common time line of the speaker and microphone streams */
+			struct sco_clock clock;
+
+#if ENABLE_MSBC
+			/* echo canceller of the microphone stream */
+			struct sco_aec aec;
+#endif
+
 		} sco;
 
 	};
@@ -365,6 +440,7 @@ void ba_transport_set_codec(
 int ba_transport_start(struct ba_transport *t);
 int ba_transport_stop(struct ba_transport *t);
 int ba_transport_stop_if_no_clients(struct ba_transport *t);
+int ba_transport_sco_link_start(struct ba_transport *t, int fd);
 
 int ba_transport_acquire(struct ba_transport *t);
 int ba_transport_release(struct ba_transport *t);
@@ -373,6 +449,18 @@ int ba_transport_set_a2dp_state(
 		struct ba_transport *t,
 		enum bluez_a2dp_transport_state state);
 
+unsigned int ba_transport_get_bt_sndbuf_latency(
+		const struct ba_transport *t);
+void ba_transport_set_bt_sndbuf_latency(
+		struct ba_transport *t,
+		unsigned int latency);
+int ba_transport_get_bt_sndbuf_size(
+		struct ba_transport *t);
+
+void ba_transport_set_a2dp_bitrate(
+		struct ba_transport *t,
+		unsigned int bitrate);
+
 bool ba_transport_pcm_is_active(
 		struct ba_transport_pcm *pcm);
 
@@ -392,6 +480,7 @@ int ba_transport_pcm_volume_update(
 int ba_transport_pcm_pause(struct ba_transport_pcm *pcm);
 int ba_transport_pcm_resume(struct ba_transport_pcm *pcm);
 int ba_transport_pcm_drain(struct ba_transport_pcm *pcm);
+int ba_transport_pcm_drain_check(struct ba_transport_pcm *pcm);
 int ba_transport_pcm_drop(struct ba_transport_pcm *pcm);
 
 int ba_transport_pcm_release(struct ba_transport_pcm *pcm);
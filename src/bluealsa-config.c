@@ -31,6 +31,8 @@ struct ba_config config = {
 
 	.keep_alive_time = 0,
 
+	.thread_policy_rtkit = false,
+
 	.volume_init_level = 0,
 
 	/* CVSD is a mandatory codec */
@@ -40,17 +42,33 @@ struct ba_config config = {
 	 * quality, so we will enable it by default */
 	.hfp.codecs.msbc = true,
 #endif
+#if ENABLE_LC3_SWB
+	/* LC3-SWB provides super wideband audio with
+	 * shorter frames, so enable it by default too */
+	.hfp.codecs.lc3_swb = true,
+#endif
+	.hfp.cvsd_batch_latency = 0,
+#if ENABLE_MSBC
+	.hfp.aec = false,
+	.hfp.aec_tail = 32,
+#endif
 
 	.hfp.features_sdp_hf =
 		SDP_HFP_HF_FEAT_CLI |
 		SDP_HFP_HF_FEAT_VOLUME |
 #if ENABLE_MSBC
 		SDP_HFP_HF_FEAT_WBAND |
+#endif
+#if ENABLE_LC3_SWB
+		SDP_HFP_HF_FEAT_SWBAND |
 #endif
 		0,
 	.hfp.features_sdp_ag =
 #if ENABLE_MSBC
 		SDP_HFP_AG_FEAT_WBAND |
+#endif
+#if ENABLE_LC3_SWB
+		SDP_HFP_AG_FEAT_SWBAND |
 #endif
 		0,
 	.hfp.features_rfcomm_hf =
@@ -83,6 +101,9 @@ struct ba_config config = {
 	.a2dp.volume = false,
 	.a2dp.force_mono = false,
 	.a2dp.force_44100 = false,
+	.a2dp.pipeline = false,
+	.a2dp.silence_timeout = 0,
+	.a2dp.bandwidth = 0,
 
 	/* Try to use high SBC encoding quality as a default. */
 	.sbc_quality = SBC_QUALITY_HIGH,
@@ -27,6 +27,19 @@
 #include <gio/gio.h>
 #include <glib.h>
 
+#include "thread-policy.h"
+
+/**
+ * Latency target of the BT socket output buffer. */
+struct ba_config_sndbuf_latency {
+	/* SCO (HFP/HSP) profile, otherwise A2DP */
+	bool sco;
+	/* codec ID or 0xFFFF for all codecs of the profile */
+	uint16_t codec_id;
+	/* latency target in milliseconds */
+	unsigned int latency;
+};
+
 struct ba_config {
 
 	/* set of enabled profiles */
@@ -65,6 +78,27 @@ struct ba_config {
 	 * infinite time. This option applies for the source profile only. */
 	int keep_alive_time;
 
+	/* Keep transport IO threads parked between streams, so they can be
+	 * reused for the next stream instead of creating new threads. */
+	bool io_thread_park;
+
+	/* Scheduling policy and CPU affinity for every class of the service
+	 * threads. By default, threads inherit the policy of the main thread. */
+	struct thread_policy thread_policy[__THREAD_CLASS_MAX];
+	/* Request real-time scheduling from the RealtimeKit daemon, if the
+	 * service is not permitted to change the scheduling policy itself. */
+	bool thread_policy_rtkit;
+
+	/* Interval in milliseconds of the ACL link monitor. The monitor reads
+	 * link quality parameters of connected devices using HCI commands.
+	 * Zero disables the monitor. */
+	unsigned int link_monitor_interval;
+
+	/* Latency targets used for sizing the BT socket output buffer. The
+	 * codec specific target takes precedence over the profile one. */
+	struct ba_config_sndbuf_latency sndbuf_latency[16];
+	size_t sndbuf_latency_len;
+
 	/* the initial volume level */
 	int volume_init_level;
 
@@ -75,9 +109,25 @@ struct ba_config {
 			bool cvsd;
 #if ENABLE_MSBC
 			bool msbc;
+#endif
+#if ENABLE_LC3_SWB
+			bool lc3_swb;
 #endif
 		} codecs;
 
+		/* Time in milliseconds of CVSD audio accumulated by the SCO decoder
+		 * before writing it to the PCM FIFO. Batching several SCO packets
+		 * reduces the number of write system calls at the cost of increased
+		 * latency. Zero disables batching. */
+		unsigned int cvsd_batch_latency;
+
+#if ENABLE_MSBC
+		/* enable echo cancellation of the SCO microphone stream */
+		bool aec;
+		/* echo tail length in milliseconds covered by the echo canceller */
+		unsigned int aec_tail;
+#endif
+
 		/* set of features exposed via Service Discovery */
 		unsigned int features_sdp_hf;
 		unsigned int features_sdp_ag;
@@ -119,6 +169,22 @@ struct ba_config {
 		 * to force lower sampling in order to save Bluetooth bandwidth. */
 		bool force_44100;
 
+		/* Run BT socket writes and transfer rate synchronization in a separate
+		 * sender thread, so the encoding of heavy codecs will not introduce
+		 * jitter in the BT transfer. */
+		bool pipeline;
+
+		/* Time in milliseconds of continuous digital silence after which the
+		 * encoder stops encoding and sending audio data. Zero disables the
+		 * silence detection. */
+		unsigned int silence_timeout;
+
+		/* Adapter-wide Bluetooth bandwidth in kbit/s available for outgoing
+		 * A2DP streams. The bandwidth is shared between concurrent streams
+		 * and reduced when SCO links are active. Zero disables the bitrate
+		 * budget scheduling. */
+		unsigned int bandwidth;
+
 	} a2dp;
 
 	/* BlueALSA supports 5 SBC qualities: low, medium, high, XQ and XQ+. The XQ
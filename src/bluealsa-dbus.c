@@ -13,8 +13,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -35,11 +37,24 @@
 #include "bluealsa-skeleton.h"
 #include "dbus.h"
 #include "hfp.h"
+#if ENABLE_MSBC
+# include "sco-aec.h"
+#endif
+#include "sco-clock.h"
+#include "thread-policy.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/log.h"
 
+/* The time window (in milliseconds) in which PCM property updates are
+ * merged into a single D-Bus PropertiesChanged signal. */
+#define BLUEALSA_DBUS_PCM_UPDATE_INTERVAL 50
+
+/* The interval (in milliseconds) of the PCM drain progress check. */
+#define BLUEALSA_DBUS_PCM_DRAIN_INTERVAL 10
+
 static const char *bluealsa_dbus_manager_path = "/org/bluealsa";
 static GDBusObjectManagerServer *bluealsa_dbus_manager = NULL;
 
@@ -136,6 +151,9 @@ static GVariant *ba_variant_new_bluealsa_codecs(void) {
 		{ HFP_CODEC_CVSD, config.hfp.codecs.cvsd },
 #if ENABLE_MSBC
 		{ HFP_CODEC_MSBC, config.hfp.codecs.msbc },
+#endif
+#if ENABLE_LC3_SWB
+		{ HFP_CODEC_LC3_SWB, config.hfp.codecs.lc3_swb },
 #endif
 	};
 
@@ -239,10 +257,66 @@ static GVariant *ba_variant_new_pcm_delay(const struct ba_transport_pcm *pcm) {
 	return g_variant_new_uint16(ba_transport_pcm_get_delay(pcm));
 }
 
+static GVariant *ba_variant_new_pcm_silence_time(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_uint64(atomic_load_explicit(&pcm->silence_usec,
+				memory_order_relaxed) / 1000);
+}
+
 static GVariant *ba_variant_new_pcm_soft_volume(const struct ba_transport_pcm *pcm) {
 	return g_variant_new_boolean(pcm->soft_volume);
 }
 
+static GVariant *ba_variant_new_pcm_sndbuf_latency(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_uint16(MIN(ba_transport_get_bt_sndbuf_latency(pcm->t), UINT16_MAX));
+}
+
+#if ENABLE_MSBC
+/**
+ * Get the echo canceller of the given PCM.
+ *
+ * @return The echo canceller or NULL if the echo cancellation is not
+ *   supported by the given PCM. */
+static struct sco_aec *ba_transport_pcm_get_aec(const struct ba_transport_pcm *pcm) {
+	struct ba_transport *t = pcm->t;
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
+			pcm == &t->sco.mic_pcm)
+		return &t->sco.aec;
+	return NULL;
+}
+#endif
+
+static GVariant *ba_variant_new_pcm_echo_cancellation(const struct ba_transport_pcm *pcm) {
+#if ENABLE_MSBC
+	const struct sco_aec *aec;
+	if ((aec = ba_transport_pcm_get_aec(pcm)) != NULL)
+		return g_variant_new_boolean(atomic_load_explicit(&aec->enabled, memory_order_relaxed));
+#else
+	(void)pcm;
+#endif
+	return NULL;
+}
+
+static GVariant *ba_variant_new_pcm_rssi(const struct ba_transport_pcm *pcm) {
+	const struct ba_device *d = pcm->t->d;
+	if (!atomic_load_explicit(&d->link.valid, memory_order_relaxed))
+		return NULL;
+	return g_variant_new_int16(atomic_load_explicit(&d->link.rssi, memory_order_relaxed));
+}
+
+static GVariant *ba_variant_new_pcm_link_quality(const struct ba_transport_pcm *pcm) {
+	const struct ba_device *d = pcm->t->d;
+	if (!atomic_load_explicit(&d->link.valid, memory_order_relaxed))
+		return NULL;
+	return g_variant_new_byte(atomic_load_explicit(&d->link.quality, memory_order_relaxed));
+}
+
+static GVariant *ba_variant_new_pcm_failed_contacts(const struct ba_transport_pcm *pcm) {
+	const struct ba_device *d = pcm->t->d;
+	if (!atomic_load_explicit(&d->link.valid, memory_order_relaxed))
+		return NULL;
+	return g_variant_new_uint16(atomic_load_explicit(&d->link.failed_contacts, memory_order_relaxed));
+}
+
 static uint8_t ba_volume_pack_dbus_volume(bool muted, int value) {
 	return (muted << 7) | (((uint8_t)value) & 0x7F);
 }
@@ -272,8 +346,18 @@ static void ba_variant_populate_pcm(GVariantBuilder *props, const struct ba_tran
 	if ((value = ba_variant_new_pcm_codec_config(pcm)) != NULL)
 		g_variant_builder_add(props, "{sv}", "CodecConfiguration", value);
 	g_variant_builder_add(props, "{sv}", "Delay", ba_variant_new_pcm_delay(pcm));
+	g_variant_builder_add(props, "{sv}", "SilenceTime", ba_variant_new_pcm_silence_time(pcm));
 	g_variant_builder_add(props, "{sv}", "SoftVolume", ba_variant_new_pcm_soft_volume(pcm));
 	g_variant_builder_add(props, "{sv}", "Volume", ba_variant_new_pcm_volume(pcm));
+	if ((value = ba_variant_new_pcm_echo_cancellation(pcm)) != NULL)
+		g_variant_builder_add(props, "{sv}", "EchoCancellation", value);
+	g_variant_builder_add(props, "{sv}", "SocketBufferLatency", ba_variant_new_pcm_sndbuf_latency(pcm));
+	if ((value = ba_variant_new_pcm_rssi(pcm)) != NULL)
+		g_variant_builder_add(props, "{sv}", "RSSI", value);
+	if ((value = ba_variant_new_pcm_link_quality(pcm)) != NULL)
+		g_variant_builder_add(props, "{sv}", "LinkQuality", value);
+	if ((value = ba_variant_new_pcm_failed_contacts(pcm)) != NULL)
+		g_variant_builder_add(props, "{sv}", "FailedContacts", value);
 
 }
 
@@ -339,6 +423,35 @@ static bool ba_variant_populate_sep(GVariantBuilder *props, const struct a2dp_se
 	return true;
 }
 
+static GVariant *ba_variant_new_bluealsa_thread_policy(void) {
+
+	GVariantBuilder policies;
+	g_variant_builder_init(&policies, G_VARIANT_TYPE("a{sa{sv}}"));
+
+	for (enum thread_class tc = 0; tc < __THREAD_CLASS_MAX; tc++) {
+
+		struct thread_policy policy;
+		if (thread_policy_get_effective(tc, &policy) == -1)
+			continue;
+
+		char cpus[128];
+		thread_policy_cpus_to_string(&policy.cpus, cpus, sizeof(cpus));
+
+		GVariantBuilder props;
+		g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+		g_variant_builder_add(&props, "{sv}", "Policy",
+				g_variant_new_string(thread_policy_to_string(policy.policy)));
+		g_variant_builder_add(&props, "{sv}", "Priority", g_variant_new_uint32(policy.priority));
+		g_variant_builder_add(&props, "{sv}", "CPUs", g_variant_new_string(cpus));
+		g_variant_builder_add(&props, "{sv}", "RealtimeKit", g_variant_new_boolean(policy.rtkit));
+
+		g_variant_builder_add(&policies, "{sa{sv}}", thread_class_to_string(tc), &props);
+
+	}
+
+	return g_variant_builder_end(&policies);
+}
+
 static GVariant *bluealsa_manager_get_property(const char *property,
 		GError **error, void *userdata) {
 	(void)error;
@@ -352,6 +465,8 @@ static GVariant *bluealsa_manager_get_property(const char *property,
 		return ba_variant_new_bluealsa_profiles();
 	if (strcmp(property, "Codecs") == 0)
 		return ba_variant_new_bluealsa_codecs();
+	if (strcmp(property, "ThreadPolicy") == 0)
+		return ba_variant_new_bluealsa_thread_policy();
 
 	g_assert_not_reached();
 	return NULL;
@@ -377,6 +492,94 @@ void bluealsa_dbus_register(void) {
 
 }
 
+/**
+ * PCM drain pending on the controller channel. */
+struct bluealsa_pcm_drain {
+	GIOChannel *ch;
+	struct ba_transport_pcm *pcm;
+};
+
+static void bluealsa_pcm_drain_free(struct bluealsa_pcm_drain *drain) {
+	g_io_channel_unref(drain->ch);
+	ba_transport_pcm_unref(drain->pcm);
+	free(drain);
+}
+
+/**
+ * Send responses for all pending drain requests. */
+static void bluealsa_pcm_drain_complete(GIOChannel *ch, struct ba_transport_pcm *pcm) {
+	gsize len;
+	for (; pcm->drain.requests > 0; pcm->drain.requests--) {
+		g_io_channel_write_chars(ch, "OK", -1, &len, NULL);
+		g_io_channel_flush(ch, NULL);
+	}
+}
+
+static gboolean bluealsa_pcm_drain_dispatch(void *userdata) {
+
+	struct bluealsa_pcm_drain *drain = (struct bluealsa_pcm_drain *)userdata;
+	struct ba_transport_pcm *pcm = drain->pcm;
+
+	/* client has closed the PCM in the meantime */
+	if (pcm->fd == -1) {
+		pcm->drain.requests = 0;
+		goto final;
+	}
+
+	if (ba_transport_pcm_drain_check(pcm) == 0)
+		return G_SOURCE_CONTINUE;
+
+	bluealsa_pcm_drain_complete(drain->ch, pcm);
+
+final:
+	pcm->drain.source = 0;
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Stop checking the progress of the pending PCM drain. */
+static void bluealsa_pcm_drain_cancel(struct ba_transport_pcm *pcm) {
+	if (pcm->drain.source != 0) {
+		g_source_remove(pcm->drain.source);
+		pcm->drain.source = 0;
+	}
+}
+
+/**
+ * Start asynchronous PCM drain.
+ *
+ * The response will be sent on the controller channel when the drain is
+ * completed, so the main loop is not blocked in the meantime. If the drain
+ * is already in progress, the request is merged with the pending one and
+ * both are responded to when the drain completes.
+ *
+ * @return On success this function returns 0. Otherwise -1 is returned. */
+static int bluealsa_pcm_drain(GIOChannel *ch, struct ba_transport_pcm *pcm) {
+
+	if (pcm->drain.requests > 0) {
+		pcm->drain.requests++;
+		return 0;
+	}
+
+	struct bluealsa_pcm_drain *drain;
+	if ((drain = malloc(sizeof(*drain))) == NULL)
+		return -1;
+
+	if (ba_transport_pcm_drain(pcm) == -1) {
+		free(drain);
+		return -1;
+	}
+
+	pcm->drain.requests = 1;
+	drain->ch = g_io_channel_ref(ch);
+	drain->pcm = ba_transport_pcm_ref(pcm);
+	pcm->drain.source = g_timeout_add_full(G_PRIORITY_DEFAULT, BLUEALSA_DBUS_PCM_DRAIN_INTERVAL,
+			bluealsa_pcm_drain_dispatch, drain,
+			(GDestroyNotify)bluealsa_pcm_drain_free);
+
+	return 0;
+}
+
 static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 		void *userdata) {
 	(void)condition;
@@ -391,13 +594,19 @@ static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 		return TRUE;
 	case G_IO_STATUS_NORMAL:
 		if (strncmp(command, BLUEALSA_PCM_CTRL_DRAIN, len) == 0) {
-			if (pcm->mode == BA_TRANSPORT_PCM_MODE_SINK)
-				ba_transport_pcm_drain(pcm);
+			/* For sink PCM the response is sent when the drain is completed. */
+			if (pcm->mode == BA_TRANSPORT_PCM_MODE_SINK &&
+					bluealsa_pcm_drain(ch, pcm) == 0)
+				return TRUE;
 			g_io_channel_write_chars(ch, "OK", -1, &len, NULL);
 		}
 		else if (strncmp(command, BLUEALSA_PCM_CTRL_DROP, len) == 0) {
 			if (pcm->mode == BA_TRANSPORT_PCM_MODE_SINK)
 				ba_transport_pcm_drop(pcm);
+			/* Drop aborts the pending drain, so the drain requests
+			 * are responded to before the drop request itself. */
+			bluealsa_pcm_drain_cancel(pcm);
+			bluealsa_pcm_drain_complete(ch, pcm);
 			g_io_channel_write_chars(ch, "OK", -1, &len, NULL);
 		}
 		else if (strncmp(command, BLUEALSA_PCM_CTRL_PAUSE, len) == 0) {
@@ -417,6 +626,9 @@ static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 	case G_IO_STATUS_AGAIN:
 		return TRUE;
 	case G_IO_STATUS_EOF:
+		/* there is no one to respond to pending drain requests */
+		bluealsa_pcm_drain_cancel(pcm);
+		pcm->drain.requests = 0;
 		pthread_mutex_lock(&pcm->mutex);
 		ba_transport_pcm_release(pcm);
 		ba_transport_thread_signal_send(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE);
@@ -598,6 +810,13 @@ static void bluealsa_pcm_get_codecs(GDBusMethodInvocation *inv, void *userdata)
 					hfp_codec_id_to_string(HFP_CODEC_MSBC), NULL);
 #endif
 
+#if ENABLE_LC3_SWB
+		if (config.hfp.codecs.lc3_swb &&
+				t->sco.rfcomm != NULL && t->sco.rfcomm->codecs.lc3_swb)
+			g_variant_builder_add(&codecs, "{sa{sv}}",
+					hfp_codec_id_to_string(HFP_CODEC_LC3_SWB), NULL);
+#endif
+
 	}
 
 	g_dbus_method_invocation_return_value(inv, g_variant_new("(a{sa{sv}})", &codecs));
@@ -718,6 +937,76 @@ final:
 		g_variant_unref(value);
 }
 
+static GVariant *ba_variant_new_thread_stats_hist(const struct thread_stats_hist *hist) {
+	uint32_t buckets[THREAD_STATS_HIST_BUCKETS];
+	for (size_t i = 0; i < ARRAYSIZE(buckets); i++)
+		buckets[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+	return g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32,
+			buckets, ARRAYSIZE(buckets), sizeof(*buckets));
+}
+
+static void bluealsa_pcm_get_stats(GDBusMethodInvocation *inv, void *userdata) {
+
+	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
+	const struct thread_stats *stats = &pcm->th->stats;
+
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+
+	g_variant_builder_add(&props, "{sv}", "CPUTime", g_variant_new_uint64(
+				atomic_load_explicit(&stats->cpu_usec, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "CodecCalls", g_variant_new_uint64(
+				atomic_load_explicit(&stats->codec_calls, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "CodecTime",
+			ba_variant_new_thread_stats_hist(&stats->codec));
+	g_variant_builder_add(&props, "{sv}", "BusyTime",
+			ba_variant_new_thread_stats_hist(&stats->busy));
+	g_variant_builder_add(&props, "{sv}", "PCMWrites", g_variant_new_uint64(
+				atomic_load_explicit(&stats->pcm_writes, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "PCMWriteRate",
+			g_variant_new_double(thread_stats_pcm_write_rate(stats)));
+
+	int64_t sco_offset;
+	unsigned int sco_jitter;
+	if (pcm->t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
+			sco_clock_get_offset(&pcm->t->sco.clock, &sco_offset, &sco_jitter)) {
+		g_variant_builder_add(&props, "{sv}", "SCOOffset", g_variant_new_int64(sco_offset));
+		g_variant_builder_add(&props, "{sv}", "SCOJitter", g_variant_new_uint32(sco_jitter));
+	}
+
+	if (pcm->t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+			pcm == &pcm->t->a2dp.pcm) {
+		g_variant_builder_add(&props, "{sv}", "BitrateBudget", g_variant_new_uint32(
+					ba_adapter_bw_get_a2dp_budget(pcm->t->d->a)));
+		unsigned int bitrate;
+		if ((bitrate = atomic_load_explicit(&pcm->t->a2dp.bitrate, memory_order_relaxed)) != 0)
+			g_variant_builder_add(&props, "{sv}", "Bitrate", g_variant_new_uint32(bitrate));
+		unsigned int hits, misses;
+		ba_device_codec_cache_get_stats(pcm->t->d, &hits, &misses);
+		g_variant_builder_add(&props, "{sv}", "CodecCacheHits", g_variant_new_uint32(hits));
+		g_variant_builder_add(&props, "{sv}", "CodecCacheMisses", g_variant_new_uint32(misses));
+	}
+
+	int sndbuf_size;
+	if ((sndbuf_size = ba_transport_get_bt_sndbuf_size(pcm->t)) != -1)
+		g_variant_builder_add(&props, "{sv}", "SocketBufferSize", g_variant_new_uint32(sndbuf_size));
+
+#if ENABLE_MSBC
+	const struct sco_aec *aec;
+	if ((aec = ba_transport_pcm_get_aec(pcm)) != NULL &&
+			atomic_load_explicit(&aec->enabled, memory_order_relaxed)) {
+		g_variant_builder_add(&props, "{sv}", "AECTime", g_variant_new_uint64(
+					atomic_load_explicit(&aec->usec, memory_order_relaxed)));
+		g_variant_builder_add(&props, "{sv}", "AECBypass", g_variant_new_boolean(
+					atomic_load_explicit(&aec->bypass, memory_order_relaxed)));
+	}
+#endif
+
+	g_dbus_method_invocation_return_value(inv, g_variant_new("(a{sv})", &props));
+	g_variant_builder_clear(&props);
+
+}
+
 static void bluealsa_rfcomm_open(GDBusMethodInvocation *inv, void *userdata) {
 
 	struct ba_rfcomm *r = (struct ba_rfcomm *)userdata;
@@ -788,10 +1077,34 @@ static GVariant *bluealsa_pcm_get_property(const char *property,
 	}
 	if (strcmp(property, "Delay") == 0)
 		return ba_variant_new_pcm_delay(pcm);
+	if (strcmp(property, "SilenceTime") == 0)
+		return ba_variant_new_pcm_silence_time(pcm);
 	if (strcmp(property, "SoftVolume") == 0)
 		return ba_variant_new_pcm_soft_volume(pcm);
 	if (strcmp(property, "Volume") == 0)
 		return ba_variant_new_pcm_volume(pcm);
+	if (strcmp(property, "EchoCancellation") == 0) {
+		if ((value = ba_variant_new_pcm_echo_cancellation(pcm)) == NULL)
+			goto unavailable;
+		return value;
+	}
+	if (strcmp(property, "SocketBufferLatency") == 0)
+		return ba_variant_new_pcm_sndbuf_latency(pcm);
+	if (strcmp(property, "RSSI") == 0) {
+		if ((value = ba_variant_new_pcm_rssi(pcm)) == NULL)
+			goto unavailable;
+		return value;
+	}
+	if (strcmp(property, "LinkQuality") == 0) {
+		if ((value = ba_variant_new_pcm_link_quality(pcm)) == NULL)
+			goto unavailable;
+		return value;
+	}
+	if (strcmp(property, "FailedContacts") == 0) {
+		if ((value = ba_variant_new_pcm_failed_contacts(pcm)) == NULL)
+			goto unavailable;
+		return value;
+	}
 
 	g_assert_not_reached();
 	return NULL;
@@ -805,7 +1118,6 @@ unavailable:
 
 static bool bluealsa_pcm_set_property(const char *property, GVariant *value,
 		GError **error, void *userdata) {
-	(void)error;
 
 	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
 
@@ -837,6 +1149,36 @@ static bool bluealsa_pcm_set_property(const char *property, GVariant *value,
 		return TRUE;
 	}
 
+	if (strcmp(property, "EchoCancellation") == 0) {
+#if ENABLE_MSBC
+		struct sco_aec *aec;
+		if ((aec = ba_transport_pcm_get_aec(pcm)) != NULL) {
+			atomic_store_explicit(&aec->enabled, g_variant_get_boolean(value), memory_order_relaxed);
+			bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_ECHO_CANCEL);
+			return TRUE;
+		}
+#endif
+		if (error != NULL)
+			*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+					"Echo cancellation not supported");
+		return FALSE;
+	}
+
+	if (strcmp(property, "SocketBufferLatency") == 0) {
+		struct ba_transport *t = pcm->t;
+		ba_transport_set_bt_sndbuf_latency(t, g_variant_get_uint16(value));
+		/* socket buffer is shared by all PCMs of the transport */
+		struct ba_transport_pcm *pcms[] = { &t->a2dp.pcm, &t->a2dp.pcm_bc };
+		if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
+			pcms[0] = &t->sco.spk_pcm;
+			pcms[1] = &t->sco.mic_pcm;
+		}
+		for (size_t i = 0; i < ARRAYSIZE(pcms); i++)
+			if (pcms[i]->ba_dbus_exported)
+				bluealsa_dbus_pcm_update(pcms[i], BA_DBUS_PCM_UPDATE_SNDBUF);
+		return TRUE;
+	}
+
 	g_assert_not_reached();
 	return FALSE;
 }
@@ -852,6 +1194,8 @@ int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm) {
 			.handler = bluealsa_pcm_get_codecs },
 		{ .method = "SelectCodec",
 			.handler = bluealsa_pcm_select_codec },
+		{ .method = "GetStats",
+			.handler = bluealsa_pcm_get_stats },
 		{ 0 },
 	};
 
@@ -888,7 +1232,8 @@ fail:
 	return 0;
 }
 
-void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
+static void bluealsa_dbus_pcm_emit_update(struct ba_transport_pcm *pcm,
+		unsigned int mask) {
 
 	GVariantBuilder props;
 	g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
@@ -909,6 +1254,22 @@ void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 		g_variant_builder_add(&props, "{sv}", "SoftVolume", ba_variant_new_pcm_soft_volume(pcm));
 	if (mask & BA_DBUS_PCM_UPDATE_VOLUME)
 		g_variant_builder_add(&props, "{sv}", "Volume", ba_variant_new_pcm_volume(pcm));
+	if (mask & BA_DBUS_PCM_UPDATE_ECHO_CANCEL) {
+		GVariant *value;
+		if ((value = ba_variant_new_pcm_echo_cancellation(pcm)) != NULL)
+			g_variant_builder_add(&props, "{sv}", "EchoCancellation", value);
+	}
+	if (mask & BA_DBUS_PCM_UPDATE_SNDBUF)
+		g_variant_builder_add(&props, "{sv}", "SocketBufferLatency", ba_variant_new_pcm_sndbuf_latency(pcm));
+	if (mask & BA_DBUS_PCM_UPDATE_LINK) {
+		GVariant *value;
+		if ((value = ba_variant_new_pcm_rssi(pcm)) != NULL)
+			g_variant_builder_add(&props, "{sv}", "RSSI", value);
+		if ((value = ba_variant_new_pcm_link_quality(pcm)) != NULL)
+			g_variant_builder_add(&props, "{sv}", "LinkQuality", value);
+		if ((value = ba_variant_new_pcm_failed_contacts(pcm)) != NULL)
+			g_variant_builder_add(&props, "{sv}", "FailedContacts", value);
+	}
 
 	g_dbus_connection_emit_properties_changed(config.dbus,
 			pcm->ba_dbus_path, BLUEALSA_IFACE_PCM, &props, NULL);
@@ -916,6 +1277,45 @@ void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 
 }
 
+static gboolean bluealsa_dbus_pcm_update_dispatch(void *userdata) {
+
+	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
+
+	/* Take all pending updates. If the mask is empty, it means that updates
+	 * were already sent via the immediate path or with the previous timeout
+	 * callback, which was scheduled in the mean time. */
+	unsigned int mask = atomic_exchange(&pcm->ba_dbus_update_mask, 0);
+	if (mask != 0 && pcm->ba_dbus_exported)
+		bluealsa_dbus_pcm_emit_update(pcm, mask);
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Notify D-Bus clients about PCM properties change.
+ *
+ * Updates of properties which are not listed in the BA_DBUS_PCM_UPDATE_IMMEDIATE
+ * mask are accumulated and sent as a single PropertiesChanged signal after the
+ * coalescing time window. Any pending update is merged with the immediate one.
+ *
+ * This function can be called from any thread. */
+void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
+
+	if (mask & BA_DBUS_PCM_UPDATE_IMMEDIATE) {
+		mask |= atomic_exchange(&pcm->ba_dbus_update_mask, 0);
+		bluealsa_dbus_pcm_emit_update(pcm, mask);
+		return;
+	}
+
+	/* Schedule the signal emission only for the first update in the window,
+	 * all subsequent updates will be merged into the pending mask. */
+	if (atomic_fetch_or(&pcm->ba_dbus_update_mask, mask) == 0)
+		g_timeout_add_full(G_PRIORITY_DEFAULT, BLUEALSA_DBUS_PCM_UPDATE_INTERVAL,
+				bluealsa_dbus_pcm_update_dispatch, ba_transport_pcm_ref(pcm),
+				(GDestroyNotify)ba_transport_pcm_unref);
+
+}
+
 void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
 
 	if (!pcm->ba_dbus_exported)
@@ -30,6 +30,23 @@
 #define BA_DBUS_PCM_UPDATE_DELAY        (1 << 5)
 #define BA_DBUS_PCM_UPDATE_SOFT_VOLUME  (1 << 6)
 #define BA_DBUS_PCM_UPDATE_VOLUME       (1 << 7)
+#define BA_DBUS_PCM_UPDATE_ECHO_CANCEL  (1 << 8)
+#define BA_DBUS_PCM_UPDATE_LINK         (1 << 9)
+#define BA_DBUS_PCM_UPDATE_SNDBUF       (1 << 10)
+
+/**
+ * PCM properties which shall be reported to clients right away. Updates of
+ * other properties (e.g. volume or delay) might be coalesced, so frequent
+ * changes will not flood D-Bus with PropertiesChanged signals. */
+#define BA_DBUS_PCM_UPDATE_IMMEDIATE ( \
+		BA_DBUS_PCM_UPDATE_FORMAT | \
+		BA_DBUS_PCM_UPDATE_CHANNELS | \
+		BA_DBUS_PCM_UPDATE_SAMPLING | \
+		BA_DBUS_PCM_UPDATE_CODEC | \
+		BA_DBUS_PCM_UPDATE_CODEC_CONFIG | \
+		BA_DBUS_PCM_UPDATE_SOFT_VOLUME | \
+		BA_DBUS_PCM_UPDATE_ECHO_CANCEL | \
+		BA_DBUS_PCM_UPDATE_SNDBUF)
 
 #define BA_DBUS_RFCOMM_UPDATE_FEATURES (1 << 0)
 #define BA_DBUS_RFCOMM_UPDATE_BATTERY  (1 << 1)
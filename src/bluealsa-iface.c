@@ -28,6 +28,10 @@ static const GDBusArgInfo arg_props = {
 	-1, "props", "a{sv}", NULL
 };
 
+static const GDBusArgInfo arg_stats = {
+	-1, "stats", "a{sv}", NULL
+};
+
 static const GDBusPropertyInfo bluealsa_iface_manager_Version = {
 	-1, "Version", "s", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
 };
@@ -44,11 +48,16 @@ static const GDBusPropertyInfo bluealsa_iface_manager_Codecs = {
 	-1, "Codecs", "as", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
 };
 
+static const GDBusPropertyInfo bluealsa_iface_manager_ThreadPolicy = {
+	-1, "ThreadPolicy", "a{sa{sv}}", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
 static const GDBusPropertyInfo *bluealsa_iface_manager_properties[] = {
 	&bluealsa_iface_manager_Version,
 	&bluealsa_iface_manager_Adapters,
 	&bluealsa_iface_manager_Profiles,
 	&bluealsa_iface_manager_Codecs,
+	&bluealsa_iface_manager_ThreadPolicy,
 	NULL,
 };
 
@@ -69,6 +78,11 @@ static const GDBusArgInfo *pcm_SelectCodec_in[] = {
 	NULL,
 };
 
+static const GDBusArgInfo *pcm_GetStats_out[] = {
+	&arg_stats,
+	NULL,
+};
+
 static const GDBusMethodInfo bluealsa_iface_pcm_Open = {
 	-1, "Open",
 	NULL,
@@ -90,10 +104,18 @@ static const GDBusMethodInfo bluealsa_iface_pcm_SelectCodec = {
 	NULL,
 };
 
+static const GDBusMethodInfo bluealsa_iface_pcm_GetStats = {
+	-1, "GetStats",
+	NULL,
+	(GDBusArgInfo **)pcm_GetStats_out,
+	NULL,
+};
+
 static const GDBusMethodInfo *bluealsa_iface_pcm_methods[] = {
 	&bluealsa_iface_pcm_Open,
 	&bluealsa_iface_pcm_GetCodecs,
 	&bluealsa_iface_pcm_SelectCodec,
+	&bluealsa_iface_pcm_GetStats,
 	NULL,
 };
 
@@ -137,6 +159,10 @@ static const GDBusPropertyInfo bluealsa_iface_pcm_Delay = {
 	-1, "Delay", "q", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
 };
 
+static const GDBusPropertyInfo bluealsa_iface_pcm_SilenceTime = {
+	-1, "SilenceTime", "t", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
 static const GDBusPropertyInfo bluealsa_iface_pcm_SoftVolume = {
 	-1, "SoftVolume", "b",
 	G_DBUS_PROPERTY_INFO_FLAGS_READABLE |
@@ -151,6 +177,32 @@ static const GDBusPropertyInfo bluealsa_iface_pcm_Volume = {
 	NULL
 };
 
+static const GDBusPropertyInfo bluealsa_iface_pcm_EchoCancellation = {
+	-1, "EchoCancellation", "b",
+	G_DBUS_PROPERTY_INFO_FLAGS_READABLE |
+	G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+	NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_SocketBufferLatency = {
+	-1, "SocketBufferLatency", "q",
+	G_DBUS_PROPERTY_INFO_FLAGS_READABLE |
+	G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+	NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_RSSI = {
+	-1, "RSSI", "n", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_LinkQuality = {
+	-1, "LinkQuality", "y", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_FailedContacts = {
+	-1, "FailedContacts", "q", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
 static const GDBusPropertyInfo *bluealsa_iface_pcm_properties[] = {
 	&bluealsa_iface_pcm_Device,
 	&bluealsa_iface_pcm_Sequence,
@@ -162,8 +214,14 @@ static const GDBusPropertyInfo *bluealsa_iface_pcm_properties[] = {
 	&bluealsa_iface_pcm_Codec,
 	&bluealsa_iface_pcm_CodecConfiguration,
 	&bluealsa_iface_pcm_Delay,
+	&bluealsa_iface_pcm_SilenceTime,
 	&bluealsa_iface_pcm_SoftVolume,
 	&bluealsa_iface_pcm_Volume,
+	&bluealsa_iface_pcm_EchoCancellation,
+	&bluealsa_iface_pcm_SocketBufferLatency,
+	&bluealsa_iface_pcm_RSSI,
+	&bluealsa_iface_pcm_LinkQuality,
+	&bluealsa_iface_pcm_FailedContacts,
 	NULL,
 };
 
@@ -39,6 +39,7 @@
 #include "bluez-skeleton.h"
 #include "dbus.h"
 #include "hci.h"
+#include "link-monitor.h"
 #include "sco.h"
 #include "utils.h"
 #include "shared/a2dp-codecs.h"
@@ -86,6 +87,17 @@ static pthread_mutex_t bluez_mutex = PTHREAD_MUTEX_INITIALIZER;
 static GHashTable *dbus_object_data_map = NULL;
 static struct bluez_adapter bluez_adapters[HCI_MAX_DEV] = { 0 };
 
+/**
+ * Asynchronous registration statistics. */
+static struct {
+	/* number of calls waiting for reply */
+	unsigned int pending;
+	/* number of calls sent in the current batch */
+	unsigned int sent;
+	/* time stamp of the first call in the batch */
+	gint64 ts;
+} bluez_register_stats = { 0 };
+
 #define bluez_adapters_device_lookup(hci_dev_id, addr) \
 	g_hash_table_lookup(bluez_adapters[hci_dev_id].device_sep_map, addr)
 #define bluez_adapters_device_get_sep(seps, i) \
@@ -100,6 +112,8 @@ static struct bluez_adapter *bluez_adapter_new(struct ba_adapter *a) {
 			g_bdaddr_hash, g_bdaddr_equal, g_free, (GDestroyNotify)g_array_unref);
 	bluez_register_battery_provider_manager(&bluez_adapters[a->hci.dev_id]);
 	bluez_register_a2dp_all(a);
+	if (link_monitor_setup(a) == -1)
+		error("Couldn't setup link monitor: %s", strerror(errno));
 	return &bluez_adapters[a->hci.dev_id];
 }
 
@@ -114,6 +128,12 @@ static void bluez_adapter_free(struct bluez_adapter *adapter) {
 	adapter->adapter = NULL;
 }
 
+static struct bluez_dbus_object_data *bluez_dbus_object_data_ref(
+		struct bluez_dbus_object_data *obj) {
+	atomic_fetch_add_explicit(&obj->ref_count, 1, memory_order_relaxed);
+	return obj;
+}
+
 static void bluez_dbus_object_data_unref(
 		struct bluez_dbus_object_data *obj) {
 	if (atomic_fetch_sub_explicit(&obj->ref_count, 1, memory_order_relaxed) > 1)
@@ -387,17 +407,70 @@ static void bluez_endpoint_release(GDBusMethodInvocation *inv, void *userdata) {
 	g_object_unref(inv);
 }
 
+static void bluez_register_object_finish(GObject *source, GAsyncResult *result,
+		void *userdata) {
+
+	struct bluez_dbus_object_data *dbus_obj = userdata;
+	GDBusMessage *rep;
+	GError *err = NULL;
+
+	if ((rep = g_dbus_connection_send_message_with_reply_finish(
+					G_DBUS_CONNECTION(source), result, &err)) != NULL &&
+			g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR)
+		g_dbus_message_to_gerror(rep, &err);
+
+	if (err != NULL) {
+		warn("Couldn't register %s: %s", dbus_obj->codec != NULL ?
+				"media endpoint" : "hands-free profile", err->message);
+		pthread_mutex_lock(&bluez_mutex);
+		dbus_obj->registered = false;
+		pthread_mutex_unlock(&bluez_mutex);
+		g_error_free(err);
+	}
+
+	if (--bluez_register_stats.pending == 0)
+		debug("BlueZ registration completed: %u calls in %.1f ms",
+				bluez_register_stats.sent,
+				(g_get_monotonic_time() - bluez_register_stats.ts) / 1000.0);
+
+	if (rep != NULL)
+		g_object_unref(rep);
+	bluez_dbus_object_data_unref(dbus_obj);
+
+}
+
+/**
+ * Send registration call for the given D-Bus object.
+ *
+ * This function does not wait for the reply. All registration calls are
+ * pipelined, so BlueZ can process them while we are sending next ones.
+ * In case of registration failure, the registered flag of the object will
+ * be cleared when the reply arrives. */
+static void bluez_register_object(
+		struct bluez_dbus_object_data *dbus_obj,
+		GDBusMessage *msg) {
+
+	if (bluez_register_stats.pending++ == 0) {
+		bluez_register_stats.ts = g_get_monotonic_time();
+		bluez_register_stats.sent = 0;
+	}
+
+	bluez_register_stats.sent++;
+	g_dbus_connection_send_message_with_reply(config.dbus, msg,
+			G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL,
+			bluez_register_object_finish, bluez_dbus_object_data_ref(dbus_obj));
+
+}
+
 /**
  * Register media endpoint in BlueZ. */
-static int bluez_register_media_endpoint(
+static void bluez_register_media_endpoint(
 		const struct ba_adapter *adapter,
-		const struct bluez_dbus_object_data *dbus_obj,
-		const char *uuid,
-		GError **error) {
+		struct bluez_dbus_object_data *dbus_obj,
+		const char *uuid) {
 
 	const struct a2dp_codec *codec = dbus_obj->codec;
-	GDBusMessage *msg = NULL, *rep = NULL;
-	int ret = 0;
+	GDBusMessage *msg;
 
 	debug("Registering media endpoint: %s", dbus_obj->path);
 
@@ -416,27 +489,9 @@ static int bluez_register_media_endpoint(
 	g_dbus_message_set_body(msg, g_variant_new("(oa{sv})", dbus_obj->path, &properties));
 	g_variant_builder_clear(&properties);
 
-	if ((rep = g_dbus_connection_send_message_with_reply_sync(config.dbus, msg,
-					G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL, error)) == NULL)
-		goto fail;
+	bluez_register_object(dbus_obj, msg);
+	g_object_unref(msg);
 
-	if (g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR) {
-		g_dbus_message_to_gerror(rep, error);
-		goto fail;
-	}
-
-	goto final;
-
-fail:
-	ret = -1;
-
-final:
-	if (msg != NULL)
-		g_object_unref(msg);
-	if (rep != NULL)
-		g_object_unref(rep);
-
-	return ret;
 }
 
 /**
@@ -522,8 +577,7 @@ static void bluez_register_a2dp(
 		}
 
 		if (!dbus_obj->registered) {
-			if (bluez_register_media_endpoint(adapter, dbus_obj, uuid, &err) == -1)
-				goto fail;
+			bluez_register_media_endpoint(adapter, dbus_obj, uuid);
 			dbus_obj->registered = true;
 		}
 
@@ -839,15 +893,13 @@ static void bluez_profile_release(GDBusMethodInvocation *inv, void *userdata) {
 
 /**
  * Register hands-free profile in BlueZ. */
-static int bluez_register_profile(
-		const struct bluez_dbus_object_data *dbus_obj,
+static void bluez_register_profile(
+		struct bluez_dbus_object_data *dbus_obj,
 		const char *uuid,
 		uint16_t version,
-		uint16_t features,
-		GError **error) {
+		uint16_t features) {
 
-	GDBusMessage *msg = NULL, *rep = NULL;
-	int ret = 0;
+	GDBusMessage *msg;
 
 	debug("Registering hands-free profile: %s", dbus_obj->path);
 
@@ -865,27 +917,9 @@ static int bluez_register_profile(
 	g_dbus_message_set_body(msg, g_variant_new("(osa{sv})", dbus_obj->path, uuid, &options));
 	g_variant_builder_clear(&options);
 
-	if ((rep = g_dbus_connection_send_message_with_reply_sync(config.dbus, msg,
-					G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL, error)) == NULL)
-		goto fail;
-
-	if (g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR) {
-		g_dbus_message_to_gerror(rep, error);
-		goto fail;
-	}
-
-	goto final;
+	bluez_register_object(dbus_obj, msg);
+	g_object_unref(msg);
 
-fail:
-	ret = -1;
-
-final:
-	if (msg != NULL)
-		g_object_unref(msg);
-	if (rep != NULL)
-		g_object_unref(rep);
-
-	return ret;
 }
 
 /**
@@ -956,8 +990,7 @@ static void bluez_register_hfp(
 	}
 
 	if (!dbus_obj->registered) {
-		if (bluez_register_profile(dbus_obj, uuid, version, features, &err) == -1)
-			goto fail;
+		bluez_register_profile(dbus_obj, uuid, version, features);
 		dbus_obj->registered = true;
 	}
 
@@ -987,10 +1020,14 @@ static void bluez_register_hfp_all(void) {
 				0x0102 /* HSP 1.2 */, 0x0);
 	if (config.profile.hfp_hf)
 		bluez_register_hfp(BLUETOOTH_UUID_HFP_HF, BA_TRANSPORT_PROFILE_HFP_HF,
-				0x0107 /* HFP 1.7 */, config.hfp.features_sdp_hf);
+				config.hfp.features_sdp_hf & SDP_HFP_HF_FEAT_SWBAND ?
+					0x0109 /* HFP 1.9 */ : 0x0107 /* HFP 1.7 */,
+				config.hfp.features_sdp_hf);
 	if (config.profile.hfp_ag)
 		bluez_register_hfp(BLUETOOTH_UUID_HFP_AG, BA_TRANSPORT_PROFILE_HFP_AG,
-				0x0107 /* HFP 1.7 */, config.hfp.features_sdp_ag);
+				config.hfp.features_sdp_ag & SDP_HFP_AG_FEAT_SWBAND ?
+					0x0109 /* HFP 1.9 */ : 0x0107 /* HFP 1.7 */,
+				config.hfp.features_sdp_ag);
 }
 
 /**
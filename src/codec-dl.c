@@ -0,0 +1,74 @@
+/*
+ * BlueALSA - codec-dl.c
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "codec-dl.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stddef.h>
+
+#include "shared/log.h"
+
+/**
+ * Load codec library and resolve all its symbols.
+ *
+ * The library is loaded only once, subsequent calls return the cached
+ * result - including the errno value of the failed attempt. This function
+ * is thread-safe, so it can be called by the IO thread right before the
+ * first use of the library.
+ *
+ * @param dl The codec library structure.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to ENOENT if the library was not found or to ENOSYS
+ *   if the library does not provide all required symbols. */
+int codec_dl_load(struct codec_dl *dl) {
+
+	int ret = 0;
+
+	pthread_mutex_lock(&dl->mutex);
+
+	if (dl->handle != NULL)
+		goto final;
+	if (dl->err != 0) {
+		errno = dl->err;
+		goto fail;
+	}
+
+	const char * const *name;
+	for (name = dl->names; *name != NULL; name++)
+		if ((dl->handle = dlopen(*name, RTLD_NOW | RTLD_LOCAL)) != NULL)
+			break;
+
+	if (dl->handle == NULL) {
+		debug("Couldn't load codec library: %s", dlerror());
+		errno = ENOENT;
+		goto fail;
+	}
+
+	const struct codec_dl_symbol *s;
+	for (s = dl->symbols; s->name != NULL; s++)
+		if ((*s->ptr = dlsym(dl->handle, s->name)) == NULL) {
+			error("Couldn't resolve codec library symbol: %s: %s", *name, s->name);
+			dlclose(dl->handle);
+			dl->handle = NULL;
+			errno = ENOSYS;
+			goto fail;
+		}
+
+	debug("Loaded codec library: %s", *name);
+	goto final;
+
+fail:
+	dl->err = errno;
+	ret = -1;
+final:
+	pthread_mutex_unlock(&dl->mutex);
+	return ret;
+}
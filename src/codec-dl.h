@@ -0,0 +1,85 @@
+/*
+ * BlueALSA - codec-dl.h
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_CODECDL_H_
+#define BLUEALSA_CODECDL_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+
+/**
+ * Symbol which shall be resolved in the codec library. */
+struct codec_dl_symbol {
+	const char *name;
+	void **ptr;
+};
+
+/**
+ * Codec library loaded on demand. */
+struct codec_dl {
+
+	/* NULL-terminated list of library names to try */
+	const char * const *names;
+	/* symbols terminated with an empty entry */
+	const struct codec_dl_symbol *symbols;
+
+	pthread_mutex_t mutex;
+	/* handle of the loaded library */
+	void *handle;
+	/* errno of the failed loading, do not try again */
+	int err;
+
+};
+
+/**
+ * Initializer for the codec library structure. */
+#define CODEC_DL_INIT(names_, symbols_) { \
+		.names = names_, \
+		.symbols = symbols_, \
+		.mutex = PTHREAD_MUTEX_INITIALIZER, \
+	}
+
+/**
+ * Declare pointer for the library function.
+ *
+ * The pointer type is deduced from the function declaration in the library
+ * header, so this macro has to be used before the function name is redefined
+ * to the pointer name, e.g.:
+ *
+ *   CODEC_DL_SYMBOL_DECLARE(foo_encode)
+ *   #define foo_encode codec_dl_foo_encode */
+#define CODEC_DL_SYMBOL_DECLARE(sym) \
+	static __typeof__(sym) *codec_dl_ ## sym;
+
+/**
+ * Declare pointer for the library function shared by several source files.
+ *
+ * The pointer has to be defined exactly once with CODEC_DL_SYMBOL_DEFINE()
+ * in the file which owns the codec library structure. */
+#define CODEC_DL_SYMBOL_EXTERN(sym) \
+	extern __typeof__(sym) *codec_dl_ ## sym;
+
+/**
+ * Define pointer previously declared with CODEC_DL_SYMBOL_EXTERN(). */
+#define CODEC_DL_SYMBOL_DEFINE(sym) \
+	__typeof__(codec_dl_ ## sym) codec_dl_ ## sym;
+
+/**
+ * Entry for the codec_dl_symbol array. */
+#define CODEC_DL_SYMBOL(sym) \
+	{ #sym, (void **)&codec_dl_ ## sym }
+
+int codec_dl_load(struct codec_dl *dl);
+
+#endif
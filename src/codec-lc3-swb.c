@@ -0,0 +1,340 @@
+/*
+ * BlueALSA - codec-lc3-swb.c
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "codec-lc3-swb.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lc3.h>
+
+#include "codec-lc3plus.h"
+#include "codec-msbc.h"
+#include "utils.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+
+/**
+ * Make sure that the LC3plus library is available. */
+int lc3_swb_load(void) {
+	return codec_lc3plus_load();
+}
+
+static void lc3_swb_enc_free(LC3PLUS_Enc *handle) {
+	if (handle == NULL)
+		return;
+	lc3plus_free_encoder_structs(handle);
+	free(handle);
+}
+
+static void lc3_swb_dec_free(LC3PLUS_Dec *handle) {
+	if (handle == NULL)
+		return;
+	lc3plus_free_decoder_structs(handle);
+	free(handle);
+}
+
+/**
+ * Create LC3plus encoder configured for the LC3-SWB stream. */
+static LC3PLUS_Enc *lc3_swb_enc_init(void) {
+
+	/* Bitrate rounded up, so the encoder will produce exactly
+	 * LC3_SWB_FRAMELEN bytes for every 7.5 ms frame. */
+	const int bitrate = DIV_ROUND_UP(LC3_SWB_FRAMELEN * 8 * 10000, LC3_SWB_FRAME_DMS);
+
+	LC3PLUS_Enc *handle;
+	LC3PLUS_Error err;
+
+	if ((handle = calloc(1, lc3plus_enc_get_size(LC3_SWB_SAMPLING, 1))) == NULL)
+		return NULL;
+
+	if ((err = lc3plus_enc_init(handle, LC3_SWB_SAMPLING, 1)) != LC3PLUS_OK ||
+			(err = lc3plus_enc_set_frame_ms(handle, LC3_SWB_FRAME_DMS * 0.1)) != LC3PLUS_OK ||
+			(err = lc3plus_enc_set_bitrate(handle, bitrate)) != LC3PLUS_OK) {
+		warn("Couldn't setup LC3-SWB encoder: %s", lc3plus_strerror(err));
+		goto fail;
+	}
+
+	if (lc3plus_enc_get_input_samples(handle) != LC3_SWB_CODESAMPLES ||
+			lc3plus_enc_get_num_bytes(handle) != LC3_SWB_FRAMELEN) {
+		warn("Unexpected LC3-SWB frame: %d samples, %d bytes",
+				lc3plus_enc_get_input_samples(handle), lc3plus_enc_get_num_bytes(handle));
+		goto fail;
+	}
+
+	return handle;
+
+fail:
+	lc3_swb_enc_free(handle);
+	errno = EINVAL;
+	return NULL;
+}
+
+/**
+ * Create LC3plus decoder configured for the LC3-SWB stream. */
+static LC3PLUS_Dec *lc3_swb_dec_init(void) {
+
+	LC3PLUS_Dec *handle;
+	LC3PLUS_Error err;
+
+	if ((handle = calloc(1, lc3plus_dec_get_size(LC3_SWB_SAMPLING, 1))) == NULL)
+		return NULL;
+
+	if ((err = lc3plus_dec_init(handle, LC3_SWB_SAMPLING, 1, LC3PLUS_PLC_ADVANCED)) != LC3PLUS_OK ||
+			(err = lc3plus_dec_set_frame_ms(handle, LC3_SWB_FRAME_DMS * 0.1)) != LC3PLUS_OK) {
+		warn("Couldn't setup LC3-SWB decoder: %s", lc3plus_strerror(err));
+		lc3_swb_dec_free(handle);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return handle;
+}
+
+/**
+ * Check whether the LC3-SWB codec can be used.
+ *
+ * Apart from loading the LC3plus library, this function creates the encoder
+ * and the decoder, so the LC3plus library build which does not support the
+ * 7.5 ms frame duration (or the eSCO frame length) will be rejected up front
+ * instead of failing every time the SCO link is established.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int lc3_swb_probe(void) {
+
+	LC3PLUS_Enc *encoder;
+	LC3PLUS_Dec *decoder;
+
+	if (lc3_swb_load() == -1)
+		return -1;
+
+	if ((encoder = lc3_swb_enc_init()) == NULL)
+		return -1;
+	lc3_swb_enc_free(encoder);
+
+	if ((decoder = lc3_swb_dec_init()) == NULL)
+		return -1;
+	lc3_swb_dec_free(decoder);
+
+	return 0;
+}
+
+int lc3_swb_init(struct esco_lc3_swb *lc3_swb) {
+
+	int err;
+
+	if (lc3_swb_load() == -1)
+		return -1;
+
+	if (!lc3_swb->initialized) {
+		debug("Initializing LC3-SWB codec");
+		if (ffb_init_uint8_t(&lc3_swb->data, sizeof(esco_lc3_swb_frame_t) * 3) == -1)
+			goto fail;
+		/* Allocate buffer for 1 decoded frame, optional 3 PLC frames and
+		 * some extra frames to account for async PCM samples reading. */
+		if (ffb_init_int16_t(&lc3_swb->pcm, LC3_SWB_CODESAMPLES * 6) == -1)
+			goto fail;
+	}
+
+	/* LC3plus does not provide a reset function, so in order to
+	 * start with a clean codec state, recreate codec handles. */
+	lc3_swb_enc_free(lc3_swb->encoder);
+	lc3_swb_dec_free(lc3_swb->decoder);
+	lc3_swb->encoder = NULL;
+	lc3_swb->decoder = NULL;
+
+	if ((lc3_swb->encoder = lc3_swb_enc_init()) == NULL)
+		goto fail;
+	if ((lc3_swb->decoder = lc3_swb_dec_init()) == NULL)
+		goto fail;
+
+	ffb_rewind(&lc3_swb->data);
+	ffb_rewind(&lc3_swb->pcm);
+
+	lc3_swb->data_corrupted = 0;
+	lc3_swb->seq_initialized = false;
+	lc3_swb->seq_number = 0;
+	lc3_swb->frames = 0;
+
+	lc3_swb->initialized = true;
+	return 0;
+
+fail:
+	err = errno;
+	lc3_swb_finish(lc3_swb);
+	errno = err;
+	return -1;
+}
+
+void lc3_swb_finish(struct esco_lc3_swb *lc3_swb) {
+
+	if (lc3_swb == NULL)
+		return;
+
+	lc3_swb_enc_free(lc3_swb->encoder);
+	lc3_swb_dec_free(lc3_swb->decoder);
+	lc3_swb->encoder = NULL;
+	lc3_swb->decoder = NULL;
+
+	ffb_free(&lc3_swb->data);
+	ffb_free(&lc3_swb->pcm);
+
+	lc3_swb->initialized = false;
+
+}
+
+/**
+ * Decode single LC3 frame or conceal it with the LC3 PLC.
+ *
+ * @param payload LC3 frame payload. In case of concealment, it shall still
+ *   point to a valid memory, because LC3plus rejects NULL input.
+ * @param bfi If true, the frame is marked as bad and the PLC is used. */
+static int lc3_swb_decode_frame(struct esco_lc3_swb *lc3_swb,
+		const uint8_t *payload, bool bfi) {
+
+	int16_t *output[] = { lc3_swb->pcm.tail };
+	LC3PLUS_Error err;
+
+	if ((err = lc3plus_dec16(lc3_swb->decoder, (void *)payload,
+					bfi ? 0 : LC3_SWB_FRAMELEN, output, bfi)) == LC3PLUS_DECODE_ERROR)
+		warn("Corrupted LC3-SWB frame, loss concealment applied");
+	else if (err != LC3PLUS_OK) {
+		error("LC3-SWB decoding error: %s", lc3plus_strerror(err));
+		return -1;
+	}
+
+	ffb_seek(&lc3_swb->pcm, LC3_SWB_CODESAMPLES);
+	return 0;
+}
+
+/**
+ * Find and decode all complete eSCO LC3-SWB frames.
+ *
+ * @return On success this function returns the number of decoded (or
+ *   reconstructed with PLC) PCM samples. */
+ssize_t lc3_swb_decode(struct esco_lc3_swb *lc3_swb) {
+
+	if (!lc3_swb->initialized)
+		return -EINVAL;
+
+	const uint8_t *input = lc3_swb->data.data;
+	size_t input_len = ffb_blen_out(&lc3_swb->data);
+	size_t shift;
+	ssize_t rv = 0;
+
+	for (;;) {
+
+		const size_t tmp = input_len;
+		const esco_lc3_swb_frame_t *frame = msbc_find_h2_header(input, &input_len);
+		input += tmp - input_len;
+
+		const size_t output_len = ffb_blen_in(&lc3_swb->pcm);
+
+		/* Stop decoding if there is not enough input data or the output
+		 * buffer is not big enough to hold decoded PCM samples and PCM
+		 * samples reconstructed with PLC (up to 3 LC3 frames). */
+		if (input_len < sizeof(*frame) ||
+				output_len < LC3_SWB_CODESIZE * (1 + 3))
+			break;
+
+		esco_h2_header_t h2;
+		memcpy(&h2, frame, sizeof(h2));
+		h2 = le16toh(h2);
+
+		uint8_t _seq = (ESCO_H2_GET_SN1(h2) & 2) | (ESCO_H2_GET_SN0(h2) & 1);
+		if (!lc3_swb->seq_initialized) {
+			lc3_swb->seq_initialized = true;
+			lc3_swb->seq_number = _seq;
+		}
+		else if (_seq != ++lc3_swb->seq_number) {
+
+			uint8_t missing = (_seq + ESCO_H2_SN_MAX - lc3_swb->seq_number) % ESCO_H2_SN_MAX;
+			warn("Missing LC3-SWB packets (%u != %u): %u", _seq, lc3_swb->seq_number, missing);
+
+			lc3_swb->seq_number = _seq;
+
+			/* LC3 PLC has to be invoked once per every missing frame. */
+			while (missing--) {
+				if (lc3_swb_decode_frame(lc3_swb, frame->payload, true) == -1) {
+					rv = -EIO;
+					goto final;
+				}
+				rv += LC3_SWB_CODESAMPLES;
+			}
+
+		}
+
+		/* Frame received with errors shall be concealed with PLC. */
+		const bool corrupted =
+			(size_t)(input - (uint8_t *)lc3_swb->data.data) < lc3_swb->data_corrupted;
+
+		if (lc3_swb_decode_frame(lc3_swb, frame->payload, corrupted) == -1) {
+			rv = -EIO;
+			goto final;
+		}
+
+		input += sizeof(*frame);
+		input_len -= sizeof(*frame);
+		rv += LC3_SWB_CODESAMPLES;
+
+	}
+
+final:
+	/* Reshuffle remaining data to the beginning of the buffer. */
+	shift = input - (uint8_t *)lc3_swb->data.data;
+	lc3_swb->data_corrupted = lc3_swb->data_corrupted > shift ? lc3_swb->data_corrupted - shift : 0;
+	ffb_shift(&lc3_swb->data, shift);
+	return rv;
+}
+
+/**
+ * Encode single eSCO LC3-SWB frame. */
+ssize_t lc3_swb_encode(struct esco_lc3_swb *lc3_swb) {
+
+	if (!lc3_swb->initialized)
+		return -EINVAL;
+
+	int16_t *input = lc3_swb->pcm.data;
+	const size_t input_len = ffb_blen_out(&lc3_swb->pcm);
+	esco_lc3_swb_frame_t *frame = (esco_lc3_swb_frame_t *)lc3_swb->data.tail;
+	size_t output_len = ffb_blen_in(&lc3_swb->data);
+
+	/* Skip encoding if there is not enough PCM samples or the output
+	 * buffer is not big enough to hold whole eSCO LC3-SWB frame.*/
+	if (input_len < LC3_SWB_CODESIZE ||
+			output_len < sizeof(*frame))
+		return 0;
+
+	int16_t *input_buffers[] = { input };
+	LC3PLUS_Error err;
+	int encoded;
+
+	if ((err = lc3plus_enc16(lc3_swb->encoder, input_buffers,
+					frame->payload, &encoded)) != LC3PLUS_OK) {
+		error("LC3-SWB encoding error: %s", lc3plus_strerror(err));
+		return -EIO;
+	}
+
+	const uint8_t n = lc3_swb->seq_number++;
+	frame->header = htole16(ESCO_H2_PACK_SEQ(n));
+
+	ffb_seek(&lc3_swb->data, sizeof(*frame));
+	lc3_swb->frames++;
+
+	/* Reshuffle remaining PCM data to the beginning of the buffer. */
+	ffb_shift(&lc3_swb->pcm, LC3_SWB_CODESAMPLES);
+
+	return sizeof(*frame);
+}
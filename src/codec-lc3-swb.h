@@ -0,0 +1,78 @@
+/*
+ * BlueALSA - codec-lc3-swb.h
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_CODECLC3SWB_H_
+#define BLUEALSA_CODECLC3SWB_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <lc3.h>
+
+#include "codec-msbc.h"
+#include "shared/ffb.h"
+
+/* LC3-SWB uses 7.5 ms frames at 32 kHz sampling frequency. The bitrate is
+ * fixed, so the single LC3 frame together with the H2 header fits exactly
+ * into the 60 bytes eSCO transparent packet. */
+#define LC3_SWB_SAMPLING    32000
+#define LC3_SWB_FRAME_DMS   75
+#define LC3_SWB_CODESAMPLES 240
+#define LC3_SWB_CODESIZE    (LC3_SWB_CODESAMPLES * sizeof(int16_t))
+#define LC3_SWB_FRAMELEN    58
+
+typedef struct esco_lc3_swb_frame {
+	esco_h2_header_t header;
+	uint8_t payload[LC3_SWB_FRAMELEN];
+} __attribute__ ((packed)) esco_lc3_swb_frame_t;
+
+struct esco_lc3_swb {
+
+	/* encoder/decoder */
+	LC3PLUS_Enc *encoder;
+	LC3PLUS_Dec *decoder;
+
+	/* buffer for eSCO frames */
+	ffb_t data;
+	/* Number of bytes at the beginning of the data buffer which were reported
+	 * by the HCI as corrupted. Frames overlapping this region are concealed
+	 * with the LC3 PLC instead of being decoded. */
+	size_t data_corrupted;
+	/* buffer for PCM samples */
+	ffb_t pcm;
+
+	uint8_t seq_initialized : 1;
+	uint8_t seq_number : 2;
+	/* number of processed frames */
+	size_t frames;
+
+	/* Determine whether structure has been initialized. This field is
+	 * used for reinitialization - it makes lc3_swb_init() idempotent. */
+	bool initialized;
+
+};
+
+int lc3_swb_load(void);
+int lc3_swb_probe(void);
+
+int lc3_swb_init(struct esco_lc3_swb *lc3_swb);
+void lc3_swb_finish(struct esco_lc3_swb *lc3_swb);
+
+ssize_t lc3_swb_decode(struct esco_lc3_swb *lc3_swb);
+ssize_t lc3_swb_encode(struct esco_lc3_swb *lc3_swb);
+
+#endif
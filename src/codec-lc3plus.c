@@ -0,0 +1,81 @@
+/*
+ * BlueALSA - codec-lc3plus.c
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "codec-lc3plus.h"
+
+#include <stddef.h>
+
+#if ENABLE_CODEC_DLOPEN
+
+CODEC_DL_SYMBOL_DEFINE(lc3plus_channels_supported)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_dec16)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_dec24)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_dec_get_output_samples)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_dec_get_size)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_dec_init)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_dec_set_frame_ms)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_dec_set_hrmode)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_enc16)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_enc24)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_enc_get_input_samples)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_enc_get_num_bytes)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_enc_get_size)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_enc_init)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_enc_set_bitrate)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_enc_set_frame_ms)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_enc_set_hrmode)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_free_decoder_structs)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_free_encoder_structs)
+CODEC_DL_SYMBOL_DEFINE(lc3plus_samplerate_supported)
+static const char * const lc3plus_dl_names[] = {
+	"libLC3plus.so.1",
+	"libLC3plus.so",
+	NULL,
+};
+static const struct codec_dl_symbol lc3plus_dl_symbols[] = {
+	CODEC_DL_SYMBOL(lc3plus_channels_supported),
+	CODEC_DL_SYMBOL(lc3plus_dec16),
+	CODEC_DL_SYMBOL(lc3plus_dec24),
+	CODEC_DL_SYMBOL(lc3plus_dec_get_output_samples),
+	CODEC_DL_SYMBOL(lc3plus_dec_get_size),
+	CODEC_DL_SYMBOL(lc3plus_dec_init),
+	CODEC_DL_SYMBOL(lc3plus_dec_set_frame_ms),
+	CODEC_DL_SYMBOL(lc3plus_dec_set_hrmode),
+	CODEC_DL_SYMBOL(lc3plus_enc16),
+	CODEC_DL_SYMBOL(lc3plus_enc24),
+	CODEC_DL_SYMBOL(lc3plus_enc_get_input_samples),
+	CODEC_DL_SYMBOL(lc3plus_enc_get_num_bytes),
+	CODEC_DL_SYMBOL(lc3plus_enc_get_size),
+	CODEC_DL_SYMBOL(lc3plus_enc_init),
+	CODEC_DL_SYMBOL(lc3plus_enc_set_bitrate),
+	CODEC_DL_SYMBOL(lc3plus_enc_set_frame_ms),
+	CODEC_DL_SYMBOL(lc3plus_enc_set_hrmode),
+	CODEC_DL_SYMBOL(lc3plus_free_decoder_structs),
+	CODEC_DL_SYMBOL(lc3plus_free_encoder_structs),
+	CODEC_DL_SYMBOL(lc3plus_samplerate_supported),
+	{ 0 },
+};
+static struct codec_dl lc3plus_dl = CODEC_DL_INIT(lc3plus_dl_names, lc3plus_dl_symbols);
+
+#endif
+
+/**
+ * Make sure that the LC3plus library is available.
+ *
+ * The library is shared by the A2DP LC3plus codec and the LC3-SWB codec
+ * for HFP, so it is loaded (and all symbols used by both codecs are
+ * resolved) only once. */
+int codec_lc3plus_load(void) {
+#if ENABLE_CODEC_DLOPEN
+	return codec_dl_load(&lc3plus_dl);
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,70 @@
+/*
+ * BlueALSA - codec-lc3plus.h
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_CODECLC3PLUS_H_
+#define BLUEALSA_CODECLC3PLUS_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <lc3.h>
+
+#if ENABLE_CODEC_DLOPEN
+
+#include "codec-dl.h"
+
+CODEC_DL_SYMBOL_EXTERN(lc3plus_channels_supported)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_dec16)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_dec24)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_dec_get_output_samples)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_dec_get_size)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_dec_init)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_dec_set_frame_ms)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_dec_set_hrmode)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_enc16)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_enc24)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_enc_get_input_samples)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_enc_get_num_bytes)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_enc_get_size)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_enc_init)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_enc_set_bitrate)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_enc_set_frame_ms)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_enc_set_hrmode)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_free_decoder_structs)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_free_encoder_structs)
+CODEC_DL_SYMBOL_EXTERN(lc3plus_samplerate_supported)
+# define lc3plus_channels_supported codec_dl_lc3plus_channels_supported
+# define lc3plus_dec16 codec_dl_lc3plus_dec16
+# define lc3plus_dec24 codec_dl_lc3plus_dec24
+# define lc3plus_dec_get_output_samples codec_dl_lc3plus_dec_get_output_samples
+# define lc3plus_dec_get_size codec_dl_lc3plus_dec_get_size
+# define lc3plus_dec_init codec_dl_lc3plus_dec_init
+# define lc3plus_dec_set_frame_ms codec_dl_lc3plus_dec_set_frame_ms
+# define lc3plus_dec_set_hrmode codec_dl_lc3plus_dec_set_hrmode
+# define lc3plus_enc16 codec_dl_lc3plus_enc16
+# define lc3plus_enc24 codec_dl_lc3plus_enc24
+# define lc3plus_enc_get_input_samples codec_dl_lc3plus_enc_get_input_samples
+# define lc3plus_enc_get_num_bytes codec_dl_lc3plus_enc_get_num_bytes
+# define lc3plus_enc_get_size codec_dl_lc3plus_enc_get_size
+# define lc3plus_enc_init codec_dl_lc3plus_enc_init
+# define lc3plus_enc_set_bitrate codec_dl_lc3plus_enc_set_bitrate
+# define lc3plus_enc_set_frame_ms codec_dl_lc3plus_enc_set_frame_ms
+# define lc3plus_enc_set_hrmode codec_dl_lc3plus_enc_set_hrmode
+# define lc3plus_free_decoder_structs codec_dl_lc3plus_free_decoder_structs
+# define lc3plus_free_encoder_structs codec_dl_lc3plus_free_encoder_structs
+# define lc3plus_samplerate_supported codec_dl_lc3plus_samplerate_supported
+
+#endif
+
+int codec_lc3plus_load(void);
+
+#endif
@@ -40,13 +40,17 @@ static const uint8_t sn[][2] = {
 /**
  * Find H2 synchronization header within eSCO transparent data.
  *
+ * In order to speed up the search on a misaligned stream, candidates for
+ * the H2 header are located with memchr() - which is vectorized in every
+ * decent C library - by looking for the lower byte of the sync word.
+ *
  * @param data Memory area with the eSCO transparent data.
  * @param len Address from where the length of the eSCO transparent data
  *   is read. Upon exit, the remaining length of the eSCO data will be
  *   stored in this variable (received length minus scanned length).
  * @return On success this function returns address of the first occurrence
  *   of the H2 synchronization header. Otherwise, it returns NULL. */
-static void *msbc_find_h2_header(const void *data, size_t *len) {
+void *msbc_find_h2_header(const void *data, size_t *len) {
 
 	const uint8_t *_data = data;
 	size_t _len = *len;
@@ -54,6 +58,17 @@ static void *msbc_find_h2_header(const void *data, size_t *len) {
 
 	while (_len >= sizeof(esco_h2_header_t)) {
 
+		/* The last byte can not start the H2 header, so skip it. */
+		const uint8_t *tmp;
+		if ((tmp = memchr(_data, ESCO_H2_SYNCWORD & 0xFF, _len - 1)) == NULL) {
+			_data += _len - 1;
+			_len = 1;
+			break;
+		}
+
+		_len -= tmp - _data;
+		_data = tmp;
+
 		esco_h2_header_t h2;
 		memcpy(&h2, _data, sizeof(h2));
 		h2 = le16toh(h2);
@@ -110,6 +125,7 @@ int msbc_init(struct esco_msbc *msbc) {
 	ffb_rewind(&msbc->data);
 	ffb_rewind(&msbc->pcm);
 
+	msbc->data_corrupted = 0;
 	msbc->seq_initialized = false;
 	msbc->seq_number = 0;
 	msbc->frames = 0;
@@ -142,7 +158,14 @@ void msbc_finish(struct esco_msbc *msbc) {
 }
 
 /**
- * Find and decode single eSCO mSBC frame. */
+ * Find and decode all complete eSCO mSBC frames.
+ *
+ * Frames are decoded as long as there is enough space in the PCM buffer.
+ * Undecoded data is moved to the beginning of the data buffer once, after
+ * all frames have been processed.
+ *
+ * @return On success this function returns the number of decoded (or
+ *   reconstructed with PLC) PCM samples. */
 ssize_t msbc_decode(struct esco_msbc *msbc) {
 
 	if (!msbc->initialized)
@@ -150,77 +173,101 @@ ssize_t msbc_decode(struct esco_msbc *msbc) {
 
 	const uint8_t *input = msbc->data.data;
 	size_t input_len = ffb_blen_out(&msbc->data);
-	size_t output_len = ffb_blen_in(&msbc->pcm);
+	size_t shift;
 	ssize_t rv = 0;
 
-	const size_t tmp = input_len;
-	const esco_msbc_frame_t *frame = msbc_find_h2_header(input, &input_len);
-	input += tmp - input_len;
-
-	/* Skip decoding if there is not enough input data or the output
-	 * buffer is not big enough to hold decoded PCM samples and PCM
-	 * samples reconstructed with PLC (up to 3 mSBC frames). */
-	if (input_len < sizeof(*frame) ||
-			output_len < MSBC_CODESIZE * (1 + 3))
-		goto final;
-
-	esco_h2_header_t h2;
-	memcpy(&h2, frame, sizeof(h2));
-	h2 = le16toh(h2);
-
-	uint8_t _seq = (ESCO_H2_GET_SN1(h2) & 2) | (ESCO_H2_GET_SN0(h2) & 1);
-	if (!msbc->seq_initialized) {
-		msbc->seq_initialized = true;
-		msbc->seq_number = _seq;
-	}
-	else if (_seq != ++msbc->seq_number) {
+	for (;;) {
+
+		const size_t tmp = input_len;
+		const esco_msbc_frame_t *frame = msbc_find_h2_header(input, &input_len);
+		input += tmp - input_len;
 
-		/* In case of missing mSBC frames (we can detect up to 3 consecutive
-		 * missing frames) use PLC for PCM samples reconstruction. */
+		const size_t output_len = ffb_blen_in(&msbc->pcm);
 
-		uint8_t missing = (_seq + ESCO_H2_SN_MAX - msbc->seq_number) % ESCO_H2_SN_MAX;
-		warn("Missing mSBC packets (%u != %u): %u", _seq, msbc->seq_number, missing);
+		/* Stop decoding if there is not enough input data or the output
+		 * buffer is not big enough to hold decoded PCM samples and PCM
+		 * samples reconstructed with PLC (up to 3 mSBC frames). */
+		if (input_len < sizeof(*frame) ||
+				output_len < MSBC_CODESIZE * (1 + 3))
+			break;
 
-		msbc->seq_number = _seq;
+		esco_h2_header_t h2;
+		memcpy(&h2, frame, sizeof(h2));
+		h2 = le16toh(h2);
 
-		plc_fillin(&msbc->plc, msbc->pcm.tail, missing * MSBC_CODESAMPLES);
-		ffb_seek(&msbc->pcm, missing * MSBC_CODESAMPLES);
-		rv += missing * MSBC_CODESAMPLES;
+		uint8_t _seq = (ESCO_H2_GET_SN1(h2) & 2) | (ESCO_H2_GET_SN0(h2) & 1);
+		if (!msbc->seq_initialized) {
+			msbc->seq_initialized = true;
+			msbc->seq_number = _seq;
+		}
+		else if (_seq != ++msbc->seq_number) {
 
-	}
+			/* In case of missing mSBC frames (we can detect up to 3 consecutive
+			 * missing frames) use PLC for PCM samples reconstruction. */
 
-	ssize_t len;
-	if ((len = sbc_decode(&msbc->sbc, frame->payload, sizeof(frame->payload),
-					msbc->pcm.tail, output_len, NULL)) < 0) {
+			uint8_t missing = (_seq + ESCO_H2_SN_MAX - msbc->seq_number) % ESCO_H2_SN_MAX;
+			warn("Missing mSBC packets (%u != %u): %u", _seq, msbc->seq_number, missing);
+
+			msbc->seq_number = _seq;
 
-		/* Move forward one byte to avoid getting stuck in
-		 * decoding the same mSBC packet all over again. */
-		input += 1;
+			plc_fillin(&msbc->plc, msbc->pcm.tail, missing * MSBC_CODESAMPLES);
+			ffb_seek(&msbc->pcm, missing * MSBC_CODESAMPLES);
+			rv += missing * MSBC_CODESAMPLES;
+
+		}
+
+		if ((size_t)(input - (uint8_t *)msbc->data.data) < msbc->data_corrupted) {
+
+			/* Frame was received with errors. Decoding it might produce audible
+			 * artifacts even though it is a valid SBC frame, so use PLC instead. */
+
+			debug("Concealing corrupted mSBC frame");
+			plc_fillin(&msbc->plc, msbc->pcm.tail, MSBC_CODESAMPLES);
+			ffb_seek(&msbc->pcm, MSBC_CODESAMPLES);
+			input += sizeof(*frame);
+			input_len -= sizeof(*frame);
+			rv += MSBC_CODESAMPLES;
+
+			continue;
+		}
+
+		ssize_t len;
+		if ((len = sbc_decode(&msbc->sbc, frame->payload, sizeof(frame->payload),
+						msbc->pcm.tail, ffb_blen_in(&msbc->pcm), NULL)) < 0) {
+
+			/* Move forward one byte to avoid getting stuck in
+			 * decoding the same mSBC packet all over again. */
+			input += 1;
+			input_len -= 1;
 
 #if MSBC_DECODE_ERROR_PLC
 
-		warn("Couldn't decode mSBC frame: %s", sbc_strerror(len));
-		plc_fillin(&msbc->plc, msbc->pcm.tail, MSBC_CODESAMPLES);
-		ffb_seek(&msbc->pcm, MSBC_CODESAMPLES);
-		rv += MSBC_CODESAMPLES;
+			warn("Couldn't decode mSBC frame: %s", sbc_strerror(len));
+			plc_fillin(&msbc->plc, msbc->pcm.tail, MSBC_CODESAMPLES);
+			ffb_seek(&msbc->pcm, MSBC_CODESAMPLES);
+			rv += MSBC_CODESAMPLES;
 
+			continue;
 #else
-		rv = len;
+			rv = len;
+			break;
 #endif
+		}
 
-		goto final;
-	}
+		/* record PCM history and blend new data after PLC */
+		plc_rx(&msbc->plc, msbc->pcm.tail, MSBC_CODESAMPLES);
 
-	/* record PCM history and blend new data after PLC */
-	plc_rx(&msbc->plc, msbc->pcm.tail, MSBC_CODESAMPLES);
+		ffb_seek(&msbc->pcm, MSBC_CODESAMPLES);
+		input += sizeof(*frame);
+		input_len -= sizeof(*frame);
+		rv += MSBC_CODESAMPLES;
 
-	ffb_seek(&msbc->pcm, MSBC_CODESAMPLES);
-	input += sizeof(*frame);
-	rv += MSBC_CODESAMPLES;
+	}
 
-final:
 	/* Reshuffle remaining data to the beginning of the buffer. */
-	ffb_shift(&msbc->data, input - (uint8_t *)msbc->data.data);
+	shift = input - (uint8_t *)msbc->data.data;
+	msbc->data_corrupted = msbc->data_corrupted > shift ? msbc->data_corrupted - shift : 0;
+	ffb_shift(&msbc->data, shift);
 	return rv;
 }
 
@@ -41,6 +41,8 @@
  * duplicated) into the 16-bit eSCO H2 header. Note, that after packing,
  * the H2 header value has to be converted to little-endian. */
 #define ESCO_H2_PACK(sn0, sn1) (ESCO_H2_SYNCWORD | (sn0) << 12 | (sn1) << 14)
+/* Pack 2-bit sequence number into the 16-bit eSCO H2 header. */
+#define ESCO_H2_PACK_SEQ(seq) ESCO_H2_PACK(((seq) & 1) * 3, (((seq) >> 1) & 1) * 3)
 
 typedef uint16_t esco_h2_header_t;
 typedef struct esco_msbc_frame {
@@ -56,6 +58,10 @@ struct esco_msbc {
 
 	/* buffer for eSCO frames */
 	ffb_t data;
+	/* Number of bytes at the beginning of the data buffer which were reported
+	 * by the HCI as corrupted. Frames overlapping this region are concealed
+	 * with PLC instead of being decoded. */
+	size_t data_corrupted;
 	/* buffer for PCM samples */
 	ffb_t pcm;
 
@@ -73,6 +79,8 @@ struct esco_msbc {
 
 };
 
+void *msbc_find_h2_header(const void *data, size_t *len);
+
 int msbc_init(struct esco_msbc *msbc);
 void msbc_finish(struct esco_msbc *msbc);
 
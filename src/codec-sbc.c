@@ -12,6 +12,7 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <glib.h>
 #include <sbc/sbc.h>
@@ -108,6 +109,39 @@ uint8_t sbc_a2dp_get_bitpool(const a2dp_sbc_t *conf, unsigned int quality) {
 	return MIN(MAX(conf->min_bitpool, bitpool), conf->max_bitpool);
 }
 
+/**
+ * Get the SBC bit-pool which fits within the given bitrate budget.
+ *
+ * @param sbc Initialized SBC structure with encoding parameters.
+ * @param min_bitpool The lowest allowed bit-pool value.
+ * @param max_bitpool The highest allowed bit-pool value.
+ * @param bitrate The bitrate budget in bits per second. If zero, the
+ *   highest allowed bit-pool value is returned.
+ * @return The highest bit-pool value within the [min_bitpool, max_bitpool]
+ *   range for which the SBC bitrate does not exceed the budget. If there is
+ *   no such value, the min_bitpool is returned. */
+uint8_t sbc_get_bitpool_for_bitrate(const sbc_t *sbc, uint8_t min_bitpool,
+		uint8_t max_bitpool, unsigned int bitrate) {
+
+	if (bitrate == 0)
+		return max_bitpool;
+
+	/* The copy shares the private data with the original structure, but
+	 * libsbc functions used below do not modify it. */
+	sbc_t tmp = *sbc;
+
+	const unsigned int duration = sbc_get_frame_duration(&tmp);
+	uint8_t bitpool;
+
+	for (bitpool = max_bitpool; bitpool > min_bitpool; bitpool--) {
+		tmp.bitpool = bitpool;
+		if (8ULL * sbc_get_frame_length(&tmp) * 1000000 / duration <= bitrate)
+			break;
+	}
+
+	return bitpool;
+}
+
 #if ENABLE_FASTSTREAM
 /**
  * Initialize SBC audio codec for A2DP FastStream connection.
@@ -194,6 +228,60 @@ int sbc_reinit_msbc(sbc_t *sbc, unsigned long flags) {
 }
 #endif
 
+/**
+ * Encode SBC frames of digital silence.
+ *
+ * Frames are encoded by a temporary encoder instance with the same
+ * parameters as the given one, so the state of the stream encoder is
+ * not affected and the result can be reused at any point of the stream.
+ *
+ * @param sbc Initialized SBC structure with encoding parameters.
+ * @param frames The number of SBC frames to encode.
+ * @param buffer Buffer for encoded SBC frames.
+ * @param size Size of the buffer.
+ * @return On success this function returns the number of bytes written
+ *   to the buffer. Otherwise, a negative error value is returned. */
+ssize_t sbc_encode_silence(const sbc_t *sbc, size_t frames,
+		void *buffer, size_t size) {
+
+	/* enough for 16 blocks, 8 subbands and 2 channels */
+	static const int16_t silence[16 * 8 * 2] = { 0 };
+
+	sbc_t tmp;
+	ssize_t rv;
+	if ((rv = sbc_init(&tmp, 0)) != 0)
+		return rv;
+
+	tmp.frequency = sbc->frequency;
+	tmp.blocks = sbc->blocks;
+	tmp.subbands = sbc->subbands;
+	tmp.mode = sbc->mode;
+	tmp.allocation = sbc->allocation;
+	tmp.bitpool = sbc->bitpool;
+	tmp.endian = sbc->endian;
+
+	const size_t codesize = sbc_get_codesize(&tmp);
+	if (codesize > sizeof(silence)) {
+		rv = -EINVAL;
+		goto final;
+	}
+
+	uint8_t *tail = buffer;
+	for (size_t i = 0; i < frames; i++) {
+		ssize_t encoded;
+		if ((rv = sbc_encode(&tmp, silence, codesize, tail, size, &encoded)) < 0)
+			goto final;
+		tail += encoded;
+		size -= encoded;
+	}
+
+	rv = tail - (uint8_t *)buffer;
+
+final:
+	sbc_finish(&tmp);
+	return rv;
+}
+
 /**
  * Get string representation of the SBC encode/decode error.
  *
@@ -19,6 +19,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include <sbc/sbc.h>
 
@@ -31,6 +32,8 @@
 #define SBC_QUALITY_XQPLUS 4
 
 uint8_t sbc_a2dp_get_bitpool(const a2dp_sbc_t *conf, unsigned int quality);
+uint8_t sbc_get_bitpool_for_bitrate(const sbc_t *sbc, uint8_t min_bitpool,
+		uint8_t max_bitpool, unsigned int bitrate);
 
 #if ENABLE_FASTSTREAM
 int sbc_init_a2dp_faststream(sbc_t *sbc, unsigned long flags,
@@ -41,6 +44,9 @@ int sbc_init_a2dp_faststream(sbc_t *sbc, unsigned long flags,
 int sbc_reinit_msbc(sbc_t *sbc, unsigned long flags);
 #endif
 
+ssize_t sbc_encode_silence(const sbc_t *sbc, size_t frames,
+		void *buffer, size_t size);
+
 const char *sbc_strerror(int err);
 
 #if DEBUG
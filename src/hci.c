@@ -13,6 +13,7 @@
 #include <errno.h>
 #include <poll.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -144,6 +145,92 @@ unsigned int hci_sco_get_mtu(int sco_fd, int hci_type) {
 	return options.mtu;
 }
 
+/**
+ * Enable SCO packet status reporting for given SCO socket.
+ *
+ * When enabled, every SCO packet read with recvmsg() is accompanied by the
+ * BT_SCM_PKT_STATUS control message which carries the HCI packet status flag
+ * reported by the controller (e.g. possibly invalid data or data lost).
+ *
+ * @param sco_fd File descriptor of opened SCO socket.
+ * @return On success this function returns 0. Otherwise, -1 is returned and
+ *   errno is set to indicate the error. */
+int hci_sco_enable_pkt_status(int sco_fd) {
+	const int enable = 1;
+	return setsockopt(sco_fd, SOL_BLUETOOTH, BT_PKT_STATUS, &enable, sizeof(enable));
+}
+
+/**
+ * Get the handle of the ACL connection with the given Bluetooth device.
+ *
+ * @param dd The HCI device descriptor.
+ * @param ba Address of the remote Bluetooth device.
+ * @param handle Pointer to the variable for the connection handle.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int hci_acl_get_handle(int dd, const bdaddr_t *ba, uint16_t *handle) {
+
+	uint8_t buffer[sizeof(struct hci_conn_info_req) + sizeof(struct hci_conn_info)];
+	struct hci_conn_info_req *cr = (struct hci_conn_info_req *)buffer;
+
+	memset(buffer, 0, sizeof(buffer));
+	bacpy(&cr->bdaddr, ba);
+	cr->type = ACL_LINK;
+
+	if (ioctl(dd, HCIGETCONNINFO, cr) == -1)
+		return -1;
+
+	*handle = cr->conn_info->handle;
+	return 0;
+}
+
+/**
+ * Read link quality parameters of the ACL connection.
+ *
+ * @param dd The HCI device descriptor.
+ * @param handle The ACL connection handle.
+ * @param info Pointer to the link info structure for output data.
+ * @param to Timeout in milliseconds of every HCI command.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int hci_acl_read_link_info(int dd, uint16_t handle, struct hci_link_info *info, int to) {
+
+	if (hci_read_rssi(dd, htobs(handle), &info->rssi, to) == -1)
+		return -1;
+	if (hci_read_link_quality(dd, htobs(handle), &info->quality, to) == -1)
+		return -1;
+
+	/* The read_failed_contact_counter_rp structure defined in the BlueZ
+	 * library has one byte counter, but according to the specification
+	 * the counter is a two-octet value. */
+	struct __attribute__ ((packed)) {
+		uint8_t status;
+		uint16_t handle;
+		uint16_t counter;
+	} rp;
+
+	uint16_t cp_handle = htobs(handle);
+	struct hci_request rq = {
+		.ogf = OGF_STATUS_PARAM,
+		.ocf = OCF_READ_FAILED_CONTACT_COUNTER,
+		.cparam = &cp_handle,
+		.clen = sizeof(cp_handle),
+		.rparam = &rp,
+		.rlen = sizeof(rp),
+	};
+
+	if (hci_send_req(dd, &rq, to) < 0)
+		return -1;
+
+	if (rp.status) {
+		errno = EIO;
+		return -1;
+	}
+
+	info->failed_contacts = btohs(rp.counter);
+	return 0;
+}
+
 /**
  * Broadcom vendor HCI command for reading SCO routing configuration. */
 int hci_bcm_read_sco_pcm_params(int dd, uint8_t *routing, uint8_t *clock,
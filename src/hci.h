@@ -47,9 +47,40 @@ int hci_get_version(int dev_id, struct hci_version *ver);
  * close(2) and connect(2) calls. */
 #define HCI_SCO_CLOSE_CONNECT_QUIRK_DELAY 300
 
+/* Socket option and control message type used by the kernel for passing
+ * SCO packet status to the user space (available since Linux 5.14). */
+#ifndef BT_PKT_STATUS
+# define BT_PKT_STATUS 16
+#endif
+#ifndef BT_SCM_PKT_STATUS
+# define BT_SCM_PKT_STATUS 0x03
+#endif
+
+/**
+ * HCI synchronous data packet status flag. */
+#define HCI_SCO_PKT_STATUS_CORRECT 0x0
+#define HCI_SCO_PKT_STATUS_INVALID 0x1
+#define HCI_SCO_PKT_STATUS_NO_DATA 0x2
+#define HCI_SCO_PKT_STATUS_PARTIAL 0x3
+
 int hci_sco_open(int dev_id);
 int hci_sco_connect(int sco_fd, const bdaddr_t *ba, uint16_t voice);
 unsigned int hci_sco_get_mtu(int sco_fd, int hci_type);
+int hci_sco_enable_pkt_status(int sco_fd);
+
+/**
+ * Link quality parameters of the ACL connection. */
+struct hci_link_info {
+	/* RSSI relative to the golden receive power range in dB */
+	int8_t rssi;
+	/* vendor specific link quality in the range [0, 255] */
+	uint8_t quality;
+	/* number of consecutive failed contacts */
+	uint16_t failed_contacts;
+};
+
+int hci_acl_get_handle(int dd, const bdaddr_t *ba, uint16_t *handle);
+int hci_acl_read_link_info(int dd, uint16_t handle, struct hci_link_info *info, int to);
 
 #define BT_BCM_PARAM_ROUTING_PCM       0x0
 #define BT_BCM_PARAM_ROUTING_TRANSPORT 0x1
@@ -19,6 +19,7 @@
 #define HFP_CODEC_UNDEFINED 0x00
 #define HFP_CODEC_CVSD      0x01
 #define HFP_CODEC_MSBC      0x02
+#define HFP_CODEC_LC3_SWB   0x03
 
 /* SDP AG feature flags */
 #define SDP_HFP_AG_FEAT_TWC    (1 << 0)
@@ -27,6 +28,7 @@
 #define SDP_HFP_AG_FEAT_RING   (1 << 3)
 #define SDP_HFP_AG_FEAT_VTAG   (1 << 4)
 #define SDP_HFP_AG_FEAT_WBAND  (1 << 5)
+#define SDP_HFP_AG_FEAT_SWBAND (1 << 8)
 
 /* SDP HF feature flags */
 #define SDP_HFP_HF_FEAT_ECNR   (1 << 0)
@@ -35,6 +37,7 @@
 #define SDP_HFP_HF_FEAT_VREC   (1 << 3)
 #define SDP_HFP_HF_FEAT_VOLUME (1 << 4)
 #define SDP_HFP_HF_FEAT_WBAND  (1 << 5)
+#define SDP_HFP_HF_FEAT_SWBAND (1 << 8)
 
 /* AG feature flags */
 #define HFP_AG_FEAT_3WC    (1 << 0)
@@ -0,0 +1,375 @@
+/*
+ * BlueALSA - io-pipeline.c
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "io-pipeline.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "thread-policy.h"
+#include "thread-stats.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+#include "shared/trace.h"
+
+/**
+ * The number of slots in the frame queue.
+ *
+ * Every BT packet and every rate sync marker occupies one slot, so this
+ * value allows to queue at least 8 BT packets. */
+#define IO_PIPELINE_SLOTS 16
+
+/**
+ * Wait until the ring buffer position changes from the given value.
+ *
+ * The waiting flag is raised before the final check of the position, so
+ * the other side will either see the flag and send notification or we
+ * will see the updated position.
+ *
+ * Note:
+ * This function temporally re-enables thread cancellation! */
+static void io_pipeline_wait(
+		int fd,
+		atomic_bool *waiting,
+		const atomic_size_t *position,
+		size_t value) {
+
+	atomic_store(waiting, true);
+
+	if (atomic_load(position) == value) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		poll(&pfd, 1, -1);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	}
+
+	atomic_store(waiting, false);
+
+	eventfd_t tmp;
+	eventfd_read(fd, &tmp);
+
+}
+
+/**
+ * Notify the other side of the ring buffer if it is waiting. */
+static void io_pipeline_notify(
+		int fd,
+		atomic_bool *waiting) {
+	if (atomic_load(waiting))
+		eventfd_write(fd, 1);
+}
+
+static void io_pipeline_sender_cleanup(struct io_pipeline *p) {
+	/* Wake up producer which might wait for a free slot, so it
+	 * will be able to notice that the sender has terminated. */
+	eventfd_write(p->event_free, 1);
+}
+
+static void *io_pipeline_sender(struct io_pipeline *p) {
+
+	thread_policy_apply(THREAD_CLASS_ENCODER);
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(io_pipeline_sender_cleanup), p);
+
+	for (;;) {
+
+		const size_t tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+		while (atomic_load_explicit(&p->head, memory_order_acquire) == tail)
+			io_pipeline_wait(p->event_used, &p->wait_used, &p->head, tail);
+
+		struct io_pipeline_slot *slot = &p->slots[tail % p->slots_len];
+
+		if (slot->resync != 0)
+			asrsync_init(&p->asrs, slot->resync);
+
+		if (slot->len > 0) {
+
+			trace(bt_dequeue, p->th->t, slot->seq);
+
+			ssize_t ret;
+			if ((ret = io_bt_write(p->th, slot->data, slot->len)) <= 0) {
+				p->status_errno = errno;
+				atomic_store(&p->status, ret);
+				break;
+			}
+
+			atomic_fetch_sub_explicit(&p->queued_bytes, slot->len, memory_order_relaxed);
+
+		}
+
+		if (slot->frames > 0) {
+
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+			asrsync_sync(&p->asrs, slot->frames);
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+			atomic_fetch_sub_explicit(&p->queued_frames, slot->frames, memory_order_relaxed);
+			atomic_store_explicit(&p->busy_usec, asrsync_get_busy_usec(&p->asrs),
+					memory_order_relaxed);
+			/* The statistics structure is owned by the encoder thread, so
+			 * only the (atomic) busy time histogram can be updated here. */
+			thread_stats_hist_add(&p->th->stats.busy, asrsync_get_busy_usec(&p->asrs));
+
+		}
+
+		atomic_store(&p->tail, tail + 1);
+		atomic_fetch_sub(&p->th->pipeline_queued, 1);
+		io_pipeline_notify(p->event_free, &p->wait_free);
+
+	}
+
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+/**
+ * Start the sender thread of the encoder pipeline.
+ *
+ * Before calling this function, the th field of the pipeline structure
+ * shall be set to the transport thread which owns the pipeline.
+ *
+ * @param p The pipeline structure.
+ * @param slot_size The maximal size of a single BT packet.
+ * @return On success this function returns 0. Otherwise -1 is returned
+ *   and errno is set appropriately. */
+int io_pipeline_start(
+		struct io_pipeline *p,
+		size_t slot_size) {
+
+	uint8_t *data;
+	int err;
+
+	const size_t slots_len = IO_PIPELINE_SLOTS;
+	if ((p->slots = calloc(slots_len, sizeof(*p->slots) + slot_size)) == NULL)
+		return -1;
+
+	data = (uint8_t *)&p->slots[slots_len];
+	for (size_t i = 0; i < slots_len; i++)
+		p->slots[i].data = &data[i * slot_size];
+
+	p->slots_len = slots_len;
+	p->slot_size = slot_size;
+	p->head = p->tail = 0;
+	p->wait_free = p->wait_used = false;
+	p->seq = 0;
+	p->status = 1;
+	p->queued_bytes = 0;
+	p->queued_frames = 0;
+	p->busy_usec = 0;
+
+	p->event_free = p->event_used = -1;
+	if ((p->event_free = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+			(p->event_used = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		goto fail;
+
+	if ((err = pthread_create(&p->sender, NULL,
+					PTHREAD_ROUTINE(io_pipeline_sender), p)) != 0) {
+		errno = err;
+		goto fail;
+	}
+
+	pthread_setname_np(p->sender, "ba-io-sender");
+	p->running = true;
+
+	return 0;
+
+fail:
+	err = errno;
+	if (p->event_free != -1)
+		close(p->event_free);
+	if (p->event_used != -1)
+		close(p->event_used);
+	free(p->slots);
+	p->slots = NULL;
+	errno = err;
+	return -1;
+}
+
+/**
+ * Stop the sender thread and release pipeline resources.
+ *
+ * This function can be used as a pthread cleanup handler. It is safe to
+ * call it on a pipeline which has not been started. */
+void io_pipeline_free(
+		struct io_pipeline *p) {
+
+	if (!p->running)
+		return;
+
+	pthread_cancel(p->sender);
+	pthread_join(p->sender, NULL);
+	p->running = false;
+
+	/* discard entries which have not been processed by the sender */
+	atomic_store(&p->th->pipeline_queued, 0);
+
+	close(p->event_free);
+	close(p->event_used);
+	free(p->slots);
+	p->slots = NULL;
+
+}
+
+/**
+ * Get the next free slot of the frame queue.
+ *
+ * Note:
+ * This function temporally re-enables thread cancellation! */
+static struct io_pipeline_slot *io_pipeline_slot_get(
+		struct io_pipeline *p) {
+
+	const size_t head = atomic_load_explicit(&p->head, memory_order_relaxed);
+	const size_t tail_full = head - p->slots_len;
+
+	for (;;) {
+		/* sender might have terminated in the meantime */
+		if (atomic_load(&p->status) != 1)
+			return NULL;
+		if (atomic_load_explicit(&p->tail, memory_order_acquire) != tail_full)
+			break;
+		io_pipeline_wait(p->event_free, &p->wait_free, &p->tail, tail_full);
+	}
+
+	return &p->slots[head % p->slots_len];
+}
+
+static void io_pipeline_slot_commit(
+		struct io_pipeline *p) {
+	atomic_fetch_add(&p->th->pipeline_queued, 1);
+	atomic_store(&p->head, atomic_load_explicit(&p->head, memory_order_relaxed) + 1);
+	io_pipeline_notify(p->event_used, &p->wait_used);
+}
+
+static ssize_t io_pipeline_status(
+		struct io_pipeline *p) {
+	if (atomic_load(&p->status) == 0)
+		return 0;
+	errno = p->status_errno;
+	return -1;
+}
+
+/**
+ * Queue BT packet for sending.
+ *
+ * This function blocks if the frame queue is full. If the pipeline is not
+ * running, data is written to the BT socket directly.
+ *
+ * Note:
+ * This function may temporally re-enable thread cancellation!
+ *
+ * @return Upon success, the number of queued bytes is returned. If the
+ *   sender has encountered BT disconnection, this function returns 0.
+ *   On error, -1 is returned and errno is set appropriately. */
+ssize_t io_pipeline_write(
+		struct io_pipeline *p,
+		struct io_poll *io,
+		const void *buffer,
+		size_t count) {
+
+	if (!p->running)
+		return io_bt_write(p->th, buffer, count);
+
+	if (count > p->slot_size)
+		return errno = EMSGSIZE, -1;
+
+	struct io_pipeline_slot *slot;
+	if ((slot = io_pipeline_slot_get(p)) == NULL)
+		return io_pipeline_status(p);
+
+	memcpy(slot->data, buffer, count);
+	slot->len = count;
+	slot->frames = 0;
+	/* If the stream has been (re)started, the sender shall reinitialize
+	 * its rate synchronization before sending this packet. */
+	slot->resync = io->asrs.frames == 0 ? io->asrs.rate : 0;
+	slot->seq = ++p->seq;
+
+	trace(bt_queue, p->th->t, slot->seq, count);
+
+	atomic_fetch_add_explicit(&p->queued_bytes, count, memory_order_relaxed);
+	io_pipeline_slot_commit(p);
+
+	return count;
+}
+
+/**
+ * Queue rate synchronization marker.
+ *
+ * This function is a counterpart of the asrsync_sync(). However, instead of
+ * sleeping in the encoder thread, the sleep is done by the sender thread
+ * after all previously queued packets have been written.
+ *
+ * Note:
+ * This function may temporally re-enable thread cancellation!
+ *
+ * @return On success this function returns 0, otherwise -1. */
+int io_pipeline_sync(
+		struct io_pipeline *p,
+		struct io_poll *io,
+		unsigned int frames) {
+
+	if (!p->running) {
+		asrsync_sync(&io->asrs, frames);
+		thread_stats_busy(&p->th->stats, asrsync_get_busy_usec(&io->asrs));
+		return 0;
+	}
+
+	struct io_pipeline_slot *slot;
+	if ((slot = io_pipeline_slot_get(p)) == NULL)
+		return -1;
+
+	slot->len = 0;
+	slot->frames = frames;
+	slot->resync = io->asrs.frames == 0 ? io->asrs.rate : 0;
+
+	atomic_fetch_add_explicit(&p->queued_frames, frames, memory_order_relaxed);
+	io_pipeline_slot_commit(p);
+
+	/* Keep track of queued frames in the encoder synchronization
+	 * structure, so the stream restart can be detected. */
+	io->asrs.frames += frames;
+
+	return 0;
+}
+
+/**
+ * Get the delay introduced by the encoding and sending.
+ *
+ * For the pipeline, it is the time spent by the sender outside of the rate
+ * synchronization plus the duration of audio waiting in the queue. */
+unsigned int io_pipeline_get_delay_usec(
+		struct io_pipeline *p,
+		const struct io_poll *io) {
+
+	if (!p->running)
+		return asrsync_get_busy_usec(&io->asrs);
+
+	unsigned int usec = atomic_load_explicit(&p->busy_usec, memory_order_relaxed);
+	if (io->asrs.rate > 0)
+		usec += (uint64_t)atomic_load_explicit(&p->queued_frames,
+				memory_order_relaxed) * 1000000 / io->asrs.rate;
+
+	return usec;
+}
+
+/**
+ * Get the number of bytes waiting in the frame queue. */
+size_t io_pipeline_get_queued_bytes(
+		struct io_pipeline *p) {
+	if (!p->running)
+		return 0;
+	return atomic_load_explicit(&p->queued_bytes, memory_order_relaxed);
+}
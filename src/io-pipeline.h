@@ -0,0 +1,121 @@
+/*
+ * BlueALSA - io-pipeline.h
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_IOPIPELINE_H_
+#define BLUEALSA_IOPIPELINE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "ba-transport.h"
+#include "io.h"
+#include "shared/rt.h"
+
+/**
+ * Single entry of the encoded frame queue. */
+struct io_pipeline_slot {
+	/* encoded BT packet */
+	void *data;
+	size_t len;
+	/* number of PCM frames for rate synchronization */
+	unsigned int frames;
+	/* if non-zero, reset rate synchronization using this sampling */
+	unsigned int resync;
+	/* packet sequence number used by tracepoints */
+	unsigned int seq;
+};
+
+/**
+ * Two-stage encoder pipeline.
+ *
+ * The encoder thread (producer) pushes encoded BT packets and rate sync
+ * markers into a bounded lock-free single-producer single-consumer ring
+ * buffer. The sender thread (consumer) writes these packets to the BT socket
+ * and maintains the constant bit rate, so encoding and BT transfer can run
+ * on separate CPUs. The eventfd notification is used only when the other
+ * side is waiting for the ring buffer to become non-empty or non-full.
+ *
+ * When the pipeline is not running, all io_pipeline_*() calls fall back to
+ * the synchronous io_bt_write() and asrsync_sync() functions. */
+struct io_pipeline {
+
+	/* associated transport thread */
+	struct ba_transport_thread *th;
+
+	/* sender thread */
+	pthread_t sender;
+	bool running;
+
+	struct io_pipeline_slot *slots;
+	size_t slots_len;
+	size_t slot_size;
+
+	/* producer and consumer positions; positions are incremented
+	 * monotonically and every position is modified by one thread only */
+	atomic_size_t head;
+	atomic_size_t tail;
+
+	/* wake-up notifications for the producer and the consumer */
+	int event_free;
+	int event_used;
+	atomic_bool wait_free;
+	atomic_bool wait_used;
+
+	/* sequence number of the last queued BT packet */
+	unsigned int seq;
+
+	/* sender status: 1 - running, 0 - BT disconnected, -1 - error */
+	atomic_int status;
+	int status_errno;
+
+	/* data queued for sending */
+	atomic_size_t queued_bytes;
+	atomic_uint queued_frames;
+
+	/* sender transfer bit rate synchronization */
+	struct asrsync asrs;
+	atomic_uint busy_usec;
+
+};
+
+int io_pipeline_start(
+		struct io_pipeline *p,
+		size_t slot_size);
+
+void io_pipeline_free(
+		struct io_pipeline *p);
+
+ssize_t io_pipeline_write(
+		struct io_pipeline *p,
+		struct io_poll *io,
+		const void *buffer,
+		size_t count);
+
+int io_pipeline_sync(
+		struct io_pipeline *p,
+		struct io_poll *io,
+		unsigned int frames);
+
+unsigned int io_pipeline_get_delay_usec(
+		struct io_pipeline *p,
+		const struct io_poll *io);
+
+size_t io_pipeline_get_queued_bytes(
+		struct io_pipeline *p);
+
+#endif
@@ -14,18 +14,46 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <bluetooth/bluetooth.h>
+
 #include <glib.h>
 
 #include "audio.h"
 #include "bluealsa-config.h"
+#include "hci.h"
+#include "thread-stats.h"
 #include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/rt.h"
+#include "shared/trace.h"
+
+/**
+ * Check whether the stop of the transport thread has been requested.
+ *
+ * When the stop is requested, IO functions return -1 and set errno to
+ * ECANCELED. Upon such an error the transport thread routine shall clean
+ * up and return, so the thread can be either joined or parked.
+ *
+ * @param pfd The poll structure of the transport thread stop_fd.
+ * @return This function returns true if the stop has been requested. */
+static bool io_poll_stop_requested(const struct pollfd *pfd) {
+	return pfd->revents & POLLIN;
+}
 
 /**
- * Read data from the BT transport (SCO or SEQPACKET) socket. */
+ * Read data from the BT transport (SCO or SEQPACKET) socket.
+ *
+ * If the SCO packet status reporting is enabled on the socket, the HCI status
+ * of the read packet is stored in the bt_pkt_status field of the transport
+ * thread structure. Otherwise, the packet is assumed to be correct. */
 ssize_t io_bt_read(
 		struct ba_transport_thread *th,
 		void *buffer,
@@ -37,7 +65,18 @@ ssize_t io_bt_read(
 	if (fd == -1)
 		return errno = EBADFD, -1;
 
-	while ((ret = read(fd, buffer, count)) == -1 &&
+	struct iovec iov = { .iov_base = buffer, .iov_len = count };
+	union {
+		char buf[CMSG_SPACE(sizeof(uint8_t))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf) };
+
+	while ((ret = recvmsg(fd, &msg, 0)) == -1 &&
 			errno == EINTR)
 		continue;
 	if (ret == -1 && (
@@ -48,6 +87,15 @@ ssize_t io_bt_read(
 		ret = 0;
 	}
 
+	th->bt_pkt_status = HCI_SCO_PKT_STATUS_CORRECT;
+	if (ret > 0) {
+		struct cmsghdr *cmsg;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+			if (cmsg->cmsg_level == SOL_BLUETOOTH &&
+					cmsg->cmsg_type == BT_SCM_PKT_STATUS)
+				th->bt_pkt_status = *(uint8_t *)CMSG_DATA(cmsg);
+	}
+
 	if (ret == 0)
 		ba_transport_thread_bt_release(th);
 
@@ -80,9 +128,13 @@ retry:
 			/* In order to provide a way of escaping from the infinite poll()
 			 * we have to temporally re-enable thread cancellation. */
 			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-			struct pollfd pfd = { fd, POLLOUT, 0 };
-			poll(&pfd, 1, -1);
+			struct pollfd pfds[2] = {
+				{ th->stop_fd, POLLIN, 0 },
+				{ fd, POLLOUT, 0 }};
+			poll(pfds, ARRAYSIZE(pfds), -1);
 			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+			if (io_poll_stop_requested(&pfds[0]))
+				return errno = ECANCELED, -1;
 			goto retry;
 		case ECONNABORTED:
 		case ECONNRESET:
@@ -95,6 +147,19 @@ retry:
 	if (ret == 0)
 		ba_transport_thread_bt_release(th);
 
+	if (ret > 0 && (th->acquire_ts.tv_sec != 0 || th->acquire_ts.tv_nsec != 0)) {
+		/* report the delay between the transport acquisition
+		 * and the first BT packet sent by the master thread */
+		struct timespec ts;
+		gettimestamp(&ts);
+		timespecsub(&ts, &th->acquire_ts, &ts);
+		const unsigned int usec = ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+		debug("Transport acquire to first BT packet: %u us", usec);
+		trace(bt_first_packet, th, usec);
+		th->acquire_ts = (struct timespec){ 0 };
+	}
+
+	trace(bt_write, th->t, fd, ret);
 	return ret;
 }
 
@@ -186,6 +251,7 @@ ssize_t io_pcm_read(
 		return ret;
 
 	samples = ret / sample_size;
+	trace(pcm_read, pcm->t, fd, samples / pcm->channels);
 	io_pcm_scale(pcm, buffer, samples);
 	return samples;
 }
@@ -214,7 +280,10 @@ ssize_t io_pcm_write(
 			goto final;
 		}
 
-		if ((ret = write(fd, buffer, len)) == -1)
+		ret = write(fd, buffer, len);
+		thread_stats_pcm_write(&pcm->th->stats);
+
+		if (ret == -1)
 			switch (errno) {
 			case EINTR:
 				continue;
@@ -223,10 +292,16 @@ ssize_t io_pcm_write(
 				 * we have to temporally re-enable thread cancellation. */
 				pthread_cleanup_push(PTHREAD_CLEANUP(pthread_mutex_unlock), &pcm->mutex);
 				pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-				struct pollfd pfd = { fd, POLLOUT, 0 };
-				poll(&pfd, 1, -1);
+				struct pollfd pfds[2] = {
+					{ pcm->th->stop_fd, POLLIN, 0 },
+					{ fd, POLLOUT, 0 }};
+				poll(pfds, ARRAYSIZE(pfds), -1);
 				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 				pthread_cleanup_pop(0);
+				if (io_poll_stop_requested(&pfds[0])) {
+					errno = ECANCELED;
+					goto final;
+				}
 				continue;
 			case EPIPE:
 				/* This errno value will be received only, when the SIGPIPE
@@ -270,8 +345,9 @@ ssize_t io_poll_and_read_bt(
 		void *buffer,
 		size_t count) {
 
-	struct pollfd fds[2] = {
+	struct pollfd fds[3] = {
 		{ th->pipe[0], POLLIN, 0 },
+		{ th->stop_fd, POLLIN, 0 },
 		{ th->bt_fd, POLLIN, 0 }};
 
 	/* Allow escaping from the poll() by thread cancellation. */
@@ -286,6 +362,11 @@ repoll:
 		return -1;
 	}
 
+	if (io_poll_stop_requested(&fds[1])) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		return errno = ECANCELED, -1;
+	}
+
 	if (fds[0].revents & POLLIN) {
 		/* dispatch incoming event */
 		io_poll_signal_filter *filter = io->signal.filter != NULL ?
@@ -303,6 +384,50 @@ repoll:
 	return io_bt_read(th, buffer, count);
 }
 
+/**
+ * Update digital silence detection state.
+ *
+ * @return This function returns true if the encoding is suspended due to
+ *   the silence and the PCM data shall be dropped. */
+static bool io_pcm_silence_update(
+		struct io_poll *io,
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t samples) {
+
+	const unsigned int timeout = config.a2dp.silence_timeout;
+	if (timeout == 0 || !(pcm->t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP))
+		return false;
+
+	const size_t frames = samples / pcm->channels;
+	const size_t size = samples * BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+
+	if (!audio_is_silence(buffer, size)) {
+		if (io->silence.active) {
+			debug("PCM silence ended: %s", pcm->ba_dbus_path);
+			/* restart rate synchronization with the encoded stream */
+			io->asrs.frames = 0;
+		}
+		io->silence.frames = 0;
+		io->silence.active = false;
+		return false;
+	}
+
+	if (!io->silence.active) {
+		io->silence.frames += frames;
+		if (io->silence.frames < (size_t)timeout * pcm->sampling / 1000)
+			return false;
+		debug("PCM silence detected: %s", pcm->ba_dbus_path);
+		io->silence.active = true;
+	}
+
+	atomic_fetch_add_explicit(&pcm->silence_usec,
+			(unsigned long long)frames * 1000000 / pcm->sampling,
+			memory_order_relaxed);
+
+	return true;
+}
+
 /**
  * Poll and read data from the PCM FIFO.
  *
@@ -315,8 +440,9 @@ ssize_t io_poll_and_read_pcm(
 		size_t samples) {
 
 	struct ba_transport_thread *th = pcm->th;
-	struct pollfd fds[2] = {
+	struct pollfd fds[3] = {
 		{ th->pipe[0], POLLIN, 0 },
+		{ th->stop_fd, POLLIN, 0 },
 		{ -1, POLLIN, 0 }};
 
 repoll:
@@ -325,13 +451,26 @@ repoll:
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 
 	/* Add PCM socket to the poll if it is active. */
-	fds[1].fd = ba_transport_pcm_is_active(pcm) ? pcm->fd : -1;
+	fds[2].fd = ba_transport_pcm_is_active(pcm) ? pcm->fd : -1;
+
+	/* While the stream is running (also when it is paused), wake up if the
+	 * PCM client does not provide data on time, so the encoder will be able
+	 * to keep the BT link clocked. */
+	int timeout = io->timeout;
+	if (timeout == -1 && io->underrun.timeout > 0 && !io->draining &&
+			io->asrs.frames > 0 && pcm->fd != -1 &&
+			io->underrun.count * io->underrun.timeout < IO_POLL_UNDERRUN_MAX_MS)
+		timeout = io->underrun.timeout;
 
 	/* Poll for reading with optional sync timeout. */
-	switch (poll(fds, ARRAYSIZE(fds), io->timeout)) {
+	switch (poll(fds, ARRAYSIZE(fds), timeout)) {
 	case 0:
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-		pthread_cond_signal(&pcm->synced);
+		if (io->timeout == -1) {
+			io->underrun.count++;
+			return errno = ETIME, -1;
+		}
+		atomic_store(&pcm->drain.synced, true);
 		io->timeout = -1;
 		return 0;
 	case -1:
@@ -341,6 +480,11 @@ repoll:
 		return -1;
 	}
 
+	if (io_poll_stop_requested(&fds[1])) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		return errno = ECANCELED, -1;
+	}
+
 	if (fds[0].revents & POLLIN) {
 		/* dispatch incoming event */
 		io_poll_signal_filter *filter = io->signal.filter != NULL ?
@@ -352,15 +496,26 @@ repoll:
 		case BA_TRANSPORT_THREAD_SIGNAL_PCM_RESUME:
 			io->asrs.frames = 0;
 			io->timeout = -1;
+			io->underrun.count = 0;
+			io->silence.frames = 0;
+			io->silence.active = false;
+			io->draining = false;
 			goto repoll;
 		case BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE:
 			/* reuse PCM read disconnection logic */
 			break;
 		case BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC:
-			io->timeout = 100;
+			/* Client sends the drain request after all data has been written
+			 * to the FIFO, so the FIFO is synchronized as soon as the poll
+			 * reports no more data to read. Do not generate underrun silence
+			 * after the drain point, it would be played after the drain. */
+			io->timeout = 0;
+			io->draining = true;
 			goto repoll;
 		case BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP:
 			io_pcm_flush(pcm);
+			io->timeout = -1;
+			io->draining = false;
 			goto repoll;
 		default:
 			goto repoll;
@@ -381,6 +536,19 @@ repoll:
 	if (samples_read == 0)
 		return 0;
 
+	io->underrun.count = 0;
+	/* New data written after the FIFO has been synchronized
+	 * means that the client has started a new stream. */
+	if (io->timeout == -1)
+		io->draining = false;
+
+	/* Drop silent PCM data, but consume it at the real-time rate,
+	 * so the PCM client will not notice any difference. */
+	if (io_pcm_silence_update(io, pcm, buffer, samples_read)) {
+		asrsync_sync(&io->asrs, samples_read / pcm->channels);
+		goto repoll;
+	}
+
 	/* When the thread is created, there might be no data in the FIFO. In fact
 	 * there might be no data for a long time - until client starts playback.
 	 * In order to correctly calculate time drift, the zero time point has to
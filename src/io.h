@@ -21,6 +21,12 @@
 #include "ba-transport.h"
 #include "shared/rt.h"
 
+/**
+ * The maximal time in milliseconds of a single PCM underrun during which
+ * the io_poll_and_read_pcm() reports underrun timeouts. After that time,
+ * the stream is considered to be stopped by the PCM client. */
+#define IO_POLL_UNDERRUN_MAX_MS 500
+
 /**
  * Callback function for thread signal filtering. */
 typedef enum ba_transport_thread_signal io_poll_signal_filter(
@@ -42,6 +48,25 @@ struct io_poll {
 	struct asrsync asrs;
 	/* keep-alive and sync timeout */
 	int timeout;
+	/* PCM underrun detection */
+	struct {
+		/* If greater than zero, the io_poll_and_read_pcm() returns -1 and
+		 * sets errno to ETIME when the PCM client does not provide data in
+		 * this number of milliseconds while the stream is running. */
+		int timeout;
+		/* the number of consecutive underrun timeouts */
+		unsigned int count;
+	} underrun;
+	/* PCM drain has been requested; the underrun detection is
+	 * suspended until the client provides new data after the drain */
+	bool draining;
+	/* digital silence detection */
+	struct {
+		/* number of consecutive silent frames */
+		size_t frames;
+		/* encoding is suspended due to silence */
+		bool active;
+	} silence;
 };
 
 ssize_t io_bt_read(
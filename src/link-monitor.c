@@ -0,0 +1,264 @@
+/*
+ * BlueALSA - link-monitor.c
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "link-monitor.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <glib.h>
+
+#include "ba-device.h"
+#include "ba-transport.h"
+#include "bluealsa-config.h"
+#include "bluealsa-dbus.h"
+#include "hci.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+
+struct link_monitor {
+
+	/* monitored adapter (not referenced) */
+	struct ba_adapter *a;
+	int dev_id;
+
+	pthread_t thread;
+	/* eventfd used to stop the monitor thread */
+	int stop_fd;
+	/* set when released from the monitor thread */
+	bool released;
+
+	/* HCI socket used by the monitor thread */
+	int dd;
+
+};
+
+static void link_monitor_close(struct link_monitor *m) {
+	if (m->dd != -1)
+		hci_close_dev(m->dd);
+	if (m->stop_fd != -1)
+		close(m->stop_fd);
+	free(m);
+}
+
+static void link_monitor_pcm_update(struct ba_transport_pcm *pcm) {
+	if (pcm->ba_dbus_exported)
+		bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_LINK);
+}
+
+/**
+ * Notify D-Bus clients about the link state change of the given device. */
+static void link_monitor_device_update(struct ba_device *d) {
+
+	GHashTableIter iter;
+	struct ba_transport *t;
+
+	pthread_mutex_lock(&d->transports_mutex);
+
+	g_hash_table_iter_init(&iter, d->transports);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&t)) {
+		if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
+			link_monitor_pcm_update(&t->a2dp.pcm);
+			link_monitor_pcm_update(&t->a2dp.pcm_bc);
+		}
+		else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
+			link_monitor_pcm_update(&t->sco.spk_pcm);
+			link_monitor_pcm_update(&t->sco.mic_pcm);
+		}
+	}
+
+	pthread_mutex_unlock(&d->transports_mutex);
+
+}
+
+/**
+ * Read the link state of the given device.
+ *
+ * @return This function returns true if the link state has changed. */
+static bool link_monitor_device_poll(int dd, struct ba_device *d) {
+
+	struct hci_link_info info;
+	uint16_t handle;
+
+	if (hci_acl_get_handle(dd, &d->addr, &handle) == -1 ||
+			hci_acl_read_link_info(dd, handle, &info, LINK_MONITOR_HCI_TIMEOUT) == -1) {
+		debug("Couldn't read link info [%s]: %s", batostr_(&d->addr), strerror(errno));
+		const bool valid = atomic_load_explicit(&d->link.valid, memory_order_relaxed);
+		ba_device_link_reset(d);
+		return valid;
+	}
+
+	return ba_device_link_update(d, &info);
+}
+
+/**
+ * Poll the link state of all devices with connected audio transports.
+ *
+ * Devices are collected (and referenced) with the adapter devices mutex
+ * locked, but the HCI commands are sent without holding any lock, so the
+ * main loop is never blocked on the monitor. */
+static void link_monitor_devices_poll(struct link_monitor *m) {
+
+	struct ba_adapter *a = m->a;
+	GPtrArray *devices = g_ptr_array_new();
+	GHashTableIter iter;
+	struct ba_device *d;
+	size_t i;
+
+	pthread_mutex_lock(&a->devices_mutex);
+
+	g_hash_table_iter_init(&iter, a->devices);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&d)) {
+		/* monitor only devices with connected audio transports */
+		pthread_mutex_lock(&d->transports_mutex);
+		const bool connected = g_hash_table_size(d->transports) > 0;
+		pthread_mutex_unlock(&d->transports_mutex);
+		if (!connected)
+			continue;
+		d->ref_count++;
+		g_ptr_array_add(devices, d);
+	}
+
+	pthread_mutex_unlock(&a->devices_mutex);
+
+	/* The HCI socket is kept open for the whole lifetime of the monitor.
+	 * In case of failure, we will try to open it again in the next round. */
+	if (devices->len > 0 && m->dd == -1 &&
+			(m->dd = hci_open_dev(m->dev_id)) == -1)
+		error("Couldn't open HCI device: %s", strerror(errno));
+
+	for (i = 0; m->dd != -1 && i < devices->len; i++) {
+		d = g_ptr_array_index(devices, i);
+		if (link_monitor_device_poll(m->dd, d))
+			link_monitor_device_update(d);
+	}
+
+	/* Please note, that releasing the last device reference might free
+	 * the adapter, so the adapter shall not be accessed afterwards. */
+	for (i = 0; i < devices->len; i++)
+		ba_device_unref(g_ptr_array_index(devices, i));
+
+	g_ptr_array_free(devices, TRUE);
+
+}
+
+static void *link_monitor_thread(struct link_monitor *m) {
+
+	struct pollfd pfd = { m->stop_fd, POLLIN, 0 };
+
+	for (;;) {
+
+		int ret;
+		if ((ret = poll(&pfd, 1, config.link_monitor_interval)) == -1) {
+			if (errno == EINTR)
+				continue;
+			error("Link monitor poll error: %s", strerror(errno));
+			break;
+		}
+
+		if (ret > 0)
+			break;
+
+		link_monitor_devices_poll(m);
+
+		/* The monitor has been released by the adapter cleanup routine
+		 * called from this very thread, so we are on our own now. */
+		if (m->released) {
+			link_monitor_close(m);
+			break;
+		}
+
+	}
+
+	return NULL;
+}
+
+/**
+ * Setup ACL link monitor for the given adapter.
+ *
+ * The monitor periodically reads the RSSI, the link quality and the failed
+ * contact counter of every device with connected audio transports. Reading
+ * is done by the dedicated thread, because every HCI command might block
+ * for up to LINK_MONITOR_HCI_TIMEOUT milliseconds. */
+int link_monitor_setup(struct ba_adapter *a) {
+
+	/* skip setup if monitor is disabled or already registered */
+	if (config.link_monitor_interval == 0 ||
+			a->link_monitor != NULL)
+		return 0;
+
+	struct link_monitor *m;
+	int err;
+
+	if ((m = calloc(1, sizeof(*m))) == NULL)
+		return -1;
+
+	/* Please note, that the adapter is not referenced by the monitor. The
+	 * monitor is released in the adapter cleanup routine. */
+	m->a = a;
+	m->dev_id = a->hci.dev_id;
+	m->dd = -1;
+
+	if ((m->stop_fd = eventfd(0, EFD_CLOEXEC)) == -1)
+		goto fail;
+
+	if ((err = pthread_create(&m->thread, NULL, PTHREAD_ROUTINE(link_monitor_thread), m)) != 0) {
+		errno = err;
+		goto fail;
+	}
+
+	pthread_setname_np(m->thread, "ba-link-monitor");
+
+	a->link_monitor = m;
+	debug("Created link monitor: %s", a->hci.name);
+	return 0;
+
+fail:
+	err = errno;
+	link_monitor_close(m);
+	errno = err;
+	return -1;
+}
+
+/**
+ * Release ACL link monitor.
+ *
+ * This function shall be called by the adapter cleanup routine. If it is
+ * called from the monitor thread itself (the last adapter reference was
+ * held by a device polled by the monitor), the thread is detached and it
+ * will release the monitor on its own. */
+void link_monitor_free(struct link_monitor *m) {
+
+	if (m == NULL)
+		return;
+
+	if (pthread_equal(m->thread, pthread_self())) {
+		pthread_detach(m->thread);
+		m->released = true;
+		return;
+	}
+
+	eventfd_write(m->stop_fd, 1);
+	pthread_join(m->thread, NULL);
+
+	link_monitor_close(m);
+
+}
@@ -0,0 +1,39 @@
+/*
+ * BlueALSA - link-monitor.h
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_LINKMONITOR_H_
+#define BLUEALSA_LINKMONITOR_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "ba-adapter.h"
+
+/**
+ * Timeout in milliseconds of HCI commands sent by the link monitor. Commands
+ * are sent sequentially for every connected device, so this value shall be
+ * kept small comparing to the monitor interval. */
+#define LINK_MONITOR_HCI_TIMEOUT 100
+
+/**
+ * Minimal link monitor interval in milliseconds. Every monitor tick sends
+ * up to three HCI commands per connected device. */
+#define LINK_MONITOR_INTERVAL_MIN 100
+
+/**
+ * Maximal link monitor interval in milliseconds. */
+#define LINK_MONITOR_INTERVAL_MAX 60000
+
+int link_monitor_setup(struct ba_adapter *a);
+void link_monitor_free(struct link_monitor *m);
+
+#endif
@@ -12,6 +12,7 @@
 # include <config.h>
 #endif
 
+#include <errno.h>
 #include <getopt.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -38,12 +39,17 @@
 #include "bluealsa-dbus.h"
 #include "bluealsa-iface.h"
 #include "bluez.h"
+#if ENABLE_LC3_SWB
+# include "codec-lc3-swb.h"
+#endif
 #include "codec-sbc.h"
 #include "hfp.h"
+#include "link-monitor.h"
 #if ENABLE_OFONO
 # include "ofono.h"
 #endif
 #include "storage.h"
+#include "thread-policy.h"
 #if ENABLE_UPOWER
 # include "upower.h"
 #endif
@@ -94,6 +100,9 @@ static char *get_hfp_codecs(void) {
 		hfp_codec_id_to_string(HFP_CODEC_CVSD),
 #if ENABLE_MSBC
 		hfp_codec_id_to_string(HFP_CODEC_MSBC),
+#endif
+#if ENABLE_LC3_SWB
+		hfp_codec_id_to_string(HFP_CODEC_LC3_SWB),
 #endif
 		NULL,
 	};
@@ -101,6 +110,58 @@ static char *get_hfp_codecs(void) {
 	return g_strjoinv(", ", (char **)strv);
 }
 
+/**
+ * Parse BT socket output buffer latency target.
+ *
+ * @param str String in the "PROFILE[:CODEC]:MS" format, where the profile
+ *   is either "a2dp" or "sco".
+ * @return On success this function returns 0. Otherwise, -1 is returned. */
+static int parse_sndbuf_latency(const char *str) {
+
+	struct ba_config_sndbuf_latency entry = { .codec_id = 0xFFFF };
+	const char *codec = strchr(str, ':');
+	const char *latency = strrchr(str, ':');
+	char name[32];
+	size_t len;
+
+	if (latency == NULL)
+		return -1;
+
+	char *tmp;
+	entry.latency = strtoul(latency + 1, &tmp, 10);
+	if (latency[1] == '\0' || *tmp != '\0')
+		return -1;
+
+	if ((len = codec - str) >= sizeof(name))
+		return -1;
+	memcpy(name, str, len);
+	name[len] = '\0';
+
+	if (strcasecmp(name, "a2dp") == 0)
+		entry.sco = false;
+	else if (strcasecmp(name, "sco") == 0)
+		entry.sco = true;
+	else
+		return -1;
+
+	if (codec != latency) {
+		if ((len = latency - codec - 1) >= sizeof(name))
+			return -1;
+		memcpy(name, codec + 1, len);
+		name[len] = '\0';
+		entry.codec_id = entry.sco ?
+			hfp_codec_id_from_string(name) : a2dp_codecs_codec_id_from_string(name);
+		if (entry.codec_id == 0xFFFF)
+			return -1;
+	}
+
+	if (config.sndbuf_latency_len == ARRAYSIZE(config.sndbuf_latency))
+		return -1;
+
+	config.sndbuf_latency[config.sndbuf_latency_len++] = entry;
+	return 0;
+}
+
 static gboolean main_loop_exit_handler(void *userdata) {
 	g_main_loop_quit((GMainLoop *)userdata);
 	return G_SOURCE_REMOVE;
@@ -156,9 +217,18 @@ int main(int argc, char **argv) {
 		{ "codec", required_argument, NULL, 'c' },
 		{ "initial-volume", required_argument, NULL, 17 },
 		{ "keep-alive", required_argument, NULL, 8 },
+		{ "io-thread-park", no_argument, NULL, 22 },
+		{ "thread-sched", required_argument, NULL, 24 },
+		{ "thread-affinity", required_argument, NULL, 25 },
+		{ "rtkit", no_argument, NULL, 26 },
+		{ "link-monitor", required_argument, NULL, 31 },
+		{ "sndbuf-latency", required_argument, NULL, 32 },
 		{ "a2dp-force-mono", no_argument, NULL, 6 },
 		{ "a2dp-force-audio-cd", no_argument, NULL, 7 },
 		{ "a2dp-volume", no_argument, NULL, 9 },
+		{ "a2dp-pipeline", no_argument, NULL, 21 },
+		{ "a2dp-silence-timeout", required_argument, NULL, 23 },
+		{ "a2dp-bandwidth", required_argument, NULL, 30 },
 		{ "sbc-quality", required_argument, NULL, 14 },
 #if ENABLE_AAC
 		{ "aac-afterburner", no_argument, NULL, 4 },
@@ -177,6 +247,11 @@ int main(int argc, char **argv) {
 #if ENABLE_MP3LAME
 		{ "mp3-algorithm", required_argument, NULL, 12 },
 		{ "mp3-vbr-quality", required_argument, NULL, 13 },
+#endif
+		{ "cvsd-batch-latency", required_argument, NULL, 27 },
+#if ENABLE_MSBC
+		{ "sco-aec", no_argument, NULL, 28 },
+		{ "sco-aec-tail", required_argument, NULL, 29 },
 #endif
 		{ "xapl-resp-name", required_argument, NULL, 16 },
 		{ 0, 0, 0, 0 },
@@ -221,9 +296,18 @@ int main(int argc, char **argv) {
 					"  -c, --codec=NAME\t\tset enabled BT audio codecs\n"
 					"  --initial-volume=NUM\t\tinitial volume level [0-100]\n"
 					"  --keep-alive=SEC\t\tkeep Bluetooth transport alive\n"
+					"  --io-thread-park\t\treuse IO threads between streams\n"
+					"  --thread-sched=CLASS:POLICY[:PRIO]\tset thread scheduling\n"
+					"  --thread-affinity=CLASS:CPUS\tset thread CPU affinity\n"
+					"  --rtkit\t\t\tuse RealtimeKit for scheduling\n"
+					"  --link-monitor=MS\t\tmonitor ACL link quality\n"
+					"  --sndbuf-latency=PROFILE[:CODEC]:MS\tsize BT socket buffer\n"
 					"  --a2dp-force-mono\t\ttry to force monophonic sound\n"
 					"  --a2dp-force-audio-cd\t\ttry to force 44.1 kHz sampling\n"
 					"  --a2dp-volume\t\t\tnative volume control by default\n"
+					"  --a2dp-pipeline\t\tencode and send in separate threads\n"
+					"  --a2dp-silence-timeout=SEC\tsuspend encoding on silence\n"
+					"  --a2dp-bandwidth=KBPS\t\tshare bandwidth between streams\n"
 					"  --sbc-quality=MODE\t\tset SBC encoder quality mode\n"
 #if ENABLE_AAC
 					"  --aac-afterburner\t\tenable FDK AAC afterburner\n"
@@ -242,6 +326,11 @@ int main(int argc, char **argv) {
 #if ENABLE_MP3LAME
 					"  --mp3-algorithm=TYPE\t\tselect LAME encoder algorithm type\n"
 					"  --mp3-vbr-quality=MODE\tset LAME encoder VBR quality mode\n"
+#endif
+					"  --cvsd-batch-latency=MS\tbatch CVSD audio up to MS\n"
+#if ENABLE_MSBC
+					"  --sco-aec\t\t\tenable SCO echo cancellation\n"
+					"  --sco-aec-tail=MS\t\tset echo tail length covered by AEC\n"
 #endif
 					"  --xapl-resp-name=NAME\t\tset product name used by XAPL\n"
 					"\nAvailable BT profiles:\n"
@@ -330,6 +419,9 @@ int main(int argc, char **argv) {
 				{ HFP_CODEC_CVSD, &config.hfp.codecs.cvsd },
 #if ENABLE_MSBC
 				{ HFP_CODEC_MSBC, &config.hfp.codecs.msbc },
+#endif
+#if ENABLE_LC3_SWB
+				{ HFP_CODEC_LC3_SWB, &config.hfp.codecs.lc3_swb },
 #endif
 			};
 
@@ -377,6 +469,42 @@ int main(int argc, char **argv) {
 		case 8 /* --keep-alive=SEC */ :
 			config.keep_alive_time = atof(optarg) * 1000;
 			break;
+		case 22 /* --io-thread-park */ :
+			config.io_thread_park = true;
+			break;
+		case 24 /* --thread-sched=CLASS:POLICY[:PRIO] */ :
+			if (thread_policy_parse_sched(config.thread_policy, optarg) == -1) {
+				error("Invalid thread scheduling policy {CLASS:POLICY[:PRIO]}: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 25 /* --thread-affinity=CLASS:CPUS */ :
+			if (thread_policy_parse_affinity(config.thread_policy, optarg) == -1) {
+				error("Invalid thread CPU affinity {CLASS:CPUS}: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 26 /* --rtkit */ :
+			config.thread_policy_rtkit = true;
+			break;
+		case 31 /* --link-monitor=MS */ : {
+			char *tmp;
+			unsigned long interval = strtoul(optarg, &tmp, 10);
+			if (*optarg == '\0' || *tmp != '\0' || (interval != 0 &&
+						(interval < LINK_MONITOR_INTERVAL_MIN || interval > LINK_MONITOR_INTERVAL_MAX))) {
+				error("Invalid link monitor interval {0, [%u, %u]}: %s",
+						LINK_MONITOR_INTERVAL_MIN, LINK_MONITOR_INTERVAL_MAX, optarg);
+				return EXIT_FAILURE;
+			}
+			config.link_monitor_interval = interval;
+			break;
+		}
+		case 32 /* --sndbuf-latency=PROFILE[:CODEC]:MS */ :
+			if (parse_sndbuf_latency(optarg) == -1) {
+				error("Invalid BT socket buffer latency {PROFILE[:CODEC]:MS}: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 
 		case 6 /* --a2dp-force-mono */ :
 			config.a2dp.force_mono = true;
@@ -387,6 +515,29 @@ int main(int argc, char **argv) {
 		case 9 /* --a2dp-volume */ :
 			config.a2dp.volume = true;
 			break;
+		case 21 /* --a2dp-pipeline */ :
+			config.a2dp.pipeline = true;
+			break;
+		case 23 /* --a2dp-silence-timeout=SEC */ : {
+			char *tmp;
+			double timeout = strtod(optarg, &tmp);
+			if (*optarg == '\0' || *tmp != '\0' || !(timeout >= 0 && timeout <= 3600)) {
+				error("Invalid A2DP silence timeout [0, 3600]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.a2dp.silence_timeout = timeout * 1000;
+			break;
+		}
+		case 30 /* --a2dp-bandwidth=KBPS */ : {
+			char *tmp;
+			unsigned long bandwidth = strtoul(optarg, &tmp, 10);
+			if (*optarg == '\0' || *tmp != '\0' || bandwidth > 3000) {
+				error("Invalid A2DP bandwidth [0, 3000]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.a2dp.bandwidth = bandwidth;
+			break;
+		}
 
 		case 14 /* --sbc-quality=MODE */ : {
 
@@ -508,6 +659,31 @@ int main(int argc, char **argv) {
 		}
 #endif
 
+		case 27 /* --cvsd-batch-latency=MS */ : {
+			unsigned int latency = atoi(optarg);
+			if (latency > 1000) {
+				error("Invalid CVSD batch latency [0, 1000]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.hfp.cvsd_batch_latency = latency;
+			break;
+		}
+
+#if ENABLE_MSBC
+		case 28 /* --sco-aec */ :
+			config.hfp.aec = true;
+			break;
+		case 29 /* --sco-aec-tail=MS */ : {
+			unsigned int tail = atoi(optarg);
+			if (tail < 1 || tail > 256) {
+				error("Invalid echo tail length [1, 256]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.hfp.aec_tail = tail;
+			break;
+		}
+#endif
+
 		case 16 /* --xapl-resp-name=NAME */ :
 			config.hfp.xapl_product_name = optarg;
 			break;
@@ -568,6 +744,18 @@ int main(int argc, char **argv) {
 
 	a2dp_codecs_init();
 
+#if ENABLE_LC3_SWB
+	if (config.hfp.codecs.lc3_swb && lc3_swb_probe() == -1) {
+		warn("Couldn't initialize LC3plus library, disabling LC3-SWB codec: %s", strerror(errno));
+		config.hfp.codecs.lc3_swb = false;
+	}
+	/* Do not advertise super wideband speech support if LC3-SWB is not used. */
+	if (!config.hfp.codecs.lc3_swb) {
+		config.hfp.features_sdp_hf &= ~SDP_HFP_HF_FEAT_SWBAND;
+		config.hfp.features_sdp_ag &= ~SDP_HFP_AG_FEAT_SWBAND;
+	}
+#endif
+
 	storage_init(BLUEALSA_STORAGE_DIR);
 
 	/* In order to receive EPIPE while writing to the pipe whose reading end
@@ -585,6 +773,11 @@ int main(int argc, char **argv) {
 			dbus_service, G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE,
 			g_bus_name_acquired, g_bus_name_lost, loop, NULL);
 
+	/* From now on, log messages will be written by the dedicated logger
+	 * thread, so IO threads will never block on stderr or syslog. */
+	if (log_async_start() == -1)
+		warn("Couldn't start asynchronous logging: %s", strerror(errno));
+
 	/* main dispatching loop */
 	debug("Starting main dispatching loop");
 	g_main_loop_run(loop);
@@ -593,5 +786,10 @@ int main(int argc, char **argv) {
 	for (size_t i = 0; i < ARRAYSIZE(config.adapters); i++)
 		ba_adapter_destroy(config.adapters[i]);
 
+	/* write pending persistent storage data */
+	storage_destroy();
+
+	log_async_stop();
+
 	return retval;
 }
@@ -16,6 +16,7 @@
 
 #include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/trace.h"
 
 /**
  * Convert clock rate. */
@@ -143,6 +144,7 @@ void rtp_state_sync_stream(
 		if ((*missing_rtp_frames = hdr_seq_number - expect_seq_number) != 0) {
 			warn("Missing RTP packets [%u != %u]: %d",
 					hdr_seq_number, expect_seq_number, *missing_rtp_frames);
+			trace(rtp_gap, rtp, hdr_seq_number, *missing_rtp_frames);
 			rtp->seq_number = hdr_seq_number;
 		}
 	}
@@ -0,0 +1,406 @@
+/*
+ * BlueALSA - sco-aec.c
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "sco-aec.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bluealsa-config.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+#include "shared/rt.h"
+
+/**
+ * Initialize the SCO echo canceller.
+ *
+ * @param aec The echo canceller structure.
+ * @param clock The SCO transport clock used to align the far-end reference
+ *   signal with the microphone stream.
+ * @param enabled The initial state of the echo cancellation switch.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set appropriately. */
+int sco_aec_init(struct sco_aec *aec, struct sco_clock *clock, bool enabled) {
+
+	memset(aec, 0, sizeof(*aec));
+	pthread_mutex_init(&aec->ref_mtx, NULL);
+	atomic_init(&aec->enabled, enabled);
+	aec->clock = clock;
+	aec->ref_pos = -1;
+
+	aec->ref_size = SCO_AEC_REF_MAX_MS * SCO_AEC_MAX_SAMPLING / 1000;
+	if ((aec->ref = calloc(aec->ref_size, sizeof(*aec->ref))) == NULL) {
+		pthread_mutex_destroy(&aec->ref_mtx);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Free the SCO echo canceller resources. */
+void sco_aec_free(struct sco_aec *aec) {
+	if (aec->ec != NULL)
+		echo_can_free(aec->ec);
+	aec->ec = NULL;
+	free(aec->ref);
+	aec->ref = NULL;
+	pthread_mutex_destroy(&aec->ref_mtx);
+}
+
+static int16_t sco_aec_clamp(float value) {
+	if (value >= INT16_MAX)
+		return INT16_MAX;
+	if (value <= INT16_MIN)
+		return INT16_MIN;
+	return lrintf(value);
+}
+
+/**
+ * Setup the resampler for the given microphone stream sampling. */
+static void sco_aec_rs_init(struct sco_aec *aec) {
+
+	memset(&aec->rs, 0, sizeof(aec->rs));
+
+	if ((aec->rs.factor = aec->sampling / SCO_AEC_SAMPLING) <= 1)
+		return;
+
+	const size_t taps = SCO_AEC_RS_TAPS_PER_FACTOR * aec->rs.factor + 1;
+	/* Cut-off frequency (relative to the stream sampling) is set slightly
+	 * below the Nyquist frequency of the echo canceller rate. */
+	const double cutoff = 0.45 / aec->rs.factor;
+	double sum = 0;
+	size_t i;
+
+	/* Windowed-sinc low-pass filter. It is used for both the decimation and
+	 * the interpolation, so its odd length gives the integer group delay. */
+	for (i = 0; i < taps; i++) {
+		const double t = i - (taps - 1) / 2.0;
+		const double sinc = t == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+		const double window = 0.54 - 0.46 * cos(2 * M_PI * i / (taps - 1));
+		aec->rs.fir[i] = sinc * window;
+		sum += aec->rs.fir[i];
+	}
+	for (i = 0; i < taps; i++)
+		aec->rs.fir[i] /= sum;
+
+	aec->rs.taps = taps;
+	aec->rs.echo_len = DIV_ROUND_UP(taps, aec->rs.factor);
+	/* the decimation and the interpolation delay the echo estimation
+	 * by the half of the filter length each */
+	aec->rs.delay_len = taps - 1;
+
+}
+
+/**
+ * Setup the noise suppressor for the given microphone stream sampling. */
+static void sco_aec_ns_init(struct sco_aec *aec) {
+
+	const float noise = 32768 * powf(10, SCO_AEC_NS_NOISE_INIT / 20.0);
+
+	aec->ns.block = SCO_AEC_NS_BLOCK_MS * aec->sampling / 1000;
+	aec->ns.count = 0;
+	aec->ns.energy = 0;
+	aec->ns.noise = noise * noise;
+	aec->ns.noise_rise = powf(10, SCO_AEC_NS_NOISE_RISE * SCO_AEC_NS_BLOCK_MS / 10000.0);
+	aec->ns.gain = 1;
+	aec->ns.gain_applied = 1;
+	aec->ns.gain_min = powf(10, -SCO_AEC_NS_ATTENUATION_MAX / 20.0);
+
+}
+
+/**
+ * Reset the echo canceller at the start of the microphone stream.
+ *
+ * This function shall be called by the SCO decoder thread. The echo
+ * canceller itself is created lazily, when the echo cancellation is
+ * enabled for the first time.
+ *
+ * @param aec The echo canceller structure.
+ * @param sampling The sampling frequency of the microphone stream. */
+void sco_aec_reset(struct sco_aec *aec, unsigned int sampling) {
+
+	if (aec->ec != NULL)
+		echo_can_free(aec->ec);
+	aec->ec = NULL;
+
+	aec->sampling = sampling;
+	aec->ref_pos = -1;
+
+	sco_aec_rs_init(aec);
+	sco_aec_ns_init(aec);
+
+	aec->window_busy_usec = 0;
+	aec->window_audio_usec = 0;
+	atomic_store_explicit(&aec->bypass, false, memory_order_relaxed);
+	atomic_store_explicit(&aec->usec, 0, memory_order_relaxed);
+
+}
+
+/**
+ * Reset the far-end reference at the start of the speaker stream.
+ *
+ * This function shall be called by the SCO encoder thread together with
+ * the reset of the speaker stream time line of the SCO transport clock. */
+void sco_aec_reset_reference(struct sco_aec *aec) {
+	pthread_mutex_lock(&aec->ref_mtx);
+	aec->ref_head = 0;
+	pthread_mutex_unlock(&aec->ref_mtx);
+}
+
+/**
+ * Store the far-end reference signal.
+ *
+ * This function shall be called by the SCO encoder thread with the PCM
+ * samples which are about to be sent to the Bluetooth device. Samples are
+ * stored regardless of the echo cancellation switch, because the position
+ * of the reference has to follow the speaker stream. */
+void sco_aec_push_reference(struct sco_aec *aec, const int16_t *samples, size_t n) {
+
+	pthread_mutex_lock(&aec->ref_mtx);
+
+	/* only the most recent samples fit in the window */
+	if (n > aec->ref_size) {
+		aec->ref_head += n - aec->ref_size;
+		samples += n - aec->ref_size;
+		n = aec->ref_size;
+	}
+
+	const size_t offset = aec->ref_head % aec->ref_size;
+	const size_t len = n < aec->ref_size - offset ? n : aec->ref_size - offset;
+	memcpy(&aec->ref[offset], samples, len * sizeof(*samples));
+	memcpy(aec->ref, &samples[len], (n - len) * sizeof(*samples));
+	aec->ref_head += n;
+
+	pthread_mutex_unlock(&aec->ref_mtx);
+
+}
+
+/**
+ * Align the far-end reference with the microphone stream.
+ *
+ * The last received microphone sample corresponds to the speaker stream
+ * position at the time of the last microphone stamp of the SCO clock. */
+static void sco_aec_align_reference(struct sco_aec *aec, size_t n) {
+
+	unsigned int jitter_usec;
+	int64_t position;
+
+	if (!sco_clock_get_spk_position(aec->clock, aec->sampling, &position, &jitter_usec)) {
+		/* speaker stream is not running, so there is no echo */
+		aec->ref_pos = -1;
+		return;
+	}
+
+	const int64_t pos = position - n;
+	int64_t tolerance = SCO_AEC_DELAY_TOLERANCE_MS * aec->sampling / 1000;
+	const int64_t jitter = 2 * (int64_t)jitter_usec * aec->sampling / 1000000;
+	if (jitter > tolerance)
+		tolerance = jitter;
+
+	if (aec->ref_pos == -1 || llabs(pos - aec->ref_pos) > tolerance) {
+		debug("Echo canceller reference alignment: %+" PRId64 " samples",
+				aec->ref_pos == -1 ? 0 : pos - aec->ref_pos);
+		aec->ref_pos = pos;
+	}
+
+}
+
+/**
+ * Remove the echo from a single microphone sample.
+ *
+ * The echo canceller runs at the SCO_AEC_SAMPLING rate. For higher rates,
+ * both signals are decimated, and the echo estimation (the difference
+ * between the canceller input and output) is interpolated back and removed
+ * from the delayed microphone signal. Hence, the microphone signal above
+ * the canceller band is left intact. */
+static int16_t sco_aec_cancel(struct sco_aec *aec, int16_t mic, int16_t ref) {
+
+	if (aec->rs.factor <= 1)
+		return echo_can_update(aec->ec, ref, mic);
+
+	const unsigned int factor = aec->rs.factor;
+	const size_t taps = aec->rs.taps;
+	const size_t echo_len = aec->rs.echo_len;
+	const float *fir = aec->rs.fir;
+	size_t i, k;
+
+	/* Update mirrored histories, so the filter window is always contiguous.
+	 * The filter is symmetric, so the window direction does not matter. */
+	aec->rs.mic[aec->rs.pos] = aec->rs.mic[aec->rs.pos + taps] = mic;
+	aec->rs.ref[aec->rs.pos] = aec->rs.ref[aec->rs.pos + taps] = ref;
+	if (++aec->rs.pos == taps)
+		aec->rs.pos = 0;
+
+	if (aec->rs.phase == 0) {
+
+		const float *m = &aec->rs.mic[aec->rs.pos];
+		const float *r = &aec->rs.ref[aec->rs.pos];
+		float mic_dec = 0;
+		float ref_dec = 0;
+
+		for (i = 0; i < taps; i++) {
+			mic_dec += fir[i] * m[i];
+			ref_dec += fir[i] * r[i];
+		}
+
+		const int16_t in = sco_aec_clamp(mic_dec);
+		const int16_t out = echo_can_update(aec->ec, sco_aec_clamp(ref_dec), in);
+
+		aec->rs.echo[aec->rs.echo_pos] = aec->rs.echo[aec->rs.echo_pos + echo_len] = in - out;
+		if (++aec->rs.echo_pos == echo_len)
+			aec->rs.echo_pos = 0;
+
+	}
+
+	/* polyphase interpolation of the echo estimation */
+	const float *e = &aec->rs.echo[aec->rs.echo_pos];
+	float echo = 0;
+	for (i = aec->rs.phase, k = echo_len - 1; i < taps; i += factor, k--)
+		echo += fir[i] * e[k];
+	echo *= factor;
+
+	if (++aec->rs.phase == factor)
+		aec->rs.phase = 0;
+
+	const int16_t delayed = aec->rs.delay[aec->rs.delay_pos];
+	aec->rs.delay[aec->rs.delay_pos] = mic;
+	if (++aec->rs.delay_pos == aec->rs.delay_len)
+		aec->rs.delay_pos = 0;
+
+	return sco_aec_clamp(delayed - echo);
+}
+
+/**
+ * Suppress the stationary background noise of a single sample.
+ *
+ * The noise floor is tracked with the minimum of the block power, and the
+ * gain is derived from the block signal-to-noise ratio. The digital silence
+ * (e.g. produced by the echo canceller non-linear processor) is not taken
+ * into account, because it does not tell anything about the noise. */
+static int16_t sco_aec_suppress_noise(struct sco_aec *aec, int16_t sample) {
+
+	const float value = sample;
+	aec->ns.energy += value * value;
+
+	if (++aec->ns.count == aec->ns.block) {
+
+		const float power = aec->ns.energy / aec->ns.count;
+		if (power >= 1) {
+
+			if (power < aec->ns.noise)
+				aec->ns.noise = power;
+			else
+				aec->ns.noise *= aec->ns.noise_rise;
+
+			/* Wiener-like gain with the noise over-subtraction */
+			const float gain = 1 - 2 * aec->ns.noise / power;
+			aec->ns.gain = gain > aec->ns.gain_min ? gain : aec->ns.gain_min;
+
+		}
+
+		aec->ns.energy = 0;
+		aec->ns.count = 0;
+
+	}
+
+	/* smooth the gain change over the analysis block */
+	aec->ns.gain_applied += (aec->ns.gain - aec->ns.gain_applied) / aec->ns.block;
+	return sco_aec_clamp(value * aec->ns.gain_applied);
+}
+
+/**
+ * Remove the echo of the far-end signal from the microphone stream.
+ *
+ * This function shall be called by the SCO decoder thread with decoded
+ * microphone PCM samples, before writing them to the PCM FIFO. The far-end
+ * reference is aligned with the microphone stream with the SCO transport
+ * clock. If there is no reference data for given samples, the reference is
+ * treated as silence. After the echo cancellation, the stationary background
+ * noise is suppressed.
+ *
+ * @param aec The echo canceller structure.
+ * @param samples The microphone PCM samples processed in place.
+ * @param n The number of samples. */
+void sco_aec_process(struct sco_aec *aec, int16_t *samples, size_t n) {
+
+	if (!atomic_load_explicit(&aec->enabled, memory_order_relaxed) ||
+			atomic_load_explicit(&aec->bypass, memory_order_relaxed))
+		return;
+
+	if (aec->ec == NULL) {
+		const int taps = config.hfp.aec_tail * SCO_AEC_SAMPLING / 1000;
+		if ((aec->ec = echo_can_init(taps, ECHO_CAN_USE_ADAPTION | ECHO_CAN_USE_NLP |
+						ECHO_CAN_USE_CNG | ECHO_CAN_USE_TX_HPF | ECHO_CAN_USE_RX_HPF)) == NULL) {
+			error("Couldn't create echo canceller: %s", strerror(ENOMEM));
+			atomic_store_explicit(&aec->bypass, true, memory_order_relaxed);
+			return;
+		}
+		debug("Created echo canceller: %u ms tail, %d taps, %u Hz -> %u Hz",
+				config.hfp.aec_tail, taps, aec->sampling, SCO_AEC_SAMPLING);
+	}
+
+	struct timespec ts0, ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts0);
+
+	sco_aec_align_reference(aec, n);
+
+	int16_t ref[256];
+	size_t done, i;
+
+	for (done = 0; done < n; done += i) {
+
+		const size_t len = n - done < ARRAYSIZE(ref) ? n - done : ARRAYSIZE(ref);
+		memset(ref, 0, len * sizeof(*ref));
+
+		/* copy the reference out of the ring buffer, so the
+		 * encoder thread is not blocked during the processing */
+		if (aec->ref_pos != -1) {
+			pthread_mutex_lock(&aec->ref_mtx);
+			const int64_t head = aec->ref_head;
+			for (i = 0; i < len; i++) {
+				const int64_t pos = aec->ref_pos + done + i;
+				if (pos >= 0 && pos < head && pos >= head - (int64_t)aec->ref_size)
+					ref[i] = aec->ref[pos % aec->ref_size];
+			}
+			pthread_mutex_unlock(&aec->ref_mtx);
+		}
+
+		for (i = 0; i < len; i++)
+			samples[done + i] = sco_aec_suppress_noise(aec,
+					sco_aec_cancel(aec, samples[done + i], ref[i]));
+
+	}
+
+	if (aec->ref_pos != -1)
+		aec->ref_pos += n;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	timespecsub(&ts, &ts0, &ts);
+	const unsigned long long usec = ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	atomic_fetch_add_explicit(&aec->usec, usec, memory_order_relaxed);
+
+	/* check the CPU budget once per every second of audio */
+	aec->window_busy_usec += usec;
+	if ((aec->window_audio_usec += 1000000ULL * n / aec->sampling) >= 1000000) {
+		if (aec->window_busy_usec * 100 > aec->window_audio_usec * SCO_AEC_CPU_BUDGET) {
+			warn("Echo cancellation CPU budget exceeded: %llu%% > %u%%",
+					aec->window_busy_usec * 100 / aec->window_audio_usec, SCO_AEC_CPU_BUDGET);
+			atomic_store_explicit(&aec->bypass, true, memory_order_relaxed);
+		}
+		aec->window_busy_usec = 0;
+		aec->window_audio_usec = 0;
+	}
+
+}
@@ -0,0 +1,171 @@
+/*
+ * BlueALSA - sco-aec.h
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_SCOAEC_H_
+#define BLUEALSA_SCOAEC_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <spandsp.h>
+
+#include "sco-clock.h"
+
+/**
+ * Length of the far-end reference signal window in milliseconds.
+ *
+ * The reference is aligned with the microphone stream with the help of the
+ * SCO transport clock, so the window has to cover the offset between the
+ * speaker and the microphone streams, which includes the SCO encoder and
+ * decoder buffering, and the jitter of that offset. */
+#define SCO_AEC_REF_MAX_MS 500
+
+/**
+ * Maximum sampling frequency of the SCO audio. */
+#define SCO_AEC_MAX_SAMPLING 32000
+
+/**
+ * Sampling frequency at which the echo canceller runs. The spandsp echo
+ * canceller is designed for the narrowband telephony, so the wideband and
+ * the super wideband streams are decimated for the echo cancellation. */
+#define SCO_AEC_SAMPLING 8000
+
+/**
+ * Number of resampler filter taps per decimation factor unit. The filter
+ * group delay is added to the microphone stream latency. */
+#define SCO_AEC_RS_TAPS_PER_FACTOR 16
+
+/**
+ * Maximum number of resampler filter taps. */
+#define SCO_AEC_RS_TAPS_MAX \
+	(SCO_AEC_RS_TAPS_PER_FACTOR * SCO_AEC_MAX_SAMPLING / SCO_AEC_SAMPLING + 1)
+
+/**
+ * The reference alignment is updated only if the offset between streams
+ * changes by more than this value in milliseconds (or twice the jitter),
+ * because every change of the alignment disturbs the echo canceller. */
+#define SCO_AEC_DELAY_TOLERANCE_MS 2
+
+/**
+ * Length of the noise suppressor analysis block in milliseconds. */
+#define SCO_AEC_NS_BLOCK_MS 4
+
+/**
+ * Initial noise floor estimation of the noise suppressor in dBFS. */
+#define SCO_AEC_NS_NOISE_INIT -60
+
+/**
+ * Maximum attenuation of the noise suppressor in dB. */
+#define SCO_AEC_NS_ATTENUATION_MAX 12
+
+/**
+ * Rate in dB per second at which the noise floor estimation is allowed to
+ * raise, e.g. when the background noise level increases. */
+#define SCO_AEC_NS_NOISE_RISE 3
+
+/**
+ * Echo cancellation CPU budget in percent of the real time. If the echo
+ * canceller consumes more, it is bypassed until the next stream start.
+ * The CPU time is measured with the thread CPU-time clock, so preemption
+ * of the decoder thread is not accounted for. */
+#define SCO_AEC_CPU_BUDGET 20
+
+/**
+ * Echo canceller of the SCO microphone stream. */
+struct sco_aec {
+
+	/* per-transport echo cancellation switch */
+	atomic_bool enabled;
+
+	/* SCO transport clock used to align the reference signal */
+	struct sco_clock *clock;
+
+	/* Far-end reference signal taken from the speaker encoder path. The
+	 * ring buffer is filled by the encoder thread and read by the decoder
+	 * thread. Samples are addressed by the speaker stream position. */
+	pthread_mutex_t ref_mtx;
+	int16_t *ref;
+	size_t ref_size;
+	/* number of reference samples since the speaker stream start */
+	uint64_t ref_head;
+
+	/* echo canceller instance owned by the decoder thread */
+	echo_can_state_t *ec;
+	/* sampling frequency of the microphone stream */
+	unsigned int sampling;
+
+	/* Speaker stream position aligned with the next microphone sample, or
+	 * -1 if the alignment is not known (speaker stream is not running). */
+	int64_t ref_pos;
+
+	/* decimation to (and interpolation from) the echo canceller rate */
+	struct {
+		unsigned int factor;
+		unsigned int phase;
+		/* symmetric low-pass filter */
+		float fir[SCO_AEC_RS_TAPS_MAX];
+		size_t taps;
+		/* mirrored histories of the microphone and the reference signals */
+		float mic[2 * SCO_AEC_RS_TAPS_MAX];
+		float ref[2 * SCO_AEC_RS_TAPS_MAX];
+		size_t pos;
+		/* mirrored history of the echo estimation at the canceller rate */
+		float echo[2 * SCO_AEC_RS_TAPS_MAX];
+		size_t echo_len;
+		size_t echo_pos;
+		/* microphone delay line matching the filters group delay */
+		int16_t delay[SCO_AEC_RS_TAPS_MAX];
+		size_t delay_len;
+		size_t delay_pos;
+	} rs;
+
+	/* noise suppressor */
+	struct {
+		size_t block;
+		size_t count;
+		float energy;
+		/* estimated noise floor power */
+		float noise;
+		float noise_rise;
+		/* target and currently applied gain */
+		float gain;
+		float gain_applied;
+		float gain_min;
+	} ns;
+
+	/* CPU budget accounting within the current window */
+	unsigned long long window_busy_usec;
+	unsigned long long window_audio_usec;
+
+	/* set if the CPU budget has been exceeded */
+	atomic_bool bypass;
+	/* CPU time spent on echo cancellation since the stream start */
+	atomic_ullong usec;
+
+};
+
+int sco_aec_init(struct sco_aec *aec, struct sco_clock *clock, bool enabled);
+void sco_aec_free(struct sco_aec *aec);
+
+void sco_aec_reset(struct sco_aec *aec, unsigned int sampling);
+void sco_aec_reset_reference(struct sco_aec *aec);
+
+void sco_aec_push_reference(struct sco_aec *aec, const int16_t *samples, size_t n);
+void sco_aec_process(struct sco_aec *aec, int16_t *samples, size_t n);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * BlueALSA - sco-clock.c
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "sco-clock.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "shared/rt.h"
+
+static int64_t sco_clock_get_usec(void) {
+	struct timespec ts;
+	gettimestamp(&ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct sco_clock_timeline *sco_clock_get_timeline(
+		struct sco_clock *clock, enum sco_clock_stream stream) {
+	return stream == SCO_CLOCK_STREAM_SPK ? &clock->spk : &clock->mic;
+}
+
+/**
+ * Initialize the SCO transport clock. */
+void sco_clock_init(struct sco_clock *clock) {
+	memset(clock, 0, sizeof(*clock));
+	pthread_mutex_init(&clock->mutex, NULL);
+}
+
+/**
+ * Free the SCO transport clock resources. */
+void sco_clock_free(struct sco_clock *clock) {
+	pthread_mutex_destroy(&clock->mutex);
+}
+
+/**
+ * Reset the time line of the given stream direction.
+ *
+ * This function shall be called by the IO thread at the beginning of the
+ * IO routine. Since the relation between streams is no longer valid, the
+ * offset and jitter estimation is reset as well. */
+void sco_clock_reset(struct sco_clock *clock, enum sco_clock_stream stream) {
+	pthread_mutex_lock(&clock->mutex);
+	struct sco_clock_timeline *tl = sco_clock_get_timeline(clock, stream);
+	tl->origin_usec = 0;
+	tl->units = 0;
+	tl->stamp_usec = 0;
+	tl->synced = false;
+	clock->offset_usec = 0;
+	clock->jitter_scaled = 0;
+	clock->updates = 0;
+	pthread_mutex_unlock(&clock->mutex);
+}
+
+/**
+ * Stamp the data transferred over the Bluetooth link.
+ *
+ * @param clock The SCO transport clock.
+ * @param stream The stream direction.
+ * @param units The amount of transferred data, e.g. the number of bytes.
+ * @param rate The nominal number of units transferred per second. */
+void sco_clock_stamp(struct sco_clock *clock, enum sco_clock_stream stream,
+		unsigned int units, unsigned int rate) {
+
+	const int64_t now = sco_clock_get_usec();
+
+	pthread_mutex_lock(&clock->mutex);
+
+	struct sco_clock_timeline *tl = sco_clock_get_timeline(clock, stream);
+	tl->units += units;
+	tl->origin_usec = now - (int64_t)(tl->units * 1000000 / rate);
+	tl->stamp_usec = now;
+	tl->synced = true;
+
+	if (clock->spk.synced && clock->mic.synced) {
+
+		const int64_t offset = clock->mic.origin_usec - clock->spk.origin_usec;
+
+		if (clock->updates++ > 0) {
+			/* Running jitter estimation as in RFC 3550 (Appendix A.8). The jitter
+			 * value is kept scaled, so there is no loss of precision. */
+			const int64_t d = offset - clock->offset_usec;
+			clock->jitter_scaled += (uint64_t)(d < 0 ? -d : d) -
+				((clock->jitter_scaled + (1 << (SCO_CLOCK_JITTER_GAIN_SHIFT - 1))) >>
+				 SCO_CLOCK_JITTER_GAIN_SHIFT);
+		}
+
+		clock->offset_usec = offset;
+
+	}
+
+	pthread_mutex_unlock(&clock->mutex);
+
+}
+
+/**
+ * Get the offset between the speaker and the microphone streams.
+ *
+ * @param clock The SCO transport clock.
+ * @param offset_usec Address where the offset of the microphone stream
+ *   relative to the speaker stream will be stored. Positive value means
+ *   that the microphone stream lags behind the speaker stream.
+ * @param jitter_usec Address where the jitter of the offset will be stored.
+ * @return This function returns false if the offset is not known yet, i.e.
+ *   not both stream directions are running. */
+bool sco_clock_get_offset(struct sco_clock *clock,
+		int64_t *offset_usec, unsigned int *jitter_usec) {
+
+	pthread_mutex_lock(&clock->mutex);
+
+	const bool valid = clock->updates > 0;
+	*offset_usec = clock->offset_usec;
+	*jitter_usec = clock->jitter_scaled >> SCO_CLOCK_JITTER_GAIN_SHIFT;
+
+	pthread_mutex_unlock(&clock->mutex);
+
+	return valid;
+}
+
+/**
+ * Get the position of the speaker stream at the last microphone stamp.
+ *
+ * This function maps the end of the microphone data received so far onto
+ * the speaker stream, which is required to align the far-end reference
+ * signal with the microphone stream, e.g. for the echo cancellation.
+ *
+ * @param clock The SCO transport clock.
+ * @param rate The number of position units per second, e.g. the sampling
+ *   frequency of the speaker stream.
+ * @param position Address where the position of the speaker stream (number
+ *   of units since the stream start) will be stored.
+ * @param jitter_usec Address where the jitter of the offset between the
+ *   speaker and the microphone streams will be stored.
+ * @return This function returns false if the position is not known yet, i.e.
+ *   not both stream directions are running. */
+bool sco_clock_get_spk_position(struct sco_clock *clock, unsigned int rate,
+		int64_t *position, unsigned int *jitter_usec) {
+
+	pthread_mutex_lock(&clock->mutex);
+
+	const bool valid = clock->spk.synced && clock->mic.synced;
+	*position = (clock->mic.stamp_usec - clock->spk.origin_usec) * rate / 1000000;
+	*jitter_usec = clock->jitter_scaled >> SCO_CLOCK_JITTER_GAIN_SHIFT;
+
+	pthread_mutex_unlock(&clock->mutex);
+
+	return valid;
+}
@@ -0,0 +1,85 @@
+/*
+ * BlueALSA - sco-clock.h
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_SCOCLOCK_H_
+#define BLUEALSA_SCOCLOCK_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The offset jitter is smoothed with the 1/2^N gain factor. The value of 4
+ * gives the same smoothing as for the inter-arrival jitter in RFC 3550. */
+#define SCO_CLOCK_JITTER_GAIN_SHIFT 4
+
+enum sco_clock_stream {
+	SCO_CLOCK_STREAM_SPK,
+	SCO_CLOCK_STREAM_MIC,
+};
+
+/**
+ * Time line of a single SCO stream direction. */
+struct sco_clock_timeline {
+
+	/* Monotonic time-stamp (in microseconds) at which the stream would
+	 * have started, if all the data transferred so far were transferred
+	 * with the nominal rate. This value is updated on every stamp. */
+	int64_t origin_usec;
+	/* amount of data transferred since the stream start */
+	uint64_t units;
+	/* monotonic time-stamp (in microseconds) of the last stamp */
+	int64_t stamp_usec;
+
+	bool synced;
+
+};
+
+/**
+ * Shared clock of the SCO transport.
+ *
+ * The SCO encoder (speaker) and decoder (microphone) threads run
+ * independently. In order to provide echo cancellation consumers with
+ * a relation between these two streams, both threads stamp the data
+ * transferred over the Bluetooth link on a common monotonic time line. */
+struct sco_clock {
+
+	pthread_mutex_t mutex;
+
+	struct sco_clock_timeline spk;
+	struct sco_clock_timeline mic;
+
+	/* microphone origin minus speaker origin */
+	int64_t offset_usec;
+	/* scaled jitter of the offset */
+	uint64_t jitter_scaled;
+	/* number of offset updates */
+	uint64_t updates;
+
+};
+
+void sco_clock_init(struct sco_clock *clock);
+void sco_clock_free(struct sco_clock *clock);
+
+void sco_clock_reset(struct sco_clock *clock, enum sco_clock_stream stream);
+void sco_clock_stamp(struct sco_clock *clock, enum sco_clock_stream stream,
+		unsigned int units, unsigned int rate);
+
+bool sco_clock_get_offset(struct sco_clock *clock,
+		int64_t *offset_usec, unsigned int *jitter_usec);
+bool sco_clock_get_spk_position(struct sco_clock *clock, unsigned int rate,
+		int64_t *position, unsigned int *jitter_usec);
+
+#endif
@@ -11,10 +11,11 @@
 #include "sco.h"
 
 #include <errno.h>
-#include <poll.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -23,9 +24,16 @@
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
 #include <bluetooth/sco.h>
+#include <glib.h>
+#if ENABLE_MSBC
+# include <spandsp.h>
+#endif
 
 #include "ba-device.h"
 #include "bluealsa-config.h"
+#if ENABLE_LC3_SWB
+# include "codec-lc3-swb.h"
+#endif
 #if ENABLE_MSBC
 # include "codec-msbc.h"
 #endif
@@ -33,6 +41,11 @@
 #include "hci.h"
 #include "hfp.h"
 #include "io.h"
+#if ENABLE_MSBC
+# include "sco-aec.h"
+#endif
+#include "sco-clock.h"
+#include "thread-stats.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
@@ -40,125 +53,152 @@
 #include "shared/rt.h"
 
 /**
- * SCO dispatcher internal data. */
-struct sco_data {
-	struct ba_adapter *a;
-	struct pollfd pfd;
+ * Incoming SCO link waiting for the connection setup completion. */
+struct sco_link {
+	struct ba_transport *t;
+	int fd;
+	/* main loop sources of the link */
+	unsigned int watch;
+	unsigned int timeout;
 };
 
-static void sco_dispatcher_cleanup(struct sco_data *data) {
-	debug("SCO dispatcher cleanup: %s", data->a->hci.name);
-	if (data->pfd.fd != -1)
-		close(data->pfd.fd);
+static void sco_link_free(struct sco_link *link) {
+	if (link->timeout != 0)
+		g_source_remove(link->timeout);
+	if (link->fd != -1)
+		close(link->fd);
+	ba_transport_unref(link->t);
+	free(link);
 }
 
-static void *sco_dispatcher_thread(struct ba_adapter *a) {
-
-	struct sco_data data = { .a = a, .pfd = { -1, POLLIN, 0 } };
-
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(sco_dispatcher_cleanup), &data);
-
-	if ((data.pfd.fd = hci_sco_open(data.a->hci.dev_id)) == -1) {
-		error("Couldn't open SCO socket: %s", strerror(errno));
-		goto fail;
-	}
-
-#if ENABLE_MSBC
-	uint32_t defer = 1;
-	if (setsockopt(data.pfd.fd, SOL_BLUETOOTH, BT_DEFER_SETUP, &defer, sizeof(defer)) == -1) {
-		error("Couldn't set deferred connection setup: %s", strerror(errno));
-		goto fail;
-	}
-#endif
+/**
+ * Callback for the SCO link setup timeout.
+ *
+ * If the remote device does not complete the connection setup in a timely
+ * manner, drop the link, so the transport reference will not be held. */
+static gboolean sco_link_timeout_cb(void *userdata) {
+	struct sco_link *link = userdata;
+	error("Couldn't setup SCO link: %s", strerror(ETIMEDOUT));
+	link->timeout = 0;
+	/* the link is freed by the watch destroy notify */
+	g_source_remove(link->watch);
+	return G_SOURCE_REMOVE;
+}
 
-	if (listen(data.pfd.fd, 10) == -1) {
-		error("Couldn't listen on SCO socket: %s", strerror(errno));
-		goto fail;
+/**
+ * Callback for the SCO link with deferred setup.
+ *
+ * After the authorization, the connection setup is finalized by the kernel
+ * asynchronously. The socket becomes writable when the link is connected. */
+static gboolean sco_link_connected_cb(G_GNUC_UNUSED GIOChannel *ch,
+		GIOCondition condition, void *userdata) {
+
+	struct sco_link *link = userdata;
+	int err = 0;
+
+	if (condition & (G_IO_ERR | G_IO_HUP)) {
+		socklen_t len = sizeof(err);
+		getsockopt(link->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		error("Couldn't setup SCO link: %s", strerror(err != 0 ? err : ECONNRESET));
+		return G_SOURCE_REMOVE;
 	}
 
-	debug("Starting SCO dispatcher loop: %s", a->hci.name);
-	for (;;) {
+	ba_transport_sco_link_start(link->t, link->fd);
+	link->fd = -1;
 
-		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-
-		if (poll(&data.pfd, 1, -1) == -1) {
-			if (errno == EINTR)
-				continue;
-			error("SCO dispatcher poll error: %s", strerror(errno));
-			goto fail;
-		}
-
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-
-		struct sockaddr_sco addr;
-		socklen_t addrlen = sizeof(addr);
-		struct ba_device *d = NULL;
-		struct ba_transport *t = NULL;
-		int fd = -1;
+	return G_SOURCE_REMOVE;
+}
 
-		if ((fd = accept(data.pfd.fd, (struct sockaddr *)&addr, &addrlen)) == -1) {
+/**
+ * Callback for the SCO listening socket.
+ *
+ * This callback is called from the main loop, so it shall never block. The
+ * listening socket and accepted links are non-blocking, and links with the
+ * deferred setup are finalized by the sco_link_connected_cb() callback. */
+static gboolean sco_dispatcher_accept_cb(GIOChannel *ch,
+		G_GNUC_UNUSED GIOCondition condition, void *userdata) {
+
+	struct ba_adapter *a = userdata;
+	struct sockaddr_sco addr;
+	socklen_t addrlen = sizeof(addr);
+	struct ba_device *d = NULL;
+	struct ba_transport *t = NULL;
+	int fd;
+
+	if ((fd = accept4(g_io_channel_unix_get_fd(ch), (struct sockaddr *)&addr,
+					&addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC)) == -1) {
+		if (errno != EAGAIN && errno != EINTR)
 			error("Couldn't accept incoming SCO link: %s", strerror(errno));
-			goto cleanup;
-		}
+		return G_SOURCE_CONTINUE;
+	}
 
-		debug("New incoming SCO link: %s: %d", batostr_(&addr.sco_bdaddr), fd);
+	debug("New incoming SCO link: %s: %d", batostr_(&addr.sco_bdaddr), fd);
 
-		if ((d = ba_device_lookup(data.a, &addr.sco_bdaddr)) == NULL) {
-			error("Couldn't lookup device: %s", batostr_(&addr.sco_bdaddr));
-			goto cleanup;
-		}
+	if ((d = ba_device_lookup(a, &addr.sco_bdaddr)) == NULL) {
+		error("Couldn't lookup device: %s", batostr_(&addr.sco_bdaddr));
+		goto cleanup;
+	}
 
-		if ((t = ba_transport_lookup(d, d->bluez_dbus_path)) == NULL) {
-			error("Couldn't lookup transport: %s", d->bluez_dbus_path);
-			goto cleanup;
-		}
+	if ((t = ba_transport_lookup(d, d->bluez_dbus_path)) == NULL) {
+		error("Couldn't lookup transport: %s", d->bluez_dbus_path);
+		goto cleanup;
+	}
 
 #if ENABLE_MSBC
-		struct bt_voice voice = { .setting = BT_VOICE_TRANSPARENT };
-		if (t->type.codec == HFP_CODEC_MSBC &&
-				setsockopt(fd, SOL_BLUETOOTH, BT_VOICE, &voice, sizeof(voice)) == -1) {
-			error("Couldn't setup transparent voice: %s", strerror(errno));
-			goto cleanup;
-		}
-		if (read(fd, &voice, 1) == -1) {
-			error("Couldn't authorize SCO connection: %s", strerror(errno));
-			goto cleanup;
-		}
-#endif
-
-		ba_transport_stop(t);
-
-		pthread_mutex_lock(&t->bt_fd_mtx);
-
-		t->bt_fd = fd;
-		t->mtu_read = t->mtu_write = hci_sco_get_mtu(fd, a->hci.type);
-		fd = -1;
+	struct bt_voice voice = { .setting = BT_VOICE_TRANSPARENT };
+	if ((t->type.codec == HFP_CODEC_MSBC ||
+				t->type.codec == HFP_CODEC_LC3_SWB) &&
+			setsockopt(fd, SOL_BLUETOOTH, BT_VOICE, &voice, sizeof(voice)) == -1) {
+		error("Couldn't setup transparent voice: %s", strerror(errno));
+		goto cleanup;
+	}
+	/* With the deferred setup, reading from the socket authorizes
+	 * the connection. It does not wait for the setup completion. */
+	if (read(fd, &voice, 1) == -1 && errno != EAGAIN) {
+		error("Couldn't authorize SCO connection: %s", strerror(errno));
+		goto cleanup;
+	}
 
-		pthread_mutex_unlock(&t->bt_fd_mtx);
+	struct sco_link *link;
+	if ((link = malloc(sizeof(*link))) == NULL) {
+		error("Couldn't create SCO link: %s", strerror(errno));
+		goto cleanup;
+	}
 
-		ba_transport_start(t);
+	link->t = t;
+	link->fd = fd;
+	t = NULL;
+	fd = -1;
+
+	GIOChannel *link_ch = g_io_channel_unix_new(link->fd);
+	link->watch = g_io_add_watch_full(link_ch, G_PRIORITY_DEFAULT, G_IO_OUT | G_IO_ERR | G_IO_HUP,
+			sco_link_connected_cb, link, (GDestroyNotify)sco_link_free);
+	link->timeout = g_timeout_add(SCO_LINK_SETUP_TIMEOUT, sco_link_timeout_cb, link);
+	g_io_channel_unref(link_ch);
+#else
+	ba_transport_sco_link_start(t, fd);
+	fd = -1;
+#endif
 
 cleanup:
-		if (d != NULL)
-			ba_device_unref(d);
-		if (t != NULL)
-			ba_transport_unref(t);
-		if (fd != -1)
-			close(fd);
-
-	}
-
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(1);
-	return NULL;
+	if (d != NULL)
+		ba_device_unref(d);
+	if (t != NULL)
+		ba_transport_unref(t);
+	if (fd != -1)
+		close(fd);
+	return G_SOURCE_CONTINUE;
 }
 
+/**
+ * Setup dispatcher for incoming SCO links.
+ *
+ * Incoming links of all adapters are dispatched by the main loop, so there
+ * is no need for a dedicated thread per adapter. */
 int sco_setup_connection_dispatcher(struct ba_adapter *a) {
 
-	/* skip setup if dispatcher thread is already running */
-	if (!pthread_equal(a->sco_dispatcher, config.main_thread))
+	/* skip setup if dispatcher is already registered */
+	if (a->sco_dispatcher != 0)
 		return 0;
 
 	/* XXX: It is a known issue with Broadcom chips, that by default, the SCO
@@ -189,23 +229,49 @@ int sco_setup_connection_dispatcher(struct ba_adapter *a) {
 
 	}
 
-	int ret;
+	int fd, err;
 
-	/* Please note, that during the SCO dispatcher thread creation the adapter
-	 * is not referenced. It is guaranteed that the adapter will be available
-	 * during the whole live-span of the thread, because the thread is canceled
-	 * in the adapter cleanup routine. See the ba_adapter_unref() function. */
-	if ((ret = pthread_create(&a->sco_dispatcher, NULL,
-					PTHREAD_ROUTINE(sco_dispatcher_thread), a)) != 0) {
-		error("Couldn't create SCO dispatcher: %s", strerror(ret));
-		a->sco_dispatcher = config.main_thread;
+	if ((fd = hci_sco_open(a->hci.dev_id)) == -1) {
+		error("Couldn't open SCO socket: %s", strerror(errno));
 		return -1;
 	}
 
-	pthread_setname_np(a->sco_dispatcher, "ba-sco-dispatch");
-	debug("Created SCO dispatcher [%s]: %s", "ba-sco-dispatch", a->hci.name);
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+		error("Couldn't set non-blocking mode: %s", strerror(errno));
+		goto fail;
+	}
+
+#if ENABLE_MSBC
+	uint32_t defer = 1;
+	if (setsockopt(fd, SOL_BLUETOOTH, BT_DEFER_SETUP, &defer, sizeof(defer)) == -1) {
+		error("Couldn't set deferred connection setup: %s", strerror(errno));
+		goto fail;
+	}
+#endif
+
+	if (listen(fd, 10) == -1) {
+		error("Couldn't listen on SCO socket: %s", strerror(errno));
+		goto fail;
+	}
 
+	/* Please note, that the adapter is not referenced by the dispatcher. It
+	 * is guaranteed that the adapter will be available during the whole
+	 * live-span of the dispatcher, because the dispatcher is removed in the
+	 * adapter cleanup routine. See the ba_adapter_unref() function. */
+	GIOChannel *ch = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(ch, TRUE);
+	a->sco_dispatcher = g_io_add_watch_full(ch, G_PRIORITY_DEFAULT,
+			G_IO_IN, sco_dispatcher_accept_cb, a, NULL);
+	g_io_channel_unref(ch);
+
+	debug("Created SCO dispatcher: %s", a->hci.name);
 	return 0;
+
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
 }
 
 static void *sco_cvsd_enc_thread(struct ba_transport_thread *th) {
@@ -220,6 +286,9 @@ static void *sco_cvsd_enc_thread(struct ba_transport_thread *th) {
 	const size_t mtu_samples = t->mtu_write / sizeof(int16_t);
 	const size_t mtu_write = t->mtu_write;
 
+	/* CVSD link transfers 8 kHz 16-bit samples */
+	const unsigned int data_rate = 8000 * sizeof(int16_t);
+
 	ffb_t buffer = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &buffer);
 
@@ -229,18 +298,30 @@ static void *sco_cvsd_enc_thread(struct ba_transport_thread *th) {
 		goto fail_init;
 	}
 
+	sco_clock_reset(&t->sco.clock, SCO_CLOCK_STREAM_SPK);
+#if ENABLE_MSBC
+	sco_aec_reset_reference(&t->sco.aec);
+#endif
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 		ssize_t samples = ffb_len_in(&buffer);
 		if ((samples = io_poll_and_read_pcm(&io, pcm, buffer.tail, samples)) <= 0) {
-			if (samples == -1)
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto exit;
 				error("PCM poll and read error: %s", strerror(errno));
+			}
 			else if (samples == 0)
 				ba_transport_stop_if_no_clients(t);
 			continue;
 		}
 
+#if ENABLE_MSBC
+		sco_aec_push_reference(&t->sco.aec, buffer.tail, samples);
+#endif
+
 		ffb_seek(&buffer, samples);
 		samples = ffb_len_out(&buffer);
 
@@ -251,11 +332,13 @@ static void *sco_cvsd_enc_thread(struct ba_transport_thread *th) {
 
 			ssize_t ret;
 			if ((ret = io_bt_write(th, input, mtu_write)) <= 0) {
-				if (ret == -1)
+				if (ret == -1 && errno != ECANCELED)
 					error("BT write error: %s", strerror(errno));
 				goto exit;
 			}
 
+			sco_clock_stamp(&t->sco.clock, SCO_CLOCK_STREAM_SPK, ret, data_rate);
+
 			input += mtu_samples;
 			input_samples -= mtu_samples;
 
@@ -263,6 +346,7 @@ static void *sco_cvsd_enc_thread(struct ba_transport_thread *th) {
 			asrsync_sync(&io.asrs, mtu_samples);
 			/* update busy delay (encoding overhead) */
 			pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100;
+			thread_stats_busy(&th->stats, asrsync_get_busy_usec(&io.asrs));
 
 		}
 
@@ -291,41 +375,103 @@ static void *sco_cvsd_dec_thread(struct ba_transport_thread *th) {
 
 	const size_t mtu_samples = t->mtu_read / sizeof(int16_t);
 	const size_t mtu_samples_multiplier = 2;
+	/* Number of samples accumulated before writing them to the PCM FIFO.
+	 * CVSD audio is always sampled at 8 kHz. */
+	const size_t batch_samples = config.hfp.cvsd_batch_latency * 8;
+	/* CVSD link transfers 8 kHz 16-bit samples */
+	const unsigned int data_rate = 8000 * sizeof(int16_t);
+
+#if ENABLE_MSBC
+	/* packet loss concealment */
+	plc_state_t plc;
+	plc_init(&plc);
+#endif
 
 	ffb_t buffer = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &buffer);
 
-	if (ffb_init_int16_t(&buffer, mtu_samples * mtu_samples_multiplier) == -1) {
+	/* Preallocate buffer for the whole batch, so that there will be always
+	 * space for at least few SCO packets after the last FIFO write. */
+	if (ffb_init_int16_t(&buffer, batch_samples + mtu_samples * mtu_samples_multiplier) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
 	}
 
+	/* report the latency introduced by the batching */
+	pcm->delay = config.hfp.cvsd_batch_latency * 10;
+
+	sco_clock_reset(&t->sco.clock, SCO_CLOCK_STREAM_MIC);
+#if ENABLE_MSBC
+	sco_aec_reset(&t->sco.aec, pcm->sampling);
+#endif
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
-		ssize_t len = ffb_blen_in(&buffer);
-		if ((len = io_poll_and_read_bt(&io, th, buffer.tail, len)) == -1)
+		const size_t space = ffb_blen_in(&buffer);
+		ssize_t len;
+
+		if ((len = io_poll_and_read_bt(&io, th, buffer.tail, space)) == -1) {
+			if (errno == ECANCELED)
+				goto exit;
 			error("BT poll and read error: %s", strerror(errno));
+			continue;
+		}
 		else if (len == 0)
 			goto exit;
 
-		if ((size_t)len == buffer.nmemb * buffer.size) {
+		sco_clock_stamp(&t->sco.clock, SCO_CLOCK_STREAM_MIC, len, data_rate);
+
+		/* If the read has filled all the available space, the SCO packet was
+		 * most likely truncated, which means that the reported MTU is wrong. */
+		if ((size_t)len == space) {
 			debug("Resizing CVSD read buffer: %zd -> %zd",
 					buffer.nmemb * buffer.size, buffer.nmemb * buffer.size * 2);
 			if (ffb_init_int16_t(&buffer, buffer.nmemb * 2) == -1)
 				error("Couldn't resize CVSD read buffer: %s", strerror(errno));
 		}
 
-		if (!ba_transport_pcm_is_active(pcm))
+		if (!ba_transport_pcm_is_active(pcm)) {
+			ffb_rewind(&buffer);
 			continue;
+		}
 
+		int16_t *data = buffer.tail;
 		ssize_t samples = len / sizeof(int16_t);
+
+		/* Conceal packets received with errors reported by the HCI. If spandsp
+		 * library is not available, such packets are simply muted. */
+		const bool corrupted = th->bt_pkt_status != HCI_SCO_PKT_STATUS_CORRECT;
+		if (corrupted)
+			debug("Concealing corrupted CVSD packet: %#x", th->bt_pkt_status);
+#if ENABLE_MSBC
+		if (corrupted)
+			plc_fillin(&plc, data, samples);
+		else
+			plc_rx(&plc, data, samples);
+		sco_aec_process(&t->sco.aec, data, samples);
+#else
+		if (corrupted)
+			memset(data, 0, samples * sizeof(int16_t));
+#endif
+
+		ffb_seek(&buffer, samples);
+
+		/* accumulate samples up to the latency budget */
+		if ((size_t)(samples = ffb_len_out(&buffer)) < batch_samples)
+			continue;
+
 		io_pcm_scale(pcm, buffer.data, samples);
-		if ((samples = io_pcm_write(pcm, buffer.data, samples)) == -1)
+		if ((samples = io_pcm_write(pcm, buffer.data, samples)) == -1) {
+			if (errno == ECANCELED)
+				goto exit;
 			error("FIFO write error: %s", strerror(errno));
+		}
 		else if (samples == 0)
 			ba_transport_stop_if_no_clients(t);
 
+		ffb_rewind(&buffer);
+
 	}
 
 exit:
@@ -348,6 +494,8 @@ static void *sco_msbc_enc_thread(struct ba_transport_thread *th) {
 	struct ba_transport_pcm *pcm = &t->sco.spk_pcm;
 	struct io_poll io = { .timeout = -1 };
 	const size_t mtu_write = t->mtu_write;
+	/* single eSCO frame is transferred per codec frame duration */
+	const unsigned int data_rate = sizeof(esco_msbc_frame_t) * 16000 / MSBC_CODESAMPLES;
 
 	struct esco_msbc msbc = { .initialized = false };
 	pthread_cleanup_push(PTHREAD_CLEANUP(msbc_finish), &msbc);
@@ -357,24 +505,34 @@ static void *sco_msbc_enc_thread(struct ba_transport_thread *th) {
 		goto fail_msbc;
 	}
 
+	sco_clock_reset(&t->sco.clock, SCO_CLOCK_STREAM_SPK);
+	sco_aec_reset_reference(&t->sco.aec);
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 		ssize_t samples = ffb_len_in(&msbc.pcm);
 		if ((samples = io_poll_and_read_pcm(&io, pcm, msbc.pcm.tail, samples)) <= 0) {
-			if (samples == -1)
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto exit;
 				error("PCM poll and read error: %s", strerror(errno));
+			}
 			else if (samples == 0)
 				ba_transport_stop_if_no_clients(t);
 			continue;
 		}
 
+		sco_aec_push_reference(&t->sco.aec, msbc.pcm.tail, samples);
 		ffb_seek(&msbc.pcm, samples);
 
 		while (ffb_len_out(&msbc.pcm) >= MSBC_CODESAMPLES) {
 
-			int err;
-			if ((err = msbc_encode(&msbc)) < 0) {
+			thread_stats_codec_begin(&th->stats);
+			const int err = msbc_encode(&msbc);
+			thread_stats_codec_end(&th->stats);
+
+			if (err < 0) {
 				error("mSBC encoding error: %s", sbc_strerror(err));
 				break;
 			}
@@ -386,11 +544,13 @@ static void *sco_msbc_enc_thread(struct ba_transport_thread *th) {
 
 				ssize_t len;
 				if ((len = io_bt_write(th, data, mtu_write)) <= 0) {
-					if (len == -1)
+					if (len == -1 && errno != ECANCELED)
 						error("BT write error: %s", strerror(errno));
 					goto exit;
 				}
 
+				sco_clock_stamp(&t->sco.clock, SCO_CLOCK_STREAM_SPK, len, data_rate);
+
 				data += len;
 				data_len -= len;
 
@@ -400,6 +560,7 @@ static void *sco_msbc_enc_thread(struct ba_transport_thread *th) {
 			asrsync_sync(&io.asrs, msbc.frames * MSBC_CODESAMPLES);
 			/* update busy delay (encoding overhead) */
 			pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100;
+			thread_stats_busy(&th->stats, asrsync_get_busy_usec(&io.asrs));
 
 			/* Move unprocessed data to the front of our linear
 			* buffer and clear the mSBC frame counter. */
@@ -430,6 +591,8 @@ static void *sco_msbc_dec_thread(struct ba_transport_thread *th) {
 	struct ba_transport *t = th->t;
 	struct ba_transport_pcm *pcm = &t->sco.mic_pcm;
 	struct io_poll io = { .timeout = -1 };
+	/* single eSCO frame is transferred per codec frame duration */
+	const unsigned int data_rate = sizeof(esco_msbc_frame_t) * 16000 / MSBC_CODESAMPLES;
 
 	struct esco_msbc msbc = { .initialized = false };
 	pthread_cleanup_push(PTHREAD_CLEANUP(msbc_finish), &msbc);
@@ -439,22 +602,40 @@ static void *sco_msbc_dec_thread(struct ba_transport_thread *th) {
 		goto fail_msbc;
 	}
 
+	sco_clock_reset(&t->sco.clock, SCO_CLOCK_STREAM_MIC);
+	sco_aec_reset(&t->sco.aec, pcm->sampling);
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 		ssize_t len = ffb_blen_in(&msbc.data);
-		if ((len = io_poll_and_read_bt(&io, th, msbc.data.tail, len)) == -1)
+		if ((len = io_poll_and_read_bt(&io, th, msbc.data.tail, len)) == -1) {
+			if (errno == ECANCELED)
+				goto exit;
 			error("BT poll and read error: %s", strerror(errno));
+		}
 		else if (len == 0)
 			goto exit;
 
+		if (len > 0)
+			sco_clock_stamp(&t->sco.clock, SCO_CLOCK_STREAM_MIC, len, data_rate);
+
 		if (!ba_transport_pcm_is_active(pcm))
 			continue;
 
 		ffb_seek(&msbc.data, len);
+		/* mark data received with errors for concealment */
+		if (th->bt_pkt_status != HCI_SCO_PKT_STATUS_CORRECT)
+			msbc.data_corrupted = ffb_blen_out(&msbc.data);
+
+		/* number of samples already processed by the echo canceller */
+		const size_t processed = ffb_len_out(&msbc.pcm);
 
-		int err;
-		if ((err = msbc_decode(&msbc)) < 0) {
+		thread_stats_codec_begin(&th->stats);
+		const int err = msbc_decode(&msbc);
+		thread_stats_codec_end(&th->stats);
+
+		if (err < 0) {
 			error("mSBC decoding error: %s", sbc_strerror(err));
 			continue;
 		}
@@ -463,9 +644,14 @@ static void *sco_msbc_dec_thread(struct ba_transport_thread *th) {
 		if ((samples = ffb_len_out(&msbc.pcm)) <= 0)
 			continue;
 
+		sco_aec_process(&t->sco.aec, (int16_t *)msbc.pcm.data + processed, samples - processed);
+
 		io_pcm_scale(pcm, msbc.pcm.data, samples);
-		if ((samples = io_pcm_write(pcm, msbc.pcm.data, samples)) == -1)
+		if ((samples = io_pcm_write(pcm, msbc.pcm.data, samples)) == -1) {
+			if (errno == ECANCELED)
+				goto exit;
 			error("FIFO write error: %s", strerror(errno));
+		}
 		else if (samples == 0)
 			ba_transport_stop_if_no_clients(t);
 
@@ -484,6 +670,192 @@ fail_msbc:
 }
 #endif
 
+#if ENABLE_LC3_SWB
+static void *sco_lc3_swb_enc_thread(struct ba_transport_thread *th) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	struct ba_transport_pcm *pcm = &t->sco.spk_pcm;
+	struct io_poll io = { .timeout = -1 };
+	const size_t mtu_write = t->mtu_write;
+	/* single eSCO frame is transferred per codec frame duration */
+	const unsigned int data_rate = sizeof(esco_lc3_swb_frame_t) * LC3_SWB_SAMPLING / LC3_SWB_CODESAMPLES;
+
+	struct esco_lc3_swb lc3_swb = { .initialized = false };
+	pthread_cleanup_push(PTHREAD_CLEANUP(lc3_swb_finish), &lc3_swb);
+
+	if (lc3_swb_init(&lc3_swb) != 0) {
+		error("Couldn't initialize LC3-SWB codec: %s", strerror(errno));
+		goto fail_lc3_swb;
+	}
+
+	sco_clock_reset(&t->sco.clock, SCO_CLOCK_STREAM_SPK);
+	sco_aec_reset_reference(&t->sco.aec);
+
+	debug_transport_thread_loop(th, "START");
+	for (ba_transport_thread_set_state_running(th);;) {
+
+		ssize_t samples = ffb_len_in(&lc3_swb.pcm);
+		if ((samples = io_poll_and_read_pcm(&io, pcm, lc3_swb.pcm.tail, samples)) <= 0) {
+			if (samples == -1) {
+				if (errno == ECANCELED)
+					goto exit;
+				error("PCM poll and read error: %s", strerror(errno));
+			}
+			else if (samples == 0)
+				ba_transport_stop_if_no_clients(t);
+			continue;
+		}
+
+		sco_aec_push_reference(&t->sco.aec, lc3_swb.pcm.tail, samples);
+		ffb_seek(&lc3_swb.pcm, samples);
+
+		while (ffb_len_out(&lc3_swb.pcm) >= LC3_SWB_CODESAMPLES) {
+
+			thread_stats_codec_begin(&th->stats);
+			const int err = lc3_swb_encode(&lc3_swb);
+			thread_stats_codec_end(&th->stats);
+
+			if (err < 0) {
+				error("LC3-SWB encoding error: %s", strerror(-err));
+				break;
+			}
+
+			uint8_t *data = lc3_swb.data.data;
+			size_t data_len = ffb_blen_out(&lc3_swb.data);
+
+			while (data_len >= mtu_write) {
+
+				ssize_t len;
+				if ((len = io_bt_write(th, data, mtu_write)) <= 0) {
+					if (len == -1 && errno != ECANCELED)
+						error("BT write error: %s", strerror(errno));
+					goto exit;
+				}
+
+				sco_clock_stamp(&t->sco.clock, SCO_CLOCK_STREAM_SPK, len, data_rate);
+
+				data += len;
+				data_len -= len;
+
+			}
+
+			/* keep data transfer at a constant bit rate */
+			asrsync_sync(&io.asrs, lc3_swb.frames * LC3_SWB_CODESAMPLES);
+			/* update busy delay (encoding overhead) */
+			pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100;
+			thread_stats_busy(&th->stats, asrsync_get_busy_usec(&io.asrs));
+
+			/* Move unprocessed data to the front of our linear
+			* buffer and clear the LC3-SWB frame counter. */
+			ffb_shift(&lc3_swb.data, ffb_blen_out(&lc3_swb.data) - data_len);
+			lc3_swb.frames = 0;
+
+		}
+
+	}
+
+exit:
+	debug_transport_thread_loop(th, "EXIT");
+	ba_transport_thread_set_state_stopping(th);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+fail_lc3_swb:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+#endif
+
+#if ENABLE_LC3_SWB
+static void *sco_lc3_swb_dec_thread(struct ba_transport_thread *th) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	struct ba_transport_pcm *pcm = &t->sco.mic_pcm;
+	struct io_poll io = { .timeout = -1 };
+	/* single eSCO frame is transferred per codec frame duration */
+	const unsigned int data_rate = sizeof(esco_lc3_swb_frame_t) * LC3_SWB_SAMPLING / LC3_SWB_CODESAMPLES;
+
+	struct esco_lc3_swb lc3_swb = { .initialized = false };
+	pthread_cleanup_push(PTHREAD_CLEANUP(lc3_swb_finish), &lc3_swb);
+
+	if (lc3_swb_init(&lc3_swb) != 0) {
+		error("Couldn't initialize LC3-SWB codec: %s", strerror(errno));
+		goto fail_lc3_swb;
+	}
+
+	sco_clock_reset(&t->sco.clock, SCO_CLOCK_STREAM_MIC);
+	sco_aec_reset(&t->sco.aec, pcm->sampling);
+
+	debug_transport_thread_loop(th, "START");
+	for (ba_transport_thread_set_state_running(th);;) {
+
+		ssize_t len = ffb_blen_in(&lc3_swb.data);
+		if ((len = io_poll_and_read_bt(&io, th, lc3_swb.data.tail, len)) == -1) {
+			if (errno == ECANCELED)
+				goto exit;
+			error("BT poll and read error: %s", strerror(errno));
+		}
+		else if (len == 0)
+			goto exit;
+
+		if (len > 0)
+			sco_clock_stamp(&t->sco.clock, SCO_CLOCK_STREAM_MIC, len, data_rate);
+
+		if (!ba_transport_pcm_is_active(pcm))
+			continue;
+
+		ffb_seek(&lc3_swb.data, len);
+		/* mark data received with errors for concealment */
+		if (th->bt_pkt_status != HCI_SCO_PKT_STATUS_CORRECT)
+			lc3_swb.data_corrupted = ffb_blen_out(&lc3_swb.data);
+
+		/* number of samples already processed by the echo canceller */
+		const size_t processed = ffb_len_out(&lc3_swb.pcm);
+
+		thread_stats_codec_begin(&th->stats);
+		const int err = lc3_swb_decode(&lc3_swb);
+		thread_stats_codec_end(&th->stats);
+
+		if (err < 0) {
+			error("LC3-SWB decoding error: %s", strerror(-err));
+			continue;
+		}
+
+		ssize_t samples;
+		if ((samples = ffb_len_out(&lc3_swb.pcm)) <= 0)
+			continue;
+
+		sco_aec_process(&t->sco.aec, (int16_t *)lc3_swb.pcm.data + processed, samples - processed);
+
+		io_pcm_scale(pcm, lc3_swb.pcm.data, samples);
+		if ((samples = io_pcm_write(pcm, lc3_swb.pcm.data, samples)) == -1) {
+			if (errno == ECANCELED)
+				goto exit;
+			error("FIFO write error: %s", strerror(errno));
+		}
+		else if (samples == 0)
+			ba_transport_stop_if_no_clients(t);
+
+		ffb_shift(&lc3_swb.pcm, samples);
+
+	}
+
+exit:
+	debug_transport_thread_loop(th, "EXIT");
+	ba_transport_thread_set_state_stopping(th);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+fail_lc3_swb:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+#endif
+
 void *sco_enc_thread(struct ba_transport_thread *th) {
 	switch (th->t->type.codec) {
 	case HFP_CODEC_CVSD:
@@ -492,6 +864,10 @@ void *sco_enc_thread(struct ba_transport_thread *th) {
 #if ENABLE_MSBC
 	case HFP_CODEC_MSBC:
 		return sco_msbc_enc_thread(th);
+#endif
+#if ENABLE_LC3_SWB
+	case HFP_CODEC_LC3_SWB:
+		return sco_lc3_swb_enc_thread(th);
 #endif
 	}
 }
@@ -504,6 +880,10 @@ void *sco_dec_thread(struct ba_transport_thread *th) {
 #if ENABLE_MSBC
 	case HFP_CODEC_MSBC:
 		return sco_msbc_dec_thread(th);
+#endif
+#if ENABLE_LC3_SWB
+	case HFP_CODEC_LC3_SWB:
+		return sco_lc3_swb_dec_thread(th);
 #endif
 	}
 }
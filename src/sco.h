@@ -19,6 +19,11 @@
 #include "ba-adapter.h"
 #include "ba-transport.h"
 
+/**
+ * Timeout in milliseconds for the connection setup completion of the
+ * incoming SCO link with the deferred setup. */
+#define SCO_LINK_SETUP_TIMEOUT 5000
+
 int sco_setup_connection_dispatcher(struct ba_adapter *a);
 
 void *sco_enc_thread(struct ba_transport_thread *th);
@@ -566,7 +566,7 @@ dbus_bool_t bluealsa_dbus_pcm_open(
 const char *bluealsa_dbus_pcm_get_codec_canonical_name(
 		const char *alias) {
 
-	static const char *sco_codecs[] = { "CVSD", "mSBC" };
+	static const char *sco_codecs[] = { "CVSD", "mSBC", "LC3-SWB" };
 	for (size_t i = 0; i < ARRAYSIZE(sco_codecs); i++)
 		if (strcasecmp(sco_codecs[i], alias) == 0)
 			return sco_codecs[i];
@@ -699,6 +699,173 @@ void bluealsa_dbus_pcm_codecs_free(
 	codecs->codecs = NULL;
 }
 
+/**
+ * Callback function for BlueALSA PCM statistics parser. */
+static dbus_bool_t bluealsa_dbus_message_iter_pcm_get_stats_cb(const char *key,
+		DBusMessageIter *value, void *userdata, DBusError *error) {
+	struct ba_pcm_stats *stats = (struct ba_pcm_stats *)userdata;
+
+	char type;
+	if ((type = dbus_message_iter_get_arg_type(value)) != DBUS_TYPE_VARIANT) {
+		dbus_set_error(error, DBUS_ERROR_INVALID_SIGNATURE,
+				"Incorrect property value type: %c != %c", type, DBUS_TYPE_VARIANT);
+		return FALSE;
+	}
+
+	DBusMessageIter variant;
+	dbus_message_iter_recurse(value, &variant);
+	type = dbus_message_iter_get_arg_type(&variant);
+
+	char type_expected;
+	dbus_uint32_t *hist = NULL;
+	size_t *hist_len = NULL;
+
+	if (strcmp(key, "CPUTime") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT64))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->cpu_time);
+	}
+	else if (strcmp(key, "CodecCalls") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT64))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->codec_calls);
+	}
+	else if (strcmp(key, "CodecTime") == 0) {
+		hist = stats->codec_time;
+		hist_len = &stats->codec_time_len;
+	}
+	else if (strcmp(key, "BusyTime") == 0) {
+		hist = stats->busy_time;
+		hist_len = &stats->busy_time_len;
+	}
+	else if (strcmp(key, "PCMWrites") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT64))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->pcm_writes);
+	}
+	else if (strcmp(key, "PCMWriteRate") == 0) {
+		if (type != (type_expected = DBUS_TYPE_DOUBLE))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->pcm_write_rate);
+	}
+	else if (strcmp(key, "SCOOffset") == 0) {
+		if (type != (type_expected = DBUS_TYPE_INT64))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->sco_offset);
+		stats->sco_offset_valid = TRUE;
+	}
+	else if (strcmp(key, "SCOJitter") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT32))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->sco_jitter);
+	}
+	else if (strcmp(key, "AECTime") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT64))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->aec_time);
+		stats->aec_valid = TRUE;
+	}
+	else if (strcmp(key, "AECBypass") == 0) {
+		if (type != (type_expected = DBUS_TYPE_BOOLEAN))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->aec_bypass);
+	}
+	else if (strcmp(key, "BitrateBudget") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT32))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->bitrate_budget);
+		stats->bitrate_budget_valid = TRUE;
+	}
+	else if (strcmp(key, "Bitrate") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT32))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->bitrate);
+	}
+	else if (strcmp(key, "SocketBufferSize") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT32))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->sndbuf_size);
+		stats->sndbuf_size_valid = TRUE;
+	}
+	else if (strcmp(key, "CodecCacheHits") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT32))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->codec_cache_hits);
+		stats->codec_cache_valid = TRUE;
+	}
+	else if (strcmp(key, "CodecCacheMisses") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT32))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &stats->codec_cache_misses);
+		stats->codec_cache_valid = TRUE;
+	}
+
+	if (hist != NULL) {
+		if (type != (type_expected = DBUS_TYPE_ARRAY))
+			goto fail;
+
+		DBusMessageIter iter;
+		dbus_uint32_t *data;
+		int len;
+
+		dbus_message_iter_recurse(&variant, &iter);
+		dbus_message_iter_get_fixed_array(&iter, &data, &len);
+
+		*hist_len = MIN((size_t)len, ARRAYSIZE(stats->codec_time));
+		memcpy(hist, data, *hist_len * sizeof(*hist));
+
+	}
+
+	return TRUE;
+
+fail:
+	dbus_set_error(error, DBUS_ERROR_INVALID_SIGNATURE,
+			"Incorrect variant for '%s': %c != %c", key, type, type_expected);
+	return FALSE;
+}
+
+/**
+ * Get BlueALSA PCM IO thread statistics. */
+dbus_bool_t bluealsa_dbus_pcm_get_stats(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		struct ba_pcm_stats *stats,
+		DBusError *error) {
+
+	DBusMessage *msg = NULL, *rep = NULL;
+	dbus_bool_t rv = FALSE;
+
+	if ((msg = dbus_message_new_method_call(ctx->ba_service, pcm_path,
+					BLUEALSA_INTERFACE_PCM, "GetStats")) == NULL) {
+		dbus_set_error(error, DBUS_ERROR_NO_MEMORY, NULL);
+		goto fail;
+	}
+
+	if ((rep = dbus_connection_send_with_reply_and_block(ctx->conn,
+					msg, DBUS_TIMEOUT_USE_DEFAULT, error)) == NULL)
+		goto fail;
+
+	DBusMessageIter iter;
+	if (!dbus_message_iter_init(rep, &iter)) {
+		dbus_set_error(error, DBUS_ERROR_INVALID_SIGNATURE, "Empty response message");
+		goto fail;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	if (!bluealsa_dbus_message_iter_dict(&iter, error,
+				bluealsa_dbus_message_iter_pcm_get_stats_cb, stats))
+		goto fail;
+
+	rv = TRUE;
+
+fail:
+	if (msg != NULL)
+		dbus_message_unref(msg);
+	if (rep != NULL)
+		dbus_message_unref(rep);
+	return rv;
+}
+
 /**
  * Select BlueALSA PCM Bluetooth audio codec. */
 dbus_bool_t bluealsa_dbus_pcm_select_codec(
@@ -825,6 +992,18 @@ dbus_bool_t bluealsa_dbus_pcm_update(
 		value = &pcm->volume.raw;
 		type = DBUS_TYPE_UINT16;
 		break;
+	case BLUEALSA_PCM_ECHO_CANCELLATION:
+		_property = "EchoCancellation";
+		variant = DBUS_TYPE_BOOLEAN_AS_STRING;
+		value = &pcm->echo_cancellation;
+		type = DBUS_TYPE_BOOLEAN;
+		break;
+	case BLUEALSA_PCM_SNDBUF_LATENCY:
+		_property = "SocketBufferLatency";
+		variant = DBUS_TYPE_UINT16_AS_STRING;
+		value = &pcm->sndbuf_latency;
+		type = DBUS_TYPE_UINT16;
+		break;
 	}
 
 	DBusMessage *msg;
@@ -1143,6 +1322,32 @@ static dbus_bool_t bluealsa_dbus_message_iter_get_pcm_props_cb(const char *key,
 			goto fail;
 		dbus_message_iter_get_basic(&variant, &pcm->volume.raw);
 	}
+	else if (strcmp(key, "EchoCancellation") == 0) {
+		if (type != (type_expected = DBUS_TYPE_BOOLEAN))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &pcm->echo_cancellation);
+	}
+	else if (strcmp(key, "SocketBufferLatency") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT16))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &pcm->sndbuf_latency);
+	}
+	else if (strcmp(key, "RSSI") == 0) {
+		if (type != (type_expected = DBUS_TYPE_INT16))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &pcm->rssi);
+		pcm->link_valid = TRUE;
+	}
+	else if (strcmp(key, "LinkQuality") == 0) {
+		if (type != (type_expected = DBUS_TYPE_BYTE))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &pcm->link_quality);
+	}
+	else if (strcmp(key, "FailedContacts") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT16))
+			goto fail;
+		dbus_message_iter_get_basic(&variant, &pcm->failed_contacts);
+	}
 
 	return TRUE;
 
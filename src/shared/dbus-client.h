@@ -107,6 +107,8 @@ struct ba_service_props {
 enum ba_pcm_property {
 	BLUEALSA_PCM_SOFT_VOLUME,
 	BLUEALSA_PCM_VOLUME,
+	BLUEALSA_PCM_ECHO_CANCELLATION,
+	BLUEALSA_PCM_SNDBUF_LATENCY,
 };
 
 /**
@@ -165,6 +167,18 @@ struct ba_pcm {
 		dbus_uint16_t raw;
 	} volume;
 
+	/* echo cancellation of the SCO microphone stream */
+	dbus_bool_t echo_cancellation;
+
+	/* BT socket output buffer latency target in milliseconds */
+	dbus_uint16_t sndbuf_latency;
+
+	/* ACL link state reported by the link monitor */
+	dbus_bool_t link_valid;
+	dbus_int16_t rssi;
+	unsigned char link_quality;
+	dbus_uint16_t failed_contacts;
+
 };
 
 /**
@@ -174,6 +188,46 @@ struct ba_pcm_codecs {
 	size_t codecs_len;
 };
 
+/**
+ * BlueALSA PCM IO thread statistics. */
+struct ba_pcm_stats {
+	/* consumed CPU time in microseconds */
+	dbus_uint64_t cpu_time;
+	/* number of encode/decode calls */
+	dbus_uint64_t codec_calls;
+	/* log-scale histograms of durations, where the bucket N
+	 * holds durations in the [2^(N-1), 2^N) us range */
+	dbus_uint32_t codec_time[24];
+	size_t codec_time_len;
+	dbus_uint32_t busy_time[24];
+	size_t busy_time_len;
+	/* number of PCM FIFO writes and their rate per second */
+	dbus_uint64_t pcm_writes;
+	double pcm_write_rate;
+	/* offset of the SCO microphone stream relative to the speaker
+	 * stream and its jitter in microseconds (SCO PCMs only) */
+	dbus_bool_t sco_offset_valid;
+	dbus_int64_t sco_offset;
+	dbus_uint32_t sco_jitter;
+	/* time spent on echo cancellation in microseconds and
+	 * whether it was bypassed due to exceeded CPU budget */
+	dbus_bool_t aec_valid;
+	dbus_uint64_t aec_time;
+	dbus_bool_t aec_bypass;
+	/* adapter bandwidth budget (zero if unlimited) and the nominal
+	 * encoder bitrate (zero if unknown) in bits per second */
+	dbus_bool_t bitrate_budget_valid;
+	dbus_uint32_t bitrate_budget;
+	dbus_uint32_t bitrate;
+	/* BT socket output buffer size in bytes */
+	dbus_bool_t sndbuf_size_valid;
+	dbus_uint32_t sndbuf_size;
+	/* device codec instance cache hits and misses */
+	dbus_bool_t codec_cache_valid;
+	dbus_uint32_t codec_cache_hits;
+	dbus_uint32_t codec_cache_misses;
+};
+
 dbus_bool_t bluealsa_dbus_connection_ctx_init(
 		struct ba_dbus_ctx *ctx,
 		const char *ba_service_name,
@@ -255,6 +309,12 @@ dbus_bool_t bluealsa_dbus_pcm_select_codec(
 		size_t configuration_len,
 		DBusError *error);
 
+dbus_bool_t bluealsa_dbus_pcm_get_stats(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		struct ba_pcm_stats *stats,
+		DBusError *error);
+
 dbus_bool_t bluealsa_dbus_open_rfcomm(
 		struct ba_dbus_ctx *ctx,
 		const char *rfcomm_path,
@@ -10,14 +10,20 @@
 
 #include "shared/log.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <syslog.h>
 #include <time.h>
+#include <unistd.h>
 
 #if WITH_LIBUNWIND
 # define UNW_LOCAL_ONLY
@@ -29,11 +35,68 @@
 #include "shared/defs.h"
 #include "shared/rt.h"
 
+/* number of entries in the per-thread log ring (power of 2) */
+#define LOG_RING_SIZE 64
+/* maximal length of a single asynchronous log message */
+#define LOG_MESSAGE_MAX 256
+/* maximal number of messages logged by a single thread per second */
+#define LOG_RATE_LIMIT 50
+/* time after which a repeated message summary is logged (in ms) */
+#define LOG_REPEAT_FLUSH_TIMEOUT 1000
+
+struct log_entry {
+	int priority;
+	/* time-stamp when the message was logged */
+	struct timespec ts;
+	char message[LOG_MESSAGE_MAX];
+};
+
+/**
+ * Single-producer single-consumer log ring.
+ *
+ * Every thread which logs messages while the asynchronous logging is enabled
+ * gets its own ring. The only consumer of all rings is the logger thread. */
+struct log_ring {
+	/* next ring on the rings list */
+	struct log_ring *next;
+	/* the owner thread has terminated */
+	atomic_bool orphaned;
+	/* rate limiting window (accessed by the producer only) */
+	time_t rate_limit_sec;
+	unsigned int rate_limit_count;
+	/* number of dropped messages */
+	atomic_uint dropped;
+	/* write and read positions */
+	atomic_size_t head;
+	atomic_size_t tail;
+	struct log_entry entries[LOG_RING_SIZE];
+};
+
 /* internal logging identifier */
 static char *_ident = NULL;
 /* if true, system logging is enabled */
 static bool _syslog = false;
 
+/* asynchronous logging backend */
+static struct {
+	/* if true, messages are passed to the logger thread */
+	atomic_bool enabled;
+	atomic_bool terminate;
+	/* number of threads which are pushing messages at the moment */
+	atomic_uint producers;
+	/* logger thread wake-up notification */
+	int event_fd;
+	pthread_t thread;
+	/* thread-specific key used for orphaned ring detection */
+	pthread_key_t ring_key;
+	bool ring_key_created;
+	/* list of all log rings */
+	_Atomic(struct log_ring *) rings;
+} _async = { .event_fd = -1 };
+
+/* log ring of the current thread */
+static __thread struct log_ring *_ring = NULL;
+
 #if DEBUG_TIME
 
 /* point "zero" for relative time */
@@ -56,18 +119,123 @@ void log_open(const char *ident, bool syslog) {
 
 }
 
-static void vlog(int priority, const char *format, va_list ap) {
+static const char *priority2str[] = {
+	[LOG_EMERG] = "X",
+	[LOG_ALERT] = "A",
+	[LOG_CRIT] = "C",
+	[LOG_ERR] = "E",
+	[LOG_WARNING] = "W",
+	[LOG_NOTICE] = "N",
+	[LOG_INFO] = "I",
+	[LOG_DEBUG] = "D",
+};
+
+/**
+ * Write already formatted message to the syslog and standard error. */
+static void log_write(int priority, const struct timespec *ts, const char *message) {
+
+#if DEBUG_TIME
+	struct timespec ts_rel;
+	timespecsub(ts, &_ts0, &ts_rel);
+#else
+	(void)ts;
+#endif
+
+	if (_syslog)
+		syslog(priority, "%s", message);
+
+	flockfile(stderr);
+
+	if (_ident != NULL)
+		fprintf(stderr, "%s: ", _ident);
+
+#if DEBUG_TIME
+	fprintf(stderr, "%lu.%.9lu: ", (long int)ts_rel.tv_sec, ts_rel.tv_nsec);
+#endif
+
+	fprintf(stderr, "%s: %s\n", priority2str[priority], message);
+
+	funlockfile(stderr);
+
+}
+
+/**
+ * Get log ring of the current thread. */
+static struct log_ring *log_ring_get(void) {
+
+	if (_ring != NULL)
+		return _ring;
+
+	struct log_ring *r;
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		return NULL;
+
+	/* Associate the ring with the current thread, so we will be
+	 * notified (key destructor) when the thread terminates. */
+	pthread_setspecific(_async.ring_key, r);
+
+	struct log_ring *head = atomic_load(&_async.rings);
+	do
+		r->next = head;
+	while (!atomic_compare_exchange_weak(&_async.rings, &head, r));
+
+	return _ring = r;
+}
 
-	static const char *priority2str[] = {
-		[LOG_EMERG] = "X",
-		[LOG_ALERT] = "A",
-		[LOG_CRIT] = "C",
-		[LOG_ERR] = "E",
-		[LOG_WARNING] = "W",
-		[LOG_NOTICE] = "N",
-		[LOG_INFO] = "I",
-		[LOG_DEBUG] = "D",
-	};
+static void log_ring_orphan(void *ring) {
+	struct log_ring *r = ring;
+	atomic_store_explicit(&r->orphaned, true, memory_order_release);
+	_ring = NULL;
+}
+
+/**
+ * Put a message into the log ring of the current thread.
+ *
+ * This function never blocks. If the ring is full or the rate limit of the
+ * current thread is exceeded, the message is dropped.
+ *
+ * @return On success this function returns 0. If the ring can not be used,
+ *   -1 is returned and the caller shall log the message synchronously. */
+static int log_ring_push(int priority, const struct timespec *ts,
+		const char *format, va_list ap) {
+
+	struct log_ring *r;
+	if ((r = log_ring_get()) == NULL)
+		return -1;
+
+	if (r->rate_limit_sec != ts->tv_sec) {
+		r->rate_limit_sec = ts->tv_sec;
+		r->rate_limit_count = 0;
+	}
+
+	const size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	const size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+	if (++r->rate_limit_count > LOG_RATE_LIMIT ||
+			head - tail == LOG_RING_SIZE) {
+		/* Wake up the logger thread on the first dropped message, so the
+		 * number of dropped messages will be reported even if there will
+		 * be no more messages from this thread. */
+		if (atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed) == 0)
+			eventfd_write(_async.event_fd, 1);
+		return 0;
+	}
+
+	struct log_entry *e = &r->entries[head & (LOG_RING_SIZE - 1)];
+	e->priority = priority;
+	e->ts = *ts;
+	vsnprintf(e->message, sizeof(e->message), format, ap);
+
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+	/* Wake up the logger thread. Writing to the eventfd does not block
+	 * unless the counter overflows, which is not possible in practice. */
+	eventfd_write(_async.event_fd, 1);
+
+	return 0;
+}
+
+static void vlog(int priority, const char *format, va_list ap) {
 
 	int oldstate;
 
@@ -77,35 +245,216 @@ static void vlog(int priority, const char *format, va_list ap) {
 	 * has to be temporally disabled. */
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
 
-#if DEBUG_TIME
 	struct timespec ts;
 	gettimestamp(&ts);
-	timespecsub(&ts, &_ts0, &ts);
-#endif
 
-	if (_syslog) {
-		va_list ap_syslog;
-		va_copy(ap_syslog, ap);
-		vsyslog(priority, format, ap_syslog);
-		va_end(ap_syslog);
+	/* Register as a producer before checking whether the asynchronous logging
+	 * is enabled. This way, the log_async_stop() can wait for all in-flight
+	 * producers before the logger resources are released. */
+	atomic_fetch_add(&_async.producers, 1);
+	if (atomic_load(&_async.enabled) &&
+			log_ring_push(priority, &ts, format, ap) == 0) {
+		atomic_fetch_sub(&_async.producers, 1);
+		goto final;
 	}
+	atomic_fetch_sub(&_async.producers, 1);
 
-	flockfile(stderr);
+	char message[1024];
+	vsnprintf(message, sizeof(message), format, ap);
+	log_write(priority, &ts, message);
 
-	if (_ident != NULL)
-		fprintf(stderr, "%s: ", _ident);
+final:
+	pthread_setcancelstate(oldstate, NULL);
+}
 
-#if DEBUG_TIME
-	fprintf(stderr, "%lu.%.9lu: ", (long int)ts.tv_sec, ts.tv_nsec);
-#endif
+/* Logger thread state used for repeated messages suppression. */
+struct log_repeat {
+	struct log_entry last;
+	unsigned int count;
+	struct timespec ts;
+};
+
+static void log_repeat_flush(struct log_repeat *rep) {
+	if (rep->count == 0)
+		return;
+	char message[64];
+	snprintf(message, sizeof(message), "Last message repeated %u times", rep->count);
+	log_write(rep->last.priority, &rep->ts, message);
+	rep->count = 0;
+}
 
-	fprintf(stderr, "%s: ", priority2str[priority]);
-	vfprintf(stderr, format, ap);
-	fputs("\n", stderr);
+static void log_entry_write(struct log_repeat *rep, const struct log_entry *e) {
 
-	funlockfile(stderr);
+	if (e->priority == rep->last.priority &&
+			strcmp(e->message, rep->last.message) == 0) {
+		/* Suppress repeated message. The summary will be logged when
+		 * different message arrives or after the flush timeout. */
+		if (rep->count++ == 0)
+			rep->ts = e->ts;
+		return;
+	}
 
-	pthread_setcancelstate(oldstate, NULL);
+	log_repeat_flush(rep);
+	log_write(e->priority, &e->ts, e->message);
+	rep->last = *e;
+
+}
+
+/**
+ * Drain all log rings.
+ *
+ * Rings of terminated threads are released once they have been drained.
+ * Since producers modify the head of the rings list only, it is safe for
+ * the logger thread to unlink any ring which is not the list head.
+ *
+ * @param rep Repeated messages suppression state.
+ * @param report_dropped If true, the number of dropped messages is logged.
+ * @return This function returns true if there are dropped messages which
+ *   have not been reported yet. */
+static bool log_rings_drain(struct log_repeat *rep, bool report_dropped) {
+
+	struct log_ring *prev = NULL;
+	struct log_ring *r = atomic_load(&_async.rings);
+	bool dropped_pending = false;
+
+	while (r != NULL) {
+
+		const bool orphaned = atomic_load_explicit(&r->orphaned, memory_order_acquire);
+		const size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+		size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+		for (; tail != head; tail++) {
+			log_entry_write(rep, &r->entries[tail & (LOG_RING_SIZE - 1)]);
+			atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+		}
+
+		unsigned int dropped;
+		if (!report_dropped)
+			dropped_pending |= atomic_load_explicit(&r->dropped, memory_order_relaxed) > 0;
+		else if ((dropped = atomic_exchange_explicit(&r->dropped, 0, memory_order_relaxed)) > 0) {
+			char message[64];
+			struct timespec ts;
+			gettimestamp(&ts);
+			snprintf(message, sizeof(message), "Dropped %u log messages", dropped);
+			log_repeat_flush(rep);
+			log_write(LOG_WARNING, &ts, message);
+		}
+
+		struct log_ring *next = r->next;
+		if (orphaned && prev != NULL) {
+			prev->next = next;
+			free(r);
+		}
+		else
+			prev = r;
+		r = next;
+
+	}
+
+	return dropped_pending;
+}
+
+static void *log_thread(void *userdata) {
+	(void)userdata;
+
+	struct log_repeat rep = { .last.priority = -1 };
+	struct pollfd pfd = { _async.event_fd, POLLIN, 0 };
+	/* time-stamp of the last dropped messages report */
+	struct timespec dropped_ts = { 0 };
+	bool dropped_pending = false;
+
+	for (;;) {
+
+		const int timeout = rep.count > 0 || dropped_pending ? LOG_REPEAT_FLUSH_TIMEOUT : -1;
+		if (poll(&pfd, 1, timeout) == 0)
+			log_repeat_flush(&rep);
+
+		eventfd_t value;
+		if (pfd.revents & POLLIN &&
+				eventfd_read(_async.event_fd, &value) == -1 &&
+				errno != EAGAIN)
+			break;
+
+		const bool terminate = atomic_load(&_async.terminate);
+
+		/* Report dropped messages at most once per the flush timeout, so
+		 * a flood of messages will not result in a flood of reports. */
+		struct timespec ts, diff;
+		gettimestamp(&ts);
+		timespecsub(&ts, &dropped_ts, &diff);
+		const bool report = terminate || dropped_ts.tv_sec == 0 ||
+			diff.tv_sec * 1000 + diff.tv_nsec / 1000000 >= LOG_REPEAT_FLUSH_TIMEOUT;
+		if (report)
+			dropped_ts = ts;
+
+		dropped_pending = log_rings_drain(&rep, report);
+
+		if (terminate)
+			break;
+
+	}
+
+	log_repeat_flush(&rep);
+	return NULL;
+}
+
+/**
+ * Enable asynchronous logging.
+ *
+ * When enabled, messages are formatted on the caller's thread and passed to
+ * the dedicated logger thread via lock-free per-thread rings. Logging threads
+ * never block on the standard error or syslog. Repeated messages are reduced
+ * to a single summary and every thread is rate limited.
+ *
+ * @return On success this function returns 0. Otherwise -1 is returned. */
+int log_async_start(void) {
+
+	if (atomic_load(&_async.enabled))
+		return 0;
+
+	if (!_async.ring_key_created) {
+		if ((errno = pthread_key_create(&_async.ring_key, log_ring_orphan)) != 0)
+			return -1;
+		_async.ring_key_created = true;
+	}
+
+	if ((_async.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		return -1;
+
+	atomic_store(&_async.terminate, false);
+	if ((errno = pthread_create(&_async.thread, NULL, log_thread, NULL)) != 0) {
+		close(_async.event_fd);
+		_async.event_fd = -1;
+		return -1;
+	}
+
+	pthread_setname_np(_async.thread, "ba-logger");
+	atomic_store_explicit(&_async.enabled, true, memory_order_release);
+
+	return 0;
+}
+
+/**
+ * Disable asynchronous logging.
+ *
+ * All pending messages are logged before this function returns. */
+void log_async_stop(void) {
+
+	if (!atomic_exchange(&_async.enabled, false))
+		return;
+
+	/* Wait for producers which have seen the asynchronous logging enabled,
+	 * so no one will write to the eventfd after it has been closed. */
+	while (atomic_load(&_async.producers) > 0)
+		sched_yield();
+
+	atomic_store(&_async.terminate, true);
+	eventfd_write(_async.event_fd, 1);
+
+	pthread_join(_async.thread, NULL);
+
+	close(_async.event_fd);
+	_async.event_fd = -1;
 
 }
 
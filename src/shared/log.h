@@ -23,6 +23,8 @@
 #include "shared/defs.h"
 
 void log_open(const char *ident, bool syslog);
+int log_async_start(void);
+void log_async_stop(void);
 void log_message(int priority, const char *format, ...) __attribute__ ((format(printf, 2, 3)));
 
 #if DEBUG
@@ -12,6 +12,8 @@
 
 #include <stdlib.h>
 
+#include "shared/trace.h"
+
 /**
  * Synchronize time with the sampling rate.
  *
@@ -47,6 +49,9 @@ int asrsync_sync(struct asrsync *asrs, unsigned int frames) {
 	/* maintain constant rate */
 	timespecsub(&ts, &asrs->ts0, &ts);
 	if (difftimespec(&ts, &ts_rate, &asrs->ts_idle) > 0) {
+		trace(asrsync_sleep, asrs,
+				(uint64_t)asrs->ts_idle.tv_sec * 1000000 + asrs->ts_idle.tv_nsec / 1000,
+				asrsync_get_busy_usec(asrs));
 		nanosleep(&asrs->ts_idle, NULL);
 		rv = 1;
 	}
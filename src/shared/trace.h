@@ -0,0 +1,35 @@
+/*
+ * BlueALSA - trace.h
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_SHARED_TRACE_H_
+#define BLUEALSA_SHARED_TRACE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+/**
+ * Static user-space tracepoints.
+ *
+ * When tracepoints are enabled, every trace() call site is compiled into a
+ * single NOP instruction plus an ELF note describing probe arguments. Such
+ * probes can be attached at run-time with bpftrace, perf or SystemTap using
+ * the "usdt:bluealsa:<name>" notation. When tracepoints are disabled, the
+ * macro expands to nothing, so arguments are not evaluated at all. */
+
+#if ENABLE_TRACEPOINTS
+# include <sys/sdt.h>
+# define trace(name, ...) STAP_PROBEV(bluealsa, name, ## __VA_ARGS__)
+#else
+# define trace(name, ...) do {} while (0)
+#endif
+
+#endif
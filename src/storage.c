@@ -11,12 +11,14 @@
 #include "storage.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include <bluetooth/bluetooth.h>
 
@@ -29,6 +31,10 @@
 #define BA_STORAGE_KEY_VOLUME      "Volume"
 #define BA_STORAGE_KEY_MUTE        "Mute"
 
+/* The number of milliseconds for which storage writes are delayed,
+ * so subsequent saves of the same device are merged into one write. */
+#define BA_STORAGE_FLUSH_DELAY 2000
+
 struct storage {
 	/* remote BT device address */
 	bdaddr_t addr;
@@ -39,6 +45,36 @@ struct storage {
 static char storage_root_dir[128];
 static GHashTable *storage_map = NULL;
 
+/* Write-behind data storage writer. */
+static struct {
+	/* guard writer data */
+	pthread_mutex_t mutex;
+	/* serialize data flushing */
+	pthread_mutex_t flush_mtx;
+	/* new pending data notification */
+	pthread_cond_t changed;
+	/* background writer thread */
+	pthread_t thread;
+	bool running;
+	bool terminate;
+	/* storage data to be written, indexed by the file path */
+	GHashTable *pending;
+	/* storage data which is being written by the flush */
+	GHashTable *flushing;
+	/* writer statistics */
+	struct storage_stats stats;
+} storage_writer = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.flush_mtx = PTHREAD_MUTEX_INITIALIZER,
+	.changed = PTHREAD_COND_INITIALIZER,
+};
+
+static void storage_get_path(const bdaddr_t *addr, char *path, size_t size) {
+	char addrstr[18];
+	ba2str(addr, addrstr);
+	snprintf(path, size, "%s/%s", storage_root_dir, addrstr);
+}
+
 static struct storage *storage_lookup(const bdaddr_t *addr) {
 	return g_hash_table_lookup(storage_map, addr);
 }
@@ -72,6 +108,97 @@ static void storage_free(struct storage *st) {
 	free(st);
 }
 
+/**
+ * Write all pending storage data to disk.
+ *
+ * Every file is written in an atomic way - data is written to a temporary
+ * file which is renamed to the final name afterwards. */
+static int storage_writer_flush(void) {
+
+	pthread_mutex_lock(&storage_writer.flush_mtx);
+
+	pthread_mutex_lock(&storage_writer.mutex);
+	GHashTable *pending = storage_writer.pending;
+	storage_writer.pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	/* Keep data visible for loaders until it is written to disk. */
+	storage_writer.flushing = pending;
+	pthread_mutex_unlock(&storage_writer.mutex);
+
+	unsigned int flushes = 0;
+	size_t bytes = 0;
+	int rv = 0;
+
+	GHashTableIter iter;
+	const char *path, *data;
+	g_hash_table_iter_init(&iter, pending);
+	while (g_hash_table_iter_next(&iter, (gpointer)&path, (gpointer)&data)) {
+
+		debug("Saving storage: %s", path);
+
+		GError *err = NULL;
+		const size_t len = strlen(data);
+		if (!g_file_set_contents(path, data, len, &err)) {
+			error("Couldn't save storage: %s", err->message);
+			g_error_free(err);
+			rv = -1;
+			continue;
+		}
+
+		flushes++;
+		bytes += len;
+
+	}
+
+	pthread_mutex_lock(&storage_writer.mutex);
+	storage_writer.flushing = NULL;
+	storage_writer.stats.flushes += flushes;
+	storage_writer.stats.bytes += bytes;
+	pthread_mutex_unlock(&storage_writer.mutex);
+
+	g_hash_table_unref(pending);
+
+	pthread_mutex_unlock(&storage_writer.flush_mtx);
+	return rv;
+}
+
+static void *storage_writer_thread(void *userdata) {
+	(void)userdata;
+
+	pthread_mutex_lock(&storage_writer.mutex);
+
+	while (!storage_writer.terminate) {
+
+		if (g_hash_table_size(storage_writer.pending) == 0) {
+			pthread_cond_wait(&storage_writer.changed, &storage_writer.mutex);
+			continue;
+		}
+
+		/* Wait a while before writing data to disk. All storage saves which
+		 * will be requested in the mean time will be written at once. */
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += BA_STORAGE_FLUSH_DELAY / 1000;
+		ts.tv_nsec += (BA_STORAGE_FLUSH_DELAY % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_nsec -= 1000000000;
+			ts.tv_sec++;
+		}
+
+		while (!storage_writer.terminate &&
+				pthread_cond_timedwait(&storage_writer.changed,
+					&storage_writer.mutex, &ts) != ETIMEDOUT)
+			continue;
+
+		pthread_mutex_unlock(&storage_writer.mutex);
+		storage_writer_flush();
+		pthread_mutex_lock(&storage_writer.mutex);
+
+	}
+
+	pthread_mutex_unlock(&storage_writer.mutex);
+	return NULL;
+}
+
 /**
  * Initialize BlueALSA persistent storage.
  *
@@ -87,17 +214,83 @@ int storage_init(const char *root) {
 		storage_map = g_hash_table_new_full(g_bdaddr_hash, g_bdaddr_equal,
 				NULL, (GDestroyNotify)storage_free);
 
+	pthread_mutex_lock(&storage_writer.mutex);
+
+	if (storage_writer.pending == NULL)
+		storage_writer.pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	int err;
+	if (!storage_writer.running) {
+		storage_writer.terminate = false;
+		if ((err = pthread_create(&storage_writer.thread, NULL,
+						storage_writer_thread, NULL)) != 0)
+			warn("Couldn't create storage writer thread: %s", strerror(err));
+		else {
+			pthread_setname_np(storage_writer.thread, "ba-storage");
+			storage_writer.running = true;
+		}
+	}
+
+	pthread_mutex_unlock(&storage_writer.mutex);
+
 	return 0;
 }
 
+/**
+ * Terminate storage writer and write all pending data to disk. */
+void storage_destroy(void) {
+
+	pthread_mutex_lock(&storage_writer.mutex);
+	const bool running = storage_writer.running;
+	storage_writer.terminate = true;
+	storage_writer.running = false;
+	pthread_cond_signal(&storage_writer.changed);
+	pthread_mutex_unlock(&storage_writer.mutex);
+
+	if (running)
+		pthread_join(storage_writer.thread, NULL);
+
+	if (storage_writer.pending != NULL) {
+		storage_writer_flush();
+		g_hash_table_unref(storage_writer.pending);
+		storage_writer.pending = NULL;
+	}
+
+	debug("Storage writer stats: saves: %u, flushes: %u, bytes: %zu",
+			storage_writer.stats.saves, storage_writer.stats.flushes,
+			storage_writer.stats.bytes);
+
+}
+
+/**
+ * Write all pending storage data to disk right away.
+ *
+ * @return On success this function returns 0. Otherwise -1 is returned. */
+int storage_flush(void) {
+
+	pthread_mutex_lock(&storage_writer.mutex);
+	const bool initialized = storage_writer.pending != NULL;
+	pthread_mutex_unlock(&storage_writer.mutex);
+
+	if (!initialized)
+		return 0;
+	return storage_writer_flush();
+}
+
+/**
+ * Get persistent storage writer statistics. */
+void storage_get_stats(struct storage_stats *stats) {
+	pthread_mutex_lock(&storage_writer.mutex);
+	*stats = storage_writer.stats;
+	pthread_mutex_unlock(&storage_writer.mutex);
+}
+
 /**
  * Load persistent storage file for the given BT device. */
 int storage_device_load(const struct ba_device *d) {
 
-	char addrstr[18];
-	char path[sizeof(storage_root_dir) + sizeof(addrstr)];
-	ba2str(&d->addr, addrstr);
-	snprintf(path, sizeof(path), "%s/%s", storage_root_dir, addrstr);
+	char path[sizeof(storage_root_dir) + 18];
+	storage_get_path(&d->addr, path, sizeof(path));
 
 	debug("Loading storage: %s", path);
 
@@ -105,8 +298,28 @@ int storage_device_load(const struct ba_device *d) {
 	if ((st = storage_new(&d->addr)) == NULL)
 		return -1;
 
+	/* The storage file content on disk might be outdated if the data is
+	 * still waiting to be written or it is being written at the moment by
+	 * the storage writer. The most recent data is in the pending table. */
+	char *data = NULL;
+	pthread_mutex_lock(&storage_writer.mutex);
+	if (storage_writer.pending != NULL)
+		data = g_strdup(g_hash_table_lookup(storage_writer.pending, path));
+	if (data == NULL && storage_writer.flushing != NULL)
+		data = g_strdup(g_hash_table_lookup(storage_writer.flushing, path));
+	pthread_mutex_unlock(&storage_writer.mutex);
+
 	GError *err = NULL;
-	if (!g_key_file_load_from_file(st->keyfile, path, G_KEY_FILE_NONE, &err)) {
+	bool ok;
+
+	if (data != NULL) {
+		ok = g_key_file_load_from_data(st->keyfile, data, -1, G_KEY_FILE_NONE, &err);
+		g_free(data);
+	}
+	else
+		ok = g_key_file_load_from_file(st->keyfile, path, G_KEY_FILE_NONE, &err);
+
+	if (!ok) {
 		if (err->code != G_FILE_ERROR_NOENT)
 			warn("Couldn't load storage: %s", err->message);
 		g_error_free(err);
@@ -117,30 +330,48 @@ int storage_device_load(const struct ba_device *d) {
 }
 
 /**
- * Save persistent storage file for the given BT device. */
+ * Save persistent storage file for the given BT device.
+ *
+ * Please note, that the storage data is not written to disk immediately.
+ * It is scheduled for writing by the background storage writer thread. */
 int storage_device_save(const struct ba_device *d) {
 
-	char addrstr[18];
-	char path[sizeof(storage_root_dir) + sizeof(addrstr)];
-	ba2str(&d->addr, addrstr);
-	snprintf(path, sizeof(path), "%s/%s", storage_root_dir, addrstr);
+	char path[sizeof(storage_root_dir) + 18];
+	storage_get_path(&d->addr, path, sizeof(path));
 
 	struct storage *st;
 	if ((st = storage_lookup(&d->addr)) == NULL)
 		return -1;
 
-	debug("Saving storage: %s", path);
-
-	GError *err = NULL;
-	if (!g_key_file_save_to_file(st->keyfile, path, &err)) {
-		error("Couldn't save storage: %s", err->message);
-		g_error_free(err);
+	char *data;
+	if ((data = g_key_file_to_data(st->keyfile, NULL, NULL)) == NULL)
 		return -1;
-	}
 
 	/* remove the storage from the map */
 	g_hash_table_remove(storage_map, &d->addr);
 
+	pthread_mutex_lock(&storage_writer.mutex);
+
+	storage_writer.stats.saves++;
+
+	if (storage_writer.pending == NULL) {
+		pthread_mutex_unlock(&storage_writer.mutex);
+		error("Couldn't save storage: %s", "Storage not initialized");
+		g_free(data);
+		return -1;
+	}
+
+	/* replace previous pending data (if any) for the same file */
+	g_hash_table_replace(storage_writer.pending, g_strdup(path), data);
+	pthread_cond_signal(&storage_writer.changed);
+
+	const bool running = storage_writer.running;
+	pthread_mutex_unlock(&storage_writer.mutex);
+
+	/* Fallback to synchronous write if the writer thread is not running. */
+	if (!running)
+		return storage_writer_flush();
+
 	return 0;
 }
 
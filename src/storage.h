@@ -16,10 +16,25 @@
 # include <config.h>
 #endif
 
+#include <stddef.h>
+
 #include "ba-device.h"
 #include "ba-transport.h"
 
+struct storage_stats {
+	/* number of storage save requests */
+	unsigned int saves;
+	/* number of storage files written to disk */
+	unsigned int flushes;
+	/* total number of bytes written to disk */
+	size_t bytes;
+};
+
 int storage_init(const char *root);
+void storage_destroy(void);
+
+int storage_flush(void);
+void storage_get_stats(struct storage_stats *stats);
 
 int storage_device_load(const struct ba_device *d);
 int storage_device_save(const struct ba_device *d);
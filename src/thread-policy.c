@@ -0,0 +1,361 @@
+/*
+ * BlueALSA - thread-policy.c
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "thread-policy.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "bluealsa-config.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+#include "shared/nv.h"
+
+#define RTKIT_DBUS_SERVICE "org.freedesktop.RealtimeKit1"
+#define RTKIT_DBUS_PATH "/org/freedesktop/RealtimeKit1"
+#define RTKIT_DBUS_IFACE "org.freedesktop.RealtimeKit1"
+
+/**
+ * RealtimeKit refuses to grant real-time scheduling for processes without
+ * the RLIMIT_RTTIME limit. The limit is in microseconds of the CPU time
+ * consumed by a real-time thread without a blocking system call. */
+#define RTKIT_RLIMIT_RTTIME_USEC 200000
+
+static const nv_entry_t thread_classes[] = {
+	{ "encoder", .v.i = THREAD_CLASS_ENCODER },
+	{ "decoder", .v.i = THREAD_CLASS_DECODER },
+	{ "rfcomm", .v.i = THREAD_CLASS_RFCOMM },
+	{ "manager", .v.i = THREAD_CLASS_MANAGER },
+	{ 0 },
+};
+
+static const nv_entry_t thread_policies[] = {
+	{ "other", .v.i = SCHED_OTHER },
+	{ "fifo", .v.i = SCHED_FIFO },
+	{ "rr", .v.i = SCHED_RR },
+	{ 0 },
+};
+
+/* effective policies of the most recently started threads */
+static struct {
+	pthread_mutex_t mutex;
+	bool applied[__THREAD_CLASS_MAX];
+	struct thread_policy policies[__THREAD_CLASS_MAX];
+} thread_policy_effective = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/**
+ * Get the name of the thread class. */
+const char *thread_class_to_string(enum thread_class tc) {
+	for (const nv_entry_t *e = thread_classes; e->name != NULL; e++)
+		if (e->v.i == (int)tc)
+			return e->name;
+	g_assert_not_reached();
+	return NULL;
+}
+
+/**
+ * Get the name of the scheduling policy. */
+const char *thread_policy_to_string(int policy) {
+	for (const nv_entry_t *e = thread_policies; e->name != NULL; e++)
+		if (e->v.i == policy)
+			return e->name;
+	return "unknown";
+}
+
+/**
+ * Split "CLASS:VALUE" string and look up the thread class. */
+static const char *thread_policy_parse_class(const char *str,
+		enum thread_class *tc) {
+
+	const char *value;
+	if ((value = strchr(str, ':')) == NULL)
+		return NULL;
+
+	char name[32];
+	const size_t len = value - str;
+	if (len >= sizeof(name))
+		return NULL;
+	memcpy(name, str, len);
+	name[len] = '\0';
+
+	const nv_entry_t *entry;
+	if ((entry = nv_find(thread_classes, name)) == NULL)
+		return NULL;
+
+	*tc = entry->v.i;
+	return value + 1;
+}
+
+/**
+ * Parse thread scheduling policy.
+ *
+ * @param policies Array of policies for all thread classes.
+ * @param str String in the "CLASS:POLICY[:PRIORITY]" format.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to EINVAL. */
+int thread_policy_parse_sched(struct thread_policy *policies, const char *str) {
+
+	enum thread_class tc;
+	const char *value;
+	if ((value = thread_policy_parse_class(str, &tc)) == NULL)
+		return errno = EINVAL, -1;
+
+	char name[16];
+	const char *priority = strchr(value, ':');
+	const size_t len = priority != NULL ? (size_t)(priority - value) : strlen(value);
+	if (len >= sizeof(name))
+		return errno = EINVAL, -1;
+	memcpy(name, value, len);
+	name[len] = '\0';
+
+	const nv_entry_t *entry;
+	if ((entry = nv_find(thread_policies, name)) == NULL)
+		return errno = EINVAL, -1;
+
+	int prio = 0;
+	if (priority != NULL) {
+		char *tmp;
+		prio = strtol(priority + 1, &tmp, 10);
+		if (priority[1] == '\0' || *tmp != '\0')
+			return errno = EINVAL, -1;
+	}
+
+	if (entry->v.i == SCHED_OTHER)
+		prio = 0;
+	else if (prio < sched_get_priority_min(entry->v.i) ||
+			prio > sched_get_priority_max(entry->v.i))
+		return errno = EINVAL, -1;
+
+	policies[tc].policy = entry->v.i;
+	policies[tc].priority = prio;
+	return 0;
+}
+
+/**
+ * Parse thread CPU affinity.
+ *
+ * @param policies Array of policies for all thread classes.
+ * @param str String in the "CLASS:CPULIST" format, where the CPU list is
+ *   a comma-separated list of CPU numbers or ranges, e.g. "0,2-3".
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to EINVAL. */
+int thread_policy_parse_affinity(struct thread_policy *policies, const char *str) {
+
+	enum thread_class tc;
+	const char *value;
+	if ((value = thread_policy_parse_class(str, &tc)) == NULL)
+		return errno = EINVAL, -1;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+
+	do {
+
+		char *tmp;
+		unsigned long first, last;
+		first = last = strtoul(value, &tmp, 10);
+		if (tmp == value)
+			return errno = EINVAL, -1;
+
+		if (*tmp == '-') {
+			value = tmp + 1;
+			last = strtoul(value, &tmp, 10);
+			if (tmp == value || last < first)
+				return errno = EINVAL, -1;
+		}
+
+		if (last >= CPU_SETSIZE)
+			return errno = EINVAL, -1;
+		for (unsigned long i = first; i <= last; i++)
+			CPU_SET(i, &cpus);
+
+		if (*tmp != ',' && *tmp != '\0')
+			return errno = EINVAL, -1;
+		value = tmp + 1;
+
+	} while (value[-1] == ',');
+
+	policies[tc].cpus = cpus;
+	return 0;
+}
+
+/**
+ * Convert CPU set into the comma-separated list of CPU ranges.
+ *
+ * @return This function returns the given buffer. */
+char *thread_policy_cpus_to_string(const cpu_set_t *cpus, char *buffer, size_t size) {
+
+	size_t len = 0;
+	buffer[0] = '\0';
+
+	for (int i = 0; i < CPU_SETSIZE; i++) {
+
+		if (!CPU_ISSET(i, cpus))
+			continue;
+
+		int last = i;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus))
+			last++;
+
+		int n;
+		if (last == i)
+			n = snprintf(&buffer[len], size - len, "%s%d", len ? "," : "", i);
+		else
+			n = snprintf(&buffer[len], size - len, "%s%d-%d", len ? "," : "", i, last);
+		if (n < 0 || (size_t)n >= size - len)
+			break;
+
+		len += n;
+		i = last;
+
+	}
+
+	return buffer;
+}
+
+/**
+ * Request real-time scheduling for the calling thread via RealtimeKit. */
+static int thread_policy_rtkit(int priority) {
+
+	GDBusMessage *msg = NULL, *rep = NULL;
+	GError *err = NULL;
+	int ret = -1;
+
+	if (config.dbus == NULL) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_RTTIME, &rl) == 0 && rl.rlim_max == RLIM_INFINITY) {
+		rl.rlim_cur = rl.rlim_max = RTKIT_RLIMIT_RTTIME_USEC;
+		if (setrlimit(RLIMIT_RTTIME, &rl) == -1)
+			warn("Couldn't set RTTIME resource limit: %s", strerror(errno));
+	}
+
+	const uint64_t tid = syscall(SYS_gettid);
+	msg = g_dbus_message_new_method_call(RTKIT_DBUS_SERVICE,
+			RTKIT_DBUS_PATH, RTKIT_DBUS_IFACE, "MakeThreadRealtime");
+	g_dbus_message_set_body(msg, g_variant_new("(tu)", tid, (uint32_t)priority));
+
+	if ((rep = g_dbus_connection_send_message_with_reply_sync(config.dbus, msg,
+					G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL, &err)) == NULL)
+		goto fail;
+
+	if (g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR) {
+		g_dbus_message_to_gerror(rep, &err);
+		goto fail;
+	}
+
+	ret = 0;
+
+fail:
+	if (msg != NULL)
+		g_object_unref(msg);
+	if (rep != NULL)
+		g_object_unref(rep);
+	if (err != NULL) {
+		warn("Couldn't acquire real-time scheduling via RealtimeKit: %s", err->message);
+		g_error_free(err);
+		errno = EPERM;
+	}
+	return ret;
+}
+
+/**
+ * Apply configured scheduling policy and CPU affinity.
+ *
+ * This function shall be called by the thread itself, right after it has
+ * been started. Missing permissions are not fatal - in such case the thread
+ * continues with the default policy and the warning is logged. If enabled,
+ * the real-time scheduling is requested from the RealtimeKit daemon, when
+ * the direct request is not permitted.
+ *
+ * @param tc The class of the calling thread. */
+void thread_policy_apply(enum thread_class tc) {
+
+	const struct thread_policy *policy = &config.thread_policy[tc];
+	const pthread_t self = pthread_self();
+	struct thread_policy effective;
+	struct sched_param param;
+	int err;
+
+	memset(&effective, 0, sizeof(effective));
+
+	param.sched_priority = policy->priority;
+	if (policy->policy != SCHED_OTHER &&
+			(err = pthread_setschedparam(self, policy->policy, &param)) != 0) {
+		if (err == EPERM && config.thread_policy_rtkit &&
+				thread_policy_rtkit(policy->priority) == 0)
+			effective.rtkit = true;
+		else
+			warn("Couldn't set %s thread scheduling policy %s:%d: %s",
+					thread_class_to_string(tc), thread_policy_to_string(policy->policy),
+					policy->priority, strerror(err));
+	}
+
+	if (CPU_COUNT(&policy->cpus) > 0 &&
+			(err = pthread_setaffinity_np(self, sizeof(policy->cpus), &policy->cpus)) != 0)
+		warn("Couldn't set %s thread CPU affinity: %s",
+				thread_class_to_string(tc), strerror(err));
+
+	/* Report the policy which is actually in effect, which
+	 * might differ from the configured one. */
+	if (pthread_getschedparam(self, &effective.policy, &param) == 0)
+		effective.priority = param.sched_priority;
+	/* RealtimeKit sets the SCHED_RESET_ON_FORK flag */
+	effective.policy &= ~SCHED_RESET_ON_FORK;
+	if (pthread_getaffinity_np(self, sizeof(effective.cpus), &effective.cpus) != 0)
+		CPU_ZERO(&effective.cpus);
+
+	pthread_mutex_lock(&thread_policy_effective.mutex);
+	const bool changed = !thread_policy_effective.applied[tc] ||
+		memcmp(&thread_policy_effective.policies[tc], &effective, sizeof(effective)) != 0;
+	thread_policy_effective.policies[tc] = effective;
+	thread_policy_effective.applied[tc] = true;
+	pthread_mutex_unlock(&thread_policy_effective.mutex);
+
+	if (changed) {
+		char cpus[128];
+		info("Effective %s thread policy: %s:%d%s CPUs: %s",
+				thread_class_to_string(tc), thread_policy_to_string(effective.policy),
+				effective.priority, effective.rtkit ? " (RealtimeKit)" : "",
+				thread_policy_cpus_to_string(&effective.cpus, cpus, sizeof(cpus)));
+	}
+
+}
+
+/**
+ * Get effective policy of the most recently started thread of given class.
+ *
+ * @return On success this function returns 0. If no thread of the given
+ *   class has been started yet, -1 is returned. */
+int thread_policy_get_effective(enum thread_class tc, struct thread_policy *policy) {
+	int ret = -1;
+	pthread_mutex_lock(&thread_policy_effective.mutex);
+	if (thread_policy_effective.applied[tc]) {
+		*policy = thread_policy_effective.policies[tc];
+		ret = 0;
+	}
+	pthread_mutex_unlock(&thread_policy_effective.mutex);
+	return ret;
+}
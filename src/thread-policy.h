@@ -0,0 +1,61 @@
+/*
+ * BlueALSA - thread-policy.h
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_THREADPOLICY_H_
+#define BLUEALSA_THREADPOLICY_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Class of the BlueALSA service thread. */
+enum thread_class {
+	/* transport encoder threads and encoder pipeline sender */
+	THREAD_CLASS_ENCODER,
+	/* transport decoder threads */
+	THREAD_CLASS_DECODER,
+	/* RFCOMM (AT commands) threads */
+	THREAD_CLASS_RFCOMM,
+	/* transport thread managers */
+	THREAD_CLASS_MANAGER,
+	__THREAD_CLASS_MAX
+};
+
+/**
+ * Scheduling policy and CPU affinity of the thread. */
+struct thread_policy {
+	/* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+	int policy;
+	/* real-time priority for SCHED_FIFO and SCHED_RR */
+	int priority;
+	/* allowed CPUs; if empty, the affinity is not changed */
+	cpu_set_t cpus;
+	/* real-time scheduling was granted by the RealtimeKit */
+	bool rtkit;
+};
+
+const char *thread_class_to_string(enum thread_class tc);
+const char *thread_policy_to_string(int policy);
+
+int thread_policy_parse_sched(struct thread_policy *policies, const char *str);
+int thread_policy_parse_affinity(struct thread_policy *policies, const char *str);
+
+char *thread_policy_cpus_to_string(const cpu_set_t *cpus, char *buffer, size_t size);
+
+void thread_policy_apply(enum thread_class tc);
+int thread_policy_get_effective(enum thread_class tc, struct thread_policy *policy);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * BlueALSA - thread-stats.c
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "thread-stats.h"
+
+#include <stddef.h>
+
+#include "shared/rt.h"
+
+static unsigned long long thread_stats_get_usec(void) {
+	struct timespec ts;
+	gettimestamp(&ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned long long thread_stats_get_cpu_usec(void) {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1)
+		return 0;
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Reset statistics at the start of the IO routine.
+ *
+ * This function shall be called by the thread for which the statistics
+ * are collected. Since the thread might be a persistent worker, the CPU
+ * time consumed so far is used as a reference point. */
+void thread_stats_start(struct thread_stats *stats) {
+
+	stats->cpu_usec0 = thread_stats_get_cpu_usec();
+	stats->cpu_updates = 0;
+	atomic_store_explicit(&stats->start_usec, thread_stats_get_usec(), memory_order_relaxed);
+	atomic_store_explicit(&stats->cpu_usec, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->codec_calls, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->pcm_writes, 0, memory_order_relaxed);
+
+	for (size_t i = 0; i < THREAD_STATS_HIST_BUCKETS; i++) {
+		atomic_store_explicit(&stats->codec.buckets[i], 0, memory_order_relaxed);
+		atomic_store_explicit(&stats->busy.buckets[i], 0, memory_order_relaxed);
+	}
+
+}
+
+/**
+ * Sample the CPU time of the calling thread. */
+void thread_stats_update_cpu(struct thread_stats *stats) {
+	atomic_store_explicit(&stats->cpu_usec,
+			thread_stats_get_cpu_usec() - stats->cpu_usec0, memory_order_relaxed);
+}
+
+/**
+ * Get the histogram bucket index for the given duration. */
+unsigned int thread_stats_hist_bucket(unsigned int usec) {
+	if (usec == 0)
+		return 0;
+	const unsigned int bucket = sizeof(usec) * 8 - __builtin_clz(usec);
+	if (bucket >= THREAD_STATS_HIST_BUCKETS)
+		return THREAD_STATS_HIST_BUCKETS - 1;
+	return bucket;
+}
+
+/**
+ * Add the duration to the histogram. */
+void thread_stats_hist_add(struct thread_stats_hist *hist, unsigned int usec) {
+	atomic_fetch_add_explicit(&hist->buckets[thread_stats_hist_bucket(usec)],
+			1, memory_order_relaxed);
+}
+
+/**
+ * Sample the CPU time once every few updates.
+ *
+ * In order to keep the overhead low, the CPU time of the thread (which
+ * requires a system call) is not sampled on every update. */
+static void thread_stats_update(struct thread_stats *stats) {
+	if (stats->cpu_updates++ % THREAD_STATS_CPU_SAMPLE_CALLS == 0)
+		thread_stats_update_cpu(stats);
+}
+
+/**
+ * Mark the start of the encode/decode call. */
+void thread_stats_codec_begin(struct thread_stats *stats) {
+	gettimestamp(&stats->codec_ts);
+}
+
+/**
+ * Mark the end of the encode/decode call. */
+void thread_stats_codec_end(struct thread_stats *stats) {
+
+	struct timespec ts;
+	gettimestamp(&ts);
+	timespecsub(&ts, &stats->codec_ts, &ts);
+	thread_stats_hist_add(&stats->codec, ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+	atomic_fetch_add_explicit(&stats->codec_calls, 1, memory_order_relaxed);
+
+	thread_stats_update(stats);
+
+}
+
+/**
+ * Record the time spent outside of the rate synchronization.
+ *
+ * @param usec The value returned by the asrsync_get_busy_usec(). */
+void thread_stats_busy(struct thread_stats *stats, unsigned int usec) {
+	thread_stats_hist_add(&stats->busy, usec);
+	thread_stats_update(stats);
+}
+
+/**
+ * Record the PCM FIFO write system call. */
+void thread_stats_pcm_write(struct thread_stats *stats) {
+	atomic_fetch_add_explicit(&stats->pcm_writes, 1, memory_order_relaxed);
+}
+
+/**
+ * Get the average number of PCM FIFO writes per second.
+ *
+ * @return The rate of PCM writes since the start of the IO routine. */
+double thread_stats_pcm_write_rate(const struct thread_stats *stats) {
+	const unsigned long long start = atomic_load_explicit(&stats->start_usec, memory_order_relaxed);
+	const unsigned long long now = thread_stats_get_usec();
+	if (now <= start)
+		return 0;
+	return 1e6 * atomic_load_explicit(&stats->pcm_writes, memory_order_relaxed) / (now - start);
+}
@@ -0,0 +1,86 @@
+/*
+ * BlueALSA - thread-stats.h
+ * Copyright (c) 2016-2022 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_THREADSTATS_H_
+#define BLUEALSA_THREADSTATS_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * The number of log-scale histogram buckets.
+ *
+ * The first bucket holds durations below 1 us, the bucket N holds durations
+ * in the [2^(N-1), 2^N) us range and the last bucket holds everything above
+ * that, which gives the resolution up to ~0.5 s. */
+#define THREAD_STATS_HIST_BUCKETS 20
+
+/**
+ * The thread CPU time is sampled every N statistics updates. */
+#define THREAD_STATS_CPU_SAMPLE_CALLS 16
+
+/**
+ * Log-scale histogram of durations. */
+struct thread_stats_hist {
+	atomic_uint buckets[THREAD_STATS_HIST_BUCKETS];
+};
+
+/**
+ * Statistics of the transport IO thread.
+ *
+ * All counters are updated by the thread itself with relaxed atomic
+ * operations, so they can be read at any time by other threads. */
+struct thread_stats {
+
+	/* monotonic time-stamp of the start of the IO routine */
+	atomic_ullong start_usec;
+
+	/* CPU time consumed since the start of the IO routine */
+	atomic_ullong cpu_usec;
+	/* thread CPU time at the start of the IO routine */
+	unsigned long long cpu_usec0;
+	/* number of statistics updates */
+	unsigned int cpu_updates;
+
+	/* number of encode/decode calls */
+	atomic_ullong codec_calls;
+	/* start time-stamp of the current codec call */
+	struct timespec codec_ts;
+	/* encode/decode call durations */
+	struct thread_stats_hist codec;
+
+	/* time spent outside of the rate synchronization */
+	struct thread_stats_hist busy;
+
+	/* number of PCM FIFO write system calls */
+	atomic_ullong pcm_writes;
+
+};
+
+void thread_stats_start(struct thread_stats *stats);
+void thread_stats_update_cpu(struct thread_stats *stats);
+
+unsigned int thread_stats_hist_bucket(unsigned int usec);
+void thread_stats_hist_add(struct thread_stats_hist *hist, unsigned int usec);
+
+void thread_stats_codec_begin(struct thread_stats *stats);
+void thread_stats_codec_end(struct thread_stats *stats);
+void thread_stats_busy(struct thread_stats *stats, unsigned int usec);
+
+void thread_stats_pcm_write(struct thread_stats *stats);
+double thread_stats_pcm_write_rate(const struct thread_stats *stats);
+
+#endif
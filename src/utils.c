@@ -290,6 +290,8 @@ const char *ba_transport_type_to_string(struct ba_transport_type type) {
 			return "HFP Hands-Free (CVSD)";
 		case HFP_CODEC_MSBC:
 			return "HFP Hands-Free (mSBC)";
+		case HFP_CODEC_LC3_SWB:
+			return "HFP Hands-Free (LC3-SWB)";
 		default:
 			return "HFP Hands-Free";
 		}
@@ -299,6 +301,8 @@ const char *ba_transport_type_to_string(struct ba_transport_type type) {
 			return "HFP Audio Gateway (CVSD)";
 		case HFP_CODEC_MSBC:
 			return "HFP Audio Gateway (mSBC)";
+		case HFP_CODEC_LC3_SWB:
+			return "HFP Audio Gateway (LC3-SWB)";
 		default:
 			return "HFP Audio Gateway";
 		}
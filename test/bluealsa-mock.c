@@ -164,7 +164,9 @@ static void *mock_a2dp_dec(struct ba_transport_thread *th) {
 
 	const unsigned int channels = t_a2dp_pcm->channels;
 	const unsigned int samplerate = t_a2dp_pcm->sampling;
-	struct pollfd fds[1] = {{ th->pipe[0], POLLIN, 0 }};
+	struct pollfd fds[2] = {
+		{ th->pipe[0], POLLIN, 0 },
+		{ th->stop_fd, POLLIN, 0 }};
 	struct asrsync asrs = { .frames = 0 };
 	int16_t buffer[1024 * 2];
 	int x = 0;
@@ -182,7 +184,10 @@ static void *mock_a2dp_dec(struct ba_transport_thread *th) {
 		int rv = poll(fds, ARRAYSIZE(fds), timeout);
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-		if (rv == 1 && fds[0].revents & POLLIN) {
+		if (rv > 0 && fds[1].revents & POLLIN)
+			break;
+
+		if (rv > 0 && fds[0].revents & POLLIN) {
 			/* dispatch incoming event */
 			enum ba_transport_thread_signal signal;
 			ba_transport_thread_signal_recv(th, &signal);
@@ -716,5 +721,6 @@ int main(int argc, char *argv[]) {
 	g_main_loop_run(loop);
 
 	ba_adapter_destroy(a);
+	storage_destroy();
 	return EXIT_SUCCESS;
 }
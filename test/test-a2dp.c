@@ -8,6 +8,10 @@
  *
  */
 
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
 #include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -15,8 +19,12 @@
 
 #include <check.h>
 #include <glib.h>
+#if ENABLE_LDAC
+# include <ldacBT.h>
+#endif
 
 #include "a2dp.h"
+#include "a2dp-ldac.h"
 #include "a2dp-sbc.h"
 #include "bluealsa-config.h"
 #include "codec-sbc.h"
@@ -26,6 +34,8 @@
 bool ba_transport_pcm_is_active(struct ba_transport_pcm *pcm) { (void)pcm; return false; }
 int ba_transport_pcm_release(struct ba_transport_pcm *pcm) { (void)pcm; return -1; }
 int ba_transport_stop_if_no_clients(struct ba_transport *t) { (void)t; return -1; }
+void ba_transport_set_a2dp_bitrate(struct ba_transport *t, unsigned int bitrate) {
+	(void)t; (void)bitrate; }
 int ba_transport_thread_bt_release(struct ba_transport_thread *th) { (void)th; return -1; }
 int ba_transport_thread_create(struct ba_transport_thread *th,
 		void *(*routine)(struct ba_transport_thread *), const char *name, bool master) {
@@ -37,6 +47,13 @@ int ba_transport_thread_signal_recv(struct ba_transport_thread *th,
 		enum ba_transport_thread_signal *signal) {
 	(void)th; (void)signal; return -1; }
 void ba_transport_thread_cleanup(struct ba_transport_thread *th) { (void)th; }
+void ba_device_codec_acquire(struct ba_device *d, struct ba_device_codec *codec,
+		const void *key, size_t key_size) {
+	(void)d; (void)key; (void)key_size; codec->handle = NULL; }
+void ba_device_codec_release(struct ba_device_codec *codec) { (void)codec; }
+unsigned int ba_adapter_bw_get_a2dp_budget(struct ba_adapter *a) { (void)a; return 0; }
+unsigned int ba_device_link_scale_bitrate(struct ba_device *d, unsigned int bitrate) {
+	(void)d; return bitrate; }
 
 START_TEST(test_a2dp_codecs_codec_id_from_string) {
 	ck_assert_int_eq(a2dp_codecs_codec_id_from_string("SBC"), A2DP_CODEC_SBC);
@@ -214,6 +231,17 @@ START_TEST(test_a2dp_select_configuration) {
 
 } END_TEST
 
+#if ENABLE_LDAC
+START_TEST(test_a2dp_ldac_get_bitrate) {
+	ck_assert_uint_eq(a2dp_ldac_get_bitrate(44100, LDACBT_EQMID_HQ), 909000);
+	ck_assert_uint_eq(a2dp_ldac_get_bitrate(88200, LDACBT_EQMID_SQ), 606000);
+	ck_assert_uint_eq(a2dp_ldac_get_bitrate(48000, LDACBT_EQMID_HQ), 990000);
+	ck_assert_uint_eq(a2dp_ldac_get_bitrate(96000, LDACBT_EQMID_MQ), 330000);
+	ck_assert_uint_eq(a2dp_ldac_get_bitrate(44100, LDACBT_EQMID_MQ + 1), 303000);
+	ck_assert_uint_eq(a2dp_ldac_get_bitrate(48000, -1), 0);
+} END_TEST
+#endif
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -234,6 +262,9 @@ int main(void) {
 	tcase_add_test(tc, test_a2dp_check_configuration);
 	tcase_add_test(tc, test_a2dp_filter_capabilities);
 	tcase_add_test(tc, test_a2dp_select_configuration);
+#if ENABLE_LDAC
+	tcase_add_test(tc, test_a2dp_ldac_get_bitrate);
+#endif
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
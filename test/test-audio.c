@@ -126,6 +126,27 @@ START_TEST(test_audio_scale_s32_4le) {
 
 } END_TEST
 
+START_TEST(test_audio_is_silence) {
+
+	uint8_t buffer[1024 + 16];
+	memset(buffer, 0, sizeof(buffer));
+
+	ck_assert_int_eq(audio_is_silence(buffer, 0), true);
+	ck_assert_int_eq(audio_is_silence(buffer, sizeof(buffer)), true);
+	ck_assert_int_eq(audio_is_silence(&buffer[3], sizeof(buffer) - 3), true);
+
+	/* non-zero byte in the unaligned head, block and tail */
+	const size_t offsets[] = { 1, 500, sizeof(buffer) - 1 };
+	for (size_t i = 0; i < ARRAYSIZE(offsets); i++) {
+		buffer[offsets[i]] = 0x01;
+		ck_assert_int_eq(audio_is_silence(buffer, sizeof(buffer)), false);
+		ck_assert_int_eq(audio_is_silence(&buffer[1], sizeof(buffer) - 1), false);
+		ck_assert_int_eq(audio_is_silence(buffer, offsets[i]), true);
+		buffer[offsets[i]] = 0x00;
+	}
+
+} END_TEST
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -138,6 +159,7 @@ int main(void) {
 	tcase_add_test(tc, test_audio_interleave_deinterleave_s32_4le);
 	tcase_add_test(tc, test_audio_scale_s16_2le);
 	tcase_add_test(tc, test_audio_scale_s32_4le);
+	tcase_add_test(tc, test_audio_is_silence);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
@@ -13,9 +13,13 @@
 #endif
 
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -32,9 +36,16 @@
 #include "ba-transport.h"
 #include "bluealsa-dbus.h"
 #include "bluez.h"
+#if ENABLE_MSBC
+# include "sco-aec.h"
+#endif
+#include "sco-clock.h"
 #include "sco.h"
 #include "storage.h"
+#include "thread-policy.h"
+#include "thread-stats.h"
 #include "shared/a2dp-codecs.h"
+#include "shared/defs.h"
 #include "shared/log.h"
 
 #include "../src/ba-transport.c"
@@ -97,6 +108,41 @@ START_TEST(test_ba_adapter) {
 
 } END_TEST
 
+START_TEST(test_ba_adapter_bw) {
+
+	struct ba_adapter *a;
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+
+	/* bandwidth is not limited by default */
+	ba_adapter_bw_link_add(a, BA_ADAPTER_BW_LINK_A2DP);
+	ck_assert_uint_eq(ba_adapter_bw_get_a2dp_budget(a), 0);
+
+	config.a2dp.bandwidth = 1000;
+	unsigned int generation = ba_adapter_bw_get_generation(a);
+
+	ck_assert_uint_eq(ba_adapter_bw_get_a2dp_budget(a), 1000000);
+	ba_adapter_bw_link_add(a, BA_ADAPTER_BW_LINK_A2DP);
+	ck_assert_uint_eq(ba_adapter_bw_get_a2dp_budget(a), 500000);
+	ba_adapter_bw_link_add(a, BA_ADAPTER_BW_LINK_SCO);
+	ck_assert_uint_eq(ba_adapter_bw_get_a2dp_budget(a), 335000);
+	ck_assert_uint_ne(ba_adapter_bw_get_generation(a), generation);
+
+	/* A2DP streams shall not be starved by SCO links */
+	ba_adapter_bw_link_add(a, BA_ADAPTER_BW_LINK_SCO);
+	ba_adapter_bw_link_add(a, BA_ADAPTER_BW_LINK_SCO);
+	ck_assert_uint_eq(ba_adapter_bw_get_a2dp_budget(a), 50000);
+
+	ba_adapter_bw_link_remove(a, BA_ADAPTER_BW_LINK_SCO);
+	ba_adapter_bw_link_remove(a, BA_ADAPTER_BW_LINK_SCO);
+	ba_adapter_bw_link_remove(a, BA_ADAPTER_BW_LINK_SCO);
+	ba_adapter_bw_link_remove(a, BA_ADAPTER_BW_LINK_A2DP);
+	ck_assert_uint_eq(ba_adapter_bw_get_a2dp_budget(a), 1000000);
+
+	config.a2dp.bandwidth = 0;
+	ba_adapter_unref(a);
+
+} END_TEST
+
 START_TEST(test_ba_device) {
 
 	struct ba_adapter *a;
@@ -121,6 +167,114 @@ START_TEST(test_ba_device) {
 
 } END_TEST
 
+START_TEST(test_ba_device_link) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	bdaddr_t addr = {{ 0x12, 0x34, 0x56, 0x78, 0x90, 0xAB }};
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+	ba_adapter_unref(a);
+
+	ck_assert_int_eq(d->link.valid, false);
+	ck_assert_uint_eq(ba_device_link_scale_bitrate(d, 1000), 1000);
+	unsigned int generation = ba_device_link_get_generation(d);
+
+	struct hci_link_info healthy = { .rssi = 0, .quality = 255, .failed_contacts = 0 };
+	ck_assert_int_eq(ba_device_link_update(d, &healthy), true);
+	ck_assert_int_eq(ba_device_link_update(d, &healthy), false);
+	ck_assert_int_eq(d->link.valid, true);
+	ck_assert_uint_eq(ba_device_link_get_generation(d), generation);
+
+	/* bitrate shall be lowered as soon as the link degrades */
+	struct hci_link_info degraded = { .rssi = 0, .quality = 255, .failed_contacts = 1 };
+	ck_assert_int_eq(ba_device_link_update(d, &degraded), true);
+	ck_assert_uint_eq(ba_device_link_scale_bitrate(d, 1000), 750);
+	ck_assert_uint_ne(ba_device_link_get_generation(d), generation);
+
+	degraded.failed_contacts = 0;
+	degraded.rssi = -20;
+	for (size_t i = 0; i < 10; i++)
+		ba_device_link_update(d, &degraded);
+	ck_assert_uint_eq(ba_device_link_scale_bitrate(d, 1000), 400);
+
+	/* and restored gradually when the link is healthy again */
+	ck_assert_int_eq(ba_device_link_update(d, &healthy), true);
+	ck_assert_uint_eq(ba_device_link_scale_bitrate(d, 1000), 500);
+
+	ba_device_link_reset(d);
+	ck_assert_int_eq(d->link.valid, false);
+	ck_assert_uint_eq(ba_device_link_scale_bitrate(d, 1000), 1000);
+
+	ba_device_unref(d);
+
+} END_TEST
+
+static unsigned int test_codec_free_count = 0;
+static void test_codec_free(void *handle) {
+	debug("%s: %p", __func__, handle);
+	test_codec_free_count++;
+}
+
+START_TEST(test_ba_device_codec_cache) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	bdaddr_t addr = {{ 0x12, 0x34, 0x56, 0x78, 0x90, 0xAB }};
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+	ba_adapter_unref(a);
+
+	int handle1, handle2;
+	const char key1[] = "AAC-44100", key2[] = "AAC-48000";
+	struct ba_device_codec c1 = { .free = test_codec_free };
+	struct ba_device_codec c2 = { .free = test_codec_free };
+	test_codec_free_count = 0;
+
+	/* cold cache - not reusable instance shall be freed */
+	ba_device_codec_acquire(d, &c1, key1, sizeof(key1));
+	ck_assert_ptr_eq(c1.handle, NULL);
+	c1.handle = &handle1;
+	ba_device_codec_release(&c1);
+	ck_assert_uint_eq(test_codec_free_count, 1);
+
+	ba_device_codec_acquire(d, &c1, key1, sizeof(key1));
+	ck_assert_ptr_eq(c1.handle, NULL);
+	c1.handle = &handle1;
+	c1.reusable = true;
+	ba_device_codec_release(&c1);
+	ck_assert_uint_eq(test_codec_free_count, 1);
+
+	/* different configuration shall not hit the cache */
+	ba_device_codec_acquire(d, &c2, key2, sizeof(key2));
+	ck_assert_ptr_eq(c2.handle, NULL);
+	c2.handle = &handle2;
+	c2.reusable = true;
+
+	/* warm cache - instance shall be moved out of the cache */
+	ba_device_codec_acquire(d, &c1, key1, sizeof(key1));
+	ck_assert_ptr_eq(c1.handle, &handle1);
+	ck_assert_uint_eq(g_hash_table_size(d->codec_cache), 0);
+	c1.reusable = true;
+
+	unsigned int hits, misses;
+	ba_device_codec_cache_get_stats(d, &hits, &misses);
+	ck_assert_uint_eq(hits, 1);
+	ck_assert_uint_eq(misses, 3);
+
+	ba_device_codec_release(&c1);
+	ba_device_codec_release(&c2);
+	ck_assert_uint_eq(g_hash_table_size(d->codec_cache), 2);
+	ck_assert_uint_eq(test_codec_free_count, 1);
+
+	/* cached instances shall be freed with the device */
+	ba_device_unref(d);
+	ck_assert_uint_eq(test_codec_free_count, 3);
+
+} END_TEST
+
 START_TEST(test_ba_transport) {
 
 	struct ba_adapter *a;
@@ -148,6 +302,59 @@ START_TEST(test_ba_transport) {
 
 } END_TEST
 
+START_TEST(test_ba_transport_sndbuf_latency) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t;
+	bdaddr_t addr = { 0 };
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+	ck_assert_ptr_ne(t = transport_new(d, "/owner", "/path"), NULL);
+
+	ba_adapter_unref(a);
+	ba_device_unref(d);
+
+	const struct ba_config_sndbuf_latency sndbuf_latency[] = {
+		{ .sco = false, .codec_id = 0xFFFF, .latency = 50 },
+		{ .sco = false, .codec_id = A2DP_CODEC_MPEG24, .latency = 30 },
+		{ .sco = true, .codec_id = HFP_CODEC_MSBC, .latency = 20 },
+	};
+
+	memcpy(config.sndbuf_latency, sndbuf_latency, sizeof(sndbuf_latency));
+	config.sndbuf_latency_len = ARRAYSIZE(sndbuf_latency);
+
+	/* transport without profile */
+	ck_assert_uint_eq(ba_transport_get_bt_sndbuf_latency(t), 0);
+
+	t->type.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE;
+	t->type.codec = A2DP_CODEC_SBC;
+	ck_assert_uint_eq(ba_transport_get_bt_sndbuf_latency(t), 50);
+	t->type.codec = A2DP_CODEC_MPEG24;
+	ck_assert_uint_eq(ba_transport_get_bt_sndbuf_latency(t), 30);
+
+	t->type.profile = BA_TRANSPORT_PROFILE_HFP_AG;
+	t->type.codec = HFP_CODEC_CVSD;
+	ck_assert_uint_eq(ba_transport_get_bt_sndbuf_latency(t), 0);
+	t->type.codec = HFP_CODEC_MSBC;
+	ck_assert_uint_eq(ba_transport_get_bt_sndbuf_latency(t), 20);
+
+	/* run-time override of the configured value */
+	ba_transport_set_bt_sndbuf_latency(t, 0);
+	ck_assert_uint_eq(ba_transport_get_bt_sndbuf_latency(t), 0);
+	ba_transport_set_bt_sndbuf_latency(t, 100);
+	ck_assert_uint_eq(ba_transport_get_bt_sndbuf_latency(t), 100);
+
+	/* socket buffer size is not available without BT socket */
+	ck_assert_int_eq(ba_transport_get_bt_sndbuf_size(t), -1);
+
+	config.sndbuf_latency_len = 0;
+	t->type.profile = BA_TRANSPORT_PROFILE_NONE;
+	ba_transport_unref(t);
+
+} END_TEST
+
 START_TEST(test_ba_transport_pcm_format) {
 
 	uint16_t format_u8 = BA_TRANSPORT_PCM_FORMAT_U8;
@@ -276,10 +483,22 @@ START_TEST(test_storage) {
 	ba_transport_pcm_volume_set(&t->a2dp.pcm.volume[0], &level, &muted, NULL);
 	ba_transport_pcm_volume_set(&t->a2dp.pcm.volume[1], &level, &muted, NULL);
 
+	struct storage_stats stats;
+	storage_get_stats(&stats);
+
 	ba_transport_unref(t);
 	ba_adapter_unref(a);
 	ba_device_unref(d);
 
+	/* write pending storage data */
+	ck_assert_int_eq(storage_flush(), 0);
+
+	struct storage_stats stats_new;
+	storage_get_stats(&stats_new);
+	ck_assert_uint_eq(stats_new.saves, stats.saves + 1);
+	ck_assert_uint_eq(stats_new.flushes, stats.flushes + 1);
+	ck_assert_uint_eq(stats_new.bytes, stats.bytes + 212);
+
 	char buffer[1024] = { 0 };
 	ck_assert_ptr_ne(f = fopen(storage_path, "r"), NULL);
 	ck_assert_int_eq(fread(buffer, 1, sizeof(buffer), f), 212);
@@ -301,6 +520,262 @@ START_TEST(test_storage) {
 
 } END_TEST
 
+START_TEST(test_thread_policy) {
+
+	struct thread_policy policies[__THREAD_CLASS_MAX];
+	memset(policies, 0, sizeof(policies));
+	char buffer[64];
+
+	ck_assert_int_eq(thread_policy_parse_sched(policies, "encoder:fifo:10"), 0);
+	ck_assert_int_eq(policies[THREAD_CLASS_ENCODER].policy, SCHED_FIFO);
+	ck_assert_int_eq(policies[THREAD_CLASS_ENCODER].priority, 10);
+	ck_assert_int_eq(thread_policy_parse_sched(policies, "rfcomm:rr"), -1);
+	ck_assert_int_eq(thread_policy_parse_sched(policies, "decoder:rr:5"), 0);
+	ck_assert_int_eq(policies[THREAD_CLASS_DECODER].policy, SCHED_RR);
+	ck_assert_int_eq(thread_policy_parse_sched(policies, "decoder:other"), 0);
+	ck_assert_int_eq(policies[THREAD_CLASS_DECODER].policy, SCHED_OTHER);
+	ck_assert_int_eq(thread_policy_parse_sched(policies, "unknown:fifo:10"), -1);
+	ck_assert_int_eq(thread_policy_parse_sched(policies, "encoder:idle"), -1);
+	ck_assert_int_eq(thread_policy_parse_sched(policies, "encoder:fifo:x"), -1);
+
+	ck_assert_int_eq(thread_policy_parse_affinity(policies, "rfcomm:0,2-3,5"), 0);
+	ck_assert_str_eq(thread_policy_cpus_to_string(&policies[THREAD_CLASS_RFCOMM].cpus,
+				buffer, sizeof(buffer)), "0,2-3,5");
+	ck_assert_int_eq(thread_policy_parse_affinity(policies, "rfcomm:3-1"), -1);
+	ck_assert_int_eq(thread_policy_parse_affinity(policies, "rfcomm:1,"), -1);
+	ck_assert_int_eq(thread_policy_parse_affinity(policies, "rfcomm:"), -1);
+
+	/* missing permissions shall not be fatal */
+	config.thread_policy[THREAD_CLASS_MANAGER] = policies[THREAD_CLASS_ENCODER];
+	thread_policy_apply(THREAD_CLASS_MANAGER);
+
+	struct thread_policy effective;
+	ck_assert_int_eq(thread_policy_get_effective(THREAD_CLASS_RFCOMM, &effective), -1);
+	ck_assert_int_eq(thread_policy_get_effective(THREAD_CLASS_MANAGER, &effective), 0);
+	ck_assert_int_gt(CPU_COUNT(&effective.cpus), 0);
+	ck_assert_int_eq(effective.rtkit, false);
+
+	struct sched_param param = { 0 };
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+	memset(&config.thread_policy[THREAD_CLASS_MANAGER], 0, sizeof(struct thread_policy));
+
+} END_TEST
+
+START_TEST(test_thread_stats) {
+
+	ck_assert_uint_eq(thread_stats_hist_bucket(0), 0);
+	ck_assert_uint_eq(thread_stats_hist_bucket(1), 1);
+	ck_assert_uint_eq(thread_stats_hist_bucket(2), 2);
+	ck_assert_uint_eq(thread_stats_hist_bucket(3), 2);
+	ck_assert_uint_eq(thread_stats_hist_bucket(4), 3);
+	ck_assert_uint_eq(thread_stats_hist_bucket(1000), 10);
+	ck_assert_uint_eq(thread_stats_hist_bucket(1024), 11);
+	ck_assert_uint_eq(thread_stats_hist_bucket(-1), THREAD_STATS_HIST_BUCKETS - 1);
+
+	struct thread_stats stats;
+	memset(&stats, 0xFF, sizeof(stats));
+	thread_stats_start(&stats);
+
+	ck_assert_uint_eq(stats.cpu_usec, 0);
+	ck_assert_uint_eq(stats.codec_calls, 0);
+	ck_assert_uint_eq(stats.pcm_writes, 0);
+	for (size_t i = 0; i < THREAD_STATS_HIST_BUCKETS; i++) {
+		ck_assert_uint_eq(stats.codec.buckets[i], 0);
+		ck_assert_uint_eq(stats.busy.buckets[i], 0);
+	}
+
+	for (size_t i = 0; i < 3; i++) {
+		thread_stats_codec_begin(&stats);
+		/* burn some CPU cycles */
+		for (volatile unsigned int x = 0; x < 1000000; x++)
+			continue;
+		thread_stats_codec_end(&stats);
+	}
+
+	thread_stats_busy(&stats, 100);
+	thread_stats_busy(&stats, 120);
+	thread_stats_pcm_write(&stats);
+	thread_stats_pcm_write(&stats);
+	thread_stats_update_cpu(&stats);
+
+	unsigned int codec_total = 0;
+	for (size_t i = 0; i < THREAD_STATS_HIST_BUCKETS; i++)
+		codec_total += stats.codec.buckets[i];
+	ck_assert_uint_eq(codec_total, 3);
+	ck_assert_uint_eq(stats.codec_calls, 3);
+	ck_assert_uint_eq(stats.busy.buckets[7], 2);
+	ck_assert_uint_gt(stats.cpu_usec, 0);
+	ck_assert_uint_eq(stats.pcm_writes, 2);
+	ck_assert(thread_stats_pcm_write_rate(&stats) > 0);
+
+} END_TEST
+
+#if ENABLE_MSBC
+static void test_sco_aec_echo(unsigned int sampling) {
+
+	struct sco_clock clock;
+	struct sco_aec aec;
+
+	sco_clock_init(&clock);
+	ck_assert_int_eq(sco_aec_init(&aec, &clock, true), 0);
+	sco_aec_reset(&aec, sampling);
+	sco_aec_reset_reference(&aec);
+
+	/* speaker stream buffered by the encoder before it is sent */
+	const size_t lead = 30 * sampling / 1000;
+	/* acoustic delay of the echo in the Bluetooth device */
+	const size_t delay = 5 * sampling / 1000;
+	const size_t block = 60 * sampling / 8000;
+	const size_t samples = 3 * sampling;
+
+	int16_t *ref = calloc(samples + lead, sizeof(*ref));
+	int16_t *mic = malloc(block * sizeof(*mic));
+	ck_assert_ptr_ne(ref, NULL);
+	ck_assert_ptr_ne(mic, NULL);
+
+	/* low-pass filtered noise within the echo canceller band */
+	uint32_t seed = 1;
+	int32_t x1 = 0, x2 = 0, x3 = 0, y1 = 0, y2 = 0, y3 = 0;
+	for (size_t i = 0; i < samples + lead; i++) {
+		seed = seed * 1103515245 + 12345;
+		const int32_t x = (int16_t)(seed >> 16) / 4;
+		const int32_t y = (x + x1 + x2 + x3) / 4;
+		ref[i] = (y + y1 + y2 + y3) / 4;
+		x3 = x2; x2 = x1; x1 = x;
+		y3 = y2; y2 = y1; y1 = y;
+	}
+
+	sco_aec_push_reference(&aec, ref, lead);
+
+	double energy_in = 0;
+	double energy_out = 0;
+
+	for (size_t pos = 0; pos + block <= samples; pos += block) {
+
+		sco_aec_push_reference(&aec, &ref[lead + pos], block);
+		sco_clock_stamp(&clock, SCO_CLOCK_STREAM_SPK, block, sampling);
+
+		/* microphone picks up the attenuated and delayed speaker signal */
+		for (size_t i = 0; i < block; i++)
+			mic[i] = pos + i >= delay ? ref[pos + i - delay] / 2 : 0;
+		sco_clock_stamp(&clock, SCO_CLOCK_STREAM_MIC, block, sampling);
+
+		/* measure the echo reduction within the last second */
+		const bool measure = pos >= samples - sampling;
+		for (size_t i = 0; measure && i < block; i++)
+			energy_in += (double)mic[i] * mic[i];
+		sco_aec_process(&aec, mic, block);
+		for (size_t i = 0; measure && i < block; i++)
+			energy_out += (double)mic[i] * mic[i];
+
+	}
+
+	ck_assert_ptr_ne(aec.ec, NULL);
+	ck_assert_int_eq(aec.bypass, false);
+	ck_assert_int_ne(aec.ref_pos, -1);
+	ck_assert(energy_in > 0);
+	/* echo shall be reduced by at least 6 dB */
+	ck_assert(energy_out < energy_in / 4);
+
+	sco_aec_free(&aec);
+	sco_clock_free(&clock);
+	free(ref);
+	free(mic);
+
+}
+
+START_TEST(test_sco_aec) {
+
+	struct sco_clock clock;
+	struct sco_aec aec;
+	int16_t ref[20000] = { 0 };
+	int16_t mic[100];
+
+	sco_clock_init(&clock);
+	ck_assert_int_eq(sco_aec_init(&aec, &clock, false), 0);
+	sco_aec_reset(&aec, 8000);
+
+	/* disabled echo canceller follows the reference position */
+	sco_aec_push_reference(&aec, ref, 1000);
+	ck_assert_uint_eq(aec.ref_head, 1000);
+
+	for (size_t i = 0; i < ARRAYSIZE(mic); i++)
+		mic[i] = i;
+	sco_aec_process(&aec, mic, ARRAYSIZE(mic));
+	for (size_t i = 0; i < ARRAYSIZE(mic); i++)
+		ck_assert_int_eq(mic[i], i);
+	ck_assert_ptr_eq(aec.ec, NULL);
+
+	/* only the most recent reference samples are kept */
+	sco_aec_reset_reference(&aec);
+	for (size_t i = 0; i < ARRAYSIZE(ref); i++)
+		ref[i] = i;
+	sco_aec_push_reference(&aec, ref, ARRAYSIZE(ref));
+	ck_assert_uint_eq(aec.ref_head, ARRAYSIZE(ref));
+	const size_t last = (ARRAYSIZE(ref) - 1) % aec.ref_size;
+	ck_assert_int_eq(aec.ref[last], ARRAYSIZE(ref) - 1);
+
+	atomic_store(&aec.enabled, true);
+
+	/* without the speaker stream the reference is not aligned */
+	sco_aec_process(&aec, mic, ARRAYSIZE(mic));
+	ck_assert_ptr_ne(aec.ec, NULL);
+	ck_assert_int_eq(aec.ref_pos, -1);
+	ck_assert_int_eq(aec.bypass, false);
+
+	sco_aec_free(&aec);
+	sco_clock_free(&clock);
+
+	test_sco_aec_echo(8000);
+	test_sco_aec_echo(16000);
+	test_sco_aec_echo(32000);
+
+} END_TEST
+#endif
+
+START_TEST(test_sco_clock) {
+
+	struct sco_clock clock;
+	int64_t offset;
+	unsigned int jitter;
+
+	sco_clock_init(&clock);
+	ck_assert_int_eq(sco_clock_get_offset(&clock, &offset, &jitter), false);
+
+	/* speaker stream started 1 s ago */
+	sco_clock_stamp(&clock, SCO_CLOCK_STREAM_SPK, 16000, 16000);
+	ck_assert_int_eq(sco_clock_get_offset(&clock, &offset, &jitter), false);
+
+	/* microphone stream started 0.5 s ago */
+	sco_clock_stamp(&clock, SCO_CLOCK_STREAM_MIC, 4000, 8000);
+	ck_assert_int_eq(sco_clock_get_offset(&clock, &offset, &jitter), true);
+	ck_assert_int_ge(offset, 500000 - 10000);
+	ck_assert_int_le(offset, 500000 + 10000);
+	ck_assert_uint_eq(jitter, 0);
+
+	/* speaker stream position at the last microphone stamp */
+	int64_t position;
+	ck_assert_int_eq(sco_clock_get_spk_position(&clock, 8000, &position, &jitter), true);
+	ck_assert_int_ge(position, 8000 - 80);
+	ck_assert_int_le(position, 8000 + 80);
+
+	/* microphone stream falls behind by 0.1 s */
+	sco_clock_stamp(&clock, SCO_CLOCK_STREAM_MIC, 0, 8000);
+	usleep(100000);
+	sco_clock_stamp(&clock, SCO_CLOCK_STREAM_MIC, 0, 8000);
+	ck_assert_int_eq(sco_clock_get_offset(&clock, &offset, &jitter), true);
+	ck_assert_int_ge(offset, 600000 - 10000);
+	ck_assert_int_le(offset, 600000 + 10000);
+	ck_assert_int_ge(jitter, 100000 / 16 - 1000);
+	ck_assert_int_le(jitter, 100000 / 16 + 1000);
+
+	sco_clock_reset(&clock, SCO_CLOCK_STREAM_MIC);
+	ck_assert_int_eq(sco_clock_get_offset(&clock, &offset, &jitter), false);
+
+	sco_clock_free(&clock);
+
+} END_TEST
+
 int main(void) {
 
 	assert(mkdir(TEST_BLUEALSA_STORAGE_DIR, 0755) == 0 || errno == EEXIST);
@@ -313,12 +788,22 @@ int main(void) {
 	suite_add_tcase(s, tc);
 
 	tcase_add_test(tc, test_ba_adapter);
+	tcase_add_test(tc, test_ba_adapter_bw);
 	tcase_add_test(tc, test_ba_device);
+	tcase_add_test(tc, test_ba_device_link);
+	tcase_add_test(tc, test_ba_device_codec_cache);
 	tcase_add_test(tc, test_ba_transport);
+	tcase_add_test(tc, test_ba_transport_sndbuf_latency);
 	tcase_add_test(tc, test_ba_transport_pcm_format);
 	tcase_add_test(tc, test_ba_transport_pcm_volume);
 	tcase_add_test(tc, test_cascade_free);
+#if ENABLE_MSBC
+	tcase_add_test(tc, test_sco_aec);
+#endif
+	tcase_add_test(tc, test_sco_clock);
 	tcase_add_test(tc, test_storage);
+	tcase_add_test(tc, test_thread_policy);
+	tcase_add_test(tc, test_thread_stats);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
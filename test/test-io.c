@@ -12,6 +12,7 @@
 # include <config.h>
 #endif
 
+#include <endian.h>
 #include <errno.h>
 #include <getopt.h>
 #include <poll.h>
@@ -23,6 +24,7 @@
 #include <string.h>
 #include <strings.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
@@ -44,13 +46,16 @@
 #include "bluealsa-config.h"
 #include "bluealsa-dbus.h"
 #include "bluez.h"
+#include "hci.h"
 #include "hfp.h"
+#include "io-pipeline.h"
 #include "io.h"
 #include "rtp.h"
 #include "sco.h"
 #include "shared/a2dp-codecs.h"
 #include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/rt.h"
 
 #include "../src/a2dp.c"
 #include "../src/a2dp-aac.c"
@@ -91,6 +96,35 @@ int storage_device_save(const struct ba_device *d) { (void)d; return 0; }
 int storage_pcm_data_sync(struct ba_transport_pcm *pcm) { (void)pcm; return 0; }
 int storage_pcm_data_update(const struct ba_transport_pcm *pcm) { (void)pcm; return 0; }
 
+/* File descriptor and the SCO packet status injected by the recvmsg(). */
+static int test_pkt_status_fd = -1;
+static uint8_t test_pkt_status = HCI_SCO_PKT_STATUS_CORRECT;
+
+/**
+ * The AF_UNIX socket silently drops control messages with the level other
+ * than SOL_SOCKET, so the BT_SCM_PKT_STATUS control message can not be sent
+ * over the socket pair. Instead, it is injected here. */
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags) {
+
+	const size_t controllen = msg->msg_controllen;
+	ssize_t ret;
+
+	if ((ret = syscall(SYS_recvmsg, fd, msg, flags)) <= 0 ||
+			fd != test_pkt_status_fd ||
+			controllen < CMSG_SPACE(sizeof(test_pkt_status)))
+		return ret;
+
+	msg->msg_controllen = controllen;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+	cmsg->cmsg_level = SOL_BLUETOOTH;
+	cmsg->cmsg_type = BT_SCM_PKT_STATUS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(test_pkt_status));
+	memcpy(CMSG_DATA(cmsg), &test_pkt_status, sizeof(test_pkt_status));
+	msg->msg_controllen = CMSG_SPACE(sizeof(test_pkt_status));
+
+	return ret;
+}
+
 static const a2dp_sbc_t config_sbc_44100_stereo = {
 	.frequency = SBC_SAMPLING_FREQ_44100,
 	.channel_mode = SBC_CHANNEL_MODE_STEREO,
@@ -371,6 +405,14 @@ static void test_start_terminate_timer(unsigned int delay) {
 	pthread_detach(thread);
 }
 
+/**
+ * Wait for the cooperative stop request. */
+static void test_io_thread_wait_stop(struct ba_transport_thread *th) {
+	struct pollfd pfd = { th->stop_fd, POLLIN, 0 };
+	while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+		continue;
+}
+
 static void *test_io_thread_dump_bt(struct ba_transport_thread *th) {
 
 	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
@@ -408,9 +450,9 @@ static void *test_io_thread_dump_bt(struct ba_transport_thread *th) {
 	if (btd != NULL)
 		bt_dump_close(btd);
 
-	/* signal termination and wait for cancellation */
+	/* signal termination and wait for stop request */
 	test_start_terminate_timer(0);
-	sleep(3600);
+	test_io_thread_wait_stop(th);
 
 	pthread_cleanup_pop(1);
 	return NULL;
@@ -525,9 +567,9 @@ static void *test_io_thread_dump_pcm(struct ba_transport_thread *th) {
 		sf_close(sf);
 #endif
 
-	/* signal termination and wait for cancellation */
+	/* signal termination and wait for stop request */
 	test_start_terminate_timer(0);
-	sleep(3600);
+	test_io_thread_wait_stop(th);
 
 	pthread_cleanup_pop(1);
 	return NULL;
@@ -694,6 +736,10 @@ START_TEST(test_a2dp_sbc) {
 		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 153 * 3;
 		test_io(t1, t2, a2dp_sbc_enc_thread, test_io_thread_dump_bt, 2 * 1024);
 		test_io(t1, t2, test_io_thread_dump_pcm, a2dp_sbc_dec_thread, 2 * 1024);
+		debug("\n\n*** A2DP codec: SBC (pipeline) ***");
+		config.a2dp.pipeline = true;
+		test_io(t1, t2, a2dp_sbc_enc_thread, test_io_thread_dump_bt, 2 * 1024);
+		config.a2dp.pipeline = false;
 	}
 
 	ba_transport_destroy(t1);
@@ -701,9 +747,331 @@ START_TEST(test_a2dp_sbc) {
 
 } END_TEST
 
+START_TEST(test_a2dp_codec_switch) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = test_transport_new_a2dp(device1, ttype, "/path/sbc",
+			&a2dp_sbc_source, &config_sbc_44100_stereo);
+	struct ba_transport_thread *th = &t->thread_enc;
+	t->mtu_read = t->mtu_write = 153 * 3;
+
+	int pcm_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+	t->a2dp.pcm.fd = pcm_fds[1];
+
+	const size_t iterations = 50;
+	struct timespec ts_total = { 0 };
+
+	for (size_t i = 0; i < iterations; i++) {
+
+		/* BT socket is closed by the transport release on every stop */
+		int bt_fds[2];
+		ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+		t->bt_fd = bt_fds[1];
+
+		ck_assert_int_eq(ba_transport_thread_create(th, a2dp_sbc_enc_thread, "encode", true), 0);
+
+		/* wait for the encoder to reach its main loop */
+		pthread_mutex_lock(&th->state_mtx);
+		while (th->state == BA_TRANSPORT_THREAD_STATE_STARTING)
+			pthread_cond_wait(&th->changed, &th->state_mtx);
+		pthread_mutex_unlock(&th->state_mtx);
+
+		struct timespec ts0, ts, ts_diff;
+		gettimestamp(&ts0);
+		transport_thread_cancel_prepare(th);
+		transport_thread_cancel(th);
+		gettimestamp(&ts);
+
+		timespecsub(&ts, &ts0, &ts_diff);
+		timespecadd(&ts_total, &ts_diff, &ts_total);
+
+		close(bt_fds[0]);
+
+	}
+
+	const unsigned int usec = (ts_total.tv_sec * 1000000 + ts_total.tv_nsec / 1000) / iterations;
+	debug("Average codec thread stop time: %u us", usec);
+	/* stop shall not fall back to the cancellation timeout */
+	ck_assert_uint_lt(usec, BA_TRANSPORT_THREAD_STOP_TIMEOUT_MS * 1000);
+
+	close(pcm_fds[0]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_a2dp_thread_park) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = test_transport_new_a2dp(device1, ttype, "/path/sbc",
+			&a2dp_sbc_source, &config_sbc_44100_stereo);
+	struct ba_transport_thread *th = &t->thread_enc;
+	t->mtu_read = t->mtu_write = 153 * 3;
+
+	int pcm_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+	t->a2dp.pcm.fd = pcm_fds[1];
+
+	int16_t pcm_sine_buffer[2 * 512];
+	snd_pcm_sine_s16_2le(pcm_sine_buffer, 512, 2, 0, 1.0 / 128);
+
+	for (size_t park = 0; park <= 1; park++) {
+
+		const size_t iterations = 20;
+		struct timespec ts_total = { 0 };
+		pthread_t worker = config.main_thread;
+
+		config.io_thread_park = park;
+
+		for (size_t i = 0; i < iterations; i++) {
+
+			int bt_fds[2];
+			ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+			t->bt_fd = bt_fds[1];
+
+			ck_assert_int_eq(write(pcm_fds[0], pcm_sine_buffer, sizeof(pcm_sine_buffer)),
+					sizeof(pcm_sine_buffer));
+
+			struct timespec ts0, ts, ts_diff;
+			gettimestamp(&ts0);
+
+			ck_assert_int_eq(ba_transport_acquire(t), bt_fds[1]);
+			ck_assert_int_eq(ba_transport_thread_create(th, a2dp_sbc_enc_thread, "encode", true), 0);
+
+			/* wait for the first encoded BT packet */
+			struct pollfd pfd = { bt_fds[0], POLLIN, 0 };
+			ck_assert_int_eq(poll(&pfd, 1, 1000), 1);
+			gettimestamp(&ts);
+
+			timespecsub(&ts, &ts0, &ts_diff);
+			timespecadd(&ts_total, &ts_diff, &ts_total);
+
+			/* in the park mode, the same worker shall be reused */
+			if (park && i > 0)
+				ck_assert(pthread_equal(th->id, worker));
+			worker = th->id;
+
+			transport_thread_cancel_prepare(th);
+			transport_thread_cancel(th);
+			ck_assert(pthread_equal(th->id, config.main_thread));
+
+			close(bt_fds[0]);
+
+		}
+
+		const unsigned int usec = (ts_total.tv_sec * 1000000 + ts_total.tv_nsec / 1000) / iterations;
+		debug("Average acquire to first BT packet time (park=%zu): %u us", park, usec);
+
+	}
+
+	config.io_thread_park = false;
+
+	close(pcm_fds[0]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_a2dp_sbc_underrun) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = test_transport_new_a2dp(device1, ttype, "/path/sbc",
+			&a2dp_sbc_source, &config_sbc_44100_stereo);
+	struct ba_transport_thread *th = &t->thread_enc;
+	t->mtu_read = t->mtu_write = 153 * 3;
+
+	int bt_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	t->bt_fd = bt_fds[1];
+
+	int pcm_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+	t->a2dp.pcm.fd = pcm_fds[1];
+
+	int16_t pcm_sine_buffer[2 * 1024];
+	snd_pcm_sine_s16_2le(pcm_sine_buffer, 1024, 2, 0, 1.0 / 128);
+	ck_assert_int_eq(write(pcm_fds[0], pcm_sine_buffer, sizeof(pcm_sine_buffer)),
+			sizeof(pcm_sine_buffer));
+
+	ck_assert_int_eq(ba_transport_thread_create(th, a2dp_sbc_enc_thread, "encode", true), 0);
+
+	struct pollfd pfd = { bt_fds[0], POLLIN, 0 };
+	uint32_t timestamp_first = 0;
+	uint32_t timestamp = 0;
+	size_t frames = 0;
+
+	/* After the PCM data is consumed, the encoder shall keep sending
+	 * silence for a limited time, without gaps in the RTP timestamp. */
+	while (poll(&pfd, 1, IO_POLL_UNDERRUN_MAX_MS * 2) == 1) {
+
+		uint8_t buffer[1024];
+		ck_assert_int_gt(read(bt_fds[0], buffer, sizeof(buffer)), 0);
+
+		const rtp_header_t *rtp_header = (rtp_header_t *)buffer;
+		const rtp_media_header_t *rtp_media_header = rtp_a2dp_get_payload(rtp_header);
+		ck_assert_ptr_ne(rtp_media_header, NULL);
+
+		if (frames == 0)
+			timestamp_first = be32toh(rtp_header->timestamp);
+		else
+			ck_assert_uint_eq(be32toh(rtp_header->timestamp), timestamp + frames);
+
+		timestamp = be32toh(rtp_header->timestamp);
+		/* 16 blocks and 8 subbands */
+		frames = rtp_media_header->frame_count * 16 * 8;
+
+	}
+
+	/* at least one silence packet beyond the PCM data */
+	ck_assert_uint_gt(timestamp + frames - timestamp_first, 1024);
+
+	transport_thread_cancel_prepare(th);
+	transport_thread_cancel(th);
+
+	close(pcm_fds[0]);
+	close(bt_fds[0]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_a2dp_sbc_drain) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = test_transport_new_a2dp(device1, ttype, "/path/sbc",
+			&a2dp_sbc_source, &config_sbc_44100_stereo);
+	struct ba_transport_thread *th = &t->thread_enc;
+	t->mtu_read = t->mtu_write = 153 * 3;
+
+	int bt_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	t->bt_fd = bt_fds[1];
+
+	int pcm_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+	t->a2dp.pcm.fd = pcm_fds[1];
+
+	int16_t pcm_sine_buffer[2 * 1024];
+	snd_pcm_sine_s16_2le(pcm_sine_buffer, 1024, 2, 0, 1.0 / 128);
+	ck_assert_int_eq(write(pcm_fds[0], pcm_sine_buffer, sizeof(pcm_sine_buffer)),
+			sizeof(pcm_sine_buffer));
+
+	/* run encoder with the pipeline, so the drain
+	 * has to account for packets queued for sending */
+	config.a2dp.pipeline = true;
+	ck_assert_int_eq(ba_transport_thread_create(th, a2dp_sbc_enc_thread, "encode", true), 0);
+	ck_assert_int_eq(ba_transport_pcm_drain(&t->a2dp.pcm), 0);
+
+	struct pollfd pfd = { bt_fds[0], POLLIN, 0 };
+	size_t frames = 0;
+
+	/* Drain shall not be completed until all PCM data has been sent. */
+	while (ba_transport_pcm_drain_check(&t->a2dp.pcm) == 0) {
+		if (poll(&pfd, 1, 10) == 1) {
+			uint8_t buffer[1024];
+			ck_assert_int_gt(read(bt_fds[0], buffer, sizeof(buffer)), 0);
+			const rtp_media_header_t *rtp_media_header = rtp_a2dp_get_payload((rtp_header_t *)buffer);
+			/* 16 blocks and 8 subbands */
+			frames += rtp_media_header->frame_count * 16 * 8;
+		}
+	}
+
+	ck_assert_uint_eq(frames, 1024);
+
+	/* After the drain point, the encoder shall not generate underrun silence. */
+	ck_assert_int_eq(poll(&pfd, 1, IO_POLL_UNDERRUN_MAX_MS * 2), 0);
+
+	transport_thread_cancel_prepare(th);
+	transport_thread_cancel(th);
+	config.a2dp.pipeline = false;
+
+	close(pcm_fds[0]);
+	close(bt_fds[0]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+/**
+ * Receive and verify packets sent by the test_io_pipeline test. */
+static void test_io_pipeline_recv(int fd, size_t *received, int timeout) {
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	while (poll(&pfd, 1, timeout) == 1) {
+		uint8_t buffer[128];
+		ssize_t len = read(fd, buffer, sizeof(buffer));
+		/* the length and the content of every packet depend on its index */
+		ck_assert_int_eq(len, 1 + *received % 64);
+		for (ssize_t i = 0; i < len; i++)
+			ck_assert_uint_eq(buffer[i], *received & 0xFF);
+		(*received)++;
+	}
+}
+
+START_TEST(test_io_pipeline) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = test_transport_new_a2dp(device1, ttype, "/path/sbc",
+			&a2dp_sbc_source, &config_sbc_44100_stereo);
+	struct ba_transport_thread *th = &t->thread_enc;
+
+	int bt_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	th->bt_fd = bt_fds[1];
+
+	struct io_poll io = { .timeout = -1 };
+	asrsync_init(&io.asrs, 44100);
+
+	struct io_pipeline pipe = { .th = th };
+	ck_assert_int_eq(io_pipeline_start(&pipe, 64), 0);
+
+	uint8_t buffer[128];
+	/* packet larger than the slot size shall be rejected */
+	ck_assert_int_eq(io_pipeline_write(&pipe, &io, buffer, 65), -1);
+	ck_assert_int_eq(errno, EMSGSIZE);
+
+	/* Queue much more packets than the number of slots in the ring buffer,
+	 * so the producer will have to wait for the sender. Every packet has
+	 * different length and content, so the order and the data integrity
+	 * can be verified on the receiving side. */
+	const size_t packets = 1000;
+	size_t received = 0;
+	for (size_t i = 0; i < packets; i++) {
+		const size_t len = 1 + i % 64;
+		memset(buffer, i & 0xFF, len);
+		ck_assert_int_eq(io_pipeline_write(&pipe, &io, buffer, len), len);
+		if (i % 100 == 0)
+			ck_assert_int_eq(io_pipeline_sync(&pipe, &io, 44), 0);
+		test_io_pipeline_recv(bt_fds[0], &received, 0);
+	}
+
+	test_io_pipeline_recv(bt_fds[0], &received, 500);
+	ck_assert_uint_eq(received, packets);
+	ck_assert_uint_eq(io_pipeline_get_queued_bytes(&pipe), 0);
+
+	io_pipeline_free(&pipe);
+
+	close(bt_fds[0]);
+	close(bt_fds[1]);
+	th->bt_fd = -1;
+	ba_transport_destroy(t);
+
+} END_TEST
+
 #if ENABLE_MP3LAME
 START_TEST(test_a2dp_mp3) {
 
+	/* IO threads are started directly, so the codec
+	 * library has to be loaded beforehand. */
+	ck_assert_int_eq(a2dp_mpeg_load(false), 0);
+	ck_assert_int_eq(a2dp_mpeg_load(true), 0);
+
 	config_mp3_44100_stereo.vbr = enable_vbr_mode ? 1 : 0;
 
 	struct ba_transport_type ttype = {
@@ -733,8 +1101,92 @@ START_TEST(test_a2dp_mp3) {
 #endif
 
 #if ENABLE_AAC
+static size_t test_a2dp_aac_encode(HANDLE_AACENCODER handle,
+		int16_t *pcm, size_t samples, uint8_t *out, size_t out_size) {
+
+	int in_bufferIdentifiers[] = { IN_AUDIO_DATA };
+	int out_bufferIdentifiers[] = { OUT_BITSTREAM_DATA };
+	int in_bufSizes[] = { samples * sizeof(*pcm) };
+	int out_bufSizes[] = { out_size };
+	int in_bufElSizes[] = { sizeof(*pcm) };
+	int out_bufElSizes[] = { sizeof(*out) };
+
+	AACENC_BufDesc in_buf = {
+		.numBufs = 1,
+		.bufs = (void **)&pcm,
+		.bufferIdentifiers = in_bufferIdentifiers,
+		.bufSizes = in_bufSizes,
+		.bufElSizes = in_bufElSizes,
+	};
+	AACENC_BufDesc out_buf = {
+		.numBufs = 1,
+		.bufs = (void **)&out,
+		.bufferIdentifiers = out_bufferIdentifiers,
+		.bufSizes = out_bufSizes,
+		.bufElSizes = out_bufElSizes,
+	};
+	AACENC_InArgs in_args = { .numInSamples = samples };
+	AACENC_OutArgs out_args = { 0 };
+
+	/* feed the same PCM frame until the encoder produces output */
+	for (size_t i = 0; i < 10; i++) {
+		ck_assert_int_eq(aacEncEncode(handle, &in_buf, &out_buf, &in_args, &out_args), AACENC_OK);
+		if (out_args.numOutBytes > 0)
+			break;
+	}
+
+	return out_args.numOutBytes;
+}
+
+static void test_a2dp_aac_enc_reset(struct ba_transport *t) {
+
+	HANDLE_AACENCODER handle1, handle2;
+	AACENC_InfoStruct aacinf;
+
+	ck_assert_ptr_ne(handle1 = a2dp_aac_enc_open(t), NULL);
+	ck_assert_ptr_ne(handle2 = a2dp_aac_enc_open(t), NULL);
+	ck_assert_int_eq(aacEncInfo(handle1, &aacinf), AACENC_OK);
+
+	const size_t samples = aacinf.inputChannels * aacinf.frameLength;
+	int16_t *pcm = malloc(samples * sizeof(*pcm));
+	uint8_t *out1 = malloc(aacinf.maxOutBufBytes);
+	uint8_t *out2 = malloc(aacinf.maxOutBufBytes);
+	ck_assert_ptr_ne(pcm, NULL);
+	ck_assert_ptr_ne(out1, NULL);
+	ck_assert_ptr_ne(out2, NULL);
+
+	/* previous session leaves its state in the encoder */
+	uint32_t seed = 1;
+	for (size_t n = 0; n < 5; n++) {
+		for (size_t i = 0; i < samples; i++)
+			pcm[i] = (seed = seed * 1103515245 + 12345) >> 16;
+		ck_assert_uint_gt(test_a2dp_aac_encode(handle1, pcm, samples,
+					out1, aacinf.maxOutBufBytes), 0);
+	}
+
+	ck_assert_int_eq(a2dp_aac_enc_reset(handle1), 0);
+
+	/* reused encoder shall produce the same first frame as a new one */
+	for (size_t i = 0; i < samples; i++)
+		pcm[i] = (i % 64) * 256 - 8192;
+	const size_t len1 = test_a2dp_aac_encode(handle1, pcm, samples, out1, aacinf.maxOutBufBytes);
+	const size_t len2 = test_a2dp_aac_encode(handle2, pcm, samples, out2, aacinf.maxOutBufBytes);
+	ck_assert_uint_gt(len1, 0);
+	ck_assert_uint_eq(len1, len2);
+	ck_assert_int_eq(memcmp(out1, out2, len1), 0);
+
+	a2dp_aac_enc_free(handle1);
+	a2dp_aac_enc_free(handle2);
+	free(pcm);
+	free(out1);
+	free(out2);
+
+}
+
 START_TEST(test_a2dp_aac) {
 
+	ck_assert_int_eq(a2dp_aac_load(), 0);
+
 	config.aac_afterburner = true;
 	config.aac_prefer_vbr = enable_vbr_mode;
 	config_aac_44100_stereo.vbr = enable_vbr_mode ? 1 : 0;
@@ -748,6 +1200,8 @@ START_TEST(test_a2dp_aac) {
 	struct ba_transport *t2 = test_transport_new_a2dp(device2, ttype, "/path/aac",
 			&a2dp_aac_sink, &config_aac_44100_stereo);
 
+	test_a2dp_aac_enc_reset(t1);
+
 	if (aging_duration) {
 		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 450;
 		test_io(t1, t2, a2dp_aac_enc_thread, a2dp_aac_dec_thread, 4 * 1024);
@@ -866,6 +1320,8 @@ START_TEST(test_a2dp_faststream) {
 #if ENABLE_LC3PLUS
 START_TEST(test_a2dp_lc3plus) {
 
+	ck_assert_int_eq(codec_lc3plus_load(), 0);
+
 	struct ba_transport_type ttype = {
 		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
 		.codec = A2DP_CODEC_VENDOR_LC3PLUS };
@@ -897,6 +1353,11 @@ START_TEST(test_a2dp_lc3plus) {
 #if ENABLE_LDAC
 START_TEST(test_a2dp_ldac) {
 
+	ck_assert_int_eq(a2dp_ldac_load(false), 0);
+#if HAVE_LDAC_DECODE
+	ck_assert_int_eq(a2dp_ldac_load(true), 0);
+#endif
+
 	config.ldac_abr = true;
 	config.ldac_eqmid = LDACBT_EQMID_HQ;
 
@@ -949,6 +1410,107 @@ START_TEST(test_sco_cvsd) {
 
 } END_TEST
 
+START_TEST(test_sco_cvsd_pkt_status) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_HSP_AG };
+	struct ba_transport *t = test_transport_new_sco(device1, ttype, "/path/sco/cvsd");
+	struct ba_transport_thread *th = &t->thread_dec;
+	t->mtu_read = t->mtu_write = 48;
+
+	int bt_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	test_pkt_status_fd = t->bt_fd = bt_fds[1];
+
+	int pcm_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+	t->sco.mic_pcm.fd = pcm_fds[1];
+
+	ck_assert_int_eq(ba_transport_thread_create(th, sco_dec_thread, "decode", true), 0);
+
+	struct pollfd pfd = { pcm_fds[0], POLLIN, 0 };
+	int16_t packet[24];
+	int16_t pcm[24];
+	size_t i;
+
+	/* correctly received silence */
+	memset(packet, 0, sizeof(packet));
+	test_pkt_status = HCI_SCO_PKT_STATUS_CORRECT;
+	ck_assert_int_eq(write(bt_fds[0], packet, sizeof(packet)), sizeof(packet));
+	ck_assert_int_eq(poll(&pfd, 1, 500), 1);
+	ck_assert_int_eq(read(pcm_fds[0], pcm, sizeof(pcm)), sizeof(pcm));
+
+	/* Corrupted packet shall not be passed to the PCM client. With silence
+	 * in the PLC history, the concealed packet shall be silent as well. */
+	for (i = 0; i < ARRAYSIZE(packet); i++)
+		packet[i] = 0x4000;
+	test_pkt_status = HCI_SCO_PKT_STATUS_PARTIAL;
+	ck_assert_int_eq(write(bt_fds[0], packet, sizeof(packet)), sizeof(packet));
+	ck_assert_int_eq(poll(&pfd, 1, 500), 1);
+	ck_assert_int_eq(read(pcm_fds[0], pcm, sizeof(pcm)), sizeof(pcm));
+	for (i = 0; i < ARRAYSIZE(pcm); i++)
+		ck_assert_int_eq(pcm[i], 0);
+
+	transport_thread_cancel_prepare(th);
+	transport_thread_cancel(th);
+
+	test_pkt_status_fd = -1;
+	test_pkt_status = HCI_SCO_PKT_STATUS_CORRECT;
+
+	close(pcm_fds[0]);
+	close(bt_fds[0]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_sco_cvsd_batch) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_HSP_AG };
+	struct ba_transport *t = test_transport_new_sco(device1, ttype, "/path/sco/cvsd");
+	struct ba_transport_thread *th = &t->thread_dec;
+	t->mtu_read = t->mtu_write = 48;
+
+	int bt_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	t->bt_fd = bt_fds[1];
+
+	int pcm_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+	t->sco.mic_pcm.fd = pcm_fds[1];
+
+	/* 15 ms batch - 5 SCO packets with 24 samples each */
+	config.hfp.cvsd_batch_latency = 15;
+	ck_assert_int_eq(ba_transport_thread_create(th, sco_dec_thread, "decode", true), 0);
+
+	int16_t packet[24] = { 0 };
+	for (size_t i = 0; i < 10; i++)
+		ck_assert_int_eq(write(bt_fds[0], packet, sizeof(packet)), sizeof(packet));
+
+	struct pollfd pfd = { pcm_fds[0], POLLIN, 0 };
+	int16_t pcm[2 * 5 * ARRAYSIZE(packet)];
+	size_t len = 0;
+	ssize_t rv;
+
+	while (len < sizeof(pcm) && poll(&pfd, 1, 500) == 1) {
+		ck_assert_int_gt(rv = read(pcm_fds[0], (uint8_t *)pcm + len, sizeof(pcm) - len), 0);
+		len += rv;
+	}
+
+	ck_assert_uint_eq(len, sizeof(pcm));
+	/* one FIFO write per batch */
+	ck_assert_uint_eq(th->stats.pcm_writes, 2);
+
+	transport_thread_cancel_prepare(th);
+	transport_thread_cancel(th);
+	config.hfp.cvsd_batch_latency = 0;
+
+	close(pcm_fds[0]);
+	close(bt_fds[0]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
 #if ENABLE_MSBC
 START_TEST(test_sco_msbc) {
 
@@ -972,6 +1534,33 @@ START_TEST(test_sco_msbc) {
 } END_TEST
 #endif
 
+#if ENABLE_LC3_SWB
+START_TEST(test_sco_lc3_swb) {
+
+	adapter->hci.features[2] = LMP_TRSP_SCO;
+	adapter->hci.features[3] = LMP_ESCO;
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_HFP_AG,
+		.codec = HFP_CODEC_LC3_SWB };
+	struct ba_transport *t1 = test_transport_new_sco(device1, ttype, "/path/sco/lc3swb");
+	struct ba_transport *t2 = test_transport_new_sco(device2, ttype, "/path/sco/lc3swb");
+
+	ck_assert_int_eq(t1->sco.spk_pcm.sampling, 32000);
+	ck_assert_int_eq(t1->sco.mic_pcm.sampling, 32000);
+
+	debug("\n\n*** SCO codec: LC3-SWB ***");
+	/* single LC3-SWB frame with the H2 header per eSCO packet */
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 60;
+	test_io(t1, t2, sco_enc_thread, test_io_thread_dump_bt, 1200);
+	test_io(t1, t2, test_io_thread_dump_pcm, sco_dec_thread, 1200);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+} END_TEST
+#endif
+
 int main(int argc, char *argv[]) {
 
 	const struct {
@@ -1007,6 +1596,9 @@ int main(int argc, char *argv[]) {
 		{ hfp_codec_id_to_string(HFP_CODEC_CVSD), test_sco_cvsd },
 #if ENABLE_MSBC
 		{ hfp_codec_id_to_string(HFP_CODEC_MSBC), test_sco_msbc },
+#endif
+#if ENABLE_LC3_SWB
+		{ hfp_codec_id_to_string(HFP_CODEC_LC3_SWB), test_sco_lc3_swb },
 #endif
 	};
 
@@ -1120,6 +1712,16 @@ int main(int argc, char *argv[]) {
 		if (enabled_codecs & (1 << i))
 			tcase_add_test(tc, codecs[i].tf);
 
+	if (enabled_codecs == 0xFFFF && aging_duration == 0) {
+		tcase_add_test(tc, test_a2dp_codec_switch);
+		tcase_add_test(tc, test_a2dp_thread_park);
+		tcase_add_test(tc, test_a2dp_sbc_underrun);
+		tcase_add_test(tc, test_a2dp_sbc_drain);
+		tcase_add_test(tc, test_io_pipeline);
+		tcase_add_test(tc, test_sco_cvsd_pkt_status);
+		tcase_add_test(tc, test_sco_cvsd_batch);
+	}
+
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
 	srunner_free(sr);
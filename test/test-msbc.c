@@ -11,7 +11,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <check.h>
 #include <glib.h>
@@ -20,6 +22,7 @@
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
+#include "shared/rt.h"
 
 #include "inc/sine.inc"
 #include "../src/codec-msbc.c"
@@ -224,6 +227,157 @@ START_TEST(test_msbc_decode_plc) {
 
 } END_TEST
 
+START_TEST(test_msbc_decode_corrupted) {
+
+	int16_t sine[3 * MSBC_CODESAMPLES];
+	snd_pcm_sine_s16_2le(sine, ARRAYSIZE(sine), 1, 0, 1.0 / 128);
+
+	struct esco_msbc msbc = { .initialized = false };
+	ck_assert_int_eq(msbc_init(&msbc), 0);
+
+	esco_msbc_frame_t frames[3];
+	size_t i;
+
+	for (i = 0; i < ARRAYSIZE(frames); i++) {
+		memcpy(msbc.pcm.tail, &sine[i * MSBC_CODESAMPLES], MSBC_CODESIZE);
+		ffb_seek(&msbc.pcm, MSBC_CODESAMPLES);
+		ck_assert_int_eq(msbc_encode(&msbc), sizeof(*frames));
+		memcpy(&frames[i], msbc.data.data, sizeof(*frames));
+		ffb_rewind(&msbc.data);
+	}
+
+	int16_t pcm[2][ARRAYSIZE(frames)][MSBC_CODESAMPLES];
+	size_t n;
+
+	for (n = 0; n < 2; n++) {
+
+		/* reinitialize encoder/decoder handler */
+		ck_assert_int_eq(msbc_init(&msbc), 0);
+
+		for (i = 0; i < ARRAYSIZE(frames); i++) {
+
+			memcpy(msbc.data.tail, &frames[i], sizeof(*frames));
+			ffb_seek(&msbc.data, sizeof(*frames));
+
+			/* in the second pass mark the middle frame as corrupted */
+			if (n == 1 && i == 1)
+				msbc.data_corrupted = ffb_blen_out(&msbc.data);
+
+			ck_assert_int_eq(msbc_decode(&msbc), MSBC_CODESAMPLES);
+			memcpy(pcm[n][i], msbc.pcm.data, MSBC_CODESIZE);
+			ffb_rewind(&msbc.pcm);
+
+		}
+
+		ck_assert_int_eq(msbc.data_corrupted, 0);
+
+	}
+
+	/* corrupted frame shall be concealed instead of being decoded */
+	ck_assert_int_eq(memcmp(pcm[0][0], pcm[1][0], MSBC_CODESIZE), 0);
+	ck_assert_int_ne(memcmp(pcm[0][1], pcm[1][1], MSBC_CODESIZE), 0);
+
+	msbc_finish(&msbc);
+
+} END_TEST
+
+/**
+ * Decode given eSCO stream in chunks of SCO packet size. */
+static size_t test_msbc_decode_stream(const uint8_t *data, size_t size,
+		struct timespec *elapsed) {
+
+	struct esco_msbc msbc = { .initialized = false };
+	ck_assert_int_eq(msbc_init(&msbc), 0);
+
+	struct timespec ts0, ts;
+	size_t samples = 0;
+	size_t i, len;
+
+	gettimestamp(&ts0);
+
+	for (i = 0; i < size; i += len) {
+
+		/* USB adjusted SCO MTU for transparent data */
+		len = MIN(MIN(size - i, ffb_blen_in(&msbc.data)), 24);
+		memcpy(msbc.data.tail, &data[i], len);
+		ffb_seek(&msbc.data, len);
+
+		ck_assert_int_ge(msbc_decode(&msbc), 0);
+		samples += ffb_len_out(&msbc.pcm);
+		ffb_rewind(&msbc.pcm);
+
+	}
+
+	gettimestamp(&ts);
+	difftimespec(&ts0, &ts, elapsed);
+
+	msbc_finish(&msbc);
+	return samples;
+}
+
+START_TEST(test_msbc_decode_benchmark) {
+
+	const size_t frames = 2000;
+	int16_t sine[MSBC_CODESAMPLES];
+	snd_pcm_sine_s16_2le(sine, ARRAYSIZE(sine), 1, 0, 1.0 / 128);
+
+	/* Garbage inserted between frames. It contains H2 sync word candidates
+	 * (0x01 bytes) which shall be rejected by the H2 header search. */
+	static const uint8_t garbage[] = { 0x01, 0x02, 0x01, 0x03, 0x00, 0x01, 0x00 };
+
+	const size_t size = frames * (sizeof(esco_msbc_frame_t) + sizeof(garbage));
+	uint8_t *misaligned = malloc(size);
+	uint8_t *lossy = malloc(size);
+	size_t misaligned_len = 0;
+	size_t lossy_len = 0;
+	size_t i;
+
+	ck_assert_ptr_ne(misaligned, NULL);
+	ck_assert_ptr_ne(lossy, NULL);
+
+	struct esco_msbc msbc = { .initialized = false };
+	ck_assert_int_eq(msbc_init(&msbc), 0);
+
+	for (i = 0; i < frames; i++) {
+
+		memcpy(msbc.pcm.tail, sine, sizeof(sine));
+		ffb_seek(&msbc.pcm, ARRAYSIZE(sine));
+		ck_assert_int_eq(msbc_encode(&msbc), sizeof(esco_msbc_frame_t));
+
+		memcpy(&misaligned[misaligned_len], garbage, sizeof(garbage));
+		misaligned_len += sizeof(garbage);
+		memcpy(&misaligned[misaligned_len], msbc.data.data, sizeof(esco_msbc_frame_t));
+		misaligned_len += sizeof(esco_msbc_frame_t);
+
+		/* drop every 4th frame (detectable with the H2 sequence number) */
+		if (i % 4 != 1) {
+			memcpy(&lossy[lossy_len], msbc.data.data, sizeof(esco_msbc_frame_t));
+			lossy_len += sizeof(esco_msbc_frame_t);
+		}
+
+		ffb_rewind(&msbc.data);
+
+	}
+
+	msbc_finish(&msbc);
+
+	struct timespec elapsed;
+
+	ck_assert_int_eq(test_msbc_decode_stream(misaligned, misaligned_len, &elapsed),
+			frames * MSBC_CODESAMPLES);
+	info("Decoded misaligned mSBC stream: %zu frames in %ld.%06ld s", frames,
+			(long)elapsed.tv_sec, elapsed.tv_nsec / 1000);
+
+	ck_assert_int_eq(test_msbc_decode_stream(lossy, lossy_len, &elapsed),
+			frames * MSBC_CODESAMPLES);
+	info("Decoded lossy mSBC stream: %zu frames in %ld.%06ld s", frames,
+			(long)elapsed.tv_sec, elapsed.tv_nsec / 1000);
+
+	free(misaligned);
+	free(lossy);
+
+} END_TEST
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -236,6 +390,8 @@ int main(void) {
 	tcase_add_test(tc, test_msbc_find_h2_header);
 	tcase_add_test(tc, test_msbc_encode_decode);
 	tcase_add_test(tc, test_msbc_decode_plc);
+	tcase_add_test(tc, test_msbc_decode_corrupted);
+	tcase_add_test(tc, test_msbc_decode_benchmark);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
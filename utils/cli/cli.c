@@ -251,8 +251,85 @@ void cli_print_pcm_properties(const struct ba_pcm *pcm, DBusError *err) {
 	cli_print_pcm_selected_codec(pcm);
 	printf("Delay: %#.1f ms\n", (double)pcm->delay / 10);
 	printf("SoftVolume: %s\n", pcm->soft_volume ? "Y" : "N");
+	if (pcm->transport & BA_PCM_TRANSPORT_MASK_SCO &&
+			pcm->mode & BA_PCM_MODE_SOURCE)
+		printf("EchoCancellation: %s\n", pcm->echo_cancellation ? "Y" : "N");
 	cli_print_pcm_volume(pcm);
 	cli_print_pcm_mute(pcm);
+	if (pcm->sndbuf_latency != 0)
+		printf("SocketBufferLatency: %u ms\n", pcm->sndbuf_latency);
+	if (pcm->link_valid) {
+		printf("RSSI: %d dB\n", pcm->rssi);
+		printf("LinkQuality: %u\n", pcm->link_quality);
+		printf("FailedContacts: %u\n", pcm->failed_contacts);
+	}
+}
+
+/**
+ * Get the upper bound (in us) of the histogram bucket which contains
+ * the given percentile of all samples. */
+static unsigned long cli_stats_hist_percentile(const dbus_uint32_t *hist,
+		size_t len, unsigned int percentile) {
+
+	unsigned long long total = 0;
+	for (size_t i = 0; i < len; i++)
+		total += hist[i];
+
+	unsigned long long count = 0;
+	for (size_t i = 0; i < len; i++)
+		if ((count += hist[i]) * 100 >= total * percentile)
+			return 1UL << i;
+
+	return 0;
+}
+
+static void cli_print_stats_hist(const char *name,
+		const dbus_uint32_t *hist, size_t len) {
+
+	unsigned long long total = 0;
+	for (size_t i = 0; i < len; i++)
+		total += hist[i];
+
+	if (total == 0) {
+		printf("%s: [ None ]\n", name);
+		return;
+	}
+
+	printf("%s: p50 < %lu us, p99 < %lu us, max < %lu us\n", name,
+			cli_stats_hist_percentile(hist, len, 50),
+			cli_stats_hist_percentile(hist, len, 99),
+			cli_stats_hist_percentile(hist, len, 100));
+
+}
+
+void cli_print_pcm_stats(const struct ba_pcm *pcm, DBusError *err) {
+
+	struct ba_pcm_stats stats;
+	if (!bluealsa_dbus_pcm_get_stats(&config.dbus, pcm->pcm_path, &stats, err))
+		return;
+
+	printf("CPUTime: %#.1f ms\n", (double)stats.cpu_time / 1000);
+	printf("CodecCalls: %llu\n", (unsigned long long)stats.codec_calls);
+	cli_print_stats_hist("CodecTime", stats.codec_time, stats.codec_time_len);
+	cli_print_stats_hist("BusyTime", stats.busy_time, stats.busy_time_len);
+	printf("PCMWrites: %llu (%.1f/s)\n",
+			(unsigned long long)stats.pcm_writes, stats.pcm_write_rate);
+	if (stats.sco_offset_valid)
+		printf("SCOOffset: %lld us (jitter %u us)\n",
+				(long long)stats.sco_offset, (unsigned int)stats.sco_jitter);
+	if (stats.aec_valid)
+		printf("AECTime: %#.1f ms%s\n", (double)stats.aec_time / 1000,
+				stats.aec_bypass ? " (bypassed)" : "");
+	if (stats.bitrate != 0)
+		printf("Bitrate: %u kbps\n", (unsigned int)stats.bitrate / 1000);
+	if (stats.bitrate_budget_valid && stats.bitrate_budget != 0)
+		printf("BitrateBudget: %u kbps\n", (unsigned int)stats.bitrate_budget / 1000);
+	if (stats.sndbuf_size_valid)
+		printf("SocketBufferSize: %u bytes\n", (unsigned int)stats.sndbuf_size);
+	if (stats.codec_cache_valid)
+		printf("CodecCache: %u hits, %u misses\n",
+				(unsigned int)stats.codec_cache_hits, (unsigned int)stats.codec_cache_misses);
+
 }
 
 int cmd_list_services(int argc, char *argv[]);
@@ -41,6 +41,7 @@ void cli_print_pcm_selected_codec(const struct ba_pcm *pcm);
 void cli_print_pcm_volume(const struct ba_pcm *pcm);
 void cli_print_pcm_mute(const struct ba_pcm *pcm);
 void cli_print_pcm_properties(const struct ba_pcm *pcm, DBusError *err);
+void cli_print_pcm_stats(const struct ba_pcm *pcm, DBusError *err);
 
 #define cli_print_error(M, ...) \
 	if (!config.quiet) { error(M, ##__VA_ARGS__); }
@@ -33,8 +33,14 @@ int cmd_info(int argc, char *argv[]) {
 	}
 
 	cli_print_pcm_properties(&pcm, &err);
-	if (dbus_error_is_set(&err))
+	if (dbus_error_is_set(&err)) {
 		warn("Unable to read available codecs: %s", err.message);
+		dbus_error_free(&err);
+	}
+
+	cli_print_pcm_stats(&pcm, &err);
+	if (dbus_error_is_set(&err))
+		warn("Unable to read IO thread statistics: %s", err.message);
 
 	return EXIT_SUCCESS;
 }